@@ -44,6 +44,17 @@
 
 static const int INT_INVALID_VALUE   = 0xdeadbeef;
 static const int MAX_NAME_LENGTH     = 64;
+static const int MAX_ENCODE_PROFILES = 3;
+static const int MAX_DIR_LENGTH      = 128;
+static const int MAX_DECIMATED_PIPES = 4;
+static const int NUM_RGB_PIPES       = 3;
+static const int MAX_PIPE_NAME_LENGTH = 31;    // Characters in a pipe name, pipe_info_t holds 32 bytes
+
+// Suffixes of the RGB pipes, in the order of ImgprocRgbLayout
+static const char* const RGB_PIPE_NAMES[NUM_RGB_PIPES] = {"rgb", "bgr", "rgb_planar"};
+
+#define DEFAULT_RECORD_DIR "/data/video"
+#define DEFAULT_RAW_RECORD_DIR "/data/raw"
 
 // -----------------------------------------------------------------------------------------------------------------------------
 // Supported stream types
@@ -103,6 +114,45 @@ enum AE_MODE
     AE_LME_MSV
 };
 
+//------------------------------------------------------------------------------------------------------------------------------
+// One video encoder output of a camera. Each profile gets its own HAL stream (scaled by the ISP) and its own pipe named
+// <camera name>_<suffix>
+//------------------------------------------------------------------------------------------------------------------------------
+struct EncodeProfile
+{
+    char    suffix[MAX_NAME_LENGTH];    ///< Pipe name suffix
+    int     width;                      ///< Encode Width of the frame
+    int     height;                     ///< Encode Height of the frame
+    bool    isH265;                     ///< H265 or H264
+    int     bitrate;                    ///< Target bitrate (bits per second)
+    bool    isBitRateConstant;          ///< CBR or VBR rate control
+    bool    lowLatency;                 ///< Tune for latency over compression (no B-frames, intra refresh, slices)
+    char    recordDir[MAX_DIR_LENGTH];  ///< Where the in-server recorder puts its files
+    int     recordSegmentSec;           ///< Start a new recording file after this many seconds (0 to disable)
+    int     recordSegmentMB;            ///< Start a new recording file after this many megabytes (0 to disable)
+    bool    recordOnStart;              ///< Start recording as soon as the camera starts
+};
+
+//------------------------------------------------------------------------------------------------------------------------------
+// Network input tensor made from every frame for the <camera name>_tensor pipe, the codes are the CAMERA_TENSOR_* ones of
+// voxl_camera_server.h
+//------------------------------------------------------------------------------------------------------------------------------
+struct TensorConfig
+{
+    int     width;                      ///< Tensor width, 0 to disable
+    int     height;                     ///< Tensor height
+    bool    crop;                       ///< Center crop the frame to the tensor aspect ratio instead of letterboxing it
+    int     pad;                        ///< Pixel value of the letterbox padding
+    int     type;                       ///< Element type
+    int     layout;                     ///< NCHW or NHWC
+    int     channels;                   ///< RGB, BGR or grey
+    float   mean[3];                    ///< Subtracted from the pixel values (0 to 255), in tensor channel order
+    float   std[3];                     ///< Divides the pixel values after that
+    float   scale;                      ///< Quantization step of 8 bit tensors
+    int     zero_point;                 ///< Quantized value of 0
+    int     threads;                    ///< Threads making the tensor
+};
+
 //------------------------------------------------------------------------------------------------------------------------------
 // Structure containing information for one camera
 // Any changes to this struct should be reflected in camera_defaults.h as well
@@ -128,10 +178,61 @@ struct PerCameraInfo
     int     s_height;           ///< Snapshot Height of the frame
     bool    flip;               ///< Flip?
     bool    ind_exp;            ///< For stereo pairs, run exposure independently?
+    bool    latest_only;        ///< Don't queue frames behind unread ones on the image pipes
+    int     small_scale;        ///< Downscale factor of the <name>_small pipe (2 or 4), 0 to disable
+    int     pyramid_levels;     ///< Levels of the <name>_pyramid pipe including full resolution, 0 to disable
 
     AE_MODE ae_mode;
     modal_exposure_config_t      ae_hist_info; ///< ModalAI AE data (Histogram)
     modal_exposure_msv_config_t  ae_msv_info;  ///< ModalAI AE data (MSV)
+
+    int           num_encode_profiles;                  ///< Number of entries in encode_profiles, 0 to use e_width/e_height
+    EncodeProfile encode_profiles[MAX_ENCODE_PROFILES]; ///< Simulcast video encode outputs
+
+    int           num_decimated;                        ///< Number of entries in decimated_fps
+    int           decimated_fps[MAX_DECIMATED_PIPES];   ///< Rates of the reduced rate preview pipes (<name>_<fps>hz)
+
+    char          raw_record_dir[MAX_DIR_LENGTH];       ///< Where start_raw_record puts its files
+    bool          raw_record_on_start;                  ///< Start raw recording as soon as the camera starts
+
+    char          replay_file[MAX_DIR_LENGTH];          ///< Raw recording to replay instead of opening the camera, empty for none
+    float         replay_speed;                         ///< Replay speed relative to the recorded timing, 0 for as fast as possible
+
+    char          rect_intrinsics_file[MAX_DIR_LENGTH]; ///< Calibration for the <name>_rect pipe, empty to disable
+    char          rect_extrinsics_file[MAX_DIR_LENGTH]; ///< Stereo extrinsics for the <name>_rect pipe
+    int           rect_threads;                         ///< Threads remapping the <name>_rect frames
+
+    int           disparity_max;                        ///< Disparity range of the <name>_disparity pipe, 0 to disable
+    int           disparity_block;                      ///< Block size of the stereo matcher
+    int           disparity_uniqueness;                 ///< Margin in percent the best match needs over any other
+    int           disparity_threads;                    ///< Threads computing the <name>_disparity frames
+
+    int           features_threshold;                   ///< FAST threshold of the <name>_features pipe, 0 to disable
+    int           features_levels;                      ///< Pyramid levels searched for features, 1 for full resolution only
+    int           features_cell;                        ///< Size in pixels of the cells features are spread over
+    int           features_per_cell;                    ///< Most features kept in each cell
+
+    float         enhanced_clip;                        ///< CLAHE clip limit of the <name>_enhanced pipe, 0 to disable
+    int           enhanced_tiles;                       ///< CLAHE tiles across and down the image
+    int           enhanced_threads;                     ///< Threads computing the <name>_enhanced frames
+
+    int           rgb_pipes;                            ///< Bit i set for a <name>_<RGB_PIPE_NAMES[i]> pipe, NV12 cameras only
+    bool          rgb_bt709;                            ///< Convert with BT.709 instead of BT.601
+    int           rgb_threads;                          ///< Threads computing the RGB frames
+
+    TensorConfig  tensor;                               ///< Input tensor of the <name>_tensor pipe
+
+    bool          en_debayer;                           ///< Colour sensor streaming RAW, publish <name>_color
+    int           bayer_pattern;                        ///< ImgprocBayer order of its colour filters
+    bool          debayer_edge;                         ///< Edge aware green interpolation on the <name>_color pipe
+    bool          debayer_nv12;                         ///< NV12 instead of RGB on the <name>_color pipe
+    int           debayer_threads;                      ///< Threads demosaicing the <name>_color frames
+
+    bool          en_compressed;                        ///< Publish the RAW8 (or luma) frames losslessly compressed on <name>_compressed
+
+    int           mjpeg_fps;                            ///< Rate of the <name>_mjpeg pipe, 0 to disable
+    int           mjpeg_quality;                        ///< JPEG quality of <name>_mjpeg and snapshot_preview, 1 to 100
+    int           mjpeg_threads;                        ///< Threads encoding the JPEGs
 };
 
 
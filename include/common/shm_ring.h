@@ -0,0 +1,75 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef VOXL_CAMERA_SERVER_SHM_RING
+#define VOXL_CAMERA_SERVER_SHM_RING
+
+#include <stdint.h>
+#include <modal_pipe.h>
+
+#include "voxl_camera_server.h"
+
+static const int SHM_RING_NUM_SLOTS = 8;
+
+//------------------------------------------------------------------------------------------------------------------------------
+// Server side of the shared memory transport (see voxl_camera_server.h). Frames are copied into a memfd backed ring of slots
+// and only a small descriptor goes through the pipe, so the cost of fanning a frame out to several clients doesn't depend on
+// the frame size anymore.
+//------------------------------------------------------------------------------------------------------------------------------
+class ShmRing
+{
+public:
+    ShmRing(const char* name);
+    ~ShmRing();
+
+    // Copy a frame into the next slot and send its descriptor out on the given pipe. For stereo pairs pass both halves,
+    // meta.size_bytes covers the whole pair.
+    int Publish(int channel, camera_image_metadata_t meta, const void* data, const void* data2 = NULL);
+
+private:
+    int  Allocate(uint32_t slotDataSize);
+    void Free();
+
+    camera_shm_slot_t* GetSlot(uint32_t slot)
+    {
+        return (camera_shm_slot_t*)(m_pRing + m_pHeader->first_slot_offset + slot * m_pHeader->slot_stride);
+    }
+
+    char                 m_name[64];            ///< memfd name, shows up in /proc/<pid>/fd
+    int                  m_fd       = -1;       ///< Ring memfd
+    uint32_t             m_ringSize = 0;        ///< Size of the mapping
+    uint8_t*             m_pRing    = NULL;     ///< Server's read/write mapping
+    camera_shm_header_t* m_pHeader  = NULL;     ///< Start of the ring
+    uint32_t             m_nextSlot = 0;        ///< Slot the next frame goes into
+};
+
+#endif // VOXL_CAMERA_SERVER_SHM_RING
@@ -0,0 +1,69 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef VOXL_CAMERA_SERVER_WORKER_POOL
+#define VOXL_CAMERA_SERVER_WORKER_POOL
+
+#include <pthread.h>
+
+//------------------------------------------------------------------------------------------------------------------------------
+// Small pool of threads to split per frame work (usually bands of rows) across cores. The thread calling Run() works on the
+// jobs too, so a pool with 0 threads just runs everything inline.
+//------------------------------------------------------------------------------------------------------------------------------
+class WorkerPool
+{
+public:
+    WorkerPool(int numThreads, const char* name);
+    ~WorkerPool();
+
+    // Run job(context, i) for i in [0, numJobs) and return once all of them are done. Only one Run() at a time.
+    void Run(int numJobs, void (*job)(void* context, int index), void* context);
+
+    void* ThreadWorker();
+
+private:
+    bool DoJob();
+
+    int              m_numThreads = 0;         ///< Worker threads (not counting the caller)
+    pthread_t*       m_threads    = NULL;      ///< Worker threads
+    pthread_mutex_t  m_mutex;                  ///< Protects everything below
+    pthread_cond_t   m_workCond;               ///< Signals the workers that there are jobs
+    pthread_cond_t   m_doneCond;               ///< Signals Run() that the last job finished
+    bool             m_stop       = false;     ///< Worker thread terminate indicator
+    void           (*m_job)(void*, int) = NULL;///< Current job function
+    void*            m_context    = NULL;      ///< Current job context
+    int              m_numJobs    = 0;         ///< Jobs in the current Run()
+    int              m_nextJob    = 0;         ///< Next job to hand out
+    int              m_pending    = 0;         ///< Jobs not finished yet
+};
+
+#endif // VOXL_CAMERA_SERVER_WORKER_POOL
@@ -49,9 +49,11 @@ int bufferAllocateBuffers(
 
 void bufferDeleteBuffers(BufferGroup& buffer);
 void bufferMakeYUVContiguous(BufferBlock* pBufferInfo);
+uint8_t* bufferGetUVPlane(BufferBlock* pBufferInfo);
 void bufferPush(BufferGroup& bufferGroup, buffer_handle_t* buffer);
 void bufferPushAddress(BufferGroup& bufferGroup, void* vaddress);
 buffer_handle_t* bufferPop(BufferGroup& bufferGroup);
+buffer_handle_t* bufferTryPop(BufferGroup& bufferGroup);
 BufferBlock* bufferGetBufferInfo(BufferGroup* bufferGroup, buffer_handle_t* buffer);
 
 #endif // CAMXHAL3BUFFER_H
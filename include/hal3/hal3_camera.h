@@ -37,6 +37,7 @@
 #include <camera/CameraMetadata.h>
 #include <hardware/camera3.h>
 #include <list>
+#include <map>
 #include <string>
 #include <modal_pipe.h>
 #include <mutex>
@@ -49,6 +50,17 @@
 #include "exposure-hist.h"
 #include "exposure-msv.h"
 #include "omx_video_encoder.h"
+#include "shm_ring.h"
+#include "raw_recorder.h"
+#include "replay_source.h"
+#include "imgproc.h"
+#include "rectify.h"
+#include "stereo_bm.h"
+#include "feature_detector.h"
+#include "clahe.h"
+#include "tensor_preproc.h"
+#include "jpeg_encoder.h"
+#include "worker_pool.h"
 #include "tof_interface.hpp"
 
 #define NUM_MODULE_OPEN_ATTEMPTS 10
@@ -88,6 +100,46 @@ public:
     void Stop();
     void EStop();
 
+    int getNumSmallClients(){
+        if( partnerMode != MODE_STEREO_SLAVE ) {
+            return pipe_server_get_num_clients(smallOutputChannel);
+        } else {
+            return pipe_server_get_num_clients(otherMgr->smallOutputChannel);
+        }
+    }
+
+    int getNumPyramidClients(){
+        if( partnerMode != MODE_STEREO_SLAVE ) {
+            return pipe_server_get_num_clients(pyramidOutputChannel);
+        } else {
+            return pipe_server_get_num_clients(otherMgr->pyramidOutputChannel);
+        }
+    }
+
+    int getNumQualityClients(){
+        if( partnerMode != MODE_STEREO_SLAVE ) {
+            return pipe_server_get_num_clients(qualityOutputChannel);
+        } else {
+            return pipe_server_get_num_clients(otherMgr->qualityOutputChannel);
+        }
+    }
+
+    int getNumStatsClients(){
+        if( partnerMode != MODE_STEREO_SLAVE ) {
+            return pipe_server_get_num_clients(statsOutputChannel);
+        } else {
+            return pipe_server_get_num_clients(otherMgr->statsOutputChannel);
+        }
+    }
+
+    int getNumFeaturesClients(){
+        if( partnerMode != MODE_STEREO_SLAVE ) {
+            return pipe_server_get_num_clients(featuresOutputChannel);
+        } else {
+            return pipe_server_get_num_clients(otherMgr->featuresOutputChannel);
+        }
+    }
+
     int getNumClients(){
         if( partnerMode != MODE_STEREO_SLAVE ) {
             return pipe_server_get_num_clients(outputChannel);
@@ -105,8 +157,6 @@ public:
     const int32_t              p_width;                        ///< Preview Width
     const int32_t              p_height;                       ///< Preview Height
     const int32_t              p_halFmt;                       ///< Preview HAL format
-    const int32_t              e_width;                        ///< Encode Width
-    const int32_t              e_height;                       ///< Encode Height
     const int32_t              e_halFmt;                       ///< Encode HAL format
     const int32_t              s_width;                        ///< Snapshot Width
     const int32_t              s_height;                       ///< Snapshot Height
@@ -117,6 +167,8 @@ private:
 
     void* ThreadPostProcessResult();
     void* ThreadIssueCaptureRequests();
+    // Takes the place of both of the above when replaying a recording
+    void* ThreadReplay();
 
     // Call the camera module and pass it the stream configuration
     int  ConfigureStreams();
@@ -132,6 +184,8 @@ private:
     typedef std::pair<int, camera3_stream_buffer> image_result;
 
     void ProcessPreviewFrame (image_result result);
+    // Everything after the buffer has been looked up, srcPixel is the image and bufferBlockInfo is NULL for replayed frames
+    void ProcessPreviewImage (camera_image_metadata_t imageInfo, uint8_t* srcPixel, BufferBlock* bufferBlockInfo);
     void ProcessEncodeFrame  (image_result result);
     void ProcessSnapshotFrame(image_result result);
 
@@ -175,10 +229,88 @@ private:
         STREAM_INVALID
     };
 
+    // Everything needed for one simulcast encode output
+    struct EncodeStream
+    {
+        EncodeProfile       profile;                    ///< Resolution/codec/bitrate of this output
+        camera3_stream_t    stream;                     ///< HAL stream feeding this encoder
+        BufferGroup         bufferGroup;                ///< Buffer manager for the stream
+        VideoEncoder*       pVideoEncoder = NULL;       ///< OMX encoder instance
+        int                 outputChannel = -1;         ///< MPA channel the encoded frames go out on
+    };
+
+    // A reduced rate copy of the preview pipe for clients that don't need every frame
+    struct DecimatedStream
+    {
+        PerCameraMgr*       pMgr = NULL;                ///< Owner, context for the control callback
+        int                 outputChannel = -1;         ///< MPA channel the frames go out on
+        volatile int64_t    period_ns = 0;              ///< Time between frames at the requested rate
+        int64_t             next_ns = 0;                ///< Earliest timestamp for the next frame to go out
+    };
+
+    // Frames latest_only didn't send to a client that was behind, kept for every image pipe
+    struct SkipCounter
+    {
+        char                name[32];                   ///< Pipe name for the reports
+        uint64_t            frames = 0;                 ///< Frames skipped since the pipe was created
+        uint64_t            reported = 0;               ///< Value of frames at the last periodic report
+    };
+
+    void HandleDecimatedControlCmd(DecimatedStream* pStream, char* cmd);
+    // Send a frame out on the reduced rate pipes that are due for one
+    void WriteDecimatedFrames(camera_image_metadata_t meta, uint8_t* frame, uint8_t* childFrame);
+    // Send a frame to the clients of an image pipe, honoring latest_only
+    void WriteImage(int ch, camera_image_metadata_t meta, uint8_t* frame, uint8_t* childFrame);
+    // Send a header and its data buffers as one message to the clients of a pipe, honoring latest_only
+    void WriteList(int ch, int n, const void** bufs, const size_t* lens);
+    // Start counting the frames latest_only skips on an image pipe
+    void AddSkipCounter(int ch, const char* pipeName);
+    // Log the pipes that skipped frames since the last report, or the totals of every pipe when the camera stops
+    void ReportSkippedFrames(bool totals);
+    // Whether any client is going to read the chroma plane of the current preview frame
+    bool ChromaNeeded();
+    // Whether the current preview frame goes out on the _enhanced pipe
+    bool EnhanceNeeded();
+    // Single pass over a preview frame for the conversions, the flip and the derived images, returns the frame to send
+    uint8_t* ProcessPreviewRows(BufferBlock* bufferBlockInfo, uint8_t* srcPixel);
+    // Send all pyramid levels of a frame (or stereo pair) in one write
+    void WritePyramid(camera_image_metadata_t meta, uint8_t* frame, uint8_t* childFrame, uint8_t* childPyramid);
+    // Send the quality scores ProcessPreviewRows collected for a frame (or stereo pair)
+    void WriteQuality(camera_image_metadata_t meta, const ImgprocQuality* childQuality);
+    // Send the histogram(s) of a frame (or stereo pair) along with the AE state
+    void WriteStats(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* childFrame);
+    void WriteEnhanced(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* childFrame);
+    // Convert an NV12 frame (or stereo pair) for every RGB pipe with clients
+    void WriteRgb(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* childFrame);
+    // Make the network input tensor of a frame (or batch of a stereo pair) and send it out
+    void WriteTensor(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* childFrame);
+    // Demosaic a RAW8 Bayer frame (or stereo pair) and send it out as RGB or NV12
+    void WriteColor(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* childFrame);
+    // Losslessly compress the RAW8 (or luma) frame (or stereo pair) and send it out
+    void WriteCompressed(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* childFrame);
+    // Whether a JPEG may be made of the current preview frame, for the _mjpeg pipe or a preview snapshot
+    bool JpegNeeded();
+    // JPEG encode the frame (or stereo pair), send it out on the _mjpeg pipe if it's due and write the pending preview snapshots
+    void WriteJpeg(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* childFrame);
+    void RectifyFrame(uint8_t* frame, uint8_t* childFrame);
+    void WriteDisparity(camera_image_metadata_t meta, const uint8_t* left, const uint8_t* right);
+    // Corners of a frame (or stereo pair), the pyramids are only searched if they hold the current frame
+    void WriteFeatures(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* pyramid,
+                       const uint8_t* childFrame, const uint8_t* childPyramid);
+
+    EncodeStream *GetEncodeStream(camera3_stream_t *stream){
+        for (int i = 0; i < numEncodeStreams; i++) {
+            if (stream == &e_streams[i].stream) {
+                return &e_streams[i];
+            }
+        }
+        return NULL;
+    }
+
     STREAM_ID GetStreamId(camera3_stream_t *stream){
         if (stream == &p_stream) {
             return STREAM_PREVIEW;
-        } else if (stream == &e_stream) {
+        } else if (GetEncodeStream(stream) != NULL) {
             return STREAM_ENCODED;
         } else if (stream == &s_stream) {
             return STREAM_SNAPSHOT;
@@ -188,14 +320,11 @@ private:
     }
 
     BufferGroup *GetBufferGroup(camera3_stream_t *stream){
-        return GetBufferGroup(GetStreamId(stream));
-    }
-    BufferGroup *GetBufferGroup(STREAM_ID stream){
-        switch (stream){
+        switch (GetStreamId(stream)){
             case STREAM_PREVIEW:
                 return &p_bufferGroup;
             case STREAM_ENCODED:
-                return &e_bufferGroup;
+                return &GetEncodeStream(stream)->bufferGroup;
             case STREAM_SNAPSHOT:
                 return &s_bufferGroup;
             default:
@@ -204,21 +333,24 @@ private:
     }
 
     camera_module_t*                    pCameraModule;               ///< Camera module
-    VideoEncoder*                       pVideoEncoder;
     ModalExposureHist                   expHistInterface;
     ModalExposureMSV                    expMSVInterface;
     Camera3Callbacks                    cameraCallbacks;             ///< Camera callbacks
     camera3_device_t*                   pDevice;                     ///< HAL3 device
     uint8_t                             num_streams;
     camera3_stream_t                    p_stream;                    ///< Stream to be used for the preview request
-    camera3_stream_t                    e_stream;                    ///< Stream to be used for the encoded request
+    EncodeStream                        e_streams[MAX_ENCODE_PROFILES]; ///< Streams/encoders for the encoded requests
+    int                                 numEncodeStreams = 0;        ///< Number of valid entries in e_streams
+    DecimatedStream                     d_streams[MAX_DECIMATED_PIPES]; ///< Reduced rate preview pipes
+    int                                 numDecimatedStreams = 0;     ///< Number of valid entries in d_streams
     camera3_stream_t                    s_stream;                    ///< Stream to be used for the snapshots request
     android::CameraMetadata             requestMetadata;             ///< Per request metadata
     BufferGroup                         p_bufferGroup;               ///< Buffer manager per stream
-    BufferGroup                         e_bufferGroup;               ///< Buffer manager per stream
     BufferGroup                         s_bufferGroup;               ///< Buffer manager per stream
     pthread_t                           requestThread;               ///< Request thread private data
     pthread_t                           resultThread;                ///< Result Thread private data
+    pthread_t                           replayThread;                ///< Replay thread private data
+    ReplaySource*                       replay = NULL;               ///< Source of the frames in place of the camera, NULL for the camera
     pthread_mutex_t                     resultMutex;                 ///< Mutex for list access
     pthread_cond_t                      resultCond;                  ///< Condition variable for wake up
     pthread_mutex_t                     aeMutex;                     ///< Mutex for list access
@@ -239,7 +371,69 @@ private:
     list<char *>                        snapshotQueue;
     atomic_int                          numNeededSnapshots {0};
     int                                 lastSnapshotNumber = 0;
-    int                                 encodeOutputChannel = -1;
+    int                                 shmOutputChannel = -1;       ///< Pipe for the shared memory descriptors
+    ShmRing*                            shmRing = NULL;              ///< Shared memory transport, frames only go in while it has clients
+    std::map<int, SkipCounter>          skipCounters;                ///< latest_only skip counts, keyed by output channel
+    int64_t                             skipReportNs = 0;            ///< Timestamp of the next periodic skip report
+    int                                 smallOutputChannel = -1;     ///< Pipe for the downscaled preview
+    uint8_t*                            smallFrame = NULL;           ///< Downscaled preview
+    bool                                smallValid = false;          ///< smallFrame holds the current frame
+    int                                 greyOutputChannel = -1;      ///< Pipe for the luma plane of NV12 previews
+    int                                 pyramidOutputChannel = -1;   ///< Pipe for the image pyramid
+    uint8_t*                            pyramidFrame = NULL;         ///< Pyramid levels below full resolution, back to back
+    uint16_t*                           pyramidScratch = NULL;       ///< Row buffer for imgprocPyrDown
+    bool                                pyramidValid = false;        ///< pyramidFrame holds the current frame
+    uint8_t*                            flipFrame = NULL;            ///< Output of the fused RAW10 conversion and flip
+    int                                 qualityOutputChannel = -1;   ///< Pipe for the sharpness and exposure scores
+    ImgprocQuality                      quality = {};                ///< Quality sums of the current frame
+    bool                                qualityValid = false;        ///< quality holds the current frame
+    int                                 statsOutputChannel = -1;     ///< Pipe for the histogram and AE state
+    uint32_t                            histogram[256];              ///< Histogram of the current frame
+    bool                                statsValid = false;          ///< histogram holds the current frame
+    bool                                histogramPending = false;    ///< histogram is left to the _enhanced tiles
+    int                                 enhancedOutputChannel = -1;  ///< Pipe for the contrast enhanced frames
+    Clahe*                              clahe[2] = {NULL, NULL};     ///< Contrast enhancement of the left (or only) and right image
+    uint8_t*                            enhancedFrame = NULL;        ///< Enhanced image(s)
+    int                                 rgbOutputChannels[NUM_RGB_PIPES] = {-1, -1, -1}; ///< Pipes for the RGB layouts
+    uint8_t*                            rgbFrame = NULL;             ///< RGB image(s), NULL if there are no RGB pipes
+    const uint8_t*                      uvPlane = NULL;              ///< UV plane of the current NV12 frame, wherever it is
+    int                                 yuvStride = 0;               ///< Row stride of both planes of the current NV12 frame
+    bool                                chromaValid = false;         ///< uvPlane is flipped along with the luma (if it has to be)
+    int                                 tensorOutputChannel = -1;    ///< Pipe for the network input tensors
+    TensorPreproc*                      tensorPreproc = NULL;        ///< Tensor maker, masters only
+    uint8_t*                            tensorFrame = NULL;          ///< Tensor (batch)
+    int                                 colorOutputChannel = -1;     ///< Pipe for the demosaiced frames
+    uint8_t*                            colorFrame = NULL;           ///< Demosaiced image(s), NULL if the camera isn't debayered
+    uint8_t*                            debayerScratch = NULL;       ///< Row pairs of every band for the NV12 output
+    int64_t                             debayerNs = 0;               ///< Time spent demosaicing since the last timing log
+    int                                 debayerFrames = 0;           ///< Frames demosaiced since the last timing log
+    int                                 compressedOutputChannel = -1;///< Pipe for the compressed frames
+    uint8_t*                            compressedFrame = NULL;      ///< Compressed image(s), NULL if the camera isn't compressed
+    int                                 compressedMaxSize = 0;       ///< Room for each image in compressedFrame
+    int64_t                             compressNs = 0;              ///< Time spent compressing since the last timing log
+    int64_t                             compressBytes = 0;           ///< Bytes the frames compressed to since the last timing log
+    int                                 compressFrames = 0;          ///< Frames compressed since the last timing log
+    int                                 mjpegOutputChannel = -1;     ///< Pipe for the JPEG frames
+    JpegEncoder*                        jpegEncoder = NULL;          ///< Made on Start for the _mjpeg pipe, on the first preview snapshot otherwise
+    int64_t                             mjpegNextNs = 0;             ///< Earliest timestamp for the next frame on the _mjpeg pipe
+    pthread_mutex_t                     previewSnapshotMutex;        ///< Protects previewSnapshotQueue
+    list<char *>                        previewSnapshotQueue;        ///< Files the next preview frame gets written to as a JPEG
+    atomic_int                          numPreviewSnapshots {0};     ///< Entries in previewSnapshotQueue
+    int                                 lastPreviewSnapshotNumber = 0;
+    int64_t                             jpegNs = 0;                  ///< Time spent JPEG encoding since the last timing log
+    int64_t                             jpegBytes = 0;               ///< Bytes of the JPEGs since the last timing log
+    int                                 jpegFrames = 0;              ///< Frames JPEG encoded since the last timing log
+    RawRecorder*                        rawRecorder = NULL;          ///< Records the main pipe's frames, masters only
+    int                                 rectOutputChannel = -1;      ///< Pipe for the undistorted/rectified frames
+    ImgprocRemap                        rectMaps[2] = {};            ///< Remap tables of the left (or only) and right image
+    uint8_t*                            rectFrame = NULL;            ///< Remapped image(s), NULL if there is no _rect pipe
+    int                                 disparityOutputChannel = -1; ///< Pipe for the stereo disparity
+    StereoMatcher*                      stereoMatcher = NULL;        ///< Disparity matcher, masters only
+    uint8_t*                            disparityFrame = NULL;       ///< Disparities followed by the validity flags
+    int                                 featuresOutputChannel = -1;  ///< Pipe for the corner features
+    FeatureDetector*                    featureDetector = NULL;      ///< Corner detector, masters only
+    camera_feature_t*                   features = NULL;             ///< Corners of the current frame (or pair)
+    WorkerPool*                         workerPool = NULL;           ///< Threads helping with the remap, matching and conversions
 
     ///< TOF Specific members
 
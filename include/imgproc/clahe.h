@@ -0,0 +1,83 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef VOXL_CAMERA_SERVER_CLAHE
+#define VOXL_CAMERA_SERVER_CLAHE
+
+#include <stddef.h>
+#include <stdint.h>
+
+//------------------------------------------------------------------------------------------------------------------------------
+// Contrast limited adaptive histogram equalization for the _enhanced pipe, the same algorithm as OpenCV's CLAHE. The image is
+// split into a grid of tiles, every tile gets an equalization table from its histogram with the counts above the clip limit
+// spread over all bins, and every pixel is mapped through the tables of the four tiles around it weighted by its distance to
+// their centers. The weights are in 1/128 instead of float, so a pixel can be one off from OpenCV.
+//
+// Tile() can run on all tiles in parallel, and then Apply() on all bands of rows. The tile histograms are kept until the next
+// image so that the caller can add them up instead of computing the histogram of the whole image again.
+//------------------------------------------------------------------------------------------------------------------------------
+class Clahe
+{
+public:
+    // width and height have to be multiples of tilesX and tilesY, clipLimit is relative to a flat histogram like in OpenCV
+    Clahe(int width, int height, int tilesX, int tilesY, float clipLimit, int numBands);
+    ~Clahe();
+
+    int NumTiles() { return m_tilesX * m_tilesY; }
+    int NumBands() { return m_numBands; }
+
+    // Histogram and equalization table of one tile, stride is the image width
+    void Tile(const uint8_t* src, int tile);
+
+    // One band of rows of the output, needs Tile() of all tiles
+    void Apply(const uint8_t* src, uint8_t* dst, int band);
+
+    // Add the (unclipped) histograms of all tiles, which is the histogram of the image
+    void AddHistograms(uint32_t* hist);
+
+private:
+    int       m_width;
+    int       m_height;
+    int       m_tilesX;
+    int       m_tilesY;
+    int       m_tileWidth;
+    int       m_tileHeight;
+    int       m_clip;                   ///< Most pixels a bin of a tile histogram keeps
+    int       m_numBands;
+
+    uint32_t* m_hists   = NULL;         ///< 256 bins per tile
+    uint8_t*  m_luts    = NULL;         ///< 256 entries per tile
+    uint16_t* m_colTile = NULL;         ///< Per column: LUT offsets of the tiles left and right of it
+    uint8_t*  m_colW    = NULL;         ///< Per column: weight of the right tile in 1/128
+};
+
+#endif // VOXL_CAMERA_SERVER_CLAHE
@@ -0,0 +1,79 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef VOXL_CAMERA_SERVER_FEATURE_DETECTOR
+#define VOXL_CAMERA_SERVER_FEATURE_DETECTOR
+
+#include <stdint.h>
+#include <vector>
+
+#include "voxl_camera_server.h"
+
+//------------------------------------------------------------------------------------------------------------------------------
+// FAST-9 corners for the _features pipe. Corners are kept if their score is the highest in their 3x3 neighbourhood (the first
+// one wins a tie), and then only the perCell strongest ones of every cellSize x cellSize cell so that the features are spread
+// over the image instead of piling up on the most textured part of it. Every pyramid level gets its own grid.
+//------------------------------------------------------------------------------------------------------------------------------
+class FeatureDetector
+{
+public:
+    FeatureDetector(int width, int height, int numLevels, int threshold, int cellSize, int perCell);
+    ~FeatureDetector();
+
+    // Most features Detect() returns for one image
+    int MaxFeatures() { return m_maxFeatures; }
+
+    // Corners of one image. pyramid holds levels 1 and up back to back like the camera manager makes them, pass NULL to only
+    // search level 0. Returns the number of features written.
+    int Detect(const uint8_t* image, const uint8_t* pyramid, uint8_t imageIndex, camera_feature_t* features);
+
+private:
+    typedef struct Candidate
+    {
+        uint32_t         key;           ///< Cell in the high half, 0xFFFF - score in the low half
+        camera_feature_t feature;
+    } Candidate;
+
+    int DetectLevel(const uint8_t* src, int width, int height, uint8_t level, uint8_t imageIndex, camera_feature_t* features);
+
+    int                    m_width;
+    int                    m_height;
+    int                    m_numLevels;
+    int                    m_threshold;
+    int                    m_cellSize;
+    int                    m_perCell;
+    int                    m_maxFeatures;
+    uint16_t*              m_scores;        ///< FAST scores of the level being searched
+    std::vector<Candidate> m_candidates;    ///< Local maxima of the level being searched
+};
+
+#endif // VOXL_CAMERA_SERVER_FEATURE_DETECTOR
@@ -0,0 +1,169 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef VOXL_CAMERA_SERVER_IMGPROC
+#define VOXL_CAMERA_SERVER_IMGPROC
+
+#include <stdint.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// CPU image processing kernels used on the preview frames before they go out on the pipes.
+//
+// All kernels work on one plane at a time, take explicit strides so that they can run directly on the HAL buffers, and only
+// touch the rows they are given so that the camera manager can run several of them over the same band of rows while it is
+// still in cache. Each kernel has a NEON implementation and a plain C fallback for the tail of a row (and for hosts without
+// NEON); both give bit exact results.
+// -----------------------------------------------------------------------------------------------------------------------------
+
+// Rows the camera manager processes at a time when it chains kernels over a frame, a multiple of every downscale factor
+static const int IMGPROC_BAND_ROWS = 16;
+
+// Convert packed MIPI RAW10 rows to RAW8 by dropping the byte holding the two least significant bits of every four pixels.
+// src and dst may be the same buffer (in place), the rows are then converted front to back so nothing is overwritten before
+// it has been read.
+void imgprocRaw10ToRaw8(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int rows);
+
+// Convert packed MIPI RAW10 rows to RAW8 and rotate them by 180 degrees, dst row 0 is src row rows-1 mirrored left to right.
+// Rotating moves pixels from the top of the buffer to the bottom so src and dst can't overlap.
+void imgprocRaw10ToRaw8Rot180(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int rows);
+
+// In place 180 degree rotation of a RAW8/grey plane (or the Y plane of NV12). Every row is swapped with its mirror row, so
+// once rows [rowStart, rowEnd) of the height rows are done they are final and the next kernel can use them; rows have to be
+// handed over top to bottom, starting at 0.
+void imgprocRot180Raw8(uint8_t* buf, int stride, int width, int height, int rowStart, int rowEnd);
+
+// Same as above for an interleaved chroma plane, the chroma pairs stay in order. width is the number of chroma pairs in a row.
+void imgprocRot180UV(uint8_t* buf, int stride, int width, int height, int rowStart, int rowEnd);
+
+// Box filter downscale of a RAW8/grey plane (or the Y plane of NV12) by a factor of 2 or 4, rounding to nearest.
+// width and rows are the source dimensions and must be multiples of the factor.
+void imgprocDownscaleRaw8(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int rows, int factor);
+
+// Same as above for an interleaved chroma plane (the UV plane of NV12/NV21), each channel is filtered separately.
+// width is the number of chroma pairs in a row.
+void imgprocDownscaleUV(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int rows, int factor);
+
+// Halve an image with the 5x5 binomial (1 4 6 4 1) filter, the same as OpenCV's pyrDown including the reflect-101 border
+// and rounding. The result is (width+1)/2 x (height+1)/2, only rows [dstRowStart, dstRowEnd) of it are produced so that it
+// can follow another kernel down the frame; output row y reads source rows up to 2y+2. scratch has to hold
+// IMGPROC_PYR_SCRATCH(width) values.
+#define IMGPROC_PYR_SCRATCH(width) ((width) + 32)
+void imgprocPyrDown(const uint8_t* src, int srcStride, int width, int height,
+                    uint8_t* dst, int dstStride, int dstRowStart, int dstRowEnd, uint16_t* scratch);
+
+// Precomputed bilinear remap of a RAW8/grey plane, e.g. for undistortion or rectification. Every output pixel has the offset
+// of the top left of its 2x2 source neighbourhood and the position inside it in 1/16 pixel. Output pixels whose source is
+// outside the image are black, each row has one span of columns [spans[2y], spans[2y+1]) that gets sampled.
+static const int IMGPROC_REMAP_FRAC_BITS = 4;
+
+typedef struct ImgprocRemap
+{
+    int       width;        ///< Output width
+    int       height;       ///< Output height
+    int       srcStride;    ///< Row stride of the source the offsets were made for
+    uint32_t* offsets;      ///< Source offset per output pixel
+    uint8_t*  weights;      ///< Source position per output pixel, x fraction in the low 4 bits and y fraction in the high 4
+    uint16_t* spans;        ///< First and one past the last sampled column of each output row
+} ImgprocRemap;
+
+// Apply a remap to rows [rowStart, rowEnd) of the output, rounding to nearest
+void imgprocRemapBilinear(const ImgprocRemap* map, const uint8_t* src, uint8_t* dst, int dstStride, int rowStart, int rowEnd);
+
+// FAST-9 corner scores of rows [rowStart, rowEnd) of a RAW8/grey plane. A pixel is a corner if 9 contiguous pixels of the
+// 16 on the radius 3 circle around it are all brighter than center + threshold or all darker than center - threshold. Its
+// score is the larger one of the sums of (|p - center| - threshold) over the brighter and over the darker circle pixels,
+// so always at least 9. Pixels that aren't corners, and the 3 pixel border, get 0.
+void imgprocFast9(const uint8_t* src, int stride, int width, int height, int threshold, uint16_t* scores, int rowStart, int rowEnd);
+
+// Image quality statistics of a RAW8/grey plane, sampled on every IMGPROC_QUALITY_ROW_STEP'th row (rows 1, 1 + step, ...)
+// and on all columns but the first. Each sampled pixel adds its value, whether it is at least IMGPROC_QUALITY_SATURATED and
+// its squared gradient to the pixels on its left and above. Rows [rowStart, rowEnd) are added to the sums in quality, the
+// row above rowStart has to be valid as well. The caller zeroes quality before the first row of a frame.
+static const int IMGPROC_QUALITY_ROW_STEP  = 4;
+static const int IMGPROC_QUALITY_SATURATED = 250;
+
+typedef struct ImgprocQuality
+{
+    uint64_t sum;           ///< Sum of the sampled pixels
+    uint64_t gradient;      ///< Sum of dx^2 + dy^2 over the sampled pixels
+    uint32_t saturated;     ///< Sampled pixels at or above IMGPROC_QUALITY_SATURATED
+    uint32_t samples;       ///< Number of sampled pixels
+} ImgprocQuality;
+
+void imgprocQuality(const uint8_t* src, int stride, int width, int rowStart, int rowEnd, ImgprocQuality* quality);
+
+// Add the pixels of rows [rowStart, rowEnd) of a RAW8/grey plane to a 256 bin histogram. The caller zeroes hist before the
+// first row of a frame.
+void imgprocHistogram(const uint8_t* src, int stride, int width, int rowStart, int rowEnd, uint32_t* hist);
+
+// NV12 to 8 bit RGB, limited range BT.601 (the same as OpenCV's COLOR_YUV2RGB_NV12) or BT.709. Both planes have the same
+// stride, which can be the padded one of the HAL buffer. Interleaved layouts write width * 3 bytes per row, the planar one
+// writes R, G and B planes of width * height each. Only rows [rowStart, rowEnd) of the output are produced.
+enum ImgprocRgbLayout
+{
+    IMGPROC_RGB24 = 0,
+    IMGPROC_BGR24,
+    IMGPROC_RGB_PLANAR
+};
+
+enum ImgprocYuvMatrix
+{
+    IMGPROC_BT601 = 0,
+    IMGPROC_BT709
+};
+
+void imgprocNV12ToRGB(const uint8_t* y, const uint8_t* uv, int stride, uint8_t* dst, int width, int height,
+                      ImgprocRgbLayout layout, ImgprocYuvMatrix matrix, int rowStart, int rowEnd);
+
+// Demosaic rows [rowStart, rowEnd) of a RAW8 Bayer image to RGB24. Missing samples are the mean of the nearest ones of their
+// colour (rounded one pair at a time), with edgeAware the green at red and blue pixels only averages along the direction with
+// the smaller gradient. The image is mirrored at its borders, which keeps the pattern, so width and height have to be even.
+// The pattern is named by its top left 2x2 block, a 180 degree rotation swaps RGGB with BGGR and GRBG with GBRG (index ^ 3).
+enum ImgprocBayer
+{
+    IMGPROC_BAYER_RGGB = 0,
+    IMGPROC_BAYER_GRBG,
+    IMGPROC_BAYER_GBRG,
+    IMGPROC_BAYER_BGGR
+};
+
+void imgprocDebayer(const uint8_t* src, int stride, int width, int height, ImgprocBayer pattern, bool edgeAware,
+                    uint8_t* dst, int dstStride, int rowStart, int rowEnd);
+
+// Same as above straight to NV12 with the limited range BT.601 matrix, the chroma of each 2x2 block is that of its mean
+// colour. rowStart and rowEnd have to be even, y and uv have the same stride. scratch holds IMGPROC_DEBAYER_SCRATCH(width)
+// bytes, one for each thread.
+#define IMGPROC_DEBAYER_SCRATCH(width) ((width) * 6)
+void imgprocDebayerNV12(const uint8_t* src, int stride, int width, int height, ImgprocBayer pattern, bool edgeAware,
+                        uint8_t* y, uint8_t* uv, int dstStride, uint8_t* scratch, int rowStart, int rowEnd);
+
+#endif // VOXL_CAMERA_SERVER_IMGPROC
@@ -0,0 +1,100 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef VOXL_CAMERA_SERVER_JPEG_ENCODER
+#define VOXL_CAMERA_SERVER_JPEG_ENCODER
+
+#include <stddef.h>
+#include <stdint.h>
+
+//------------------------------------------------------------------------------------------------------------------------------
+// Baseline JPEG encoder for the _mjpeg pipe and preview snapshots. Grey frames (or the luma plane) become grey JPEGs and NV12
+// frames 4:2:0 ones straight from their planes, the images of a stereo pair are stacked left over right in one JPEG. The
+// standard Huffman tables and the quality scaled standard quantization tables are used.
+//
+// The DCT is the AAN one with its scale factors folded into the quantization, NEON does it on a whole block in registers with
+// the same 16 bit arithmetic as the plain C path, so both give the same output. There is a restart marker after every row of
+// MCUs, which makes the bands of MCU rows independent: EncodeBand() can run on all of them in parallel, each into its own
+// part of an arena allocated once, and Finish() moves them together behind the headers.
+//------------------------------------------------------------------------------------------------------------------------------
+class JpegEncoder
+{
+public:
+    // Images are width x height, NV12 if colour is set (width and height even) and grey otherwise. Quality is 1 to 100.
+    JpegEncoder(int width, int height, int numImages, bool colour, int quality, int numBands);
+    ~JpegEncoder();
+
+    int NumBands() { return m_numBands; }
+
+    // One band of MCU rows, y, uv and stride have an entry per image and uv is ignored for grey images
+    void EncodeBand(const uint8_t* const* y, const uint8_t* const* uv, const int* stride, int band);
+
+    // The JPEG file once all bands are done, NULL if a band didn't fit in its part of the arena
+    const uint8_t* Finish(int* size);
+
+private:
+    typedef struct HuffTable
+    {
+        uint16_t code[256];
+        uint8_t  size[256];
+    } HuffTable;
+
+    typedef struct QuantTable
+    {
+        uint16_t recip[64];             ///< 65536 / divisor, rounded up, in the (transposed) order the DCT leaves them in
+        uint16_t half[64];              ///< Half the divisor, for rounding
+    } QuantTable;
+
+    void WriteHeaders(const uint8_t tables[2][64]);
+    void EncodeMcuRow(const uint8_t* const* y, const uint8_t* const* uv, const int* stride, int row, int band);
+
+    int         m_width;
+    int         m_height;
+    int         m_numImages;
+    bool        m_colour;
+    int         m_numBands;
+    int         m_mcuSize;              ///< 16 for 4:2:0, 8 for grey
+    int         m_mcusX;                ///< MCUs across, the restart interval
+    int         m_mcuRows;              ///< MCU rows of the whole (stacked) image
+
+    QuantTable  m_quant[2];             ///< Luma and chroma
+    HuffTable   m_dc[2];
+    HuffTable   m_ac[2];
+
+    uint8_t*    m_arena = NULL;         ///< Headers, then every band's part
+    int         m_headerSize = 0;
+    int*        m_bandRow = NULL;       ///< First MCU row of each band, and the MCU row count at the end
+    uint8_t**   m_bandStart = NULL;     ///< Each band's part of the arena, and the end of the arena at the end
+    int*        m_bandSize = NULL;      ///< Bytes a band wrote, -1 if it ran out of room
+};
+
+#endif // VOXL_CAMERA_SERVER_JPEG_ENCODER
@@ -0,0 +1,55 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef VOXL_CAMERA_SERVER_RECTIFY
+#define VOXL_CAMERA_SERVER_RECTIFY
+
+#include "imgproc.h"
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Builds the remap tables for the _rect pipes from OpenCV style calibration files (the .yml files written by the voxl camera
+// calibrator). This is done once at startup, the per frame work is just imgprocRemapBilinear().
+//
+// Intrinsics files hold the camera matrices and distortion as M/D (or M1/D1 and M2/D2 for a stereo pair) plus an optional
+// "distortion_model: fisheye", otherwise the OpenCV plumb bob model with 4, 5 or 8 coefficients is assumed. Extrinsics files
+// hold R and T from the left to the right camera and optionally the rectification R1/R2/P1/P2 from cv::stereoRectify(), if
+// those are missing they are computed here the same way (Bouguet, zero disparity, no alpha scaling).
+//
+// Mono cameras are undistorted into their own camera matrix.
+// -----------------------------------------------------------------------------------------------------------------------------
+
+// Fills maps[0] for a mono camera (extrinsicsFile NULL) or maps[0] and maps[1] for the left and right half of a stereo pair.
+// Returns 0 on success, the maps have to be freed with rectifyFreeMap().
+int  rectifyBuildMaps(const char* intrinsicsFile, const char* extrinsicsFile, int width, int height, ImgprocRemap* maps);
+void rectifyFreeMap(ImgprocRemap* map);
+
+#endif // VOXL_CAMERA_SERVER_RECTIFY
@@ -0,0 +1,95 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef VOXL_CAMERA_SERVER_STEREO_BM
+#define VOXL_CAMERA_SERVER_STEREO_BM
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Disparities on the _disparity pipe are in 1/16 pixel
+static const int STEREO_BM_SUBPIXEL_BITS = 4;
+
+//------------------------------------------------------------------------------------------------------------------------------
+// Block matching stereo on a rectified pair. Both images get a 5x5 census transform, the matching cost is the hamming distance
+// between census signatures summed over a square block. For every left pixel the disparity with the lowest cost wins, refined
+// to 1/16 pixel with a parabola through its neighbours. A pixel is only marked valid if
+//
+//   - its block and census window are inside both images for the whole disparity range
+//   - no other disparity (more than one pixel away) costs less than (100 + uniqueness)% of the best one
+//   - matching the right image against the left one lands within one pixel of the same disparity
+//
+// The work is split into horizontal bands, Census() and then Match() can run on all of them in parallel. Every band keeps its
+// own scratch memory so they don't share anything but the census images.
+//------------------------------------------------------------------------------------------------------------------------------
+class StereoMatcher
+{
+public:
+    // numDisparities is a multiple of 8, blockSize odd and at most 11, uniqueness is in percent (0 disables the check)
+    StereoMatcher(int width, int height, int numDisparities, int blockSize, int uniqueness, int numBands);
+    ~StereoMatcher();
+
+    int NumBands() { return m_numBands; }
+
+    // Census transform of one band of the left (image 0) or right (image 1) image, stride is the image width
+    void Census(int image, const uint8_t* src, int band);
+
+    // Disparity and validity (255 valid, 0 not) of one band of left image pixels, needs Census() of all bands of both images
+    void Match(int band, uint16_t* disparity, uint8_t* valid);
+
+private:
+    void BandRows(int band, int* rowStart, int* rowEnd)
+    {
+        *rowStart = band * m_height / m_numBands;
+        *rowEnd   = (band + 1) * m_height / m_numBands;
+    }
+
+    void RowCost(int y, uint8_t* cost);
+    void MatchRow(int band, uint16_t* disparity, uint8_t* valid);
+
+    int       m_width;
+    int       m_height;
+    int       m_numDisparities;
+    int       m_blockSize;
+    int       m_uniqueness;             ///< Uniqueness margin in 1/128
+    int       m_numBands;
+    int       m_border;                 ///< Census plus block radius, pixels closer to the edge are never valid
+    int       m_aggStride;              ///< Row stride of the aggregated costs, padded for the right to left check
+
+    uint8_t*  m_census  = NULL;         ///< 3 signature byte planes of the left then the right image
+    uint8_t*  m_rowCost = NULL;         ///< Per band: costs of the last blockSize rows, numDisparities planes each
+    uint16_t* m_colSum  = NULL;         ///< Per band: cost summed over the block rows
+    uint16_t* m_agg     = NULL;         ///< Per band: cost summed over the whole block
+    uint16_t* m_right   = NULL;         ///< Per band: best disparity of every right image pixel
+};
+
+#endif // VOXL_CAMERA_SERVER_STEREO_BM
@@ -0,0 +1,106 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef VOXL_CAMERA_SERVER_TENSOR_PREPROC
+#define VOXL_CAMERA_SERVER_TENSOR_PREPROC
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "common_defs.h"
+#include "imgproc.h"
+
+//------------------------------------------------------------------------------------------------------------------------------
+// Turns frames into the input tensor of a network for the _tensor pipe: bilinear resize to the tensor size (letterboxed or
+// center cropped), conversion to RGB, BGR or grey, normalization or quantization, and NCHW or NHWC layout in one pass. Every
+// output row is made from the two source rows around it, which NEON blends into a small buffer per band; the columns are
+// then picked out of that buffer and converted, and the normalization is a table per channel since the result only depends
+// on the 8 bit value. The frame is only read where it's sampled and the tensor is written once.
+//
+// Process() can run on all bands of all images of a batch in parallel.
+//------------------------------------------------------------------------------------------------------------------------------
+class TensorPreproc
+{
+public:
+    // Frames are srcWidth x srcHeight, NV12 if colour is set and grey (or the luma plane only) otherwise. Grey frames are
+    // repeated in all channels of an RGB/BGR tensor.
+    TensorPreproc(const TensorConfig* config, int srcWidth, int srcHeight, bool colour, ImgprocYuvMatrix matrix,
+                  int numBands, int numImages);
+    ~TensorPreproc();
+
+    int    NumBands()   { return m_numBands; }
+    int    Channels()   { return m_channels; }
+    size_t ImageBytes() { return (size_t)m_config.width * m_config.height * m_channels * m_elemSize; }
+
+    // Where the frame is in the tensor: tensor x = image x * scaleX + offsetX, same for y
+    void Placement(float* scaleX, float* scaleY, float* offsetX, float* offsetY);
+
+    // One band of rows of the tensor of one image of the batch, dst is the start of the batch. uv is ignored for grey frames.
+    void Process(const uint8_t* y, const uint8_t* uv, int stride, uint8_t* dst, int image, int band);
+
+private:
+    void Sample(const uint8_t* y, const uint8_t* uv, int stride, int row, uint8_t* scratch, const uint8_t* planes[3]);
+    void Store(const uint8_t* const* planes, uint8_t* dst, int row);
+
+    TensorConfig     m_config;
+    bool             m_colour;
+    ImgprocYuvMatrix m_matrix;
+    int              m_srcWidth;
+    int              m_srcHeight;
+    int              m_numBands;
+    int              m_numImages;
+    int              m_channels;
+    int              m_elemSize;            ///< Bytes per tensor element
+
+    int              m_dstX;                ///< Tensor column of the left of the image area
+    int              m_dstY;                ///< Tensor row of the top of the image area
+    int              m_dstWidth;            ///< Width of the image area, the rest is padding
+    int              m_dstHeight;           ///< Height of the image area
+    float            m_srcX;                ///< Frame position of the left of the image area
+    float            m_srcY;                ///< Frame position of the top of the image area
+    float            m_srcWidthUsed;        ///< Frame width mapped to the image area
+    float            m_srcHeightUsed;       ///< Frame height mapped to the image area
+
+    uint16_t*        m_colOffset = NULL;    ///< Per column: left luma sample, then per column pair: left chroma pair
+    uint8_t*         m_colWeight = NULL;    ///< Per column (pair): weight of the right sample in 1/128
+    int*             m_rowOffset = NULL;    ///< Per row: upper luma row, then upper chroma row
+    uint8_t*         m_rowWeight = NULL;    ///< Per row: weight of the lower row in 1/128
+    int              m_lumaSpan[2];         ///< First and one past the last luma byte of a row that gets sampled
+    int              m_chromaSpan[2];       ///< Same for the chroma rows
+
+    float            m_lutFloat[3][256];    ///< Tensor value per channel and pixel value for float tensors
+    uint8_t          m_lutQuant[3][256];    ///< Same for quantized ones (int8 as two's complement)
+    uint8_t*         m_scratch = NULL;      ///< Row buffers for every band of every image
+    size_t           m_scratchSize;         ///< Bytes of them per band
+};
+
+#endif // VOXL_CAMERA_SERVER_TENSOR_PREPROC
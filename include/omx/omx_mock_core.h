@@ -0,0 +1,59 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef VOXL_CAMERA_SERVER_OMX_MOCK_CORE
+#define VOXL_CAMERA_SERVER_OMX_MOCK_CORE
+
+#include <OMX_Core.h>
+#include <OMX_Component.h>
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Stand-in for the vendor OMX core so that the encoder path can be run on a machine without the hardware encoder. It
+// implements the same four entry points that we dlsym out of the vendor library, and the components it hands out accept the
+// same parameters as the qcom avc/hevc encoders. Instead of encoding anything they wait for a configurable amount of time
+// and then return synthetic Annex-B output: stream headers flagged as codec config first, then one frame per input buffer
+// with IDR frames flagged as sync frames, split into slices when slice delivery mode is on.
+//
+// Selected at startup with the environment:
+//
+//     VOXL_OMX_CORE=mock              use this core instead of the vendor library
+//     VOXL_OMX_MOCK_DELAY_US=<us>     time each frame spends "in the encoder", defaults to 5000
+// -----------------------------------------------------------------------------------------------------------------------------
+OMX_ERRORTYPE MockOMX_Init(void);
+OMX_ERRORTYPE MockOMX_Deinit(void);
+OMX_ERRORTYPE MockOMX_GetHandle(OMX_OUT OMX_HANDLETYPE*   handle,
+                                OMX_IN  OMX_STRING        componentName,
+                                OMX_IN  OMX_PTR           appData,
+                                OMX_IN  OMX_CALLBACKTYPE* callBacks);
+OMX_ERRORTYPE MockOMX_FreeHandle(OMX_IN OMX_HANDLETYPE hComp);
+
+#endif // VOXL_CAMERA_SERVER_OMX_MOCK_CORE
@@ -34,12 +34,14 @@
 #define VOXL_CAMERA_SERVER_VIDEO_ENCODER
 
 #include <list>
+#include <atomic>
 #include <OMX_Core.h>
 #include <OMX_IVCommon.h>
 #include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <buffer_manager.h>
+#include "recorder.h"
 
 // -----------------------------------------------------------------------------------------------------------------------------
 // Video encoder config data
@@ -55,8 +57,22 @@ typedef struct VideoEncoderConfig
     bool     isH265;                ///< Is it H265 encoding or H264
     BufferGroup *inputBuffers;      ///< Input buffers coming from hal3
     int      outputPipe;            ///< Pre-configured MPA output pipe
+    bool     isLowLatency;          ///< Tune for latency over compression
+    RecorderConfig* recorder;       ///< In-server recorder settings, NULL for no recorder
 } VideoEncoderConfig;
 
+// -----------------------------------------------------------------------------------------------------------------------------
+// Running encoder statistics, printed periodically in debug mode and once more when the encoder stops. Only the output thread
+// touches these, the skipped frames are counted from other threads and kept separately.
+// -----------------------------------------------------------------------------------------------------------------------------
+typedef struct EncoderStats
+{
+    uint64_t framesEncoded;         ///< Frames that came out of the encoder
+    int64_t  latencySumNs;          ///< Capture to first encoded byte latency, summed over framesEncoded
+    int64_t  latencyMinNs;          ///< Smallest capture to first encoded byte latency
+    int64_t  latencyMaxNs;          ///< Largest capture to first encoded byte latency
+} EncoderStats;
+
 //------------------------------------------------------------------------------------------------------------------------------
 // Main interface class that interacts with the OMX Encoder component and the Camera Manager class. At the crux of it, this
 // class takes the YUV frames from the camera and passes it to the OMX component for encoding. It gets the final encoded frames
@@ -72,13 +88,30 @@ public:
     void Start();
     // This call indicates that no more frames will be sent for encoding
     void Stop();
-    // Client of this encoder class calls this function to pass in the YUV video frame to be encoded
+    // Client of this encoder class calls this function to pass in the YUV video frame to be encoded. If the encoder already
+    // has too many frames waiting the frame is skipped and the buffer goes straight back to the input buffer group.
     void ProcessFrameToEncode(camera_image_metadata_t meta, BufferBlock* buffer);
+    // Ask for the stream headers and a sync frame to be sent out again, used when a new client connects to the pipe
+    void RequestSyncFrame();
+    // Called by the camera for every frame it couldn't capture for this encoder because no input buffer was free
+    void CountSkippedNoBuffer() { m_framesSkippedNoBuffer++; }
+    // Start / stop the in-server recorder
+    void StartRecording();
+    void StopRecording();
+    bool IsRecording();
+    // Commands coming in on the encoded pipe's control pipe
+    void HandleControlCmd(char* cmd);
 
     void* ThreadProcessOMXOutputPort();
 
     // Set the OMX component configuration
     OMX_ERRORTYPE SetConfig(VideoEncoderConfig* pVideoEncoderConfig);
+    // Set the intra refresh and slice parameters used in low latency mode
+    OMX_ERRORTYPE SetLowLatencyConfig(VideoEncoderConfig* pVideoEncoderConfig);
+    // Print the running statistics
+    void PrintStats();
+    // Copy of the running statistics, only consistent once the encoder has been stopped
+    EncoderStats GetStats() { return m_stats; }
     // Set input / output port parameters
     OMX_ERRORTYPE SetPortParams(OMX_U32  portIndex,
                                 OMX_U32  width,
@@ -115,6 +148,19 @@ public:
     uint32_t               m_nextInputBufferIndex;  ///< Next input buffer to use
     OMX_BUFFERHEADERTYPE** m_ppOutputBuffers;       ///< Output buffers
     uint32_t               m_nextOutputBufferIndex; ///< Next input buffer to use
+    uint8_t*               m_pCodecConfig = NULL;   ///< Cached stream headers (SPS/PPS, +VPS for h265)
+    uint32_t               m_codecConfigSize = 0;   ///< Size of the cached stream headers
+    std::atomic_bool       m_needCodecConfig {false}; ///< Resend the stream headers before the next sync frame
+    bool                   m_sliceDelivery = false; ///< Output buffers hold single slices instead of whole frames
+    bool                   m_frameStarted = false;  ///< Part of the current frame has already been sent (slice delivery)
+    uint32_t               m_maxInputInFlight;      ///< Most input frames the encoder may hold at once
+    std::atomic_int        m_inputInFlight {0};     ///< Input frames currently held by the encoder
+    Recorder*              m_pRecorder = NULL;      ///< In-server recorder, fed from the output thread
+
+private:
+    EncoderStats           m_stats = {0, 0, INT64_MAX, 0}; ///< Running statistics, output thread only
+    std::atomic<uint64_t>  m_framesSkippedBusy {0}; ///< Frames recycled because too many were already waiting in the encoder
+    std::atomic<uint64_t>  m_framesSkippedNoBuffer {0}; ///< Frames never captured because no input buffer was free
 };
 
 #endif // VOXL_CAMERA_SERVER_VIDEO_ENCODER
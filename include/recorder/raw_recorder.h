@@ -0,0 +1,97 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef VOXL_CAMERA_SERVER_RAW_RECORDER
+#define VOXL_CAMERA_SERVER_RAW_RECORDER
+
+#include <list>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include <modal_pipe.h>
+
+#include "common_defs.h"
+#include "voxl_camera_server.h"
+
+//------------------------------------------------------------------------------------------------------------------------------
+// Records uncompressed camera frames with their metadata to the indexed slot format described in voxl_camera_server.h. The
+// camera thread copies each frame into one of a fixed number of slot buffers and goes on, a writer thread puts the slots on
+// disk. If the disk falls behind so far that no slot buffer is free the frame is dropped and counted rather than holding up
+// the camera.
+//------------------------------------------------------------------------------------------------------------------------------
+class RawRecorder
+{
+public:
+    RawRecorder(const char* name, const char* dir);
+    ~RawRecorder();
+
+    void Start();
+    // Stop recording, this waits for everything queued so far to be written and finishes the file
+    void Stop();
+    bool IsRecording() { return m_recording; }
+
+    // Called by the camera thread for every frame while recording, data2 is the right image of a stereo pair
+    void AddFrame(camera_image_metadata_t meta, const uint8_t* data, const uint8_t* data2);
+
+    void* ThreadWriter();
+
+private:
+    int  OpenFile();
+    void CloseFile();
+    int  AllocateSlots(uint32_t frameBytes);
+    void FreeSlots();
+
+    char                       m_name[MAX_NAME_LENGTH]; ///< Camera name, used in file names
+    char                       m_dir[MAX_DIR_LENGTH];   ///< Directory to record to
+    volatile bool              m_recording = false;     ///< Accepting frames, only changed with m_mutex held
+    volatile bool              m_stop      = false;     ///< Writer thread terminate indicator
+    bool                       m_threadRunning = false; ///< Writer thread has been started
+
+    pthread_t                  m_thread;                ///< Writer thread
+    pthread_mutex_t            m_mutex;                 ///< Protects the slot lists and m_recording
+    pthread_cond_t             m_cond;                  ///< Wakes up the writer thread
+    std::list<uint8_t*>        m_queue;                 ///< Filled slots waiting to be written
+    std::list<uint8_t*>        m_freeSlots;             ///< Slots the camera thread can fill
+    uint8_t*                   m_pSlotMem = NULL;       ///< Memory of all slot buffers
+    uint64_t                   m_slotSize = 0;          ///< Bytes per slot, in memory and in the file
+    uint64_t                   m_framesDropped = 0;     ///< Frames that found no free slot
+    bool                       m_filling = false;       ///< The camera thread is copying a frame into a slot it took
+
+    // Writer thread state
+    char                       m_startTime[32];         ///< Wall clock time recording started, used in file names
+    int                        m_fd = -1;               ///< Current file
+    uint64_t                   m_nextOffset = 0;        ///< Where the next slot goes in the file
+    uint64_t                   m_reservedEnd = 0;       ///< End of the space preallocated so far
+    std::vector<camera_raw_index_t> m_index;            ///< Index of the frames written so far
+};
+
+#endif // VOXL_CAMERA_SERVER_RAW_RECORDER
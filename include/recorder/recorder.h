@@ -0,0 +1,144 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef VOXL_CAMERA_SERVER_RECORDER
+#define VOXL_CAMERA_SERVER_RECORDER
+
+#include <list>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "common_defs.h"
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Recorder config data
+// -----------------------------------------------------------------------------------------------------------------------------
+typedef struct RecorderConfig
+{
+    char     name[MAX_NAME_LENGTH];     ///< Base name of the recorded files (the encoded pipe name)
+    char     dir[MAX_DIR_LENGTH];       ///< Directory to record to
+    uint32_t width;                     ///< Encoded width
+    uint32_t height;                    ///< Encoded height
+    bool     isH265;                    ///< H265 or H264 stream
+    int      segmentSec;                ///< Start a new file after this many seconds, 0 to disable
+    int      segmentMB;                 ///< Start a new file after this many megabytes, 0 to disable
+    void   (*requestSync)(void* context); ///< Asks the encoder for a sync frame to start the next file on, can be NULL
+    void*    requestSyncContext;        ///< Passed back to requestSync
+} RecorderConfig;
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// One encoded frame (or the stream headers) waiting for the writer thread
+// -----------------------------------------------------------------------------------------------------------------------------
+typedef struct RecorderFrame
+{
+    std::vector<uint8_t> data;          ///< Annex-B data as it came out of the encoder
+    int64_t  timestamp_ns;              ///< Capture timestamp
+    bool     isCodecConfig;             ///< Stream headers rather than a frame
+    bool     isSyncFrame;               ///< IDR frame
+} RecorderFrame;
+
+//------------------------------------------------------------------------------------------------------------------------------
+// Records an encoded stream to Matroska files from inside the server. The encoder output thread hands over its buffers (one
+// copy, no IPC) and a writer thread does the muxing and file IO. The Segment and Clusters are written with unknown sizes so a
+// file is playable up to the last complete block even if we never get to close it (power loss, crash). Files always start on
+// a sync frame. Once the configured time or size is reached the encoder is asked for one and the file is rotated on it.
+//------------------------------------------------------------------------------------------------------------------------------
+class Recorder
+{
+public:
+    Recorder(RecorderConfig* pRecorderConfig);
+    ~Recorder();
+
+    // Start recording, the first file is started at the next sync frame so the encoder should be asked for one
+    void Start();
+    // Stop recording, this waits for everything queued so far to be written
+    void Stop();
+    bool IsRecording() { return m_recording; }
+
+    // Called by the encoder output thread for every output buffer. With slice delivery a frame arrives in several pieces,
+    // isEndOfFrame marks the last one.
+    void AddBuffer(const uint8_t* data,
+                   uint32_t       size,
+                   int64_t        timestamp_ns,
+                   bool           isCodecConfig,
+                   bool           isSyncFrame,
+                   bool           isEndOfFrame);
+
+    void* ThreadWriter();
+
+private:
+    RecorderFrame* GetFrame();
+    void           QueueFrame(RecorderFrame* pFrame);
+    void           RecycleFrame(RecorderFrame* pFrame);
+
+    bool SegmentFull(int64_t timestamp_ns);
+    int  OpenFile(int64_t timestamp_ns);
+    void CloseFile();
+    void WriteHeaders();
+    void WriteFrame(RecorderFrame* pFrame);
+    void Append(const void* data, uint32_t size);
+    void Flush();
+
+    RecorderConfig             m_config;
+    volatile bool              m_recording = false;     ///< Accepting frames
+    volatile bool              m_stop      = false;     ///< Writer thread terminate indicator
+    bool                       m_threadRunning = false; ///< Writer thread has been started
+
+    pthread_t                  m_thread;                ///< Writer thread
+    pthread_mutex_t            m_mutex;                 ///< Protects the queues and the cached headers
+    pthread_cond_t             m_cond;                  ///< Wakes up the writer thread
+    std::list<RecorderFrame*>  m_queue;                 ///< Frames waiting to be written
+    std::list<RecorderFrame*>  m_freeFrames;            ///< Written frames kept around to reuse their memory
+    uint64_t                   m_queuedBytes = 0;       ///< Bytes waiting in m_queue
+
+    // Encoder output thread state
+    std::vector<uint8_t>       m_cachedConfig;          ///< Latest stream headers from the encoder
+    bool                       m_needConfig = false;    ///< Queue the headers before the next frame
+    bool                       m_waitForSync = true;    ///< Drop frames until the next sync frame
+    RecorderFrame*             m_pCurrent = NULL;       ///< Frame being assembled from slices
+
+    // Writer thread state
+    std::vector<uint8_t>       m_codecConfig;           ///< Stream headers for the file being written
+    std::vector<uint32_t>      m_nals;                  ///< Scratch list of NAL offset/size pairs
+    char                       m_startTime[32];         ///< Wall clock time recording started, used in file names
+    int                        m_segment = 0;           ///< Number of the current file
+    int                        m_fd = -1;               ///< Current file
+    uint64_t                   m_fileBytes = 0;         ///< Bytes written to the current file
+    int64_t                    m_fileStartNs = 0;       ///< Timestamp of the first frame in the current file
+    int64_t                    m_clusterMs = -1;        ///< Timestamp of the current cluster relative to m_fileStartNs
+    bool                       m_syncRequested = false; ///< Asked the encoder for the sync frame to rotate on
+    uint8_t*                   m_pWriteBuf = NULL;      ///< Aligned staging buffer for file writes
+    uint32_t                   m_writeBufUsed = 0;      ///< Bytes used in m_pWriteBuf
+};
+
+#endif // VOXL_CAMERA_SERVER_RECORDER
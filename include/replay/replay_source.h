@@ -0,0 +1,82 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#ifndef VOXL_CAMERA_SERVER_REPLAY_SOURCE
+#define VOXL_CAMERA_SERVER_REPLAY_SOURCE
+
+#include <vector>
+#include <stdint.h>
+#include <modal_pipe.h>
+
+//------------------------------------------------------------------------------------------------------------------------------
+// Frames from a raw recording (see camera_raw_header_t) in place of the camera. The file is mmap'd, the kernel is asked to read
+// ahead of the frame being handed out and to drop what's behind it, so long recordings don't end up resident. The mapping is
+// private and writable so the frames can be processed in place without touching the file.
+//
+// Frames are paced by their recorded timestamps divided by the speed, a speed of 0 hands them out as fast as they are taken.
+//------------------------------------------------------------------------------------------------------------------------------
+class ReplaySource
+{
+public:
+    // Throws -EINVAL if the file can't be opened or isn't a raw recording
+    ReplaySource(const char* path, float speed);
+    ~ReplaySource();
+
+    int  NumFrames() { return m_slots.size(); }
+    bool IsStereo();
+
+    // Metadata as recorded, for stereo recordings size_bytes covers both images
+    const camera_image_metadata_t* GetMeta(int frame);
+    // Image 0 is the mono or left image, 1 the right image of a stereo recording
+    uint8_t* GetImage(int frame, int image);
+
+    // Sleeps until the frame is due, returns early with false if *pStop gets set in the meantime
+    bool WaitForFrame(int frame, const bool* pStop);
+
+    int64_t  MaxLateNs() { return m_maxLateNs; }
+
+private:
+    void Prefetch(int frame);
+
+    char                  m_path[256];         ///< File being replayed, for log messages
+    int                   m_fd      = -1;      ///< File descriptor of the recording
+    uint8_t*              m_pMap    = NULL;    ///< The whole file
+    size_t                m_mapSize = 0;       ///< Bytes mapped
+    uint64_t              m_slotSize;          ///< Bytes per frame slot
+    std::vector<uint64_t> m_slots;             ///< Offset of every frame's slot, in recorded order
+    float                 m_speed;             ///< Playback speed, 0 for as fast as possible
+    int64_t               m_startNs   = -1;    ///< Monotonic time the first frame was handed out
+    int64_t               m_maxLateNs = 0;     ///< Furthest behind schedule a frame was handed out
+    int                   m_prefetched = 0;    ///< Frames up to here have been asked for already
+};
+
+#endif // VOXL_CAMERA_SERVER_REPLAY_SOURCE
@@ -0,0 +1,109 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+/**
+ * @file voxl_camera_codec.h
+ *
+ * Lossless compression of RAW8 (or luma) images, as sent on the <name>_compressed pipes of voxl-camera-server. The
+ * decoder is built into libvoxl_camera_codec together with the encoder and installed to /usr/lib, this header to
+ * /usr/include.
+ *
+ * Every pixel is predicted from its neighbours as left + up - up_left (0 outside the image) and the residual, zigzag
+ * mapped to 0..255, goes into blocks of 16 pixels that are stored with as many bits as their largest residual needs.
+ * Each row of the stream is one 4 bit width (0 to 8) per block, two to a byte with the first block in the low nibble,
+ * followed by every block's bit planes: width little endian uint16_t, least significant bit first, bit i for pixel i
+ * of the block. The pixels past the image width in the last block of a row are 0 residuals.
+ *
+ * Both directions are NEON vectorized on ARM, noisy images come out at about 1.5x and clean ones at 2 to 4x.
+ */
+
+#ifndef VOXL_CAMERA_CODEC_H
+#define VOXL_CAMERA_CODEC_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAMERA_CODEC_MAGIC          0x564C4C38
+#define CAMERA_CODEC_VERSION        1
+#define CAMERA_CODEC_BLOCK          16
+
+typedef struct camera_codec_header_t
+{
+    uint32_t magic;                 ///< CAMERA_CODEC_MAGIC
+    uint32_t version;               ///< CAMERA_CODEC_VERSION
+    int32_t  width;                 ///< Image width
+    int32_t  height;                ///< Image height
+    uint32_t size_bytes;            ///< Bytes in the stream, including this header
+} camera_codec_header_t;
+
+/**
+ * Buffer size camera_codec_encode() needs for an image of this size, some slack for the vectorized writes included
+ */
+int camera_codec_max_size(int width, int height);
+
+/**
+ * Compress an image into dst, which has to hold camera_codec_max_size() bytes
+ *
+ * @return     bytes in the stream, or -1 if the size is invalid or dst too small
+ */
+int camera_codec_encode(const uint8_t* src, int stride, int width, int height, uint8_t* dst, int dst_size);
+
+/**
+ * Size of the image in a stream
+ *
+ * @return     0, or -1 if the data doesn't start with a valid header
+ */
+int camera_codec_get_size(const uint8_t* data, int size, int* width, int* height);
+
+/**
+ * Decompress a stream into dst, rows stride bytes apart
+ *
+ * @return     0, or -1 if the stream is invalid or truncated
+ */
+int camera_codec_decode(const uint8_t* data, int size, uint8_t* dst, int stride);
+
+/**
+ * Same as camera_codec_encode() and camera_codec_decode() but always in plain C, the vectorized versions have to give
+ * byte identical streams and images. Meant for tests.
+ */
+int camera_codec_encode_reference(const uint8_t* src, int stride, int width, int height, uint8_t* dst, int dst_size);
+int camera_codec_decode_reference(const uint8_t* data, int size, uint8_t* dst, int stride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VOXL_CAMERA_CODEC_H
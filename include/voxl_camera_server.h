@@ -50,6 +50,312 @@
 
 #define MAX_ALLOWED_CAMERAS 6
 
+/**
+ * Shared memory transport
+ *
+ * Besides the regular image pipe, every camera has a <name>_shm pipe. Instead of the image itself, the server
+ * writes a small camera_shm_desc_t to it for every frame. The image goes into a ring of slots in a memfd owned by the
+ * server, and every client maps that ring read-only. Each frame is copied once no matter how many clients there are.
+ *
+ * To map the ring, open "/proc/<server_pid>/fd/<fd>" from the descriptor with O_RDONLY and mmap ring_size bytes
+ * PROT_READ/MAP_SHARED. The server switches to a new ring if the frame size grows, so remap whenever fd or ring_size
+ * changes.
+ *
+ * Slots are reused as soon as the ring wraps around, and each slot has a sequence number that is odd while the
+ * server is writing it. Before using the data check camera_shm_slot_valid(), and check it again when you're done
+ * with it. If either check fails, the frame was overwritten underneath you and should be dropped.
+ */
+#define CAMERA_SHM_MAGIC            0x5653484D
+#define CAMERA_SHM_VERSION          1
+#define CAMERA_SHM_SLOT_DATA_OFFSET 128
+
+typedef struct camera_shm_header_t
+{
+    uint32_t magic;                 ///< CAMERA_SHM_MAGIC
+    uint32_t version;               ///< CAMERA_SHM_VERSION
+    uint32_t num_slots;             ///< Number of slots in the ring
+    uint32_t slot_stride;           ///< Bytes from the start of one slot to the next
+    uint32_t slot_data_size;        ///< Most image bytes a slot can hold
+    uint32_t first_slot_offset;     ///< Offset of slot 0 from the start of the ring
+} camera_shm_header_t;
+
+typedef struct camera_shm_slot_t
+{
+    uint32_t seq;                   ///< Odd while the server is writing the slot
+    uint32_t reserved;
+    camera_image_metadata_t meta;   ///< Same metadata the regular pipe would send
+    // image data starts CAMERA_SHM_SLOT_DATA_OFFSET bytes into the slot, stereo pairs are left then right
+} camera_shm_slot_t;
+
+typedef struct camera_shm_desc_t
+{
+    uint32_t magic;                 ///< CAMERA_SHM_MAGIC
+    int32_t  server_pid;            ///< Process holding the ring
+    int32_t  fd;                    ///< The ring's fd in the server process
+    uint32_t ring_size;             ///< Bytes to map
+    uint32_t slot;                  ///< Slot holding this frame
+    uint32_t seq;                   ///< Slot sequence number this frame was written with
+    camera_image_metadata_t meta;   ///< Copy of the frame metadata
+} camera_shm_desc_t;
+
+static inline const camera_shm_slot_t* camera_shm_get_slot(const void* ring, const camera_shm_desc_t* desc)
+{
+    const camera_shm_header_t* header = (const camera_shm_header_t*)ring;
+
+    return (const camera_shm_slot_t*)((const uint8_t*)ring + header->first_slot_offset + desc->slot * header->slot_stride);
+}
+
+static inline const uint8_t* camera_shm_get_data(const void* ring, const camera_shm_desc_t* desc)
+{
+    return (const uint8_t*)camera_shm_get_slot(ring, desc) + CAMERA_SHM_SLOT_DATA_OFFSET;
+}
+
+static inline int camera_shm_slot_valid(const void* ring, const camera_shm_desc_t* desc)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&camera_shm_get_slot(ring, desc)->seq, __ATOMIC_ACQUIRE) == desc->seq;
+}
+
+/**
+ * Image pyramid
+ *
+ * Cameras with pyramid_levels set in the config file publish <name>_pyramid. Every frame on it is one
+ * camera_pyramid_metadata_t followed by meta.size_bytes of image data holding every level of the RAW8 (or luma) image,
+ * each level half the size of the one above it as made by OpenCV's pyrDown. Level 0 is the full resolution frame. For a
+ * stereo pair all levels of the left image come first and then all levels of the right one.
+ */
+#define CAMERA_PYRAMID_MAGIC        0x56505952
+#define CAMERA_PYRAMID_MAX_LEVELS   4
+
+typedef struct camera_pyramid_level_t
+{
+    int16_t  width;
+    int16_t  height;
+    int32_t  stride;
+    uint32_t offset;                ///< Bytes from the end of the camera_pyramid_metadata_t to the level's first pixel
+} camera_pyramid_level_t;
+
+typedef struct camera_pyramid_metadata_t
+{
+    uint32_t magic;                 ///< CAMERA_PYRAMID_MAGIC
+    int32_t  num_levels;            ///< Levels per image, including level 0
+    int32_t  num_images;            ///< 1, or 2 for a stereo pair
+    int32_t  reserved;
+    camera_image_metadata_t meta;   ///< Metadata of the full resolution frame, size_bytes covers all levels of all images
+    camera_pyramid_level_t  levels[2 * CAMERA_PYRAMID_MAX_LEVELS]; ///< num_levels entries per image, left image first
+} camera_pyramid_metadata_t;
+
+/**
+ * Raw frame recordings
+ *
+ * The "start_raw_record" control command records the frames of a camera's main pipe to
+ * <raw_record_dir>/<name>_<date>_<time>_<n>.raw until "stop_raw_record". The files are made to be mmap'd:
+ *
+ *   offset 0              camera_raw_header_t, padded to CAMERA_RAW_ALIGN
+ *   first_slot_offset     one slot of slot_size bytes per frame, each starting with the frame's camera_image_metadata_t
+ *                         and with the image (left then right for stereo) CAMERA_RAW_DATA_OFFSET bytes into the slot
+ *   index_offset          num_frames camera_raw_index_t
+ *
+ * Every slot and the index start on a CAMERA_RAW_ALIGN boundary. The index and the header counts are written when the
+ * recording stops, if index_offset is 0 the recording was cut short and the slots can still be walked with slot_size
+ * until one doesn't start with CAMERA_MAGIC_NUMBER.
+ */
+#define CAMERA_RAW_MAGIC            0x56524157
+#define CAMERA_RAW_VERSION          1
+#define CAMERA_RAW_ALIGN            4096
+#define CAMERA_RAW_DATA_OFFSET      64
+
+typedef struct camera_raw_header_t
+{
+    uint32_t magic;                 ///< CAMERA_RAW_MAGIC
+    uint32_t version;               ///< CAMERA_RAW_VERSION
+    char     name[64];              ///< Camera (pipe) name
+    uint64_t slot_size;             ///< Bytes per frame slot, a multiple of CAMERA_RAW_ALIGN
+    uint64_t first_slot_offset;     ///< Offset of the first slot
+    uint64_t num_frames;            ///< Frames in the file, 0 until the recording is stopped
+    uint64_t index_offset;          ///< Offset of the index, 0 until the recording is stopped
+    uint64_t frames_dropped;        ///< Frames the disk couldn't keep up with, 0 until the recording is stopped
+} camera_raw_header_t;
+
+typedef struct camera_raw_index_t
+{
+    int64_t  timestamp_ns;          ///< Frame timestamp
+    uint64_t offset;                ///< Offset of the frame's slot
+    int32_t  frame_id;              ///< Frame id from the metadata
+    uint32_t size_bytes;            ///< Image bytes in the slot
+} camera_raw_index_t;
+
+/**
+ * Stereo disparity
+ *
+ * Stereo cameras with disparity_max set in the config file publish <name>_disparity, matched on the rectified pair if the
+ * camera has a rect_intrinsics_file and on the images as they come otherwise. Frames on it are a camera_image_metadata_t
+ * with format IMAGE_FORMAT_RAW16 and the timing of the stereo frame, followed by width * height uint16_t disparities of the
+ * left image in 1/(1 << CAMERA_DISPARITY_SUBPIXEL_BITS) pixel and then width * height uint8_t validity flags (255 valid, 0
+ * no reliable match). meta.size_bytes covers both.
+ */
+#define CAMERA_DISPARITY_SUBPIXEL_BITS  4
+
+/**
+ * Corner features
+ *
+ * Cameras with features_threshold set in the config file publish <name>_features: the FAST-9 corners of every frame, after
+ * 3x3 non-max suppression and keeping only the features_per_cell strongest ones in each features_cell sized cell of the
+ * image. Every frame on it is one camera_features_metadata_t followed by num_features camera_feature_t. The corners of
+ * pyramid level l are in that level's pixels, roughly 1 << l full resolution pixels each.
+ */
+#define CAMERA_FEATURES_MAGIC       0x56464541
+
+typedef struct camera_feature_t
+{
+    int16_t  x;                     ///< Column in the pixels of its pyramid level
+    int16_t  y;                     ///< Row in the pixels of its pyramid level
+    uint16_t score;                 ///< FAST score, higher is stronger
+    uint8_t  level;                 ///< Pyramid level the corner was found on, 0 is full resolution
+    uint8_t  image;                 ///< 0 for the left (or only) image, 1 for the right one of a stereo pair
+} camera_feature_t;
+
+typedef struct camera_features_metadata_t
+{
+    uint32_t magic;                 ///< CAMERA_FEATURES_MAGIC
+    int32_t  num_features;          ///< camera_feature_t following the header
+    int32_t  num_levels;            ///< Pyramid levels that were searched
+    int32_t  threshold;             ///< FAST threshold
+    camera_image_metadata_t meta;   ///< Metadata of the frame the corners are from, size_bytes covers the features
+} camera_features_metadata_t;
+
+/**
+ * Frame quality
+ *
+ * Every camera publishes <name>_quality, one camera_quality_metadata_t per frame while it has clients. The scores come from
+ * every 4th row of the RAW8 (or luma) image and are computed in the pass the server makes over the frame anyway, so a client
+ * can skip blurred or badly exposed frames before it reads or processes the image.
+ */
+#define CAMERA_QUALITY_MAGIC        0x56515541
+
+typedef struct camera_quality_image_t
+{
+    float    sharpness;             ///< Mean of dx^2 + dy^2 between neighbouring pixels, drops with motion blur and defocus
+    float    saturated;             ///< Fraction of pixels at 250 or above
+    float    mean;                  ///< Mean pixel value, 0 to 255
+} camera_quality_image_t;
+
+typedef struct camera_quality_metadata_t
+{
+    uint32_t magic;                 ///< CAMERA_QUALITY_MAGIC
+    int32_t  num_images;            ///< 2 for stereo pairs
+    camera_quality_image_t images[2];   ///< Left (or only) and right image
+    camera_image_metadata_t meta;   ///< Metadata of the frame the scores are for, size_bytes is 0
+} camera_quality_metadata_t;
+
+/**
+ * Image statistics
+ *
+ * Every camera publishes <name>_stats, one camera_stats_t per frame while it has clients: the 256 bin histogram of the RAW8
+ * (or luma) image, its mean sample value and the state of the server's auto exposure after it has seen the frame. Clients
+ * with their own exposure aware logic can use these instead of going over the image again.
+ */
+#define CAMERA_STATS_MAGIC          0x56535441
+
+typedef struct camera_stats_t
+{
+    uint32_t magic;                 ///< CAMERA_STATS_MAGIC
+    int32_t  num_images;            ///< 2 for stereo pairs
+    uint32_t histogram[2][256];     ///< Pixel counts of the left (or only) and right image
+    float    msv[2];                ///< Mean sample value of each image, 0 to 255 like ae_desired_msv
+    int32_t  ae_mode;               ///< 0 off, 1 ISP, 2 ModalAI histogram, 3 ModalAI MSV
+    float    ae_desired_msv;        ///< Target of the ModalAI auto exposure, 0 if it isn't running
+    int64_t  ae_exposure_ns;        ///< Exposure the auto exposure has asked for, meta has the one this frame used
+    int32_t  ae_gain;               ///< Gain the auto exposure has asked for
+    camera_image_metadata_t meta;   ///< Metadata of the frame the statistics are for, size_bytes is 0
+} camera_stats_t;
+
+/**
+ * RGB images
+ *
+ * NV12 cameras with rgb_pipes in the config file publish <name>_rgb, <name>_bgr and/or <name>_rgb_planar, the frames
+ * converted with the rgb_matrix (BT.601 or BT.709, limited range) colour matrix. libmodal_pipe only has a format code for
+ * interleaved RGB so all three use IMAGE_FORMAT_RGB (IMAGE_FORMAT_STEREO_RGB for pairs): bgr has the channels the other
+ * way around and rgb_planar is the full R plane, then G, then B, with meta.stride width instead of width * 3.
+ */
+
+/**
+ * Demosaiced images
+ *
+ * Colour sensors streamed as RAW (preview_format raw8/raw10) with a bayer_pattern in the config file publish <name>_color,
+ * the Bayer frames demosaiced in software with bilinear or edge directed (debayer_method) interpolation. The frames are
+ * IMAGE_FORMAT_RGB or, with debayer_output nv12, IMAGE_FORMAT_NV12 (the STEREO_ variants for pairs).
+ */
+
+/**
+ * Network input tensors
+ *
+ * Cameras with tensor_width and tensor_height set in the config file publish <name>_tensor: every frame resized to the
+ * tensor size (letterboxed or center cropped), converted to RGB, BGR or grey, normalized as (pixel - mean) / std and, for
+ * the 8 bit types, quantized as round(normalized / scale) + zero_point. Every frame on it is one camera_tensor_metadata_t
+ * followed by the tensor, a batch of two for stereo pairs. The placement fields map image coordinates to tensor ones so
+ * that detections can be mapped back: tensor x = image x * scale_x + offset_x.
+ */
+#define CAMERA_TENSOR_MAGIC         0x5654454E
+
+#define CAMERA_TENSOR_FLOAT32       0
+#define CAMERA_TENSOR_UINT8         1
+#define CAMERA_TENSOR_INT8          2
+
+#define CAMERA_TENSOR_NCHW          0
+#define CAMERA_TENSOR_NHWC          1
+
+#define CAMERA_TENSOR_RGB           0
+#define CAMERA_TENSOR_BGR           1
+#define CAMERA_TENSOR_GREY          2
+
+typedef struct camera_tensor_metadata_t
+{
+    uint32_t magic;                 ///< CAMERA_TENSOR_MAGIC
+    int32_t  type;                  ///< CAMERA_TENSOR_FLOAT32, CAMERA_TENSOR_UINT8 or CAMERA_TENSOR_INT8
+    int32_t  layout;                ///< CAMERA_TENSOR_NCHW or CAMERA_TENSOR_NHWC
+    int32_t  channel_order;         ///< CAMERA_TENSOR_RGB, CAMERA_TENSOR_BGR or CAMERA_TENSOR_GREY
+    int32_t  n;                     ///< Batch size, 2 for stereo pairs
+    int32_t  c;                     ///< Channels, 1 for grey
+    int32_t  h;                     ///< Tensor height
+    int32_t  w;                     ///< Tensor width
+    float    quant_scale;           ///< Quantization step of 8 bit tensors
+    int32_t  quant_zero_point;      ///< Quantized value of 0
+    float    scale_x;               ///< Tensor pixels per image pixel across
+    float    scale_y;               ///< Tensor pixels per image pixel down
+    float    offset_x;              ///< Tensor x of image x 0 (negative when cropped)
+    float    offset_y;              ///< Tensor y of image y 0
+    camera_image_metadata_t meta;   ///< Metadata of the frame the tensor is from, size_bytes covers the tensor
+} camera_tensor_metadata_t;
+
+/**
+ * Compressed images
+ *
+ * Cameras with en_compressed set in the config file publish <name>_compressed: the RAW8 (or luma) image of every frame
+ * losslessly compressed for loggers and links that can't keep up with the full frames. Every frame on it is one
+ * camera_compressed_metadata_t followed by one stream per image (left then right for stereo pairs), each image_bytes long.
+ * The streams are decoded with camera_codec_decode() from libvoxl_camera_codec, see voxl_camera_codec.h.
+ */
+#define CAMERA_COMPRESSED_MAGIC     0x56434D50
+
+typedef struct camera_compressed_metadata_t
+{
+    uint32_t magic;                 ///< CAMERA_COMPRESSED_MAGIC
+    int32_t  num_images;            ///< 2 for stereo pairs
+    uint32_t image_bytes[2];        ///< Stream size of the left (or only) and right image
+    camera_image_metadata_t meta;   ///< Metadata of the decoded frame (RAW8 or STEREO_RAW8), size_bytes covers the streams
+} camera_compressed_metadata_t;
+
+/**
+ * JPEG images
+ *
+ * Cameras with mjpeg_fps set in the config file publish <name>_mjpeg: preview frames JPEG encoded in software at that rate
+ * and mjpeg_quality, in colour for NV12 cameras and grey otherwise. The frames are IMAGE_FORMAT_JPG with size_bytes covering
+ * the JPEG file, stereo pairs are one JPEG twice the height with the left image on top. The snapshot_preview control command
+ * writes the next preview frame to a JPEG file the same way, to the file name given after it or to
+ * /data/snapshots/<name>-preview-<n>.jpg, and works without the snapshot stream or the <name>_mjpeg pipe.
+ */
+
 void EStopCameraServer();
 
 #endif
@@ -0,0 +1,380 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "voxl_camera_codec.h"
+
+#define ROW_WIDTHS_BYTES(blocks)    (((blocks) + 1) / 2)
+#define ROW_MAX_BYTES(blocks)       (ROW_WIDTHS_BYTES(blocks) + (blocks) * 2 * 8)
+
+static inline int NumBlocks(int width)
+{
+    return (width + CAMERA_CODEC_BLOCK - 1) / CAMERA_CODEC_BLOCK;
+}
+
+static inline uint8_t Zigzag(uint8_t r)
+{
+    return (uint8_t)((r << 1) ^ ((int8_t)r >> 7));
+}
+
+static inline uint8_t Unzigzag(uint8_t z)
+{
+    return (uint8_t)((z >> 1) ^ -(z & 1));
+}
+
+static inline int Bits(uint8_t v)
+{
+    return v ? 32 - __builtin_clz(v) : 0;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Bit b of each of the 8 bytes in v as one byte, byte i going to bit i. The multiply moves bit 8i to bit 56 + i without any of
+// the partial products overlapping.
+// -----------------------------------------------------------------------------------------------------------------------------
+static inline uint8_t GatherPlane(uint64_t v, int b)
+{
+    return (uint8_t)((((v >> b) & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56);
+}
+
+// Inverse of GatherPlane() for bit 0: bit i of the index in byte i
+struct SpreadTable
+{
+    uint64_t bytes[256];
+
+    SpreadTable()
+    {
+        for(int m = 0; m < 256; m++){
+            bytes[m] = 0;
+            for(int i = 0; i < 8; i++){
+                bytes[m] |= (uint64_t)((m >> i) & 1) << (8 * i);
+            }
+        }
+    }
+};
+
+static const SpreadTable spread;
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// One (possibly partial) block in plain C: the residuals of count pixels, the rest of the block 0
+// -----------------------------------------------------------------------------------------------------------------------------
+static uint8_t* EncodeBlock(const uint8_t* cur, const uint8_t* up, int x, int count, uint8_t* widths, int block, uint8_t* out)
+{
+    uint8_t z[CAMERA_CODEC_BLOCK] = {0};
+    uint8_t max = 0;
+
+    for(int i = 0; i < count; i++){
+        const int     c    = x + i;
+        const uint8_t l    = c > 0 ? cur[c - 1] : 0;
+        const uint8_t u    = up != NULL ? up[c] : 0;
+        const uint8_t ul   = (up != NULL && c > 0) ? up[c - 1] : 0;
+
+        z[i] = Zigzag((uint8_t)(cur[c] - (uint8_t)(l + u - ul)));
+        max |= z[i];
+    }
+
+    // The or of all residuals needs as many bits as the largest one
+    const int bits = Bits(max);
+    widths[block >> 1] |= bits << ((block & 1) * 4);
+
+    uint64_t lo, hi;
+    memcpy(&lo, z, 8);
+    memcpy(&hi, z + 8, 8);
+
+    for(int b = 0; b < bits; b++){
+        *out++ = GatherPlane(lo, b);
+        *out++ = GatherPlane(hi, b);
+    }
+
+    return out;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Whole rows, vectorized unless simd is false. The plain C path is the reference the NEON one has to match byte for byte.
+// -----------------------------------------------------------------------------------------------------------------------------
+static uint8_t* EncodeRow(const uint8_t* cur, const uint8_t* up, int width, uint8_t* out, bool simd)
+{
+    const int blocks = NumBlocks(width);
+    uint8_t*  widths = out;
+    int       x      = 0;
+    int       block  = 0;
+
+    memset(widths, 0, ROW_WIDTHS_BYTES(blocks));
+    out += ROW_WIDTHS_BYTES(blocks);
+
+#ifdef __ARM_NEON
+    static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t w     = vld1q_u8(weights);
+    uint8x16_t       prevC = vdupq_n_u8(0);
+    uint8x16_t       prevU = vdupq_n_u8(0);
+
+    for(; simd && x + CAMERA_CODEC_BLOCK <= width; x += CAMERA_CODEC_BLOCK, block++){
+        const uint8x16_t c  = vld1q_u8(cur + x);
+        const uint8x16_t u  = up != NULL ? vld1q_u8(up + x) : vdupq_n_u8(0);
+        const uint8x16_t l  = vextq_u8(prevC, c, 15);
+        const uint8x16_t ul = vextq_u8(prevU, u, 15);
+        const uint8x16_t r  = vsubq_u8(c, vsubq_u8(vaddq_u8(l, u), ul));
+        const uint8x16_t z  = veorq_u8(vshlq_n_u8(r, 1), vreinterpretq_u8_s8(vshrq_n_s8(vreinterpretq_s8_u8(r), 7)));
+
+        prevC = c;
+        prevU = u;
+
+        uint8x8_t max = vpmax_u8(vget_low_u8(z), vget_high_u8(z));
+        max = vpmax_u8(max, max);
+        max = vpmax_u8(max, max);
+        max = vpmax_u8(max, max);
+
+        const int bits = 8 - vget_lane_u8(vclz_u8(max), 0);
+        widths[block >> 1] |= bits << ((block & 1) * 4);
+
+        // Every plane as a 16 bit mask, the pairwise adds collect the weighted bits of each half into one byte. All 8 planes
+        // are stored and the output only moves on by the ones the block needs, max_size has the slack for that.
+        uint8x8_t q[8];
+        for(int b = 0; b < 8; b++){
+            const uint8x16_t p = vandq_u8(vtstq_u8(z, vdupq_n_u8(1 << b)), w);
+            q[b] = vpadd_u8(vget_low_u8(p), vget_high_u8(p));
+        }
+
+        const uint8x8_t planes0123 = vpadd_u8(vpadd_u8(q[0], q[1]), vpadd_u8(q[2], q[3]));
+        const uint8x8_t planes4567 = vpadd_u8(vpadd_u8(q[4], q[5]), vpadd_u8(q[6], q[7]));
+
+        vst1q_u8(out, vcombine_u8(planes0123, planes4567));
+        out += 2 * bits;
+    }
+#endif
+
+    for(; x < width; x += CAMERA_CODEC_BLOCK, block++){
+        const int count = (width - x < CAMERA_CODEC_BLOCK) ? width - x : CAMERA_CODEC_BLOCK;
+
+        out = EncodeBlock(cur, up, x, count, widths, block, out);
+    }
+
+    return out;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// One (possibly partial) block in plain C, the pixels are rebuilt one after the other from their left neighbour
+// -----------------------------------------------------------------------------------------------------------------------------
+static const uint8_t* DecodeBlock(const uint8_t* in, int bits, const uint8_t* up, int x, int count, uint8_t* cur)
+{
+    uint64_t lo = 0, hi = 0;
+
+    for(int b = 0; b < bits; b++){
+        lo |= spread.bytes[*in++] << b;
+        hi |= spread.bytes[*in++] << b;
+    }
+
+    uint8_t z[CAMERA_CODEC_BLOCK];
+    memcpy(z, &lo, 8);
+    memcpy(z + 8, &hi, 8);
+
+    for(int i = 0; i < count; i++){
+        const int     c  = x + i;
+        const uint8_t l  = c > 0 ? cur[c - 1] : 0;
+        const uint8_t u  = up != NULL ? up[c] : 0;
+        const uint8_t ul = (up != NULL && c > 0) ? up[c - 1] : 0;
+
+        cur[c] = (uint8_t)(Unzigzag(z[i]) + l + u - ul);
+    }
+
+    return in;
+}
+
+static const uint8_t* DecodeRow(const uint8_t* in, const uint8_t* end, const uint8_t* up, int width, uint8_t* cur, bool simd)
+{
+    const int      blocks = NumBlocks(width);
+    const uint8_t* widths = in;
+
+    if(end - in < ROW_WIDTHS_BYTES(blocks)) return NULL;
+    in += ROW_WIDTHS_BYTES(blocks);
+
+    // Check the whole row up front so the blocks don't have to
+    int planes = 0;
+    for(int block = 0; block < blocks; block++){
+        const int bits = (widths[block >> 1] >> ((block & 1) * 4)) & 0xF;
+
+        if(bits > 8) return NULL;
+        planes += bits;
+    }
+
+    if(end - in < 2 * planes) return NULL;
+
+    int x     = 0;
+    int block = 0;
+
+#ifdef __ARM_NEON
+    static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t w     = vld1q_u8(weights);
+    const uint8x16_t zero  = vdupq_n_u8(0);
+    const uint8x16_t one   = vdupq_n_u8(1);
+    uint8x16_t       prevC = zero;
+    uint8x16_t       prevU = zero;
+
+    for(; simd && x + CAMERA_CODEC_BLOCK <= width; x += CAMERA_CODEC_BLOCK, block++){
+        const int  bits = (widths[block >> 1] >> ((block & 1) * 4)) & 0xF;
+        uint8x16_t z    = zero;
+
+        for(int b = 0; b < bits; b++, in += 2){
+            const uint8x16_t mask = vcombine_u8(vdup_n_u8(in[0]), vdup_n_u8(in[1]));
+
+            z = vorrq_u8(z, vandq_u8(vtstq_u8(mask, w), vdupq_n_u8(1 << b)));
+        }
+
+        const uint8x16_t r  = veorq_u8(vshrq_n_u8(z, 1),
+                                       vreinterpretq_u8_s8(vnegq_s8(vreinterpretq_s8_u8(vandq_u8(z, one)))));
+        const uint8x16_t u  = up != NULL ? vld1q_u8(up + x) : zero;
+        const uint8x16_t ul = vextq_u8(prevU, u, 15);
+
+        // Every pixel is its left neighbour plus d, so the row is the running sum of d from the last pixel of the block before
+        uint8x16_t d = vsubq_u8(vaddq_u8(r, u), ul);
+        d = vaddq_u8(d, vextq_u8(zero, d, 15));
+        d = vaddq_u8(d, vextq_u8(zero, d, 14));
+        d = vaddq_u8(d, vextq_u8(zero, d, 12));
+        d = vaddq_u8(d, vextq_u8(zero, d, 8));
+
+        const uint8x16_t c = vaddq_u8(d, vdupq_lane_u8(vget_high_u8(prevC), 7));
+
+        vst1q_u8(cur + x, c);
+        prevC = c;
+        prevU = u;
+    }
+#endif
+
+    for(; x < width; x += CAMERA_CODEC_BLOCK, block++){
+        const int bits  = (widths[block >> 1] >> ((block & 1) * 4)) & 0xF;
+        const int count = (width - x < CAMERA_CODEC_BLOCK) ? width - x : CAMERA_CODEC_BLOCK;
+
+        in = DecodeBlock(in, bits, up, x, count, cur);
+    }
+
+    return in;
+}
+
+int camera_codec_max_size(int width, int height)
+{
+    if(width <= 0 || height <= 0) return -1;
+
+    return sizeof(camera_codec_header_t) + height * ROW_MAX_BYTES(NumBlocks(width)) + CAMERA_CODEC_BLOCK;
+}
+
+static int Encode(const uint8_t* src, int stride, int width, int height, uint8_t* dst, int dst_size, bool simd)
+{
+    if(width <= 0 || height <= 0 || stride < width || dst_size < camera_codec_max_size(width, height)) return -1;
+
+    uint8_t* out = dst + sizeof(camera_codec_header_t);
+
+    for(int y = 0; y < height; y++){
+        out = EncodeRow(src + y * stride, y > 0 ? src + (y - 1) * stride : NULL, width, out, simd);
+    }
+
+    camera_codec_header_t header;
+    header.magic      = CAMERA_CODEC_MAGIC;
+    header.version    = CAMERA_CODEC_VERSION;
+    header.width      = width;
+    header.height     = height;
+    header.size_bytes = out - dst;
+    memcpy(dst, &header, sizeof(header));
+
+    return header.size_bytes;
+}
+
+int camera_codec_encode(const uint8_t* src, int stride, int width, int height, uint8_t* dst, int dst_size)
+{
+    return Encode(src, stride, width, height, dst, dst_size, true);
+}
+
+int camera_codec_encode_reference(const uint8_t* src, int stride, int width, int height, uint8_t* dst, int dst_size)
+{
+    return Encode(src, stride, width, height, dst, dst_size, false);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Copy of the stream header (the stream may be at any alignment), checked against the bytes there are
+// -----------------------------------------------------------------------------------------------------------------------------
+static int ReadHeader(const uint8_t* data, int size, camera_codec_header_t* header)
+{
+    if(data == NULL || size < (int)sizeof(camera_codec_header_t)) return -1;
+    memcpy(header, data, sizeof(camera_codec_header_t));
+
+    if(header->magic != CAMERA_CODEC_MAGIC || header->version != CAMERA_CODEC_VERSION ||
+       header->width <= 0 || header->height <= 0 ||
+       header->size_bytes < sizeof(camera_codec_header_t) || header->size_bytes > (uint32_t)size){
+        return -1;
+    }
+
+    return 0;
+}
+
+int camera_codec_get_size(const uint8_t* data, int size, int* width, int* height)
+{
+    camera_codec_header_t header;
+
+    if(ReadHeader(data, size, &header)) return -1;
+
+    *width  = header.width;
+    *height = header.height;
+
+    return 0;
+}
+
+static int Decode(const uint8_t* data, int size, uint8_t* dst, int stride, bool simd)
+{
+    camera_codec_header_t header;
+
+    if(ReadHeader(data, size, &header) || stride < header.width) return -1;
+
+    const uint8_t* in  = data + sizeof(camera_codec_header_t);
+    const uint8_t* end = data + header.size_bytes;
+
+    for(int y = 0; y < header.height; y++){
+        in = DecodeRow(in, end, y > 0 ? dst + (y - 1) * stride : NULL, header.width, dst + y * stride, simd);
+
+        if(in == NULL) return -1;
+    }
+
+    return 0;
+}
+
+int camera_codec_decode(const uint8_t* data, int size, uint8_t* dst, int stride)
+{
+    return Decode(data, size, dst, stride, true);
+}
+
+int camera_codec_decode_reference(const uint8_t* data, int size, uint8_t* dst, int stride)
+{
+    return Decode(data, size, dst, stride, false);
+}
@@ -0,0 +1,192 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <modal_journal.h>
+
+#include "shm_ring.h"
+
+#ifndef MFD_CLOEXEC
+    #define MFD_CLOEXEC       0x0001U
+    #define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+#define SHM_PAGE_SIZE 4096
+
+static inline uint32_t RoundUpToPage(uint32_t size)
+{
+    return (size + SHM_PAGE_SIZE - 1) & ~(SHM_PAGE_SIZE - 1);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Constructor, the ring itself is only allocated once the first frame shows up
+// -----------------------------------------------------------------------------------------------------------------------------
+ShmRing::ShmRing(const char* name)
+{
+    snprintf(m_name, sizeof(m_name), "%s_shm", name);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Destructor
+// -----------------------------------------------------------------------------------------------------------------------------
+ShmRing::~ShmRing()
+{
+    Free();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Creates a new ring big enough for slotDataSize bytes per frame. Clients that still have the old one mapped keep it until
+// they see a descriptor with the new fd.
+// -----------------------------------------------------------------------------------------------------------------------------
+int ShmRing::Allocate(uint32_t slotDataSize)
+{
+    Free();
+
+    // memfd_create isn't wrapped by older glibc versions
+    if ((m_fd = syscall(SYS_memfd_create, m_name, MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+    {
+        M_ERROR("Failed to create shared memory ring %s: %s\n", m_name, strerror(errno));
+        return -1;
+    }
+
+    uint32_t headerSize = RoundUpToPage(sizeof(camera_shm_header_t));
+    uint32_t slotStride = RoundUpToPage(CAMERA_SHM_SLOT_DATA_OFFSET + slotDataSize);
+
+    m_ringSize = headerSize + SHM_RING_NUM_SLOTS * slotStride;
+
+    if (ftruncate(m_fd, m_ringSize))
+    {
+        M_ERROR("Failed to size shared memory ring %s: %s\n", m_name, strerror(errno));
+        Free();
+        return -1;
+    }
+
+    // Clients map the whole thing, make sure it can never shrink underneath them
+    #ifdef F_ADD_SEALS
+        fcntl(m_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+    #endif
+
+    m_pRing = (uint8_t*)mmap(NULL, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+
+    if (m_pRing == MAP_FAILED)
+    {
+        M_ERROR("Failed to map shared memory ring %s: %s\n", m_name, strerror(errno));
+        m_pRing = NULL;
+        Free();
+        return -1;
+    }
+
+    m_pHeader = (camera_shm_header_t*)m_pRing;
+    m_pHeader->magic             = CAMERA_SHM_MAGIC;
+    m_pHeader->version           = CAMERA_SHM_VERSION;
+    m_pHeader->num_slots         = SHM_RING_NUM_SLOTS;
+    m_pHeader->slot_stride       = slotStride;
+    m_pHeader->slot_data_size    = slotStride - CAMERA_SHM_SLOT_DATA_OFFSET;
+    m_pHeader->first_slot_offset = headerSize;
+
+    m_nextSlot = 0;
+
+    M_DEBUG("Created shared memory ring %s: %d slots of %d bytes\n", m_name, SHM_RING_NUM_SLOTS, slotStride);
+
+    return 0;
+}
+
+void ShmRing::Free()
+{
+    if (m_pRing != NULL)
+    {
+        munmap(m_pRing, m_ringSize);
+        m_pRing   = NULL;
+        m_pHeader = NULL;
+    }
+
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Writes the frame into the next slot, the sequence number is odd while we are at it so that readers can tell
+// -----------------------------------------------------------------------------------------------------------------------------
+int ShmRing::Publish(int channel, camera_image_metadata_t meta, const void* data, const void* data2)
+{
+    uint32_t size = meta.size_bytes;
+
+    if (m_pRing == NULL || size > m_pHeader->slot_data_size)
+    {
+        if (Allocate(size)) return -1;
+    }
+
+    uint32_t           slot  = m_nextSlot;
+    camera_shm_slot_t* pSlot = GetSlot(slot);
+    uint32_t           seq   = pSlot->seq + 1;
+
+    m_nextSlot = (m_nextSlot + 1) % SHM_RING_NUM_SLOTS;
+
+    __atomic_store_n(&pSlot->seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    pSlot->meta = meta;
+
+    uint8_t* dst = (uint8_t*)pSlot + CAMERA_SHM_SLOT_DATA_OFFSET;
+
+    if (data2 == NULL)
+    {
+        memcpy(dst, data, size);
+    }
+    else
+    {
+        memcpy(dst,            data,  size / 2);
+        memcpy(dst + size / 2, data2, size / 2);
+    }
+
+    __atomic_store_n(&pSlot->seq, seq + 1, __ATOMIC_RELEASE);
+
+    camera_shm_desc_t desc;
+    desc.magic      = CAMERA_SHM_MAGIC;
+    desc.server_pid = getpid();
+    desc.fd         = m_fd;
+    desc.ring_size  = m_ringSize;
+    desc.slot       = slot;
+    desc.seq        = seq + 1;
+    desc.meta       = meta;
+
+    return pipe_server_write(channel, &desc, sizeof(desc));
+}
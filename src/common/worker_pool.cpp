@@ -0,0 +1,170 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <stdio.h>
+#include <modal_journal.h>
+
+#include "worker_pool.h"
+
+// Thread names are limited to 15 characters, 12 of the pool name and 2 digits of the thread index
+#define MAX_WORKER_THREADS 99
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Constructor, starts the worker threads
+// -----------------------------------------------------------------------------------------------------------------------------
+WorkerPool::WorkerPool(int numThreads, const char* name)
+{
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_workCond, NULL);
+    pthread_cond_init(&m_doneCond, NULL);
+
+    if (numThreads <= 0) return;
+
+    if (numThreads > MAX_WORKER_THREADS)
+    {
+        M_WARN("%s: %d worker threads requested, limiting to %d\n", name, numThreads, MAX_WORKER_THREADS);
+        numThreads = MAX_WORKER_THREADS;
+    }
+
+    m_threads = new pthread_t[numThreads];
+
+    for (int i = 0; i < numThreads; i++)
+    {
+        if (pthread_create(&m_threads[i],
+                           NULL,
+                           [](void* data){ return ((WorkerPool*)data)->ThreadWorker(); },
+                           this))
+        {
+            M_WARN("%s: only started %d of %d worker threads\n", name, i, numThreads);
+            break;
+        }
+
+        char threadName[16];
+        snprintf(threadName, sizeof(threadName), "%.12s%d", name, i % (MAX_WORKER_THREADS + 1));
+        pthread_setname_np(m_threads[i], threadName);
+
+        m_numThreads++;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Destructor, stops the worker threads
+// -----------------------------------------------------------------------------------------------------------------------------
+WorkerPool::~WorkerPool()
+{
+    pthread_mutex_lock(&m_mutex);
+    m_stop = true;
+    pthread_cond_broadcast(&m_workCond);
+    pthread_mutex_unlock(&m_mutex);
+
+    for (int i = 0; i < m_numThreads; i++)
+    {
+        pthread_join(m_threads[i], NULL);
+    }
+
+    delete[] m_threads;
+
+    pthread_cond_destroy(&m_doneCond);
+    pthread_cond_destroy(&m_workCond);
+    pthread_mutex_destroy(&m_mutex);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Takes the next job and runs it, called with the mutex held. Returns false if there was nothing left to hand out.
+// -----------------------------------------------------------------------------------------------------------------------------
+bool WorkerPool::DoJob()
+{
+    if (m_nextJob >= m_numJobs) return false;
+
+    int    index            = m_nextJob++;
+    void (*job)(void*, int) = m_job;
+    void*  context          = m_context;
+
+    pthread_mutex_unlock(&m_mutex);
+    job(context, index);
+    pthread_mutex_lock(&m_mutex);
+
+    if (--m_pending == 0)
+    {
+        pthread_cond_signal(&m_doneCond);
+    }
+
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Hands the jobs out and works on them until they're all finished
+// -----------------------------------------------------------------------------------------------------------------------------
+void WorkerPool::Run(int numJobs, void (*job)(void* context, int index), void* context)
+{
+    pthread_mutex_lock(&m_mutex);
+
+    m_job     = job;
+    m_context = context;
+    m_numJobs = numJobs;
+    m_nextJob = 0;
+    m_pending = numJobs;
+
+    if (m_numThreads > 0 && numJobs > 1)
+    {
+        pthread_cond_broadcast(&m_workCond);
+    }
+
+    while (DoJob());
+
+    while (m_pending > 0)
+    {
+        pthread_cond_wait(&m_doneCond, &m_mutex);
+    }
+
+    pthread_mutex_unlock(&m_mutex);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Worker thread
+// -----------------------------------------------------------------------------------------------------------------------------
+void* WorkerPool::ThreadWorker()
+{
+    pthread_mutex_lock(&m_mutex);
+
+    while (!m_stop)
+    {
+        if (!DoJob())
+        {
+            pthread_cond_wait(&m_workCond, &m_mutex);
+        }
+    }
+
+    pthread_mutex_unlock(&m_mutex);
+
+    return NULL;
+}
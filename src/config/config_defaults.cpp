@@ -57,6 +57,9 @@ static const PerCameraInfo OV7251Defaults =
         -1,                         //< Snapshot Height of the frame
         false,                      //< Flip
         false,                      //< Independent Exposure
+        false,                      //< Latest frame only
+        0,                          //< Small pipe scale
+        0,                          //< Pyramid levels
         AE_LME_MSV,                 //< AE Mode
         {                           //< Hist AE Algorithm Parameters
             100,                    //< Gain Min
@@ -108,6 +111,9 @@ static const PerCameraInfo OV9782Defaults =
         -1,                         //< Snapshot Height of the frame
         false,                      //< Flip
         false,                      //< Independent Exposure
+        false,                      //< Latest frame only
+        0,                          //< Small pipe scale
+        0,                          //< Pyramid levels
         AE_LME_MSV,                 //< AE Mode
         {                           //< Hist AE Algorithm Parameters
             54,                     //< Gain Min
@@ -160,6 +166,9 @@ static const PerCameraInfo IMX214Defaults =
         2160,                       //< Snapshot Height of the frame
         false,                      //< Flip
         false,                      //< Independent Exposure
+        false,                      //< Latest frame only
+        0,                          //< Small pipe scale
+        0,                          //< Pyramid levels
         AE_ISP,                     //< AE Mode
         {                           //< Hist AE Algorithm Parameters
             100,                    //< Gain Min
@@ -198,6 +207,9 @@ static const PerCameraInfo TOFDefaults =
         -1,                         //< Snapshot Height of the frame
         false,                      //< Flip
         false,                      //< Independent Exposure
+        false,                      //< Latest frame only
+        0,                          //< Small pipe scale
+        0,                          //< Pyramid levels
         AE_OFF,                     //< AE Mode
     };
 
@@ -221,6 +233,9 @@ static const PerCameraInfo emptyDefaults =
         -1,                         //< Snapshot Height of the frame
         false,                      //< Flip
         false,                      //< Independent Exposure
+        false,                      //< Latest frame only
+        0,                          //< Small pipe scale
+        0,                          //< Pyramid levels
         AE_OFF,                     //< AE Mode
     };
 
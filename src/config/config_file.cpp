@@ -33,6 +33,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <string>
 #include <list>
@@ -41,6 +42,7 @@
 
 #include "config_file.h"
 #include "config_defaults.h"
+#include "voxl_camera_server.h"
 #include <modal_journal.h>
 
 #define CURRENT_VERSION 0.1
@@ -63,12 +65,16 @@ static CameraType   GetCameraType(cJSON* pCameraInfo);
 #define JsonFlipString         "flip"                     ///< Camera flip?
 #define JsonPWidthString       "preview_width"            ///< Preview Frame width
 #define JsonPHeightString      "preview_height"           ///< Preview Frame height
+#define JsonPFormatString      "preview_format"           ///< Preview Frame format, e.g. raw8 to bypass the ISP
 #define JsonEWidthString       "encode_width"             ///< Encode Frame width
 #define JsonEHeightString      "encode_height"            ///< Encode Frame height
 #define JsonSWidthString       "snapshot_width"           ///< Snapshot Frame width
 #define JsonSHeightString      "snapshot_height"          ///< Snapshot Frame height
 #define JsonFpsString          "frame_rate"               ///< Fps
 #define JsonIndExpString       "independent_exposure"     ///< Independent exposure for a stereo pair
+#define JsonLatestOnlyString   "latest_only"              ///< Skip frames for clients that haven't read the last one
+#define JsonSmallScaleString   "small_scale"              ///< Downscale factor of the _small preview pipe
+#define JsonPyrLevelsString    "pyramid_levels"           ///< Levels of the _pyramid pipe
 #define JsonAEDesiredMSVString "ae_desired_msv"           ///< Modal AE Algorithm Desired MSV
 #define JsonAEFilterAlpha      "ae_filter_alpha"          ///< Modal AE MSV Algo filter alpha
 #define JsonAEIgnoreFraction   "ae_ignore_fraction"       ///< Modal AE MSV algo ignore frac for most saturated
@@ -81,6 +87,71 @@ static CameraType   GetCameraType(cJSON* pCameraInfo);
 #define JsonCameraIdString     "camera_id"                ///< Camera id
 #define JsonCameraId2String    "camera_id_second"         ///< Camera id 2
 #define JsonEnabledString      "enabled"                  ///< Is camera enabled
+#define JsonEncProfilesString  "encode_profiles"          ///< List of simulcast encode outputs
+#define JsonEncNameString      "name"                     ///< Encode profile pipe suffix
+#define JsonEncWidthString     "width"                    ///< Encode profile frame width
+#define JsonEncHeightString    "height"                   ///< Encode profile frame height
+#define JsonEncCodecString     "codec"                    ///< Encode profile codec (h264/h265)
+#define JsonEncBitrateString   "bitrate_mbps"             ///< Encode profile target bitrate
+#define JsonEncRateCtrlString  "rate_control"             ///< Encode profile rate control (cbr/vbr)
+#define JsonEncLowLatString    "low_latency"              ///< Encode profile low latency mode
+#define JsonEncRecDirString    "record_dir"               ///< Encode profile in-server recording directory
+#define JsonEncRecSegSString   "record_segment_s"         ///< Encode profile recording file length limit
+#define JsonEncRecSegMBString  "record_segment_mb"        ///< Encode profile recording file size limit
+#define JsonEncRecStartString  "record_on_start"          ///< Encode profile starts recording with the camera
+#define JsonDecimatedString    "decimated_fps"            ///< Rates of the reduced rate preview pipes
+#define JsonRawRecDirString    "raw_record_dir"           ///< Raw frame recording directory
+#define JsonRawRecStartString  "raw_record_on_start"      ///< Start raw frame recording with the camera
+#define JsonReplayFileString   "replay_file"              ///< Raw recording to replay in place of the camera
+#define JsonReplaySpeedString  "replay_speed"             ///< Replay speed, 0 for as fast as possible
+#define JsonRectIntrString     "rect_intrinsics_file"     ///< Lens calibration for the _rect pipe
+#define JsonRectExtrString     "rect_extrinsics_file"     ///< Stereo calibration for the _rect pipe
+#define JsonRectThreadsString  "rect_threads"             ///< Threads remapping the _rect frames
+#define JsonDispMaxString      "disparity_max"            ///< Disparity range of the _disparity pipe
+#define JsonDispBlockString    "disparity_block"          ///< Stereo matcher block size
+#define JsonDispUniqueString   "disparity_uniqueness"     ///< Stereo matcher uniqueness margin in percent
+#define JsonDispThreadsString  "disparity_threads"        ///< Threads computing the _disparity frames
+#define JsonFeatThreshString   "features_threshold"       ///< FAST threshold of the _features pipe
+#define JsonFeatLevelsString   "features_levels"          ///< Pyramid levels searched for features
+#define JsonFeatCellString     "features_cell"            ///< Size of the feature grid cells
+#define JsonFeatPerCellString  "features_per_cell"        ///< Features kept per grid cell
+#define JsonEnhClipString      "enhanced_clip"            ///< CLAHE clip limit of the _enhanced pipe
+#define JsonEnhTilesString     "enhanced_tiles"           ///< CLAHE tile grid size
+#define JsonEnhThreadsString   "enhanced_threads"         ///< Threads computing the _enhanced frames
+#define JsonRgbPipesString     "rgb_pipes"                ///< RGB layouts to publish for NV12 cameras
+#define JsonRgbMatrixString    "rgb_matrix"               ///< YUV to RGB conversion matrix (bt601/bt709)
+#define JsonRgbThreadsString   "rgb_threads"              ///< Threads computing the RGB frames
+#define JsonTenWidthString     "tensor_width"             ///< Width of the _tensor pipe's tensors
+#define JsonTenHeightString    "tensor_height"            ///< Height of the _tensor pipe's tensors
+#define JsonTenResizeString    "tensor_resize"            ///< Fitting the frame to the tensor (letterbox/crop)
+#define JsonTenPadString       "tensor_pad"               ///< Pixel value of the letterbox padding
+#define JsonTenTypeString      "tensor_type"              ///< Tensor element type (float32/uint8/int8)
+#define JsonTenLayoutString    "tensor_layout"            ///< Tensor layout (nchw/nhwc)
+#define JsonTenChannelsString  "tensor_channels"          ///< Tensor channels (rgb/bgr/grey)
+#define JsonTenMeanString      "tensor_mean"              ///< Per channel mean subtracted from the pixel values
+#define JsonTenStdString       "tensor_std"               ///< Per channel divisor of the pixel values
+#define JsonTenScaleString     "tensor_scale"             ///< Quantization step of 8 bit tensors
+#define JsonTenZeroString      "tensor_zero_point"        ///< Quantized value of 0
+#define JsonTenThreadsString   "tensor_threads"           ///< Threads making the tensors
+#define JsonBayerString        "bayer_pattern"            ///< Colour filter order of a RAW colour sensor
+#define JsonDebMethodString    "debayer_method"           ///< Demosaic method of the _color pipe (bilinear/edge)
+#define JsonDebOutputString    "debayer_output"           ///< Format of the _color pipe (rgb/nv12)
+#define JsonDebThreadsString   "debayer_threads"          ///< Threads demosaicing the _color frames
+#define JsonCompressedString   "en_compressed"            ///< Publish the losslessly compressed _compressed pipe
+#define JsonMjpegFpsString     "mjpeg_fps"                ///< Rate of the _mjpeg pipe
+#define JsonMjpegQualityString "mjpeg_quality"            ///< JPEG quality of the _mjpeg pipe and preview snapshots
+#define JsonMjpegThreadsString "mjpeg_threads"            ///< Threads encoding the JPEGs
+
+// Strings of the tensor options, in the order of the CAMERA_TENSOR_* codes
+static const char* const TensorResizeStrings[]   = {"letterbox", "crop"};
+static const char* const TensorTypeStrings[]     = {"float32", "uint8", "int8"};
+static const char* const TensorLayoutStrings[]   = {"nchw", "nhwc"};
+static const char* const TensorChannelsStrings[] = {"rgb", "bgr", "grey"};
+
+// Strings of the demosaic options, the patterns in the order of ImgprocBayer after "none"
+static const char* const BayerStrings[]          = {"none", "rggb", "grbg", "gbrg", "bggr"};
+static const char* const DebayerMethodStrings[]  = {"bilinear", "edge"};
+static const char* const DebayerOutputStrings[]  = {"rgb", "nv12"};
 
 #define contains(a, b) (std::find(a.begin(), a.end(), b) != a.end())
 
@@ -158,6 +229,8 @@ Status ReadConfigFile(list<PerCameraInfo> &cameras)    ///< Returned camera info
         info.flip = tmp;
         json_fetch_bool_with_default(cur, JsonIndExpString,  &tmp, false);
         info.ind_exp = tmp;
+        json_fetch_bool_with_default(cur, JsonLatestOnlyString, &tmp, false);
+        info.latest_only = tmp;
 
         json_fetch_int_with_default  (cur, JsonPWidthString,        &info.p_width,   info.p_width);
         json_fetch_int_with_default  (cur, JsonPHeightString,       &info.p_height,  info.p_height);
@@ -165,6 +238,433 @@ Status ReadConfigFile(list<PerCameraInfo> &cameras)    ///< Returned camera info
         json_fetch_int_with_default  (cur, JsonEHeightString,       &info.e_height,  info.e_height);
         json_fetch_int_with_default  (cur, JsonSWidthString,        &info.s_width,   info.s_width);
         json_fetch_int_with_default  (cur, JsonSHeightString,       &info.s_height,  info.s_height);
+        json_fetch_int_with_default  (cur, JsonSmallScaleString,    &info.small_scale, 0);
+
+        if(cJSON_HasObjectItem(cur, JsonPFormatString) && info.type != CAMTYPE_TOF){
+            json_fetch_string(cur, JsonPFormatString, buffer, 63);
+
+            int fmt = FMT_RAW8;
+            while(fmt < FMT_TOF && strcmp(buffer, GetImageFmtString(fmt))) fmt++;
+
+            if(fmt == FMT_TOF){
+                M_ERROR("Reading config file: camera %s has invalid %s: %s, should be raw8, raw10, nv12 or nv21\n",
+                    info.name, JsonPFormatString, buffer);
+                goto ERROR_EXIT;
+            }
+            info.p_format = fmt;
+        }
+
+        if(info.small_scale != 0){
+            const int f = info.small_scale;
+
+            // The NV12 chroma plane is half size, it has to divide by the factor as well
+            if((f != 2 && f != 4) || info.p_width % (2*f) || info.p_height % (2*f)){
+                M_ERROR("Reading config file: camera %s has invalid %s: %d, should be 2 or 4 and divide half the preview size\n",
+                    info.name, JsonSmallScaleString, f);
+                goto ERROR_EXIT;
+            }
+        }
+
+        json_fetch_int_with_default  (cur, JsonPyrLevelsString,     &info.pyramid_levels, 0);
+
+        if(info.pyramid_levels != 0 && (info.pyramid_levels < 2 || info.pyramid_levels > CAMERA_PYRAMID_MAX_LEVELS)){
+            M_ERROR("Reading config file: camera %s has invalid %s: %d, should be between 2 and %d\n",
+                info.name, JsonPyrLevelsString, info.pyramid_levels, CAMERA_PYRAMID_MAX_LEVELS);
+            goto ERROR_EXIT;
+        }
+
+        if(cJSON_HasObjectItem(cur, JsonEncProfilesString)){
+
+            int numProfiles;
+            cJSON* profiles = json_fetch_array(cur, JsonEncProfilesString, &numProfiles);
+
+            if(profiles == NULL || numProfiles > MAX_ENCODE_PROFILES){
+                M_ERROR("Reading config file: camera %s has invalid %s, at most %d are supported\n",
+                    info.name, JsonEncProfilesString, MAX_ENCODE_PROFILES);
+                goto ERROR_EXIT;
+            }
+
+            info.num_encode_profiles = 0;
+            for(cJSON *prof = profiles->child; prof != NULL; prof = prof->next){
+
+                EncodeProfile &p = info.encode_profiles[info.num_encode_profiles];
+                memset(&p, 0, sizeof(EncodeProfile));
+
+                if(!cJSON_HasObjectItem(prof, JsonEncNameString) || json_fetch_string(prof, JsonEncNameString, p.suffix, MAX_NAME_LENGTH-1)){
+                    if(info.num_encode_profiles == 0) strcpy(p.suffix, "encoded");
+                    else snprintf(p.suffix, MAX_NAME_LENGTH, "encoded_%d", info.num_encode_profiles);
+                }
+
+                // The pipe is <camera>_<suffix>, a longer name would get cut off and could end up the same as another profile's
+                if(strlen(info.name) + 1 + strlen(p.suffix) > MAX_PIPE_NAME_LENGTH){
+                    M_ERROR("Reading config file: encode profile %s for camera %s makes a pipe name longer than %d characters\n",
+                        p.suffix, info.name, MAX_PIPE_NAME_LENGTH);
+                    goto ERROR_EXIT;
+                }
+
+                for(int i = 0; i < info.num_encode_profiles; i++){
+                    if(!strcmp(p.suffix, info.encode_profiles[i].suffix)){
+                        M_ERROR("Reading config file: camera %s has multiple encode profiles named: %s\n", info.name, p.suffix);
+                        goto ERROR_EXIT;
+                    }
+                }
+
+                if(json_fetch_int(prof, JsonEncWidthString,  &p.width) ||
+                   json_fetch_int(prof, JsonEncHeightString, &p.height) ||
+                   p.width <= 0 || p.height <= 0){
+                    M_ERROR("Reading config file: encode profile %s for camera %s needs a valid width and height\n", p.suffix, info.name);
+                    goto ERROR_EXIT;
+                }
+
+                char codec[16] = "h265";
+                if(cJSON_HasObjectItem(prof, JsonEncCodecString)) json_fetch_string(prof, JsonEncCodecString, codec, 15);
+                if(!strcasecmp(codec, "h265")){
+                    p.isH265 = true;
+                } else if(!strcasecmp(codec, "h264")){
+                    p.isH265 = false;
+                } else {
+                    M_ERROR("Reading config file: encode profile %s has invalid codec: %s, should be h264 or h265\n", p.suffix, codec);
+                    goto ERROR_EXIT;
+                }
+
+                float mbps;
+                json_fetch_float_with_default(prof, JsonEncBitrateString, &mbps, 50.0);
+                p.bitrate = mbps * 1000000;
+
+                char rateControl[16] = "cbr";
+                if(cJSON_HasObjectItem(prof, JsonEncRateCtrlString)) json_fetch_string(prof, JsonEncRateCtrlString, rateControl, 15);
+                if(!strcasecmp(rateControl, "cbr")){
+                    p.isBitRateConstant = true;
+                } else if(!strcasecmp(rateControl, "vbr")){
+                    p.isBitRateConstant = false;
+                } else {
+                    M_ERROR("Reading config file: encode profile %s has invalid rate control: %s, should be cbr or vbr\n", p.suffix, rateControl);
+                    goto ERROR_EXIT;
+                }
+
+                int lowLatency;
+                json_fetch_bool_with_default(prof, JsonEncLowLatString, &lowLatency, false);
+                p.lowLatency = lowLatency;
+
+                strcpy(p.recordDir, DEFAULT_RECORD_DIR);
+                if(cJSON_HasObjectItem(prof, JsonEncRecDirString)) json_fetch_string(prof, JsonEncRecDirString, p.recordDir, MAX_DIR_LENGTH-1);
+
+                json_fetch_int_with_default(prof, JsonEncRecSegSString,  &p.recordSegmentSec, 0);
+                json_fetch_int_with_default(prof, JsonEncRecSegMBString, &p.recordSegmentMB,  0);
+                if(p.recordSegmentSec < 0 || p.recordSegmentMB < 0){
+                    M_ERROR("Reading config file: encode profile %s has a negative recording segment limit\n", p.suffix);
+                    goto ERROR_EXIT;
+                }
+
+                int recordOnStart;
+                json_fetch_bool_with_default(prof, JsonEncRecStartString, &recordOnStart, false);
+                p.recordOnStart = recordOnStart;
+
+                info.num_encode_profiles++;
+            }
+
+            info.en_encode = info.num_encode_profiles > 0;
+        }
+
+        if(cJSON_HasObjectItem(cur, JsonDecimatedString)){
+
+            int numDecimated;
+            cJSON* rates = json_fetch_array(cur, JsonDecimatedString, &numDecimated);
+
+            if(rates == NULL || numDecimated > MAX_DECIMATED_PIPES){
+                M_ERROR("Reading config file: camera %s has invalid %s, at most %d are supported\n",
+                    info.name, JsonDecimatedString, MAX_DECIMATED_PIPES);
+                goto ERROR_EXIT;
+            }
+
+            info.num_decimated = 0;
+            for(cJSON *rate = rates->child; rate != NULL; rate = rate->next){
+
+                int fps = rate->valueint;
+                if(!cJSON_IsNumber(rate) || fps <= 0 || fps >= info.fps){
+                    M_ERROR("Reading config file: camera %s has invalid decimated rate, should be between 1 and %d\n",
+                        info.name, info.fps - 1);
+                    goto ERROR_EXIT;
+                }
+
+                for(int i = 0; i < info.num_decimated; i++){
+                    if(info.decimated_fps[i] == fps){
+                        M_ERROR("Reading config file: camera %s has multiple decimated pipes at %dhz\n", info.name, fps);
+                        goto ERROR_EXIT;
+                    }
+                }
+
+                info.decimated_fps[info.num_decimated++] = fps;
+            }
+        }
+
+        strcpy(info.raw_record_dir, DEFAULT_RAW_RECORD_DIR);
+        if(cJSON_HasObjectItem(cur, JsonRawRecDirString)) json_fetch_string(cur, JsonRawRecDirString, info.raw_record_dir, MAX_DIR_LENGTH-1);
+
+        json_fetch_bool_with_default(cur, JsonRawRecStartString, &tmp, false);
+        info.raw_record_on_start = tmp;
+
+        info.replay_file[0] = 0;
+        if(cJSON_HasObjectItem(cur, JsonReplayFileString)) json_fetch_string(cur, JsonReplayFileString, info.replay_file, MAX_DIR_LENGTH-1);
+
+        json_fetch_float_with_default(cur, JsonReplaySpeedString, &info.replay_speed, 1.0);
+        if(info.replay_speed < 0.0){
+            M_ERROR("Reading config file: camera %s has negative %s\n", info.name, JsonReplaySpeedString);
+            goto ERROR_EXIT;
+        }
+
+        info.rect_intrinsics_file[0] = 0;
+        if(cJSON_HasObjectItem(cur, JsonRectIntrString)) json_fetch_string(cur, JsonRectIntrString, info.rect_intrinsics_file, MAX_DIR_LENGTH-1);
+
+        info.rect_extrinsics_file[0] = 0;
+        if(cJSON_HasObjectItem(cur, JsonRectExtrString)) json_fetch_string(cur, JsonRectExtrString, info.rect_extrinsics_file, MAX_DIR_LENGTH-1);
+
+        json_fetch_int_with_default(cur, JsonRectThreadsString, &info.rect_threads, 1);
+        if(info.rect_threads < 1 || info.rect_threads > 8){
+            M_ERROR("Reading config file: camera %s has invalid %s, should be between 1 and 8\n", info.name, JsonRectThreadsString);
+            goto ERROR_EXIT;
+        }
+
+        if(info.rect_intrinsics_file[0] != 0 && info.camId2 != -1 && info.rect_extrinsics_file[0] == 0){
+            M_ERROR("Reading config file: stereo camera %s needs %s for its _rect pipe\n", info.name, JsonRectExtrString);
+            goto ERROR_EXIT;
+        }
+
+        json_fetch_int_with_default(cur, JsonDispMaxString,     &info.disparity_max,        0);
+        json_fetch_int_with_default(cur, JsonDispBlockString,   &info.disparity_block,      7);
+        json_fetch_int_with_default(cur, JsonDispUniqueString,  &info.disparity_uniqueness, 10);
+        json_fetch_int_with_default(cur, JsonDispThreadsString, &info.disparity_threads,    1);
+        if(info.disparity_max != 0){
+            if(info.camId2 == -1){
+                M_ERROR("Reading config file: camera %s has %s set but isn't a stereo pair\n", info.name, JsonDispMaxString);
+                goto ERROR_EXIT;
+            }
+            if(info.disparity_max < 8 || info.disparity_max > 256 || info.disparity_max % 8 != 0){
+                M_ERROR("Reading config file: camera %s has invalid %s, should be a multiple of 8 up to 256\n", info.name, JsonDispMaxString);
+                goto ERROR_EXIT;
+            }
+            if(info.disparity_block < 3 || info.disparity_block > 11 || info.disparity_block % 2 == 0){
+                M_ERROR("Reading config file: camera %s has invalid %s, should be odd between 3 and 11\n", info.name, JsonDispBlockString);
+                goto ERROR_EXIT;
+            }
+            if(info.disparity_uniqueness < 0 || info.disparity_uniqueness > 100){
+                M_ERROR("Reading config file: camera %s has invalid %s, should be between 0 and 100\n", info.name, JsonDispUniqueString);
+                goto ERROR_EXIT;
+            }
+            if(info.disparity_threads < 1 || info.disparity_threads > 8){
+                M_ERROR("Reading config file: camera %s has invalid %s, should be between 1 and 8\n", info.name, JsonDispThreadsString);
+                goto ERROR_EXIT;
+            }
+        }
+
+        json_fetch_int_with_default(cur, JsonFeatThreshString,  &info.features_threshold, 0);
+        json_fetch_int_with_default(cur, JsonFeatLevelsString,  &info.features_levels,    1);
+        json_fetch_int_with_default(cur, JsonFeatCellString,    &info.features_cell,      32);
+        json_fetch_int_with_default(cur, JsonFeatPerCellString, &info.features_per_cell,  4);
+        if(info.features_threshold != 0){
+            if(info.features_threshold < 1 || info.features_threshold > 254){
+                M_ERROR("Reading config file: camera %s has invalid %s, should be between 1 and 254\n", info.name, JsonFeatThreshString);
+                goto ERROR_EXIT;
+            }
+            if(info.features_levels < 1 || (info.features_levels > 1 && info.features_levels > info.pyramid_levels)){
+                M_ERROR("Reading config file: camera %s has invalid %s, should be 1 or up to %s\n", info.name, JsonFeatLevelsString, JsonPyrLevelsString);
+                goto ERROR_EXIT;
+            }
+            if(info.features_cell < 8 || info.features_cell > 512){
+                M_ERROR("Reading config file: camera %s has invalid %s, should be between 8 and 512\n", info.name, JsonFeatCellString);
+                goto ERROR_EXIT;
+            }
+            if(info.features_per_cell < 1 || info.features_per_cell > 255){
+                M_ERROR("Reading config file: camera %s has invalid %s, should be between 1 and 255\n", info.name, JsonFeatPerCellString);
+                goto ERROR_EXIT;
+            }
+        }
+
+        json_fetch_float_with_default(cur, JsonEnhClipString,    &info.enhanced_clip,    0.0);
+        json_fetch_int_with_default  (cur, JsonEnhTilesString,   &info.enhanced_tiles,   8);
+        json_fetch_int_with_default  (cur, JsonEnhThreadsString, &info.enhanced_threads, 1);
+        if(info.enhanced_clip < 0.0){
+            M_ERROR("Reading config file: camera %s has negative %s\n", info.name, JsonEnhClipString);
+            goto ERROR_EXIT;
+        }
+        if(info.enhanced_clip != 0.0){
+            if(info.enhanced_tiles < 1 || info.enhanced_tiles > 16 ||
+               info.p_width % info.enhanced_tiles || info.p_height % info.enhanced_tiles){
+                M_ERROR("Reading config file: camera %s has invalid %s, should be up to 16 and divide the preview size\n", info.name, JsonEnhTilesString);
+                goto ERROR_EXIT;
+            }
+            if(info.enhanced_threads < 1 || info.enhanced_threads > 8){
+                M_ERROR("Reading config file: camera %s has invalid %s, should be between 1 and 8\n", info.name, JsonEnhThreadsString);
+                goto ERROR_EXIT;
+            }
+        }
+
+        info.rgb_pipes = 0;
+        if(cJSON_HasObjectItem(cur, JsonRgbPipesString)){
+
+            int numRgb;
+            cJSON* layouts = json_fetch_array(cur, JsonRgbPipesString, &numRgb);
+
+            if(layouts == NULL){
+                M_ERROR("Reading config file: camera %s has invalid %s\n", info.name, JsonRgbPipesString);
+                goto ERROR_EXIT;
+            }
+
+            for(cJSON *layout = layouts->child; layout != NULL; layout = layout->next){
+
+                int i = 0;
+                while(i < NUM_RGB_PIPES && !(cJSON_IsString(layout) && !strcmp(layout->valuestring, RGB_PIPE_NAMES[i]))) i++;
+
+                if(i == NUM_RGB_PIPES){
+                    M_ERROR("Reading config file: camera %s has invalid %s entry, should be rgb, bgr or rgb_planar\n",
+                        info.name, JsonRgbPipesString);
+                    goto ERROR_EXIT;
+                }
+
+                info.rgb_pipes |= 1 << i;
+            }
+        }
+
+        info.rgb_bt709 = false;
+        if(cJSON_HasObjectItem(cur, JsonRgbMatrixString)){
+            json_fetch_string(cur, JsonRgbMatrixString, buffer, 63);
+
+            if(!strcmp(buffer, "bt709")){
+                info.rgb_bt709 = true;
+            } else if(strcmp(buffer, "bt601")){
+                M_ERROR("Reading config file: camera %s has invalid %s: %s, should be bt601 or bt709\n",
+                    info.name, JsonRgbMatrixString, buffer);
+                goto ERROR_EXIT;
+            }
+        }
+
+        json_fetch_int_with_default(cur, JsonRgbThreadsString, &info.rgb_threads, 1);
+        if(info.rgb_threads < 1 || info.rgb_threads > 8){
+            M_ERROR("Reading config file: camera %s has invalid %s, should be between 1 and 8\n", info.name, JsonRgbThreadsString);
+            goto ERROR_EXIT;
+        }
+
+        TensorConfig& ten = info.tensor;
+        int           tensorCrop;
+        json_fetch_int_with_default  (cur, JsonTenWidthString,   &ten.width,      0);
+        json_fetch_int_with_default  (cur, JsonTenHeightString,  &ten.height,     0);
+        json_fetch_int_with_default  (cur, JsonTenPadString,     &ten.pad,        0);
+        json_fetch_float_with_default(cur, JsonTenScaleString,   &ten.scale,      1.0);
+        json_fetch_int_with_default  (cur, JsonTenZeroString,    &ten.zero_point, 0);
+        json_fetch_int_with_default  (cur, JsonTenThreadsString, &ten.threads,    1);
+        if(json_fetch_enum_with_default(cur, JsonTenResizeString,   &tensorCrop,   TensorResizeStrings,   2, 0) ||
+           json_fetch_enum_with_default(cur, JsonTenTypeString,     &ten.type,     TensorTypeStrings,     3, CAMERA_TENSOR_FLOAT32) ||
+           json_fetch_enum_with_default(cur, JsonTenLayoutString,   &ten.layout,   TensorLayoutStrings,   2, CAMERA_TENSOR_NCHW) ||
+           json_fetch_enum_with_default(cur, JsonTenChannelsString, &ten.channels, TensorChannelsStrings, 3, CAMERA_TENSOR_RGB)){
+            M_ERROR("Reading config file: camera %s has an invalid tensor option\n", info.name);
+            goto ERROR_EXIT;
+        }
+        ten.crop = tensorCrop;
+
+        for(int i = 0; i < 3; i++){
+            ten.mean[i] = 0.0;
+            ten.std[i]  = 1.0;
+        }
+        for(int i = 0; i < 2; i++){
+            const char* key  = i ? JsonTenStdString : JsonTenMeanString;
+            float*      dest = i ? ten.std : ten.mean;
+            double      values[3];
+
+            if(!cJSON_HasObjectItem(cur, key)) continue;
+
+            if(json_fetch_fixed_array_of_double(cur, key, values, 3)){
+                M_ERROR("Reading config file: camera %s has invalid %s, should be an array of 3 numbers\n", info.name, key);
+                goto ERROR_EXIT;
+            }
+            for(int c = 0; c < 3; c++){
+                dest[c] = values[c];
+            }
+        }
+
+        if(ten.width != 0 || ten.height != 0){
+            if(ten.width < 16 || ten.width > 4096 || ten.height < 16 || ten.height > 4096){
+                M_ERROR("Reading config file: camera %s has invalid %s/%s, should be between 16 and 4096\n",
+                    info.name, JsonTenWidthString, JsonTenHeightString);
+                goto ERROR_EXIT;
+            }
+            if(ten.pad < 0 || ten.pad > 255){
+                M_ERROR("Reading config file: camera %s has invalid %s, should be between 0 and 255\n", info.name, JsonTenPadString);
+                goto ERROR_EXIT;
+            }
+            if(ten.std[0] == 0.0 || ten.std[1] == 0.0 || ten.std[2] == 0.0){
+                M_ERROR("Reading config file: camera %s has a 0 in %s\n", info.name, JsonTenStdString);
+                goto ERROR_EXIT;
+            }
+            if(ten.type != CAMERA_TENSOR_FLOAT32 && ten.scale <= 0.0){
+                M_ERROR("Reading config file: camera %s has invalid %s, should be positive\n", info.name, JsonTenScaleString);
+                goto ERROR_EXIT;
+            }
+            if(ten.type != CAMERA_TENSOR_FLOAT32 &&
+               (ten.zero_point < ((ten.type == CAMERA_TENSOR_INT8) ? -128 : 0) || ten.zero_point > ((ten.type == CAMERA_TENSOR_INT8) ? 127 : 255))){
+                M_ERROR("Reading config file: camera %s has %s out of the range of %s\n", info.name, JsonTenZeroString, JsonTenTypeString);
+                goto ERROR_EXIT;
+            }
+            if(ten.threads < 1 || ten.threads > 8){
+                M_ERROR("Reading config file: camera %s has invalid %s, should be between 1 and 8\n", info.name, JsonTenThreadsString);
+                goto ERROR_EXIT;
+            }
+        }
+
+        int bayer, debayerEdge, debayerNV12;
+        if(json_fetch_enum_with_default(cur, JsonBayerString,     &bayer,       BayerStrings,         5, 0) ||
+           json_fetch_enum_with_default(cur, JsonDebMethodString, &debayerEdge, DebayerMethodStrings, 2, 0) ||
+           json_fetch_enum_with_default(cur, JsonDebOutputString, &debayerNV12, DebayerOutputStrings, 2, 0)){
+            M_ERROR("Reading config file: camera %s has an invalid demosaic option\n", info.name);
+            goto ERROR_EXIT;
+        }
+        info.en_debayer    = (bayer != 0);
+        info.bayer_pattern = info.en_debayer ? bayer - 1 : 0;
+        info.debayer_edge  = debayerEdge;
+        info.debayer_nv12  = debayerNV12;
+
+        json_fetch_int_with_default(cur, JsonDebThreadsString, &info.debayer_threads, 1);
+        if(info.en_debayer){
+            if(info.p_format != FMT_RAW8 && info.p_format != FMT_RAW10){
+                M_ERROR("Reading config file: camera %s has %s set but doesn't stream RAW\n", info.name, JsonBayerString);
+                goto ERROR_EXIT;
+            }
+            if(info.p_width % 2 || info.p_height % 2){
+                M_ERROR("Reading config file: camera %s needs an even preview size for %s\n", info.name, JsonBayerString);
+                goto ERROR_EXIT;
+            }
+            if(info.debayer_threads < 1 || info.debayer_threads > 8){
+                M_ERROR("Reading config file: camera %s has invalid %s, should be between 1 and 8\n", info.name, JsonDebThreadsString);
+                goto ERROR_EXIT;
+            }
+        }
+
+        json_fetch_bool_with_default(cur, JsonCompressedString, &tmp, false);
+        info.en_compressed = tmp;
+        if(info.en_compressed && info.type == CAMTYPE_TOF){
+            M_ERROR("Reading config file: camera %s has %s set, TOF cameras can't be compressed\n", info.name, JsonCompressedString);
+            goto ERROR_EXIT;
+        }
+
+        // The quality and threads also apply to the preview snapshots, which don't need the pipe
+        json_fetch_int_with_default(cur, JsonMjpegFpsString,     &info.mjpeg_fps,     0);
+        json_fetch_int_with_default(cur, JsonMjpegQualityString, &info.mjpeg_quality, 80);
+        json_fetch_int_with_default(cur, JsonMjpegThreadsString, &info.mjpeg_threads, 1);
+        if(info.mjpeg_fps < 0 || info.mjpeg_fps > info.fps){
+            M_ERROR("Reading config file: camera %s has invalid %s, should be between 0 and %d\n", info.name, JsonMjpegFpsString, info.fps);
+            goto ERROR_EXIT;
+        }
+        if(info.mjpeg_fps != 0 && info.type == CAMTYPE_TOF){
+            M_ERROR("Reading config file: camera %s has %s set, TOF cameras can't publish JPEGs\n", info.name, JsonMjpegFpsString);
+            goto ERROR_EXIT;
+        }
+        if(info.mjpeg_quality < 1 || info.mjpeg_quality > 100){
+            M_ERROR("Reading config file: camera %s has invalid %s, should be between 1 and 100\n", info.name, JsonMjpegQualityString);
+            goto ERROR_EXIT;
+        }
+        if(info.mjpeg_threads < 1 || info.mjpeg_threads > 8){
+            M_ERROR("Reading config file: camera %s has invalid %s, should be between 1 and 8\n", info.name, JsonMjpegThreadsString);
+            goto ERROR_EXIT;
+        }
 
         json_fetch_float_with_default (cur, JsonAEDesiredMSVString , &info.ae_hist_info.desired_msv, info.ae_hist_info.desired_msv);
         json_fetch_float_with_default (cur, JsonAEKPString ,         &info.ae_hist_info.k_p_ns,      info.ae_hist_info.k_p_ns);
@@ -221,12 +721,144 @@ void WriteConfigFile(list<PerCameraInfo> cameras)     ///< Camera info for each
 
         cJSON_AddNumberToObject  (node, JsonPWidthString,        info.p_width);
         cJSON_AddNumberToObject  (node, JsonPHeightString,       info.p_height);
+        if (info.type != CAMTYPE_TOF && info.p_format != getDefaultCameraInfo(info.type).p_format) {
+            cJSON_AddStringToObject(node, JsonPFormatString,     GetImageFmtString(info.p_format));
+        }
 
-        if (info.en_encode) {
+        if (info.en_encode && info.num_encode_profiles > 0) {
+            cJSON* profArray = cJSON_AddArrayToObject(node, JsonEncProfilesString);
+
+            for(int i = 0; i < info.num_encode_profiles; i++){
+                EncodeProfile &p = info.encode_profiles[i];
+                cJSON* prof = cJSON_CreateObject();
+
+                cJSON_AddStringToObject(prof, JsonEncNameString,     p.suffix);
+                cJSON_AddNumberToObject(prof, JsonEncWidthString,    p.width);
+                cJSON_AddNumberToObject(prof, JsonEncHeightString,   p.height);
+                cJSON_AddStringToObject(prof, JsonEncCodecString,    p.isH265 ? "h265" : "h264");
+                cJSON_AddNumberToObject(prof, JsonEncBitrateString,  p.bitrate / 1000000.0);
+                cJSON_AddStringToObject(prof, JsonEncRateCtrlString, p.isBitRateConstant ? "cbr" : "vbr");
+                cJSON_AddBoolToObject  (prof, JsonEncLowLatString,   p.lowLatency);
+                cJSON_AddStringToObject(prof, JsonEncRecDirString,   p.recordDir);
+                cJSON_AddNumberToObject(prof, JsonEncRecSegSString,  p.recordSegmentSec);
+                cJSON_AddNumberToObject(prof, JsonEncRecSegMBString, p.recordSegmentMB);
+                cJSON_AddBoolToObject  (prof, JsonEncRecStartString, p.recordOnStart);
+
+                cJSON_AddItemToArray(profArray, prof);
+            }
+        } else if (info.en_encode) {
             cJSON_AddNumberToObject  (node, JsonEWidthString,        info.e_width);
             cJSON_AddNumberToObject  (node, JsonEHeightString,       info.e_height);
         }
 
+        cJSON_AddBoolToObject  (node, JsonLatestOnlyString, info.latest_only);
+
+        if (info.small_scale != 0) {
+            cJSON_AddNumberToObject(node, JsonSmallScaleString, info.small_scale);
+        }
+
+        if (info.pyramid_levels != 0) {
+            cJSON_AddNumberToObject(node, JsonPyrLevelsString, info.pyramid_levels);
+        }
+
+        if (info.num_decimated > 0) {
+            cJSON* rateArray = cJSON_AddArrayToObject(node, JsonDecimatedString);
+            for(int i = 0; i < info.num_decimated; i++){
+                cJSON_AddItemToArray(rateArray, cJSON_CreateNumber(info.decimated_fps[i]));
+            }
+        }
+
+        if (info.type != CAMTYPE_TOF) {
+            cJSON_AddStringToObject(node, JsonRawRecDirString,   info.raw_record_dir[0] ? info.raw_record_dir : DEFAULT_RAW_RECORD_DIR);
+            cJSON_AddBoolToObject  (node, JsonRawRecStartString, info.raw_record_on_start);
+        }
+
+        if (info.replay_file[0] != 0) {
+            cJSON_AddStringToObject(node, JsonReplayFileString,  info.replay_file);
+            cJSON_AddNumberToObject(node, JsonReplaySpeedString, info.replay_speed);
+        }
+
+        if (info.rect_intrinsics_file[0] != 0) {
+            cJSON_AddStringToObject(node, JsonRectIntrString,    info.rect_intrinsics_file);
+            if (info.rect_extrinsics_file[0] != 0) {
+                cJSON_AddStringToObject(node, JsonRectExtrString, info.rect_extrinsics_file);
+            }
+            cJSON_AddNumberToObject(node, JsonRectThreadsString, info.rect_threads);
+        }
+
+        if (info.disparity_max != 0) {
+            cJSON_AddNumberToObject(node, JsonDispMaxString,     info.disparity_max);
+            cJSON_AddNumberToObject(node, JsonDispBlockString,   info.disparity_block);
+            cJSON_AddNumberToObject(node, JsonDispUniqueString,  info.disparity_uniqueness);
+            cJSON_AddNumberToObject(node, JsonDispThreadsString, info.disparity_threads);
+        }
+
+        if (info.features_threshold != 0) {
+            cJSON_AddNumberToObject(node, JsonFeatThreshString,  info.features_threshold);
+            cJSON_AddNumberToObject(node, JsonFeatLevelsString,  info.features_levels);
+            cJSON_AddNumberToObject(node, JsonFeatCellString,    info.features_cell);
+            cJSON_AddNumberToObject(node, JsonFeatPerCellString, info.features_per_cell);
+        }
+
+        if (info.enhanced_clip != 0.0) {
+            cJSON_AddNumberToObject(node, JsonEnhClipString,     info.enhanced_clip);
+            cJSON_AddNumberToObject(node, JsonEnhTilesString,    info.enhanced_tiles);
+            cJSON_AddNumberToObject(node, JsonEnhThreadsString,  info.enhanced_threads);
+        }
+
+        if (info.rgb_pipes != 0) {
+            cJSON* rgbArray = cJSON_AddArrayToObject(node, JsonRgbPipesString);
+            for(int i = 0; i < NUM_RGB_PIPES; i++){
+                if(info.rgb_pipes & (1 << i)){
+                    cJSON_AddItemToArray(rgbArray, cJSON_CreateString(RGB_PIPE_NAMES[i]));
+                }
+            }
+            cJSON_AddStringToObject(node, JsonRgbMatrixString,   info.rgb_bt709 ? "bt709" : "bt601");
+            cJSON_AddNumberToObject(node, JsonRgbThreadsString,  info.rgb_threads);
+        }
+
+        if (info.tensor.width != 0) {
+            const TensorConfig& ten = info.tensor;
+
+            cJSON_AddNumberToObject(node, JsonTenWidthString,    ten.width);
+            cJSON_AddNumberToObject(node, JsonTenHeightString,   ten.height);
+            cJSON_AddStringToObject(node, JsonTenResizeString,   TensorResizeStrings[ten.crop]);
+            cJSON_AddNumberToObject(node, JsonTenPadString,      ten.pad);
+            cJSON_AddStringToObject(node, JsonTenTypeString,     TensorTypeStrings[ten.type]);
+            cJSON_AddStringToObject(node, JsonTenLayoutString,   TensorLayoutStrings[ten.layout]);
+            cJSON_AddStringToObject(node, JsonTenChannelsString, TensorChannelsStrings[ten.channels]);
+
+            cJSON* meanArray = cJSON_AddArrayToObject(node, JsonTenMeanString);
+            cJSON* stdArray  = cJSON_AddArrayToObject(node, JsonTenStdString);
+            for(int i = 0; i < 3; i++){
+                cJSON_AddItemToArray(meanArray, cJSON_CreateNumber(ten.mean[i]));
+                cJSON_AddItemToArray(stdArray,  cJSON_CreateNumber(ten.std[i]));
+            }
+
+            if (ten.type != CAMERA_TENSOR_FLOAT32) {
+                cJSON_AddNumberToObject(node, JsonTenScaleString, ten.scale);
+                cJSON_AddNumberToObject(node, JsonTenZeroString,  ten.zero_point);
+            }
+            cJSON_AddNumberToObject(node, JsonTenThreadsString,  ten.threads);
+        }
+
+        if (info.en_debayer) {
+            cJSON_AddStringToObject(node, JsonBayerString,       BayerStrings[info.bayer_pattern + 1]);
+            cJSON_AddStringToObject(node, JsonDebMethodString,   DebayerMethodStrings[info.debayer_edge]);
+            cJSON_AddStringToObject(node, JsonDebOutputString,   DebayerOutputStrings[info.debayer_nv12]);
+            cJSON_AddNumberToObject(node, JsonDebThreadsString,  info.debayer_threads);
+        }
+
+        if (info.en_compressed) {
+            cJSON_AddBoolToObject  (node, JsonCompressedString,  info.en_compressed);
+        }
+
+        if (info.mjpeg_fps != 0) {
+            cJSON_AddNumberToObject(node, JsonMjpegFpsString,     info.mjpeg_fps);
+            cJSON_AddNumberToObject(node, JsonMjpegQualityString, info.mjpeg_quality);
+            cJSON_AddNumberToObject(node, JsonMjpegThreadsString, info.mjpeg_threads);
+        }
+
         if (info.en_snapshot) {
             cJSON_AddNumberToObject  (node, JsonSWidthString,        info.s_width);
             cJSON_AddNumberToObject  (node, JsonSHeightString,       info.s_height);
@@ -49,20 +49,40 @@ static int SetupGrallocInterface()
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------
-// Moves the UV planes to be contiguous with the y plane
+// Packs the Y and UV planes into width byte rows with the UV plane right behind the Y plane, the layout the pipes send.
+// Rows only ever move towards the start of the buffer so they are moved front to back, nothing gets overwritten before it
+// has been moved itself.
 // -----------------------------------------------------------------------------------------------------------------------------
 void bufferMakeYUVContiguous(BufferBlock* pBufferInfo)
 {
-
     const int height = pBufferInfo->height;
     const int width  = pBufferInfo->width;
+    const int stride = pBufferInfo->stride;
+    uint8_t*  y      = (uint8_t*)(pBufferInfo->vaddress);
+    uint8_t*  uv     = bufferGetUVPlane(pBufferInfo);
 
-    if((uint8_t*)(pBufferInfo->vaddress) + (width*height) == offsetMap.at(pBufferInfo)){
+    if(stride == width && uv == y + (width*height)){
         M_VERBOSE("Buffer already continuous\n");
         return;
     }
 
-    memcpy((uint8_t*)(pBufferInfo->vaddress) + (width*height), offsetMap.at(pBufferInfo), (width * height / 2));
+    if(stride != width){
+        for(int row = 1; row < height; row++){
+            memmove(y + row * width, y + row * stride, width);
+        }
+    }
+
+    for(int row = 0; row < height / 2; row++){
+        memmove(y + (height + row) * width, uv + row * stride, width);
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Where gralloc put the UV plane, rows are stride bytes apart like the Y plane
+// -----------------------------------------------------------------------------------------------------------------------------
+uint8_t* bufferGetUVPlane(BufferBlock* pBufferInfo)
+{
+    return (uint8_t*)offsetMap.at(pBufferInfo);
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------
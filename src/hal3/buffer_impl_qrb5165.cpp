@@ -28,19 +28,35 @@ static int ionFd;
 #define ALIGN_BYTE(x, a) ((x % a == 0) ? x : x - (x % a) + a)
 
 // -----------------------------------------------------------------------------------------------------------------------------
-// Moves the UV planes to be contiguous with the y plane
+// Packs the Y and UV planes into width byte rows with the UV plane right behind the Y plane, the layout the pipes send.
+// Rows only ever move towards the start of the buffer so they are moved front to back, nothing gets overwritten before it
+// has been moved itself.
 // -----------------------------------------------------------------------------------------------------------------------------
 void bufferMakeYUVContiguous(BufferBlock* pBufferInfo)
 {
-
     const int height = pBufferInfo->height;
     const int width  = pBufferInfo->width;
-    //(Total size - expected size) / 1.5 because there's padding at the end as well
-    const int offset = (pBufferInfo->size - (width * height * 1.5))/1.5;
+    const int stride = pBufferInfo->stride;
+    uint8_t*  y      = (uint8_t*)(pBufferInfo->vaddress);
+    uint8_t*  uv     = bufferGetUVPlane(pBufferInfo);
+
+    if(stride != width){
+        for(int row = 1; row < height; row++){
+            memmove(y + row * width, y + row * stride, width);
+        }
+    }
+
+    for(int row = 0; row < height / 2; row++){
+        memmove(y + (height + row) * width, uv + row * stride, width);
+    }
+}
 
-    memcpy((uint8_t*)(pBufferInfo->vaddress) + (width*height),
-           (uint8_t*)(pBufferInfo->vaddress) + (width*height) + offset,
-           width*height/2);
+// -----------------------------------------------------------------------------------------------------------------------------
+// The UV plane follows slice padded rows of the Y plane, rows are stride bytes apart in both
+// -----------------------------------------------------------------------------------------------------------------------------
+uint8_t* bufferGetUVPlane(BufferBlock* pBufferInfo)
+{
+    return (uint8_t*)(pBufferInfo->vaddress) + pBufferInfo->stride * pBufferInfo->slice;
 }
 
 int allocateOneBuffer(
@@ -95,7 +95,8 @@ void bufferPushAddress(BufferGroup& bufferGroup, void* vaddress)
 buffer_handle_t* bufferPop(BufferGroup& bufferGroup)
 {
     unique_lock<mutex> lock(bufferMutex);
-    if (bufferGroup.freeBuffers.size() == 0) {
+    // The condition variable is shared between all groups, make sure it was our group that got a buffer back
+    while (bufferGroup.freeBuffers.size() == 0) {
         bufferConditionVar.wait(lock);
     }
 
@@ -104,6 +105,19 @@ buffer_handle_t* bufferPop(BufferGroup& bufferGroup)
     return buffer;
 }
 
+// Same as bufferPop but returns NULL instead of waiting when no buffers are free
+buffer_handle_t* bufferTryPop(BufferGroup& bufferGroup)
+{
+    unique_lock<mutex> lock(bufferMutex);
+    if (bufferGroup.freeBuffers.size() == 0) {
+        return NULL;
+    }
+
+    buffer_handle_t* buffer = bufferGroup.freeBuffers.front();
+    bufferGroup.freeBuffers.pop_front();
+    return buffer;
+}
+
 BufferBlock* bufferGetBufferInfo(BufferGroup* bufferGroup, buffer_handle_t* buffer)
 {
     unique_lock<mutex> lock(bufferMutex);
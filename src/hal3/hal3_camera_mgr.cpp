@@ -53,16 +53,22 @@
 #include "common_defs.h"
 #include "hal3_camera.h"
 #include "voxl_camera_server.h"
+#include "voxl_camera_codec.h"
 #include "voxl_cutils.h"
 
-#define CONTROL_COMMANDS "set_exp_gain,set_exp,set_gain,start_ae,stop_ae"
+#define CONTROL_COMMANDS "set_exp_gain,set_exp,set_gain,start_ae,stop_ae,start_raw_record,stop_raw_record,snapshot_preview"
+#define ENCODE_CONTROL_COMMANDS "start_record,stop_record"
+#define DECIMATED_CONTROL_COMMANDS "set_rate"
 
 #define NUM_PREVIEW_BUFFERS 16
 #define NUM_ENCODE_BUFFERS 11
+#define NUM_ENCODE_BUFFERS_LOW_LATENCY 6
 #define NUM_SNAPSHOT_BUFFERS 16
 
 #define JPEG_DEFUALT_QUALITY        85
 
+#define SKIP_REPORT_PERIOD_S        10      // How often the latest_only skip counts are logged
+
 #define abs(x,y) ((x) > (y) ? (x) : (y))
 
 #define MAX_STEREO_DISCREPENCY_NS ((1000000000/configInfo.fps)*0.9)
@@ -93,19 +99,17 @@ PerCameraMgr::PerCameraMgr(PerCameraInfo pCameraInfo) :
     configInfo        (pCameraInfo),
     outputChannel     (pipe_server_get_next_available_channel()),
     cameraId          (pCameraInfo.camId),
-    en_encode         (pCameraInfo.en_encode),
-    en_snapshot       (pCameraInfo.en_snapshot),
+    en_encode         (pCameraInfo.en_encode   && pCameraInfo.replay_file[0] == 0),
+    en_snapshot       (pCameraInfo.en_snapshot && pCameraInfo.replay_file[0] == 0),
     p_width           (pCameraInfo.p_width),
     p_height          (pCameraInfo.p_height),
     p_halFmt          (HalFmtFromType(pCameraInfo.p_format)),
-    e_width           (pCameraInfo.e_width),
-    e_height          (pCameraInfo.e_height),
     e_halFmt          (HAL3_FMT_YUV),
     s_width           (pCameraInfo.s_width),
     s_height          (pCameraInfo.s_height),
     s_halFmt          (HAL_PIXEL_FORMAT_BLOB),
     ae_mode           (pCameraInfo.ae_mode),
-    pCameraModule     (HAL3_get_camera_module()),
+    pCameraModule     (pCameraInfo.replay_file[0] == 0 ? HAL3_get_camera_module() : NULL),
     expHistInterface  (pCameraInfo.ae_hist_info),
     expMSVInterface   (pCameraInfo.ae_msv_info)
 {
@@ -115,96 +119,192 @@ PerCameraMgr::PerCameraMgr(PerCameraInfo pCameraInfo) :
     cameraCallbacks.cameraCallbacks = {&CameraModuleCaptureResult, &CameraModuleNotify};
     cameraCallbacks.pPrivate        = this;
 
-    if(pCameraModule == NULL ){
-        M_ERROR("Failed to get HAL module!\n");
+    if (configInfo.replay_file[0] != 0) {
+        // Frames come from a recording, there is no camera to open or buffers to allocate
+        if (configInfo.type == CAMTYPE_TOF) {
+            M_ERROR("Camera %s: replay is not supported for TOF cameras\n", name);
 
-        throw -EINVAL;
-    }
+            throw -EINVAL;
+        }
 
-    // Check if the stream configuration is supported by the camera or not. If cameraid doesnt support the stream configuration
-    // we just exit. The stream configuration is checked into the static metadata associated with every camera.
-    if (!HAL3_is_config_supported(cameraId, p_width, p_height, p_halFmt))
-    {
-        M_ERROR("Camera %d failed to find supported preview config: %dx%d\n", cameraId, p_width, p_height);
+        if (pCameraInfo.en_encode || pCameraInfo.en_snapshot) {
+            M_WARN("Camera %s: encode and snapshot streams are not available while replaying\n", name);
+        }
 
-        throw -EINVAL;
-    }
-    if (en_encode && !HAL3_is_config_supported(cameraId, e_width, e_height, e_halFmt))
-    {
-        M_ERROR("Camera %d failed to find supported encode config: %dx%d\n", cameraId, e_width, e_height);
+        replay = new ReplaySource(configInfo.replay_file, configInfo.replay_speed);
 
-        throw -EINVAL;
-    }
-    if (en_snapshot && !HAL3_is_config_supported(cameraId, s_width, s_height, s_halFmt))
-    {
-        M_ERROR("Camera %d failed to find supported snapshot config: %dx%d\n", cameraId, s_width, s_height);
+        const camera_image_metadata_t* pMeta = replay->GetMeta(0);
+        const bool isNV12 = (pMeta->format == IMAGE_FORMAT_NV12 || pMeta->format == IMAGE_FORMAT_STEREO_NV12);
 
-        throw -EINVAL;
-    }
+        if (pMeta->width != p_width || pMeta->height != p_height || isNV12 != (p_halFmt == HAL3_FMT_YUV)) {
+            M_ERROR("Camera %s: replay %s is %dx%d %s, config is %dx%d\n", name, configInfo.replay_file,
+                pMeta->width, pMeta->height, pipe_image_format_to_string(pMeta->format), p_width, p_height);
+            delete replay;
 
-    char cameraName[20];
-    sprintf(cameraName, "%d", cameraId);
+            throw -EINVAL;
+        }
 
-    if (pCameraModule->common.methods->open(&pCameraModule->common, cameraName, (hw_device_t**)(&pDevice)))
-    {
-        M_ERROR("Open camera %s failed!\n", name);
+        pDevice = NULL;
+        is10bit = false;
+    } else {
+        if(pCameraModule == NULL ){
+            M_ERROR("Failed to get HAL module!\n");
 
-        throw -EINVAL;
-    }
+            throw -EINVAL;
+        }
 
-    if (pDevice->ops->initialize(pDevice, (camera3_callback_ops*)&cameraCallbacks))
-    {
-        M_ERROR("Initialize camera %s failed!\n", name);
+        // Check if the stream configuration is supported by the camera or not. If cameraid doesnt support the stream configuration
+        // we just exit. The stream configuration is checked into the static metadata associated with every camera.
+        if (!HAL3_is_config_supported(cameraId, p_width, p_height, p_halFmt))
+        {
+            M_ERROR("Camera %d failed to find supported preview config: %dx%d\n", cameraId, p_width, p_height);
 
-        throw -EINVAL;
+            throw -EINVAL;
+        }
+        if (en_encode) {
+
+            // Older configs only give a single encode resolution, treat that as one profile with the original settings
+            if (pCameraInfo.num_encode_profiles == 0) {
+                EncodeProfile &p    = e_streams[0].profile;
+                memset(&p, 0, sizeof(EncodeProfile));
+                strcpy(p.suffix, "encoded");
+                strcpy(p.recordDir, DEFAULT_RECORD_DIR);
+                p.width             = pCameraInfo.e_width;
+                p.height            = pCameraInfo.e_height;
+                p.isH265            = true;
+                p.bitrate           = 50000000;
+                p.isBitRateConstant = true;
+                numEncodeStreams    = 1;
+            } else {
+                for (int i = 0; i < pCameraInfo.num_encode_profiles; i++) {
+                    e_streams[i].profile = pCameraInfo.encode_profiles[i];
+                }
+                numEncodeStreams = pCameraInfo.num_encode_profiles;
+            }
+
+            for (int i = 0; i < numEncodeStreams; i++) {
+                EncodeProfile &p = e_streams[i].profile;
+                if (!HAL3_is_config_supported(cameraId, p.width, p.height, e_halFmt))
+                {
+                    M_ERROR("Camera %d failed to find supported encode config: %dx%d\n", cameraId, p.width, p.height);
+
+                    throw -EINVAL;
+                }
+            }
+        }
+        if (en_snapshot && !HAL3_is_config_supported(cameraId, s_width, s_height, s_halFmt))
+        {
+            M_ERROR("Camera %d failed to find supported snapshot config: %dx%d\n", cameraId, s_width, s_height);
+
+            throw -EINVAL;
+        }
+
+        char cameraName[20];
+        sprintf(cameraName, "%d", cameraId);
+
+        if (pCameraModule->common.methods->open(&pCameraModule->common, cameraName, (hw_device_t**)(&pDevice)))
+        {
+            M_ERROR("Open camera %s failed!\n", name);
+
+            throw -EINVAL;
+        }
+
+        if (pDevice->ops->initialize(pDevice, (camera3_callback_ops*)&cameraCallbacks))
+        {
+            M_ERROR("Initialize camera %s failed!\n", name);
+
+            throw -EINVAL;
+        }
+
+        if (ConfigureStreams())
+        {
+            M_ERROR("Failed to configure streams for camera: %s\n", name);
+
+            throw -EINVAL;
+        }
+
+        if (bufferAllocateBuffers(p_bufferGroup,
+                                  NUM_PREVIEW_BUFFERS,
+                                  p_stream.width,
+                                  p_stream.height,
+                                  p_stream.format,
+                                  p_stream.usage)) {
+            M_ERROR("Failed to allocate preview buffers for camera: %s\n", name);
+
+            throw -EINVAL;
+        }
     }
 
-    if (ConfigureStreams())
-    {
-        M_ERROR("Failed to configure streams for camera: %s\n", name);
+    if (configInfo.small_scale != 0 && configInfo.type != CAMTYPE_TOF) {
+        const int f = configInfo.small_scale;
 
-        throw -EINVAL;
+        // Big enough for NV12, stereo pairs use one buffer from each manager
+        smallFrame = (uint8_t*)malloc((p_width / f) * (p_height / f) * 3 / 2);
     }
 
-    if (bufferAllocateBuffers(p_bufferGroup,
-                              NUM_PREVIEW_BUFFERS,
-                              p_stream.width,
-                              p_stream.height,
-                              p_stream.format,
-                              p_stream.usage)) {
-        M_ERROR("Failed to allocate preview buffers for camera: %s\n", name);
+    if (configInfo.pyramid_levels != 0 && configInfo.type != CAMTYPE_TOF) {
+        int size = 0;
+        int w    = p_width;
+        int h    = p_height;
 
-        throw -EINVAL;
+        // Level 0 goes out straight from the preview buffer
+        for (int l = 1; l < configInfo.pyramid_levels; l++) {
+            w     = (w + 1) / 2;
+            h     = (h + 1) / 2;
+            size += w * h;
+        }
+
+        pyramidFrame   = (uint8_t*)malloc(size);
+        pyramidScratch = (uint16_t*)malloc(IMGPROC_PYR_SCRATCH(p_width) * sizeof(uint16_t));
+    }
+
+    // Recordings were made after the flip
+    if (configInfo.flip && configInfo.type != CAMTYPE_TOF && replay == NULL && p_halFmt == HAL_PIXEL_FORMAT_RAW10) {
+        flipFrame = (uint8_t*)malloc(p_width * p_height);
     }
 
-    if (en_encode) {
+    for (int i = 0; i < numEncodeStreams; i++) {
+
+        EncodeStream &e = e_streams[i];
 
-        if (bufferAllocateBuffers(e_bufferGroup,
-                                  NUM_ENCODE_BUFFERS,
-                                  e_stream.width,
-                                  e_stream.height,
-                                  e_stream.format,
-                                  e_stream.usage)) {
-            M_ERROR("Failed to allocate encode buffers for camera: %s\n", name);
+        if (bufferAllocateBuffers(e.bufferGroup,
+                                  e.stream.max_buffers,
+                                  e.stream.width,
+                                  e.stream.height,
+                                  e.stream.format,
+                                  e.stream.usage)) {
+            M_ERROR("Failed to allocate encode buffers for camera: %s (%s)\n", name, e.profile.suffix);
             throw -EINVAL;
         }
 
         try{
-            encodeOutputChannel = pipe_server_get_next_available_channel();
+            e.outputChannel = pipe_server_get_next_available_channel();
+
+            RecorderConfig rec_info;
+            snprintf(rec_info.name, MAX_NAME_LENGTH, "%s_%s", name, e.profile.suffix);
+            strcpy(rec_info.dir, e.profile.recordDir);
+            rec_info.width      = e.profile.width;
+            rec_info.height     = e.profile.height;
+            rec_info.isH265     = e.profile.isH265;
+            rec_info.segmentSec = e.profile.recordSegmentSec;
+            rec_info.segmentMB  = e.profile.recordSegmentMB;
+
             VideoEncoderConfig enc_info = {
-                .width =             (uint32_t)e_width,   ///< Image width
-                .height =            (uint32_t)e_height,  ///< Image height
-                .format =            (uint32_t)e_halFmt,  ///< Image format
-                .isBitRateConstant = true,      ///< Is the bit rate constant
-                .targetBitRate =     50000000,      ///< Desired target bitrate
-                .frameRate =         pCameraInfo.fps,       ///< Frame rate
-                .isH265 =            true,       ///< Is it H265 encoding or H264
-                .inputBuffers =      &e_bufferGroup,
-                .outputPipe =        encodeOutputChannel
+                .width =             (uint32_t)e.profile.width,     ///< Image width
+                .height =            (uint32_t)e.profile.height,    ///< Image height
+                .format =            (uint32_t)e_halFmt,            ///< Image format
+                .isBitRateConstant = e.profile.isBitRateConstant,   ///< Is the bit rate constant
+                .targetBitRate =     e.profile.bitrate,             ///< Desired target bitrate
+                .frameRate =         pCameraInfo.fps,               ///< Frame rate
+                .isH265 =            e.profile.isH265,              ///< Is it H265 encoding or H264
+                .inputBuffers =      &e.bufferGroup,
+                .outputPipe =        e.outputChannel,
+                .isLowLatency =      e.profile.lowLatency,
+                .recorder =          &rec_info
             };
-            pVideoEncoder = new VideoEncoder(&enc_info);
+            e.pVideoEncoder = new VideoEncoder(&enc_info);
         } catch(int) {
-            M_ERROR("Failed to initialize encoder for camera: %s\n", name);
+            M_ERROR("Failed to initialize encoder for camera: %s (%s)\n", name, e.profile.suffix);
             throw -EINVAL;
         }
 
@@ -253,6 +353,31 @@ PerCameraMgr::PerCameraMgr(PerCameraInfo pCameraInfo) :
 PerCameraMgr::~PerCameraMgr() {
     if (partnerMode == MODE_STEREO_MASTER)
         delete otherMgr;
+
+    free(smallFrame);
+    free(pyramidFrame);
+    free(pyramidScratch);
+    free(flipFrame);
+    free(rectFrame);
+    free(disparityFrame);
+    free(features);
+    free(enhancedFrame);
+    free(rgbFrame);
+    free(tensorFrame);
+    free(colorFrame);
+    free(debayerScratch);
+    free(compressedFrame);
+    rectifyFreeMap(&rectMaps[0]);
+    rectifyFreeMap(&rectMaps[1]);
+
+    delete stereoMatcher;
+    delete featureDetector;
+    delete clahe[0];
+    delete clahe[1];
+    delete tensorPreproc;
+    delete jpegEncoder;
+    delete workerPool;
+    delete replay;
 }
 
 
@@ -281,16 +406,20 @@ int PerCameraMgr::ConfigureStreams()
     streams.push_back(&p_stream);
     streamConfig.num_streams ++;
 
-    if(en_encode) {
+    // One stream per encode profile, the ISP does the scaling for each of them
+    for(int i = 0; i < numEncodeStreams; i++) {
+        camera3_stream_t &e_stream = e_streams[i].stream;
+
         e_stream.stream_type = CAMERA3_STREAM_OUTPUT;
-        e_stream.width       = e_width;
-        e_stream.height      = e_height;
+        e_stream.width       = e_streams[i].profile.width;
+        e_stream.height      = e_streams[i].profile.height;
         e_stream.format      = e_halFmt;
         e_stream.data_space  = HAL_DATASPACE_UNKNOWN;
         e_stream.usage       = GRALLOC_USAGE_HW_VIDEO_ENCODER;
         // e_stream.usage       = GRALLOC_USAGE_HW_COMPOSER | GRALLOC_USAGE_HW_TEXTURE;
         e_stream.rotation    = ROTATION_MODE;
-        e_stream.max_buffers = NUM_ENCODE_BUFFERS;
+        // Keep the encoder input queue short in low latency mode, frames waiting in it only add delay
+        e_stream.max_buffers = e_streams[i].profile.lowLatency ? NUM_ENCODE_BUFFERS_LOW_LATENCY : NUM_ENCODE_BUFFERS;
         e_stream.priv        = 0;
 
         streams.push_back(&e_stream);
@@ -456,16 +585,137 @@ int PerCameraMgr::ConstructDefaultRequestSettings()
 void PerCameraMgr::Start()
 {
 
+    // Only known here, the stereo child is set up as a mono camera and told afterwards
+    if(replay != NULL && replay->IsStereo() != (partnerMode != MODE_MONO)){
+        M_ERROR("Camera %s: replay %s is %s, camera is %s\n", name, configInfo.replay_file,
+            replay->IsStereo() ? "stereo" : "mono", partnerMode == MODE_MONO ? "mono" : "stereo");
+
+        throw -EINVAL;
+    }
+
     if(partnerMode != MODE_STEREO_SLAVE){
+        // Built before the pipes, the _rect pipe only exists if this worked
+        if(configInfo.rect_intrinsics_file[0] != 0 && configInfo.type != CAMTYPE_TOF){
+            const bool stereo = (partnerMode == MODE_STEREO_MASTER);
+
+            if(rectifyBuildMaps(configInfo.rect_intrinsics_file, stereo ? configInfo.rect_extrinsics_file : NULL,
+                                p_width, p_height, rectMaps)){
+                M_ERROR("Failed to load the rectification calibration for camera: %s\n", name);
+
+                throw -EINVAL;
+            }
+
+            rectFrame = (uint8_t*)malloc(p_width * p_height * (stereo ? 2 : 1));
+        }
+
+        if(configInfo.disparity_max != 0 && partnerMode == MODE_STEREO_MASTER){
+            stereoMatcher  = new StereoMatcher(p_width, p_height, configInfo.disparity_max, configInfo.disparity_block,
+                                               configInfo.disparity_uniqueness, configInfo.disparity_threads);
+            disparityFrame = (uint8_t*)malloc(p_width * p_height * 3);
+        }
+
+        if(configInfo.features_threshold != 0 && configInfo.type != CAMTYPE_TOF){
+            const int images = (partnerMode == MODE_STEREO_MASTER) ? 2 : 1;
+
+            featureDetector = new FeatureDetector(p_width, p_height, configInfo.features_levels, configInfo.features_threshold,
+                                                  configInfo.features_cell, configInfo.features_per_cell);
+            features        = (camera_feature_t*)malloc(images * featureDetector->MaxFeatures() * sizeof(camera_feature_t));
+        }
+
+        if(configInfo.enhanced_clip != 0.0 && configInfo.type != CAMTYPE_TOF){
+            const int images = (partnerMode == MODE_STEREO_MASTER) ? 2 : 1;
+
+            for(int i = 0; i < images; i++){
+                clahe[i] = new Clahe(p_width, p_height, configInfo.enhanced_tiles, configInfo.enhanced_tiles,
+                                     configInfo.enhanced_clip, configInfo.enhanced_threads);
+            }
+            enhancedFrame = (uint8_t*)malloc(p_width * p_height * images);
+        }
+
+        if(configInfo.rgb_pipes != 0){
+            if(p_halFmt == HAL3_FMT_YUV){
+                rgbFrame = (uint8_t*)malloc(p_width * p_height * 3 * ((partnerMode == MODE_STEREO_MASTER) ? 2 : 1));
+            } else {
+                M_WARN("Camera %s doesn't output NV12, ignoring its RGB pipes\n", name);
+            }
+        }
+
+        // Grey cameras fill all channels of colour tensors with the grey image
+        if(configInfo.tensor.width != 0 && configInfo.type != CAMTYPE_TOF){
+            const int images = (partnerMode == MODE_STEREO_MASTER) ? 2 : 1;
+
+            tensorPreproc = new TensorPreproc(&configInfo.tensor, p_width, p_height, p_halFmt == HAL3_FMT_YUV,
+                                              configInfo.rgb_bt709 ? IMGPROC_BT709 : IMGPROC_BT601, configInfo.tensor.threads, images);
+            tensorFrame   = (uint8_t*)malloc(tensorPreproc->ImageBytes() * images);
+        }
+
+        if(configInfo.en_debayer){
+            const int images = (partnerMode == MODE_STEREO_MASTER) ? 2 : 1;
+
+            if(p_halFmt == HAL_PIXEL_FORMAT_RAW10){
+                colorFrame = (uint8_t*)malloc(p_width * p_height * (configInfo.debayer_nv12 ? 3 : 6) / 2 * images);
+
+                if(configInfo.debayer_nv12){
+                    debayerScratch = (uint8_t*)malloc(IMGPROC_DEBAYER_SCRATCH(p_width) * configInfo.debayer_threads * images);
+                }
+            } else {
+                M_WARN("Camera %s doesn't output RAW, ignoring its bayer pattern\n", name);
+            }
+        }
+
+        if(configInfo.en_compressed){
+            const int images = (partnerMode == MODE_STEREO_MASTER) ? 2 : 1;
+
+            compressedMaxSize = camera_codec_max_size(p_width, p_height);
+            compressedFrame   = (uint8_t*)malloc(compressedMaxSize * images);
+        }
+
+        // The encoder for preview snapshots alone is only made when the first one is taken
+        if(configInfo.mjpeg_fps > 0){
+            const int images = (partnerMode == MODE_STEREO_MASTER) ? 2 : 1;
+
+            jpegEncoder = new JpegEncoder(p_width, p_height, images, p_halFmt == HAL3_FMT_YUV, configInfo.mjpeg_quality,
+                                          configInfo.mjpeg_threads);
+        }
+
+        // One pool for all of them, they run one after the other
+        if(rectFrame != NULL || stereoMatcher != NULL || clahe[0] != NULL || rgbFrame != NULL || tensorPreproc != NULL ||
+           colorFrame != NULL || jpegEncoder != NULL){
+            int threads = std::max(rectFrame     != NULL ? configInfo.rect_threads      : 1,
+                                   stereoMatcher != NULL ? configInfo.disparity_threads : 1);
+            threads     = std::max(clahe[0]      != NULL ? configInfo.enhanced_threads  : 1, threads);
+            threads     = std::max(rgbFrame      != NULL ? configInfo.rgb_threads       : 1, threads);
+            threads     = std::max(tensorPreproc != NULL ? configInfo.tensor.threads    : 1, threads);
+            threads     = std::max(colorFrame    != NULL ? configInfo.debayer_threads   : 1, threads);
+            threads     = std::max(jpegEncoder   != NULL ? configInfo.mjpeg_threads     : 1, threads);
+
+            char poolName[16];
+            snprintf(poolName, sizeof(poolName), "cam%d-work", cameraId);
+
+            workerPool = new WorkerPool(threads - 1, poolName);
+        }
+
         if(SetupPipes()){
             M_ERROR("Failed to setup pipes for camera: %s\n", name);
 
             throw -EINVAL;
         }
+
+        if(configInfo.type != CAMTYPE_TOF){
+            rawRecorder = new RawRecorder(name, configInfo.raw_record_dir[0] ? configInfo.raw_record_dir : DEFAULT_RAW_RECORD_DIR);
+
+            if(configInfo.raw_record_on_start){
+                rawRecorder->Start();
+            }
+        }
     }
 
-    if(pVideoEncoder) {
-        pVideoEncoder->Start();
+    for(int i = 0; i < numEncodeStreams; i++) {
+        e_streams[i].pVideoEncoder->Start();
+
+        if(e_streams[i].profile.recordOnStart) {
+            e_streams[i].pVideoEncoder->StartRecording();
+        }
     }
 
     pthread_condattr_t condAttr;
@@ -474,6 +724,7 @@ void PerCameraMgr::Start()
     pthread_mutex_init(&resultMutex, NULL);
     pthread_mutex_init(&stereoMutex, NULL);
     pthread_mutex_init(&aeMutex, NULL);
+    pthread_mutex_init(&previewSnapshotMutex, NULL);
     pthread_cond_init(&resultCond, &condAttr);
     pthread_cond_init(&stereoCond, &condAttr);
     pthread_condattr_destroy(&condAttr);
@@ -483,8 +734,12 @@ void PerCameraMgr::Start()
     pthread_attr_t attr;
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
-    pthread_create(&requestThread, &attr, [](void* data){return ((PerCameraMgr*)data)->ThreadIssueCaptureRequests();}, this);
-    pthread_create(&resultThread,  &attr, [](void* data){return ((PerCameraMgr*)data)->ThreadPostProcessResult();},  this);
+    if(replay != NULL){
+        pthread_create(&replayThread, &attr, [](void* data){return ((PerCameraMgr*)data)->ThreadReplay();}, this);
+    } else {
+        pthread_create(&requestThread, &attr, [](void* data){return ((PerCameraMgr*)data)->ThreadIssueCaptureRequests();}, this);
+        pthread_create(&resultThread,  &attr, [](void* data){return ((PerCameraMgr*)data)->ThreadPostProcessResult();},  this);
+    }
     pthread_attr_destroy(&attr);
 
     if(partnerMode == MODE_STEREO_MASTER){
@@ -505,11 +760,16 @@ void PerCameraMgr::Stop()
         otherMgr->stopped = true;
     }
 
-    pthread_join(requestThread, NULL);
+    if(replay != NULL){
+        pthread_cond_broadcast(&stereoCond);
+        pthread_join(replayThread, NULL);
+    } else {
+        pthread_join(requestThread, NULL);
 
-    pthread_cond_broadcast(&stereoCond);
-    pthread_cond_broadcast(&resultCond);
-    pthread_join(resultThread, NULL);
+        pthread_cond_broadcast(&stereoCond);
+        pthread_cond_broadcast(&resultCond);
+        pthread_join(resultThread, NULL);
+    }
     pthread_cond_signal(&resultCond);
     pthread_mutex_unlock(&resultMutex);
     pthread_mutex_destroy(&resultMutex);
@@ -519,13 +779,20 @@ void PerCameraMgr::Stop()
         otherMgr->Stop();
     }
 
-    if(pVideoEncoder) {
-        pVideoEncoder->Stop();
-        delete pVideoEncoder;
+    // Nothing feeds it once the result thread is gone, finish the file
+    delete rawRecorder;
+    rawRecorder = NULL;
+
+    for(int i = 0; i < numEncodeStreams; i++) {
+        e_streams[i].pVideoEncoder->Stop();
+        delete e_streams[i].pVideoEncoder;
+        e_streams[i].pVideoEncoder = NULL;
     }
 
     bufferDeleteBuffers(p_bufferGroup);
-    bufferDeleteBuffers(e_bufferGroup);
+    for(int i = 0; i < numEncodeStreams; i++) {
+        bufferDeleteBuffers(e_streams[i].bufferGroup);
+    }
     bufferDeleteBuffers(s_bufferGroup);
 
     if (pDevice != NULL)
@@ -539,8 +806,86 @@ void PerCameraMgr::Stop()
 
     pthread_mutex_destroy(&aeMutex);
 
+    pthread_mutex_destroy(&previewSnapshotMutex);
+    for(char* filename : previewSnapshotQueue){
+        M_WARN("Camera: %s stopped before writing preview snapshot %s\n", name, filename);
+        free(filename);
+    }
+    previewSnapshotQueue.clear();
+
+    ReportSkippedFrames(true);
+    skipCounters.clear();
+
     pipe_server_close(outputChannel);
 
+    if(smallOutputChannel != -1){
+        pipe_server_close(smallOutputChannel);
+    }
+
+    if(greyOutputChannel != -1){
+        pipe_server_close(greyOutputChannel);
+    }
+
+    if(pyramidOutputChannel != -1){
+        pipe_server_close(pyramidOutputChannel);
+    }
+
+    if(rectOutputChannel != -1){
+        pipe_server_close(rectOutputChannel);
+    }
+
+    if(disparityOutputChannel != -1){
+        pipe_server_close(disparityOutputChannel);
+    }
+
+    if(featuresOutputChannel != -1){
+        pipe_server_close(featuresOutputChannel);
+    }
+
+    if(qualityOutputChannel != -1){
+        pipe_server_close(qualityOutputChannel);
+    }
+
+    if(statsOutputChannel != -1){
+        pipe_server_close(statsOutputChannel);
+    }
+
+    if(enhancedOutputChannel != -1){
+        pipe_server_close(enhancedOutputChannel);
+    }
+
+    if(tensorOutputChannel != -1){
+        pipe_server_close(tensorOutputChannel);
+    }
+
+    if(colorOutputChannel != -1){
+        pipe_server_close(colorOutputChannel);
+    }
+
+    if(compressedOutputChannel != -1){
+        pipe_server_close(compressedOutputChannel);
+    }
+
+    if(mjpegOutputChannel != -1){
+        pipe_server_close(mjpegOutputChannel);
+    }
+
+    for(int i = 0; i < NUM_RGB_PIPES; i++){
+        if(rgbOutputChannels[i] != -1){
+            pipe_server_close(rgbOutputChannels[i]);
+        }
+    }
+
+    for(int i = 0; i < numDecimatedStreams; i++){
+        pipe_server_close(d_streams[i].outputChannel);
+    }
+
+    if(shmRing != NULL){
+        pipe_server_close(shmOutputChannel);
+        delete shmRing;
+        shmRing = NULL;
+    }
+
 }
 
 
@@ -665,27 +1010,6 @@ void PerCameraMgr::CameraModuleNotify(const camera3_callback_ops_t *cb, const ca
     }
 }
 
-// -----------------------------------------------------------------------------------------------------------------------------
-// Convert 10-bit RAW to 8-bit RAW
-// -----------------------------------------------------------------------------------------------------------------------------
-static void ConvertTo8bitRaw(uint8_t* pImg, uint32_t widthPixels, uint32_t heightPixels)
-{
-    // This link has the description of the RAW10 format:
-    // https://gitlab.com/SaberMod/pa-android-frameworks-base/commit/d1988a98ed69db8c33b77b5c085ab91d22ef3bbc
-
-    uint32_t *destBuffer = (uint32_t*) pImg;
-    // Figure out size of the raw8 destination buffer in 32 bit words
-    uint32_t destSize = (widthPixels * heightPixels) / 4;
-
-    for (uint32_t i = 0; i < destSize; i++) {
-        *destBuffer++ = *((uint32_t*) pImg);
-        // Skip every fifth byte because that is just a collection of the 2
-        // least significant bits from the previous four pixels. We don't want
-        // those least significant bits.
-        pImg += 5;
-    }
-}
-
 static bool Check10bit(uint8_t* pImg, uint32_t widthPixels, uint32_t heightPixels)
 {
     if (pImg == NULL) {
@@ -733,51 +1057,1077 @@ static void CreateParentDirs(const char *file_path)
   free(dir_path);
 }
 
+static FILE* OpenSnapshotFile(const char* path)
+{
+    FILE* file_descriptor = fopen(path, "wb");
+    if(! file_descriptor){
+
+        //Check to see if we were just missing parent directories
+        CreateParentDirs(path);
+
+        file_descriptor = fopen(path, "wb");
+
+        if(! file_descriptor){
+            M_ERROR("failed to open file descriptor for snapshot save\n");
+        }
+    }
+
+    return file_descriptor;
+}
+
 static void WriteSnapshot(BufferBlock* bufferBlockInfo, int format, const char* path)
 {
-    uint64_t size    = bufferBlockInfo->size;
+    uint64_t size    = bufferBlockInfo->size;
+
+    uint8_t* src_data = (uint8_t*)bufferBlockInfo->vaddress;
+    FILE* file_descriptor = OpenSnapshotFile(path);
+    if(! file_descriptor){
+        return;
+    }
+
+    if (format == HAL_PIXEL_FORMAT_BLOB) {
+
+        fwrite(src_data, size, 1, file_descriptor);
+
+    } else {
+        M_ERROR("%s recieved frame in unsuppored format\n", __FUNCTION__);
+    }
+
+    fclose(file_descriptor);
+}
+
+static void Mipi12ToRaw16(camera_image_metadata_t meta, uint8_t *raw12Buf, uint16_t *raw16Buf) 
+{
+    // Convert image buffer from MIPI RAW12 to RAW16 format
+    // ToF MIPI RAW12 is stored in the format of:
+    // P1[11:4] P2[11:4] P2[3:0] P1[3:0]
+    // 2 pixels occupy 3 bytes, no padding needed
+
+    // ToF data is 12bit held in an 8bit format, use seperate counter to track 1.5x difference in data size
+    int buf8Idx, buf16Idx;
+    for (buf8Idx = 0, buf16Idx = 0; buf16Idx < meta.size_bytes / 2; buf8Idx += 3, buf16Idx++){
+        raw16Buf[(buf16Idx*2)]   = (raw12Buf[buf8Idx] << 4) + (raw12Buf[buf8Idx + 2] & 0x0F);
+        raw16Buf[(buf16Idx*2)+1] = (raw12Buf[buf8Idx + 1] << 4) + ((raw12Buf[buf8Idx + 2] & 0xF0) >> 4);
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// The reduced rate pipes are scheduled off the frame timestamps rather than by counting frames so that the average rate holds
+// for rates that don't divide the camera rate and across dropped frames. Nothing is written to a pipe without clients.
+// -----------------------------------------------------------------------------------------------------------------------------
+void PerCameraMgr::WriteDecimatedFrames(camera_image_metadata_t meta, uint8_t* frame, uint8_t* childFrame)
+{
+    // Half a camera frame of slack so that timestamp jitter doesn't push us to the next frame
+    const int64_t slack_ns = 500000000LL / configInfo.fps;
+
+    for(int i = 0; i < numDecimatedStreams; i++){
+        DecimatedStream &d = d_streams[i];
+
+        if(pipe_server_get_num_clients(d.outputChannel) <= 0) continue;
+        if(meta.timestamp_ns < d.next_ns - slack_ns) continue;
+
+        // Stay on schedule, but don't try to catch up after a gap (or a long time without clients)
+        d.next_ns += d.period_ns;
+        if(d.next_ns < meta.timestamp_ns) d.next_ns = meta.timestamp_ns + d.period_ns;
+
+        WriteImage(d.outputChannel, meta, frame, childFrame);
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Metadata of a frame after downscaling by factor f, works for mono and stereo RAW8/NV12
+// -----------------------------------------------------------------------------------------------------------------------------
+static camera_image_metadata_t SmallMeta(camera_image_metadata_t meta, int f)
+{
+    meta.width      /= f;
+    meta.height     /= f;
+    meta.stride     /= f;
+    meta.size_bytes /= f * f;
+
+    return meta;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Metadata for just the luma plane of an NV12 frame (or stereo pair), the plane itself goes out straight from the preview
+// buffer at yuvStride. Also used with stride = width for the packed single plane images we make from RAW8 or NV12 frames.
+// -----------------------------------------------------------------------------------------------------------------------------
+static camera_image_metadata_t GreyMeta(camera_image_metadata_t meta, int stride)
+{
+    const bool stereo = (meta.format == IMAGE_FORMAT_STEREO_NV12 || meta.format == IMAGE_FORMAT_STEREO_RAW8);
+
+    meta.format     = stereo ? IMAGE_FORMAT_STEREO_RAW8 : IMAGE_FORMAT_RAW8;
+    meta.stride     = stride;
+    meta.size_bytes = stride * meta.height * (stereo ? 2 : 1);
+
+    return meta;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Write a frame to every client of an image pipe, see WriteList for latest_only
+// -----------------------------------------------------------------------------------------------------------------------------
+void PerCameraMgr::WriteImage(int ch, camera_image_metadata_t meta, uint8_t* frame, uint8_t* childFrame)
+{
+    if(!configInfo.latest_only){
+        if(childFrame == NULL){
+            pipe_server_write_camera_frame(ch, meta, frame);
+        } else {
+            pipe_server_write_stereo_frame(ch, meta, frame, childFrame);
+        }
+        return;
+    }
+
+    const size_t frameBytes = (childFrame == NULL) ? meta.size_bytes : meta.size_bytes / 2;
+
+    const void*  bufs[] = {&meta, frame, childFrame};
+    const size_t lens[] = {sizeof(camera_image_metadata_t), frameBytes, frameBytes};
+
+    WriteList(ch, (childFrame == NULL) ? 2 : 3, bufs, lens);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Write a header and its data as one message to every client of a pipe. Data that is already in a pipe can't be taken back,
+// so in latest_only mode a client that hasn't finished reading what we sent it before doesn't get the new message queued
+// behind it. The client never has more than one message waiting and always gets the newest one available at the time it
+// catches up.
+// -----------------------------------------------------------------------------------------------------------------------------
+void PerCameraMgr::WriteList(int ch, int n, const void** bufs, const size_t* lens)
+{
+    if(!configInfo.latest_only){
+        pipe_server_write_list(ch, n, bufs, lens);
+        return;
+    }
+
+    for(int client = 0; client < PIPE_SERVER_MAX_CLIENTS_PER_CH; client++){
+
+        if(pipe_server_get_client_state(ch, client) != CLIENT_CONNECTED) continue;
+
+        if(pipe_server_bytes_in_pipe(ch, client) > 0){
+            M_VERBOSE("Client %d of channel %d is behind, skipping a frame\n", client, ch);
+            std::map<int, SkipCounter>::iterator counter = skipCounters.find(ch);
+            if(counter != skipCounters.end()) counter->second.frames++;
+            continue;
+        }
+
+        for(int i = 0; i < n; i++){
+            if(lens[i] > 0){
+                pipe_server_write_to_client(ch, client, bufs[i], lens[i]);
+            }
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// latest_only is set per camera, but how often it kicks in depends on the clients of each pipe, so the skipped frames are
+// counted and reported per pipe
+// -----------------------------------------------------------------------------------------------------------------------------
+void PerCameraMgr::AddSkipCounter(int ch, const char* pipeName)
+{
+    if(!configInfo.latest_only) return;
+
+    SkipCounter counter;
+    snprintf(counter.name, sizeof(counter.name), "%s", pipeName);
+
+    skipCounters[ch] = counter;
+}
+
+void PerCameraMgr::ReportSkippedFrames(bool totals)
+{
+    for(std::map<int, SkipCounter>::iterator it = skipCounters.begin(); it != skipCounters.end(); it++){
+        SkipCounter &c = it->second;
+
+        if(totals){
+            if(c.frames != 0){
+                M_DEBUG("Pipe %s skipped %llu frames for clients that were behind\n", c.name, (unsigned long long)c.frames);
+            }
+        } else if(c.frames != c.reported){
+            M_DEBUG("Pipe %s skipped %llu frames for clients that were behind in the last %ds\n",
+                c.name, (unsigned long long)(c.frames - c.reported), SKIP_REPORT_PERIOD_S);
+            c.reported = c.frames;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// The pipes are owned by the master of a stereo pair
+// -----------------------------------------------------------------------------------------------------------------------------
+bool PerCameraMgr::ChromaNeeded()
+{
+    PerCameraMgr* m = (partnerMode == MODE_STEREO_SLAVE) ? otherMgr : this;
+
+    if(pipe_server_get_num_clients(m->outputChannel)      > 0) return true;
+    if(pipe_server_get_num_clients(m->shmOutputChannel)   > 0) return true;
+    if(pipe_server_get_num_clients(m->smallOutputChannel) > 0) return true;
+
+    // Recordings are packed NV12 frames, replay assumes so
+    if(m->rawRecorder != NULL && m->rawRecorder->IsRecording()) return true;
+
+    for(int i = 0; i < m->numDecimatedStreams; i++){
+        if(pipe_server_get_num_clients(m->d_streams[i].outputChannel) > 0) return true;
+    }
+
+    // The RGB pipes and the tensor read the chroma where the HAL put it, unless it has to be flipped
+    for(int i = 0; configInfo.flip && i < NUM_RGB_PIPES; i++){
+        if(pipe_server_get_num_clients(m->rgbOutputChannels[i]) > 0) return true;
+    }
+
+    if(configInfo.flip && m->tensorPreproc != NULL && pipe_server_get_num_clients(m->tensorOutputChannel) > 0) return true;
+
+    // So do the JPEGs, frames between the ones the _mjpeg pipe is due for get their chroma flipped for nothing
+    if(configInfo.flip && m->JpegNeeded()) return true;
+
+    return false;
+}
+
+bool PerCameraMgr::EnhanceNeeded()
+{
+    PerCameraMgr* m = (partnerMode == MODE_STEREO_SLAVE) ? otherMgr : this;
+
+    return m->clahe[0] != NULL && pipe_server_get_num_clients(m->enhancedOutputChannel) > 0;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Everything the server does to the pixels of a preview frame happens here. Raw frames are walked once, a band of rows at a
+// time, so the later stages find each band still in cache after the RAW10 to RAW8 conversion has written it.
+// -----------------------------------------------------------------------------------------------------------------------------
+uint8_t* PerCameraMgr::ProcessPreviewRows(BufferBlock* bufferBlockInfo, uint8_t* srcPixel)
+{
+    const bool doSmall   = (smallFrame != NULL) && (getNumSmallClients() > 0);
+    const bool doPyramid = (pyramidFrame != NULL) &&
+                           (getNumPyramidClients() > 0 || (configInfo.features_levels > 1 && getNumFeaturesClients() > 0));
+    const bool doFlip    = configInfo.flip && replay == NULL;
+    const bool greyFmt   = (p_halFmt == HAL_PIXEL_FORMAT_RAW10 || p_halFmt == HAL3_FMT_YUV);
+    const bool doQuality = greyFmt && (getNumQualityClients() > 0);
+    const bool doStats   = greyFmt && (getNumStatsClients() > 0);
+    const bool histLater = doStats && EnhanceNeeded();  // The _enhanced tile histograms add up to it
+    const int  f         = configInfo.small_scale;
+    int        pyrRows   = 0;   // Rows of pyramid level 1 done in the band loop
+    uint8_t*   frame     = srcPixel;
+
+    smallValid   = doSmall;
+    pyramidValid = doPyramid;
+    qualityValid = doQuality;
+    statsValid   = doStats;
+
+    histogramPending = histLater;
+
+    memset(&quality, 0, sizeof(ImgprocQuality));
+    memset(histogram, 0, sizeof(histogram));
+
+    if (p_halFmt == HAL_PIXEL_FORMAT_RAW10 && (is10bit || doSmall || doPyramid || doFlip || doQuality || doStats))
+    {
+        // Packed RAW10 rows have no padding, 5 bytes for every 4 pixels
+        const int raw10Stride = p_width * 5 / 4;
+
+        // The top rows of a flipped frame come from the bottom of the RAW10 data, converting those in place would overwrite
+        // rows that haven't been read yet
+        if (is10bit && doFlip) frame = flipFrame;
+
+        for (int y = 0; y < p_height; y += IMGPROC_BAND_ROWS)
+        {
+            const int rows = std::min(IMGPROC_BAND_ROWS, p_height - y);
+            uint8_t*  band = frame + y * p_width;
+
+            if (is10bit && doFlip)
+            {
+                imgprocRaw10ToRaw8Rot180(srcPixel + (p_height - y - rows) * raw10Stride, raw10Stride, band, p_width, p_width, rows);
+            }
+            else if (is10bit)
+            {
+                imgprocRaw10ToRaw8(srcPixel + y * raw10Stride, raw10Stride, band, p_width, p_width, rows);
+            }
+            else if (doFlip)
+            {
+                imgprocRot180Raw8(frame, p_width, p_width, p_height, y, y + rows);
+            }
+
+            if (doQuality)
+            {
+                imgprocQuality(frame, p_width, p_width, y, y + rows, &quality);
+            }
+
+            if (doStats && !histLater)
+            {
+                imgprocHistogram(frame, p_width, p_width, y, y + rows, histogram);
+            }
+
+            if (doSmall)
+            {
+                imgprocDownscaleRaw8(band, p_width, smallFrame + (y / f) * (p_width / f), p_width / f, p_width, rows, f);
+            }
+
+            if (doPyramid)
+            {
+                // Level 1 row r needs source rows up to 2r+2, the rows that reach into the next band wait for it
+                const int ready = (y + rows == p_height) ? (p_height + 1) / 2 : (y + rows - 1) / 2;
+
+                imgprocPyrDown(frame, p_width, p_width, p_height,
+                               pyramidFrame, (p_width + 1) / 2, pyrRows, ready, pyramidScratch);
+                pyrRows = ready;
+            }
+        }
+    }
+    else if (p_halFmt == HAL3_FMT_YUV)
+    {
+        // Nothing to convert, the flip is the only pass over the planes. ProcessPreviewImage has set yuvStride and uvPlane.
+        if (doFlip)
+        {
+            imgprocRot180Raw8(srcPixel, yuvStride, p_width, p_height, 0, p_height);
+
+            if (chromaValid)
+            {
+                imgprocRot180UV((uint8_t*)uvPlane, yuvStride, p_width / 2, p_height / 2, 0, p_height / 2);
+            }
+        }
+
+        if (doQuality)
+        {
+            imgprocQuality(srcPixel, yuvStride, p_width, 0, p_height, &quality);
+        }
+
+        if (doStats && !histLater)
+        {
+            imgprocHistogram(srcPixel, yuvStride, p_width, 0, p_height, histogram);
+        }
+
+        if (doSmall)
+        {
+            // Same planes the _grey and _rgb pipes read
+            imgprocDownscaleRaw8(srcPixel, yuvStride, smallFrame, p_width / f, p_width, p_height, f);
+            imgprocDownscaleUV(uvPlane, yuvStride,
+                               smallFrame + (p_width / f) * (p_height / f), p_width / f,
+                               p_width / 2, p_height / 2, f);
+        }
+    }
+
+    if (doPyramid)
+    {
+        // Whatever the band loop didn't get to of level 1, then each smaller level from the one above it
+        const uint8_t* src = frame;
+        uint8_t*       dst = pyramidFrame;
+        int            w   = p_width;
+        int            h   = p_height;
+
+        for (int l = 1; l < configInfo.pyramid_levels; l++)
+        {
+            const int dw = (w + 1) / 2;
+            const int dh = (h + 1) / 2;
+
+            imgprocPyrDown(src, w, w, h, dst, dw, (l == 1) ? pyrRows : 0, dh, pyramidScratch);
+
+            src  = dst;
+            dst += dw * dh;
+            w    = dw;
+            h    = dh;
+        }
+    }
+
+    return frame;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Scores from the sums ProcessPreviewRows collected, childQuality is the right image of a stereo pair
+// -----------------------------------------------------------------------------------------------------------------------------
+static camera_quality_image_t QualityScores(const ImgprocQuality* q)
+{
+    camera_quality_image_t scores;
+    const float            n = (q->samples != 0) ? (float)q->samples : 1.0f;
+
+    scores.sharpness = (float)q->gradient  / n;
+    scores.saturated = (float)q->saturated / n;
+    scores.mean      = (float)q->sum       / n;
+
+    return scores;
+}
+
+void PerCameraMgr::WriteQuality(camera_image_metadata_t meta, const ImgprocQuality* childQuality)
+{
+    camera_quality_metadata_t hdr;
+    memset(&hdr, 0, sizeof(camera_quality_metadata_t));
+
+    hdr.magic           = CAMERA_QUALITY_MAGIC;
+    hdr.num_images      = (childQuality == NULL) ? 1 : 2;
+    hdr.images[0]       = QualityScores(&quality);
+    if(childQuality != NULL){
+        hdr.images[1]   = QualityScores(childQuality);
+    }
+    hdr.meta            = meta;
+    hdr.meta.size_bytes = 0;
+
+    pipe_server_write(qualityOutputChannel, &hdr, sizeof(camera_quality_metadata_t));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Sent after the auto exposure has run so that the AE state is the one that follows from this frame
+// -----------------------------------------------------------------------------------------------------------------------------
+static float HistogramMean(const uint32_t* hist)
+{
+    uint64_t sum   = 0;
+    uint64_t count = 0;
+
+    for(int i = 0; i < 256; i++){
+        sum   += (uint64_t)hist[i] * i;
+        count += hist[i];
+    }
+
+    return (count != 0) ? (float)sum / count : 0.0f;
+}
+
+void PerCameraMgr::WriteStats(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* childFrame)
+{
+    camera_stats_t  stats;
+    const uint32_t* childHistogram = (childFrame != NULL) ? otherMgr->histogram : NULL;
+
+    memset(&stats, 0, sizeof(camera_stats_t));
+
+    // Left to the _enhanced pipe, but its clients went away before it got to this frame
+    const bool yuv = (p_halFmt == HAL3_FMT_YUV);
+
+    if(histogramPending){
+        imgprocHistogram(frame, yuv ? yuvStride : p_width, p_width, 0, p_height, histogram);
+        histogramPending = false;
+    }
+    if(childFrame != NULL && otherMgr->histogramPending){
+        imgprocHistogram(childFrame, yuv ? otherMgr->yuvStride : p_width, p_width, 0, p_height, otherMgr->histogram);
+        otherMgr->histogramPending = false;
+    }
+
+    stats.magic      = CAMERA_STATS_MAGIC;
+    stats.num_images = (childHistogram == NULL) ? 1 : 2;
+
+    memcpy(stats.histogram[0], histogram, sizeof(histogram));
+    stats.msv[0] = HistogramMean(histogram);
+
+    if(childHistogram != NULL){
+        memcpy(stats.histogram[1], childHistogram, sizeof(histogram));
+        stats.msv[1] = HistogramMean(childHistogram);
+    }
+
+    pthread_mutex_lock(&aeMutex);
+    stats.ae_mode        = ae_mode;
+    stats.ae_exposure_ns = setExposure;
+    stats.ae_gain        = setGain;
+    pthread_mutex_unlock(&aeMutex);
+
+    if(ae_mode == AE_LME_HIST){
+        stats.ae_desired_msv = configInfo.ae_hist_info.desired_msv;
+    } else if(ae_mode == AE_LME_MSV){
+        stats.ae_desired_msv = configInfo.ae_msv_info.desired_msv;
+    }
+
+    stats.meta            = meta;
+    stats.meta.size_bytes = 0;
+
+    pipe_server_write(statsOutputChannel, &stats, sizeof(camera_stats_t));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Level 0 and the other camera's levels go straight from their buffers, the header has the offsets of every level
+// -----------------------------------------------------------------------------------------------------------------------------
+void PerCameraMgr::WritePyramid(camera_image_metadata_t meta, uint8_t* frame, uint8_t* childFrame, uint8_t* childPyramid)
+{
+    camera_pyramid_metadata_t pyr;
+    memset(&pyr, 0, sizeof(camera_pyramid_metadata_t));
+
+    pyr.magic       = CAMERA_PYRAMID_MAGIC;
+    pyr.num_levels  = configInfo.pyramid_levels;
+    pyr.num_images  = (childFrame == NULL) ? 1 : 2;
+    pyr.meta        = meta;
+    pyr.meta.format = (childFrame == NULL) ? IMAGE_FORMAT_RAW8 : IMAGE_FORMAT_STEREO_RAW8;
+    pyr.meta.stride = p_width;
+
+    uint32_t offset = 0;
+    for (int i = 0; i < pyr.num_images; i++) {
+        int w = p_width;
+        int h = p_height;
+
+        for (int l = 0; l < pyr.num_levels; l++) {
+            camera_pyramid_level_t &level = pyr.levels[i * pyr.num_levels + l];
+
+            level.width  = w;
+            level.height = h;
+            level.stride = w;
+            level.offset = offset;
+
+            offset += w * h;
+            w       = (w + 1) / 2;
+            h       = (h + 1) / 2;
+        }
+    }
+    pyr.meta.size_bytes = offset;
+
+    const size_t frameBytes = p_width * p_height;
+    const size_t levelBytes = offset / pyr.num_images - frameBytes;
+
+    const void*  bufs[] = {&pyr, frame, pyramidFrame, childFrame, childPyramid};
+    const size_t lens[] = {sizeof(camera_pyramid_metadata_t), frameBytes, levelBytes, frameBytes, levelBytes};
+
+    WriteList(pyramidOutputChannel, 1 + 2 * pyr.num_images, bufs, lens);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Runs on the frame thread, the grid keeps the number of corners (and the time spent sorting them) bounded
+// -----------------------------------------------------------------------------------------------------------------------------
+void PerCameraMgr::WriteFeatures(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* pyramid,
+                                 const uint8_t* childFrame, const uint8_t* childPyramid)
+{
+    camera_features_metadata_t hdr;
+
+    int count = featureDetector->Detect(frame, pyramid, 0, features);
+    if(childFrame != NULL){
+        count += featureDetector->Detect(childFrame, childPyramid, 1, features + count);
+    }
+
+    hdr.magic           = CAMERA_FEATURES_MAGIC;
+    hdr.num_features    = count;
+    hdr.num_levels      = (pyramid != NULL) ? configInfo.features_levels : 1;
+    hdr.threshold       = configInfo.features_threshold;
+    hdr.meta            = GreyMeta(meta, p_width);
+    hdr.meta.size_bytes = count * sizeof(camera_feature_t);
+
+    const void*  bufs[] = {&hdr, features};
+    const size_t lens[] = {sizeof(camera_features_metadata_t), (size_t)hdr.meta.size_bytes};
+
+    WriteList(featuresOutputChannel, 2, bufs, lens);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Undistorts (rectifies for stereo pairs) the RAW8 or luma plane into rectFrame. The rows of both images are split into bands
+// that the worker pool and this thread remap in parallel.
+// -----------------------------------------------------------------------------------------------------------------------------
+static const int RECT_BAND_ROWS = 4 * IMGPROC_BAND_ROWS;
+
+typedef struct RectJobs
+{
+    const ImgprocRemap* maps;           ///< Left (or only) and right remap table
+    const uint8_t*      src[2];         ///< Left (or only) and right image
+    uint8_t*            dst;            ///< Both output images back to back
+    int                 bandsPerImage;  ///< Jobs per image
+} RectJobs;
+
+void PerCameraMgr::RectifyFrame(uint8_t* frame, uint8_t* childFrame)
+{
+    RectJobs jobs;
+
+    jobs.maps          = rectMaps;
+    jobs.src[0]        = frame;
+    jobs.src[1]        = childFrame;
+    jobs.dst           = rectFrame;
+    jobs.bandsPerImage = (p_height + RECT_BAND_ROWS - 1) / RECT_BAND_ROWS;
+
+    workerPool->Run(jobs.bandsPerImage * (childFrame != NULL ? 2 : 1),
+                    [](void* context, int index){
+                        RectJobs*           jobs     = (RectJobs*)context;
+                        int                 image    = index / jobs->bandsPerImage;
+                        const ImgprocRemap* map      = &jobs->maps[image];
+                        int                 rowStart = (index % jobs->bandsPerImage) * RECT_BAND_ROWS;
+                        int                 rowEnd   = std::min(rowStart + RECT_BAND_ROWS, map->height);
+
+                        imgprocRemapBilinear(map, jobs->src[image], jobs->dst + image * map->width * map->height,
+                                             map->width, rowStart, rowEnd);
+                    },
+                    &jobs);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Matches a stereo pair and sends the disparity out on <name>_disparity. Both census transforms and then the matching are
+// split into the matcher's bands for the worker pool.
+// -----------------------------------------------------------------------------------------------------------------------------
+typedef struct DisparityJobs
+{
+    StereoMatcher*  matcher;
+    const uint8_t*  src[2];             ///< Left and right image
+    uint16_t*       disparity;          ///< Output disparities
+    uint8_t*        valid;              ///< Output validity flags
+} DisparityJobs;
+
+void PerCameraMgr::WriteDisparity(camera_image_metadata_t meta, const uint8_t* left, const uint8_t* right)
+{
+    DisparityJobs jobs;
+    const int     bands = stereoMatcher->NumBands();
+
+    jobs.matcher   = stereoMatcher;
+    jobs.src[0]    = left;
+    jobs.src[1]    = right;
+    jobs.disparity = (uint16_t*)disparityFrame;
+    jobs.valid     = disparityFrame + p_width * p_height * sizeof(uint16_t);
+
+    workerPool->Run(2 * bands,
+                    [](void* context, int index){
+                        DisparityJobs* jobs  = (DisparityJobs*)context;
+                        int            bands = jobs->matcher->NumBands();
+
+                        jobs->matcher->Census(index / bands, jobs->src[index / bands], index % bands);
+                    },
+                    &jobs);
+
+    workerPool->Run(bands,
+                    [](void* context, int index){
+                        DisparityJobs* jobs = (DisparityJobs*)context;
+
+                        jobs->matcher->Match(index, jobs->disparity, jobs->valid);
+                    },
+                    &jobs);
+
+    meta.format     = IMAGE_FORMAT_RAW16;
+    meta.stride     = meta.width * sizeof(uint16_t);
+    meta.size_bytes = meta.width * meta.height * (sizeof(uint16_t) + 1);
+
+    WriteImage(disparityOutputChannel, meta, disparityFrame, NULL);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Contrast enhances a frame (or stereo pair) and sends it out on <name>_enhanced. The tiles of both images and then the bands
+// of rows of both images are spread over the worker pool. The tile histograms are the frame's histogram for _stats.
+// -----------------------------------------------------------------------------------------------------------------------------
+typedef struct EnhanceJobs
+{
+    Clahe*          clahe[2];
+    const uint8_t*  src[2];             ///< Left (or only) and right image
+    uint8_t*        dst[2];             ///< Enhanced images
+} EnhanceJobs;
+
+void PerCameraMgr::WriteEnhanced(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* childFrame)
+{
+    EnhanceJobs jobs;
+    const int   images = (childFrame != NULL) ? 2 : 1;
+
+    jobs.clahe[0] = clahe[0];
+    jobs.clahe[1] = clahe[1];
+    jobs.src[0]   = frame;
+    jobs.src[1]   = childFrame;
+    jobs.dst[0]   = enhancedFrame;
+    jobs.dst[1]   = enhancedFrame + p_width * p_height;
+
+    workerPool->Run(images * clahe[0]->NumTiles(),
+                    [](void* context, int index){
+                        EnhanceJobs* jobs  = (EnhanceJobs*)context;
+                        int          tiles = jobs->clahe[0]->NumTiles();
+
+                        jobs->clahe[index / tiles]->Tile(jobs->src[index / tiles], index % tiles);
+                    },
+                    &jobs);
+
+    workerPool->Run(images * clahe[0]->NumBands(),
+                    [](void* context, int index){
+                        EnhanceJobs* jobs  = (EnhanceJobs*)context;
+                        int          bands = jobs->clahe[0]->NumBands();
+
+                        jobs->clahe[index / bands]->Apply(jobs->src[index / bands], jobs->dst[index / bands], index % bands);
+                    },
+                    &jobs);
+
+    if(histogramPending){
+        clahe[0]->AddHistograms(histogram);
+        histogramPending = false;
+    }
+    if(childFrame != NULL && otherMgr->histogramPending){
+        clahe[1]->AddHistograms(otherMgr->histogram);
+        otherMgr->histogramPending = false;
+    }
+
+    WriteImage(enhancedOutputChannel, GreyMeta(meta, p_width), enhancedFrame, (childFrame != NULL) ? jobs.dst[1] : NULL);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Converts a frame (or stereo pair) to each RGB layout that has clients. Both planes are read with the stride of the buffer
+// they are in, the bands of rows of both images are spread over the worker pool.
+// -----------------------------------------------------------------------------------------------------------------------------
+typedef struct RgbJobs
+{
+    const uint8_t*   y[2];              ///< Luma plane of the left (or only) and right image
+    const uint8_t*   uv[2];             ///< Chroma planes
+    int              stride[2];         ///< Stride of both planes of each image
+    uint8_t*         dst[2];            ///< Converted images
+    int              width;
+    int              height;
+    int              bands;
+    ImgprocRgbLayout layout;
+    ImgprocYuvMatrix matrix;
+} RgbJobs;
+
+void PerCameraMgr::WriteRgb(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* childFrame)
+{
+    RgbJobs   jobs;
+    const int images = (childFrame != NULL) ? 2 : 1;
+
+    jobs.y[0]      = frame;
+    jobs.y[1]      = childFrame;
+    jobs.uv[0]     = uvPlane;
+    jobs.uv[1]     = (childFrame != NULL) ? otherMgr->uvPlane : NULL;
+    jobs.stride[0] = yuvStride;
+    jobs.stride[1] = (childFrame != NULL) ? otherMgr->yuvStride : 0;
+    jobs.dst[0]    = rgbFrame;
+    jobs.dst[1]    = rgbFrame + p_width * p_height * 3;
+    jobs.width     = p_width;
+    jobs.height    = p_height;
+    jobs.bands     = configInfo.rgb_threads;
+    jobs.matrix    = configInfo.rgb_bt709 ? IMGPROC_BT709 : IMGPROC_BT601;
+
+    for(int i = 0; i < NUM_RGB_PIPES; i++){
+        if(rgbOutputChannels[i] == -1 || pipe_server_get_num_clients(rgbOutputChannels[i]) <= 0) continue;
+
+        jobs.layout = (ImgprocRgbLayout)i;
+
+        workerPool->Run(images * jobs.bands,
+                        [](void* context, int index){
+                            RgbJobs*  jobs  = (RgbJobs*)context;
+                            const int image = index / jobs->bands;
+                            const int band  = index % jobs->bands;
+
+                            imgprocNV12ToRGB(jobs->y[image], jobs->uv[image], jobs->stride[image], jobs->dst[image],
+                                             jobs->width, jobs->height, jobs->layout, jobs->matrix,
+                                             band * jobs->height / jobs->bands, (band + 1) * jobs->height / jobs->bands);
+                        },
+                        &jobs);
+
+        camera_image_metadata_t rgbMeta = meta;
+        rgbMeta.format     = (childFrame != NULL) ? IMAGE_FORMAT_STEREO_RGB : IMAGE_FORMAT_RGB;
+        rgbMeta.stride     = (jobs.layout == IMGPROC_RGB_PLANAR) ? p_width : p_width * 3;
+        rgbMeta.size_bytes = p_width * p_height * 3 * images;
+
+        WriteImage(rgbOutputChannels[i], rgbMeta, rgbFrame, (childFrame != NULL) ? jobs.dst[1] : NULL);
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Makes the tensor of a frame, or the batch of both images of a stereo pair, the bands of rows of both images are spread over
+// the worker pool. NV12 frames are read in place with the stride of their buffers, RAW8 ones are at the preview width.
+// -----------------------------------------------------------------------------------------------------------------------------
+typedef struct TensorJobs
+{
+    TensorPreproc*   preproc;
+    const uint8_t*   y[2];              ///< Luma (or grey) plane of the left (or only) and right image
+    const uint8_t*   uv[2];             ///< Chroma planes, unused for grey frames
+    int              stride[2];         ///< Stride of the planes of each image
+    uint8_t*         dst;               ///< Tensor batch
+} TensorJobs;
+
+void PerCameraMgr::WriteTensor(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* childFrame)
+{
+    TensorJobs jobs;
+    const bool colour = (p_halFmt == HAL3_FMT_YUV);
+    const int  images = (childFrame != NULL) ? 2 : 1;
+
+    jobs.preproc   = tensorPreproc;
+    jobs.y[0]      = frame;
+    jobs.y[1]      = childFrame;
+    jobs.uv[0]     = colour ? uvPlane : NULL;
+    jobs.uv[1]     = (colour && childFrame != NULL) ? otherMgr->uvPlane : NULL;
+    jobs.stride[0] = colour ? yuvStride : p_width;
+    jobs.stride[1] = (colour && childFrame != NULL) ? otherMgr->yuvStride : p_width;
+    jobs.dst       = tensorFrame;
+
+    workerPool->Run(images * tensorPreproc->NumBands(),
+                    [](void* context, int index){
+                        TensorJobs* jobs  = (TensorJobs*)context;
+                        const int   bands = jobs->preproc->NumBands();
+                        const int   image = index / bands;
+
+                        jobs->preproc->Process(jobs->y[image], jobs->uv[image], jobs->stride[image], jobs->dst, image, index % bands);
+                    },
+                    &jobs);
+
+    const TensorConfig&      ten = configInfo.tensor;
+    camera_tensor_metadata_t hdr;
+
+    hdr.magic            = CAMERA_TENSOR_MAGIC;
+    hdr.type             = ten.type;
+    hdr.layout           = ten.layout;
+    hdr.channel_order    = ten.channels;
+    hdr.n                = images;
+    hdr.c                = tensorPreproc->Channels();
+    hdr.h                = ten.height;
+    hdr.w                = ten.width;
+    hdr.quant_scale      = ten.scale;
+    hdr.quant_zero_point = ten.zero_point;
+    hdr.meta             = meta;
+    hdr.meta.size_bytes  = tensorPreproc->ImageBytes() * images;
+
+    tensorPreproc->Placement(&hdr.scale_x, &hdr.scale_y, &hdr.offset_x, &hdr.offset_y);
+
+    const void*  bufs[] = {&hdr, tensorFrame};
+    const size_t lens[] = {sizeof(camera_tensor_metadata_t), (size_t)hdr.meta.size_bytes};
+
+    WriteList(tensorOutputChannel, 2, bufs, lens);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Demosaics a RAW8 frame (or stereo pair) into colorFrame, the bands of rows of both images are spread over the worker pool.
+// The average time it takes is logged every DEBAYER_LOG_FRAMES frames so the raw path can be compared with the ISP one.
+// -----------------------------------------------------------------------------------------------------------------------------
+static const int DEBAYER_LOG_FRAMES = 100;
+
+typedef struct DebayerJobs
+{
+    const uint8_t* src[2];              ///< RAW8 left (or only) and right image
+    uint8_t*       dst[2];              ///< Their RGB or NV12 images
+    uint8_t*       scratch;             ///< Row pairs of every band for NV12
+    int            width;
+    int            height;
+    int            bands;
+    ImgprocBayer   pattern;
+    bool           edgeAware;
+} DebayerJobs;
+
+void PerCameraMgr::WriteColor(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* childFrame)
+{
+    DebayerJobs jobs;
+    const int   images    = (childFrame != NULL) ? 2 : 1;
+    const int   frameSize = p_width * p_height * (configInfo.debayer_nv12 ? 3 : 6) / 2;
+
+    // Rotating an even sized image by 180 degrees moves every pixel to the other row and column parity
+    jobs.src[0]    = frame;
+    jobs.src[1]    = childFrame;
+    jobs.dst[0]    = colorFrame;
+    jobs.dst[1]    = colorFrame + frameSize;
+    jobs.scratch   = debayerScratch;
+    jobs.width     = p_width;
+    jobs.height    = p_height;
+    jobs.bands     = configInfo.debayer_threads;
+    jobs.pattern   = (ImgprocBayer)(configInfo.flip ? configInfo.bayer_pattern ^ 3 : configInfo.bayer_pattern);
+    jobs.edgeAware = configInfo.debayer_edge;
+
+    struct timespec startTs, endTs;
+    clock_gettime(CLOCK_MONOTONIC, &startTs);
+
+    workerPool->Run(images * jobs.bands,
+                    [](void* context, int index){
+                        DebayerJobs* jobs  = (DebayerJobs*)context;
+                        const int    image = index / jobs->bands;
+                        const int    band  = index % jobs->bands;
+                        const int    start = (band * jobs->height / jobs->bands) & ~1;
+                        const int    end   = ((band + 1) * jobs->height / jobs->bands) & ~1;
+
+                        if(jobs->scratch != NULL){
+                            uint8_t* y = jobs->dst[image];
+
+                            imgprocDebayerNV12(jobs->src[image], jobs->width, jobs->width, jobs->height, jobs->pattern,
+                                               jobs->edgeAware, y, y + jobs->width * jobs->height, jobs->width,
+                                               jobs->scratch + index * IMGPROC_DEBAYER_SCRATCH(jobs->width), start, end);
+                        } else {
+                            imgprocDebayer(jobs->src[image], jobs->width, jobs->width, jobs->height, jobs->pattern,
+                                           jobs->edgeAware, jobs->dst[image], jobs->width * 3, start, end);
+                        }
+                    },
+                    &jobs);
+
+    clock_gettime(CLOCK_MONOTONIC, &endTs);
+    debayerNs += (endTs.tv_sec - startTs.tv_sec) * 1000000000LL + (endTs.tv_nsec - startTs.tv_nsec);
+
+    if(++debayerFrames == DEBAYER_LOG_FRAMES){
+        const double ms = debayerNs / 1e6 / debayerFrames;
+
+        M_DEBUG("Camera %s demosaiced %d %dx%d %s frame(s) in %.2fms on average (%.0f Mpixel/s, %d threads)\n",
+            name, images, p_width, p_height, configInfo.debayer_nv12 ? "NV12" : "RGB", ms,
+            images * p_width * p_height / (ms * 1000.0), configInfo.debayer_threads);
+
+        debayerNs     = 0;
+        debayerFrames = 0;
+    }
+
+    camera_image_metadata_t colorMeta = meta;
+    if(configInfo.debayer_nv12){
+        colorMeta.format = (childFrame != NULL) ? IMAGE_FORMAT_STEREO_NV12 : IMAGE_FORMAT_NV12;
+        colorMeta.stride = p_width;
+    } else {
+        colorMeta.format = (childFrame != NULL) ? IMAGE_FORMAT_STEREO_RGB : IMAGE_FORMAT_RGB;
+        colorMeta.stride = p_width * 3;
+    }
+    colorMeta.size_bytes = frameSize * images;
+
+    WriteImage(colorOutputChannel, colorMeta, colorFrame, (childFrame != NULL) ? jobs.dst[1] : NULL);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Compresses the RAW8 (or luma) image(s) of a frame for the _compressed pipe. The ratio and the throughput are logged every
+// COMPRESS_LOG_FRAMES frames.
+// -----------------------------------------------------------------------------------------------------------------------------
+static const int COMPRESS_LOG_FRAMES = 100;
+
+void PerCameraMgr::WriteCompressed(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* childFrame)
+{
+    camera_compressed_metadata_t hdr;
+    const uint8_t* images[2] = {frame, childFrame};
+    const int      strides[2] = {p_halFmt == HAL3_FMT_YUV ? yuvStride : p_width,
+                                 (p_halFmt == HAL3_FMT_YUV && childFrame != NULL) ? otherMgr->yuvStride : p_width};
+
+    hdr.magic      = CAMERA_COMPRESSED_MAGIC;
+    hdr.num_images = (childFrame != NULL) ? 2 : 1;
+    hdr.image_bytes[0] = 0;
+    hdr.image_bytes[1] = 0;
+
+    struct timespec startTs, endTs;
+    clock_gettime(CLOCK_MONOTONIC, &startTs);
+
+    for(int i = 0; i < hdr.num_images; i++){
+        const int size = camera_codec_encode(images[i], strides[i], p_width, p_height,
+                                             compressedFrame + hdr.image_bytes[0], compressedMaxSize);
+
+        if(size < 0){
+            M_ERROR("Camera %s failed to compress frame %d\n", name, meta.frame_id);
+            return;
+        }
+
+        hdr.image_bytes[i] = size;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &endTs);
+    compressNs    += (endTs.tv_sec - startTs.tv_sec) * 1000000000LL + (endTs.tv_nsec - startTs.tv_nsec);
+    compressBytes += hdr.image_bytes[0] + hdr.image_bytes[1];
+
+    if(++compressFrames == COMPRESS_LOG_FRAMES){
+        const double pixels = (double)hdr.num_images * p_width * p_height * compressFrames;
+
+        M_DEBUG("Camera %s compressed %d %dx%d image(s) in %.2fms on average (%.0f MB/s), ratio %.2f\n",
+            name, hdr.num_images, p_width, p_height, compressNs / 1e6 / compressFrames,
+            pixels * 1000.0 / compressNs, pixels / compressBytes);
+
+        compressNs     = 0;
+        compressBytes  = 0;
+        compressFrames = 0;
+    }
+
+    hdr.meta            = GreyMeta(meta, p_width);
+    hdr.meta.size_bytes = hdr.image_bytes[0] + hdr.image_bytes[1];
+
+    const void*  bufs[] = {&hdr, compressedFrame};
+    const size_t lens[] = {sizeof(camera_compressed_metadata_t), (size_t)hdr.meta.size_bytes};
+
+    WriteList(compressedOutputChannel, 2, bufs, lens);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// The _mjpeg pipe and the preview snapshots share one encoder, a frame is encoded once for both. The bands of MCU rows of the
+// stacked images are spread over the worker pool, or all done here if the camera doesn't have one. The encoding time and the
+// JPEG size are logged every JPEG_LOG_FRAMES frames.
+// -----------------------------------------------------------------------------------------------------------------------------
+static const int JPEG_LOG_FRAMES = 100;
+
+typedef struct JpegJobs
+{
+    JpegEncoder*     encoder;
+    const uint8_t*   y[2];              ///< Luma (or grey) plane of the left (or only) and right image
+    const uint8_t*   uv[2];             ///< Chroma planes, unused for grey frames
+    int              stride[2];         ///< Stride of the planes of each image
+} JpegJobs;
+
+bool PerCameraMgr::JpegNeeded()
+{
+    if(numPreviewSnapshots > 0) return true;
+
+    return mjpegOutputChannel != -1 && pipe_server_get_num_clients(mjpegOutputChannel) > 0;
+}
+
+void PerCameraMgr::WriteJpeg(camera_image_metadata_t meta, const uint8_t* frame, const uint8_t* childFrame)
+{
+    const bool colour = (p_halFmt == HAL3_FMT_YUV);
+    const int  images = (childFrame != NULL) ? 2 : 1;
 
-    uint8_t* src_data = (uint8_t*)bufferBlockInfo->vaddress;
-    FILE* file_descriptor = fopen(path, "wb");
-    if(! file_descriptor){
+    // Leave it to the next frame, ChromaNeeded() knows about it now
+    if(colour && (!chromaValid || (childFrame != NULL && !otherMgr->chromaValid))) return;
 
-        //Check to see if we were just missing parent directories
-        CreateParentDirs(path);
+    // Scheduled like the reduced rate pipes
+    bool toPipe = false;
+    if(mjpegOutputChannel != -1 && pipe_server_get_num_clients(mjpegOutputChannel) > 0){
+        const int64_t slack_ns  = 500000000LL / configInfo.fps;
+        const int64_t period_ns = 1000000000LL / configInfo.mjpeg_fps;
 
-        file_descriptor = fopen(path, "wb");
+        if(meta.timestamp_ns >= mjpegNextNs - slack_ns){
+            mjpegNextNs += period_ns;
+            if(mjpegNextNs < meta.timestamp_ns) mjpegNextNs = meta.timestamp_ns + period_ns;
 
-        if(! file_descriptor){
-            M_ERROR("failed to open file descriptor for snapshot save\n");
-            return;
+            toPipe = true;
         }
     }
 
-    if (format == HAL_PIXEL_FORMAT_BLOB) {
+    list<char *> files;
+    if(numPreviewSnapshots > 0){
+        pthread_mutex_lock(&previewSnapshotMutex);
+        files.swap(previewSnapshotQueue);
+        numPreviewSnapshots = 0;
+        pthread_mutex_unlock(&previewSnapshotMutex);
+    }
 
-        fwrite(src_data, size, 1, file_descriptor);
+    if(!toPipe && files.empty()) return;
+
+    if(jpegEncoder == NULL){
+        jpegEncoder = new JpegEncoder(p_width, p_height, images, colour, configInfo.mjpeg_quality,
+                                      (workerPool != NULL) ? configInfo.mjpeg_threads : 1);
+    }
+
+    JpegJobs jobs;
 
+    jobs.encoder   = jpegEncoder;
+    jobs.y[0]      = frame;
+    jobs.y[1]      = childFrame;
+    jobs.uv[0]     = colour ? uvPlane : NULL;
+    jobs.uv[1]     = (colour && childFrame != NULL) ? otherMgr->uvPlane : NULL;
+    jobs.stride[0] = colour ? yuvStride : p_width;
+    jobs.stride[1] = (colour && childFrame != NULL) ? otherMgr->yuvStride : p_width;
+
+    struct timespec startTs, endTs;
+    clock_gettime(CLOCK_MONOTONIC, &startTs);
+
+    if(workerPool != NULL){
+        workerPool->Run(jpegEncoder->NumBands(),
+                        [](void* context, int index){
+                            JpegJobs* jobs = (JpegJobs*)context;
+
+                            jobs->encoder->EncodeBand(jobs->y, jobs->uv, jobs->stride, index);
+                        },
+                        &jobs);
     } else {
-        M_ERROR("%s recieved frame in unsuppored format\n", __FUNCTION__);
+        for(int band = 0; band < jpegEncoder->NumBands(); band++){
+            jpegEncoder->EncodeBand(jobs.y, jobs.uv, jobs.stride, band);
+        }
     }
 
-    fclose(file_descriptor);
-}
+    int            size;
+    const uint8_t* jpeg = jpegEncoder->Finish(&size);
 
-static void Mipi12ToRaw16(camera_image_metadata_t meta, uint8_t *raw12Buf, uint16_t *raw16Buf) 
-{
-    // Convert image buffer from MIPI RAW12 to RAW16 format
-    // ToF MIPI RAW12 is stored in the format of:
-    // P1[11:4] P2[11:4] P2[3:0] P1[3:0]
-    // 2 pixels occupy 3 bytes, no padding needed
+    clock_gettime(CLOCK_MONOTONIC, &endTs);
 
-    // ToF data is 12bit held in an 8bit format, use seperate counter to track 1.5x difference in data size
-    int buf8Idx, buf16Idx;
-    for (buf8Idx = 0, buf16Idx = 0; buf16Idx < meta.size_bytes / 2; buf8Idx += 3, buf16Idx++){
-        raw16Buf[(buf16Idx*2)]   = (raw12Buf[buf8Idx] << 4) + (raw12Buf[buf8Idx + 2] & 0x0F);
-        raw16Buf[(buf16Idx*2)+1] = (raw12Buf[buf8Idx + 1] << 4) + ((raw12Buf[buf8Idx + 2] & 0xF0) >> 4);
+    if(jpeg == NULL){
+        M_ERROR("Camera %s frame %d didn't fit in the JPEG buffer\n", name, meta.frame_id);
+    } else {
+        jpegNs    += (endTs.tv_sec - startTs.tv_sec) * 1000000000LL + (endTs.tv_nsec - startTs.tv_nsec);
+        jpegBytes += size;
+
+        if(++jpegFrames == JPEG_LOG_FRAMES){
+            M_DEBUG("Camera %s JPEG encoded %d %dx%d image(s) in %.2fms on average, %lld bytes on average\n",
+                name, images, p_width, p_height, jpegNs / 1e6 / jpegFrames, (long long)(jpegBytes / jpegFrames));
+
+            jpegNs     = 0;
+            jpegBytes  = 0;
+            jpegFrames = 0;
+        }
     }
-}
 
+    if(toPipe && jpeg != NULL){
+        // Stereo pairs are one JPEG with the left image on top
+        camera_image_metadata_t jpegMeta = meta;
+        jpegMeta.format     = IMAGE_FORMAT_JPG;
+        jpegMeta.height     = p_height * images;
+        jpegMeta.stride     = p_width;
+        jpegMeta.size_bytes = size;
+
+        WriteImage(mjpegOutputChannel, jpegMeta, (uint8_t*)jpeg, NULL);
+    }
+
+    for(char* filename : files){
+        if(jpeg != NULL){
+            FILE* file_descriptor = OpenSnapshotFile(filename);
+
+            if(file_descriptor){
+                M_PRINT("Camera: %s writing preview snapshot to :\"%s\"\n", name, filename);
+                fwrite(jpeg, size, 1, file_descriptor);
+                fclose(file_descriptor);
+            }
+        }
+
+        free(filename);
+    }
+}
 
 void PerCameraMgr::ProcessPreviewFrame(image_result result)
 {
@@ -791,12 +2141,15 @@ void PerCameraMgr::ProcessPreviewFrame(image_result result)
         return;
     }
 
+    ProcessPreviewImage(imageInfo, (uint8_t*)bufferBlockInfo->vaddress, bufferBlockInfo);
+}
+
+void PerCameraMgr::ProcessPreviewImage(camera_image_metadata_t imageInfo, uint8_t* srcPixel, BufferBlock* bufferBlockInfo)
+{
     imageInfo.magic_number = CAMERA_MAGIC_NUMBER;
     imageInfo.width        = p_width;
     imageInfo.height       = p_height;
 
-    uint8_t* srcPixel      = (uint8_t*)bufferBlockInfo->vaddress;
-
 
     //Tof is different from the rest, pass the data off to spectre then send it out
     if(configInfo.type == CAMTYPE_TOF) {
@@ -819,13 +2172,18 @@ void PerCameraMgr::ProcessPreviewFrame(image_result result)
         return;
     }
 
+    if(configInfo.latest_only && imageInfo.timestamp_ns >= skipReportNs){
+        ReportSkippedFrames(false);
+        skipReportNs = imageInfo.timestamp_ns + SKIP_REPORT_PERIOD_S * 1000000000LL;
+    }
+
 
     if (p_halFmt == HAL_PIXEL_FORMAT_RAW10)
     {
         M_VERBOSE("Preview format HAL_PIXEL_FORMAT_RAW10\n");
 
-        // check the first frame to see if we actually got a raw10 frame or if it's actually raw8
-        if(imageInfo.frame_id == 1){
+        // check the first frame to see if we actually got a raw10 frame or if it's actually raw8, recordings are always raw8
+        if(imageInfo.frame_id == 1 && replay == NULL){
             M_DEBUG("%s received raw10 frame, checking to see if is actually raw8\n", name);
 
             if((is10bit = Check10bit(srcPixel, p_width, p_height))){
@@ -838,31 +2196,99 @@ void PerCameraMgr::ProcessPreviewFrame(image_result result)
         imageInfo.format     = IMAGE_FORMAT_RAW8;
         imageInfo.size_bytes = p_width * p_height;
         imageInfo.stride     = p_width;
-
-        if(is10bit){
-            ConvertTo8bitRaw(srcPixel,
-                             p_width,
-                             p_height);
-        }
     }
     else if (p_halFmt == HAL3_FMT_YUV)
     {
         M_VERBOSE("Preview format HAL3_FMT_YUV\n");
         imageInfo.format     = IMAGE_FORMAT_NV12;
-        bufferMakeYUVContiguous(bufferBlockInfo);
+        // Every pipe sends packed width byte rows. Buffers without row padding only need the UV plane moved up behind the
+        // luma, and only if a client wants the chroma. Padded ones (e.g. 4056 wide on QRB5165) always get re-pitched so the
+        // luma rows line up. Recordings are packed already.
+        const bool chromaNeeded = ChromaNeeded();
+        const bool contiguous   = replay == NULL && (chromaNeeded || (int)bufferBlockInfo->stride != p_width);
+        if(contiguous){
+            bufferMakeYUVContiguous(bufferBlockInfo);
+        }
+
+        // The chroma is only flipped along with the luma if a client wanted it when we got here
+        chromaValid = chromaNeeded || !configInfo.flip || replay != NULL;
+
+        uvPlane   = (contiguous || replay != NULL) ? srcPixel + p_width * p_height : bufferGetUVPlane(bufferBlockInfo);
+        yuvStride = p_width;
         ///<@todo assuming 420 format and multiplying by 1.5 because NV21/NV12 is 12 bits per pixel
-        imageInfo.size_bytes = (bufferBlockInfo->width * bufferBlockInfo->height * 1.5);
+        imageInfo.size_bytes = (p_width * p_height * 1.5);
 
     } else {
         M_ERROR("Camera: %s received invalid preview format, stopping\n", name);
         EStopCameraServer();
     }
 
+    srcPixel = ProcessPreviewRows(bufferBlockInfo, srcPixel);
+
     if (partnerMode == MODE_MONO){
         // Ship the frame out of the camera server
-        pipe_server_write_camera_frame(outputChannel, imageInfo, srcPixel);
+        WriteImage(outputChannel, imageInfo, srcPixel, NULL);
         M_VERBOSE("Sent frame %d through pipe %s\n", imageInfo.frame_id, name);
 
+        if(rawRecorder != NULL && rawRecorder->IsRecording()){
+            rawRecorder->AddFrame(imageInfo, srcPixel, NULL);
+        }
+
+        if(pipe_server_get_num_clients(shmOutputChannel) > 0){
+            shmRing->Publish(shmOutputChannel, imageInfo, srcPixel);
+        }
+
+        WriteDecimatedFrames(imageInfo, srcPixel, NULL);
+
+        if(smallValid){
+            WriteImage(smallOutputChannel, SmallMeta(imageInfo, configInfo.small_scale), smallFrame, NULL);
+        }
+
+        if(pipe_server_get_num_clients(greyOutputChannel) > 0){
+            WriteImage(greyOutputChannel, GreyMeta(imageInfo, yuvStride), srcPixel, NULL);
+        }
+
+        if(qualityValid){
+            WriteQuality(imageInfo, NULL);
+        }
+
+        if(pyramidValid && pipe_server_get_num_clients(pyramidOutputChannel) > 0){
+            WritePyramid(imageInfo, srcPixel, NULL, NULL);
+        }
+
+        if(featureDetector != NULL && pipe_server_get_num_clients(featuresOutputChannel) > 0){
+            WriteFeatures(imageInfo, srcPixel, pyramidValid ? pyramidFrame : NULL, NULL, NULL);
+        }
+
+        if(rectFrame != NULL && pipe_server_get_num_clients(rectOutputChannel) > 0){
+            RectifyFrame(srcPixel, NULL);
+            WriteImage(rectOutputChannel, GreyMeta(imageInfo, p_width), rectFrame, NULL);
+        }
+
+        if(clahe[0] != NULL && pipe_server_get_num_clients(enhancedOutputChannel) > 0){
+            WriteEnhanced(imageInfo, srcPixel, NULL);
+        }
+
+        if(rgbFrame != NULL){
+            WriteRgb(imageInfo, srcPixel, NULL);
+        }
+
+        if(tensorPreproc != NULL && pipe_server_get_num_clients(tensorOutputChannel) > 0){
+            WriteTensor(imageInfo, srcPixel, NULL);
+        }
+
+        if(colorFrame != NULL && pipe_server_get_num_clients(colorOutputChannel) > 0){
+            WriteColor(imageInfo, srcPixel, NULL);
+        }
+
+        if(compressedFrame != NULL && pipe_server_get_num_clients(compressedOutputChannel) > 0){
+            WriteCompressed(imageInfo, srcPixel, NULL);
+        }
+
+        if(JpegNeeded()){
+            WriteJpeg(imageInfo, srcPixel, NULL);
+        }
+
         int64_t    new_exposure_ns;
         int32_t    new_gain;
 
@@ -894,6 +2320,10 @@ void PerCameraMgr::ProcessPreviewFrame(image_result result)
         }
         pthread_mutex_unlock(&aeMutex);
 
+        if(statsValid){
+            WriteStats(imageInfo, srcPixel, NULL);
+        }
+
     } else if (partnerMode == MODE_STEREO_MASTER){
 
         switch (imageInfo.format){
@@ -964,9 +2394,87 @@ void PerCameraMgr::ProcessPreviewFrame(image_result result)
         }
 
         // Ship the frame out of the camera server
-        pipe_server_write_stereo_frame(outputChannel, imageInfo, srcPixel, childFrame);
+        WriteImage(outputChannel, imageInfo, srcPixel, childFrame);
         M_VERBOSE("Sent frame %d through pipe %s\n", imageInfo.frame_id, name);
 
+        if(rawRecorder != NULL && rawRecorder->IsRecording()){
+            rawRecorder->AddFrame(imageInfo, srcPixel, childFrame);
+        }
+
+        if(pipe_server_get_num_clients(shmOutputChannel) > 0){
+            shmRing->Publish(shmOutputChannel, imageInfo, srcPixel, childFrame);
+        }
+
+        WriteDecimatedFrames(imageInfo, srcPixel, childFrame);
+
+        // The child manager made its half while we were waiting for it
+        if(smallValid && otherMgr->smallValid){
+            WriteImage(smallOutputChannel, SmallMeta(imageInfo, configInfo.small_scale), smallFrame, otherMgr->smallFrame);
+        }
+
+        if(pipe_server_get_num_clients(greyOutputChannel) > 0){
+            WriteImage(greyOutputChannel, GreyMeta(imageInfo, yuvStride), srcPixel, childFrame);
+        }
+
+        if(qualityValid && otherMgr->qualityValid){
+            WriteQuality(imageInfo, &otherMgr->quality);
+        }
+
+        const bool pyramidsValid = pyramidValid && otherMgr->pyramidValid;
+
+        if(pyramidsValid && pipe_server_get_num_clients(pyramidOutputChannel) > 0){
+            WritePyramid(imageInfo, srcPixel, childFrame, otherMgr->pyramidFrame);
+        }
+
+        if(featureDetector != NULL && pipe_server_get_num_clients(featuresOutputChannel) > 0){
+            WriteFeatures(imageInfo, srcPixel, pyramidsValid ? pyramidFrame : NULL,
+                          childFrame, pyramidsValid ? otherMgr->pyramidFrame : NULL);
+        }
+
+        const bool rectWanted      = rectFrame != NULL && pipe_server_get_num_clients(rectOutputChannel) > 0;
+        const bool disparityWanted = stereoMatcher != NULL && pipe_server_get_num_clients(disparityOutputChannel) > 0;
+
+        // The matcher works on the rectified pair when there is a calibration for it
+        if(rectFrame != NULL && (rectWanted || disparityWanted)){
+            RectifyFrame(srcPixel, childFrame);
+        }
+
+        if(rectWanted){
+            WriteImage(rectOutputChannel, GreyMeta(imageInfo, p_width), rectFrame, rectFrame + p_width * p_height);
+        }
+
+        if(disparityWanted){
+            if(rectFrame != NULL){
+                WriteDisparity(imageInfo, rectFrame, rectFrame + p_width * p_height);
+            } else {
+                WriteDisparity(imageInfo, srcPixel, childFrame);
+            }
+        }
+
+        if(clahe[0] != NULL && pipe_server_get_num_clients(enhancedOutputChannel) > 0){
+            WriteEnhanced(imageInfo, srcPixel, childFrame);
+        }
+
+        if(rgbFrame != NULL){
+            WriteRgb(imageInfo, srcPixel, childFrame);
+        }
+
+        if(tensorPreproc != NULL && pipe_server_get_num_clients(tensorOutputChannel) > 0){
+            WriteTensor(imageInfo, srcPixel, childFrame);
+        }
+
+        if(colorFrame != NULL && pipe_server_get_num_clients(colorOutputChannel) > 0){
+            WriteColor(imageInfo, srcPixel, childFrame);
+        }
+
+        if(compressedFrame != NULL && pipe_server_get_num_clients(compressedOutputChannel) > 0){
+            WriteCompressed(imageInfo, srcPixel, childFrame);
+        }
+
+        if(JpegNeeded()){
+            WriteJpeg(imageInfo, srcPixel, childFrame);
+        }
+
         // Run Auto Exposure
         int64_t    new_exposure_ns;
         int32_t    new_gain;
@@ -1011,6 +2519,10 @@ void PerCameraMgr::ProcessPreviewFrame(image_result result)
         }
         pthread_mutex_unlock(&aeMutex);
 
+        if(statsValid && otherMgr->statsValid){
+            WriteStats(imageInfo, srcPixel, childFrame);
+        }
+
         //Clear the pointers and signal the child thread for cleanup
         childFrame = NULL;
         pthread_mutex_unlock(&stereoMutex);
@@ -1070,22 +2582,22 @@ void PerCameraMgr::ProcessPreviewFrame(image_result result)
 void PerCameraMgr::ProcessEncodeFrame(image_result result)
 {
 
-    BufferBlock* bufferBlockInfo = bufferGetBufferInfo(&e_bufferGroup, result.second.buffer);
+    EncodeStream* e = GetEncodeStream(result.second.stream);
+    BufferBlock* bufferBlockInfo = bufferGetBufferInfo(&e->bufferGroup, result.second.buffer);
 
-    fprintf(stderr, "%s, %d\n", __FUNCTION__, result.first );
     camera_image_metadata_t meta;
     if(getMeta(result.first, &meta)) {
         M_WARN("Trying to process encode buffer without metadata\n");
-        bufferPush(e_bufferGroup, result.second.buffer);
+        bufferPush(e->bufferGroup, result.second.buffer);
         return;
     }
 
-    meta.width = e_width;
-    meta.height = e_height;
+    meta.width = e->profile.width;
+    meta.height = e->profile.height;
 
     // bufferMakeYUVContiguous(bufferBlockInfo);
 
-    pVideoEncoder->ProcessFrameToEncode(meta, bufferBlockInfo);
+    e->pVideoEncoder->ProcessFrameToEncode(meta, bufferBlockInfo);
 }
 
 void PerCameraMgr::ProcessSnapshotFrame(image_result result)
@@ -1338,16 +2850,21 @@ int PerCameraMgr::ProcessOneCaptureRequest(int frameNumber)
     request.num_output_buffers ++;
     streamBufferList.push_back(pstreamBuffer);
 
-    if(en_encode && pipe_server_get_num_clients(encodeOutputChannel)){
+    // Encoders are only fed while someone is listening to their pipe or they are recording
+    for(int i = 0; i < numEncodeStreams; i++){
+
+        if(!pipe_server_get_num_clients(e_streams[i].outputChannel) &&
+           !e_streams[i].pVideoEncoder->IsRecording()) continue;
 
         camera3_stream_buffer_t estreamBuffer;
-        if ((estreamBuffer.buffer   = (const native_handle_t**)bufferPop(e_bufferGroup)) == NULL) {
-            M_ERROR("Failed to get buffer for encoder stream: Cam(%s), Frame(%d)\n", name, frameNumber);
-            EStopCameraServer();
-            return -1;
+        // Don't hold up the whole request waiting on a slow encoder, just skip this frame for it
+        if ((estreamBuffer.buffer   = (const native_handle_t**)bufferTryPop(e_streams[i].bufferGroup)) == NULL) {
+            M_VERBOSE("No free buffer for encoder stream %s, skipping: Cam(%s), Frame(%d)\n", e_streams[i].profile.suffix, name, frameNumber);
+            e_streams[i].pVideoEncoder->CountSkippedNoBuffer();
+            continue;
         }
 
-        estreamBuffer.stream        = &e_stream;
+        estreamBuffer.stream        = &e_streams[i].stream;
         estreamBuffer.status        = 0;
         estreamBuffer.acquire_fence = -1;
         estreamBuffer.release_fence = -1;
@@ -1471,13 +2988,51 @@ void* PerCameraMgr::ThreadIssueCaptureRequests()
     return NULL;
 }
 
+// -----------------------------------------------------------------------------------------------------------------------------
+// Hands the frames of a recording to the same processing the camera's frames get, as the capture results would arrive. The
+// child of a stereo pair replays the right images from its own mapping of the file, the pairing then works as it does for
+// the camera since both see the same timestamps.
+// -----------------------------------------------------------------------------------------------------------------------------
+void* PerCameraMgr::ThreadReplay()
+{
+    char buf[16];
+    sprintf(buf, "cam%d-replay", cameraId);
+    pthread_setname_np(pthread_self(), buf);
+
+    M_VERBOSE("Entered thread: %s(tid: %lu)\n", buf, syscall(SYS_gettid));
+
+    const int image = (partnerMode == MODE_STEREO_SLAVE) ? 1 : 0;
+    int       frame = 0;
+
+    struct timespec startTs, endTs;
+    clock_gettime(CLOCK_MONOTONIC, &startTs);
+
+    for (; frame < replay->NumFrames() && !EStopped; frame++)
+    {
+        if(!replay->WaitForFrame(frame, &stopped)) break;
+
+        ProcessPreviewImage(*replay->GetMeta(frame), replay->GetImage(frame, image), NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &endTs);
+    double seconds = (endTs.tv_sec - startTs.tv_sec) + (endTs.tv_nsec - startTs.tv_nsec) / 1e9;
+
+    M_PRINT("Camera %s replayed %d of %d frames in %.2fs (%.1f fps), at most %.1fms behind schedule\n",
+        name, frame, replay->NumFrames(), seconds, seconds > 0 ? frame / seconds : 0.0, replay->MaxLateNs() / 1e6);
+
+    return NULL;
+}
+
 enum AECommandVals {
     SET_EXP_GAIN,
     SET_EXP,
     SET_GAIN,
     START_AE,
     STOP_AE,
-    SNAPSHOT
+    SNAPSHOT,
+    START_RAW_RECORD,
+    STOP_RAW_RECORD,
+    SNAPSHOT_PREVIEW
 };
 static const char* CmdStrings[] =
 {
@@ -1486,7 +3041,10 @@ static const char* CmdStrings[] =
     "set_gain",
     "start_ae",
     "stop_ae",
-    "snapshot"
+    "snapshot",
+    "start_raw_record",
+    "stop_raw_record",
+    "snapshot_preview"
 };
 
 int PerCameraMgr::SetupPipes()
@@ -1511,14 +3069,210 @@ int PerCameraMgr::SetupPipes()
         info.size_bytes = 64*1024*1024;
 
         pipe_server_create(outputChannel, info, SERVER_FLAG_EN_CONTROL_PIPE);
+        AddSkipCounter(outputChannel, info.name);
 
         pipe_server_set_available_control_commands(outputChannel, cont_cmds);
 
-        if(en_encode){
-            char encode_name[32];
-            snprintf(encode_name, 31, "%s_encoded", name);
-            strcpy(info.name, encode_name);
-            pipe_server_create(encodeOutputChannel, info, 0);
+        // Same frames as the main pipe, but the images go through shared memory
+        shmOutputChannel = pipe_server_get_next_available_channel();
+        shmRing          = new ShmRing(name);
+
+        pipe_info_t shmInfo;
+        snprintf(shmInfo.name, 31, "%s_shm", name);
+        strcpy(shmInfo.type       , "camera_shm_desc_t");
+        strcpy(shmInfo.server_name, PROCESS_NAME);
+        shmInfo.size_bytes = 64*1024;
+
+        pipe_server_create(shmOutputChannel, shmInfo, 0);
+
+        if(smallFrame != NULL){
+            smallOutputChannel = pipe_server_get_next_available_channel();
+
+            pipe_info_t smallInfo = info;
+            snprintf(smallInfo.name, 31, "%s_small", name);
+            smallInfo.size_bytes = 16*1024*1024;
+
+            pipe_server_create(smallOutputChannel, smallInfo, 0);
+            AddSkipCounter(smallOutputChannel, smallInfo.name);
+        }
+
+        if(pyramidFrame != NULL){
+            pyramidOutputChannel = pipe_server_get_next_available_channel();
+
+            pipe_info_t pyrInfo = info;
+            snprintf(pyrInfo.name, 31, "%s_pyramid", name);
+            strcpy(pyrInfo.type, "camera_pyramid_metadata_t");
+
+            pipe_server_create(pyramidOutputChannel, pyrInfo, 0);
+            AddSkipCounter(pyramidOutputChannel, pyrInfo.name);
+        }
+
+        if(rectFrame != NULL){
+            rectOutputChannel = pipe_server_get_next_available_channel();
+
+            pipe_info_t rectInfo = info;
+            snprintf(rectInfo.name, 31, "%s_rect", name);
+
+            pipe_server_create(rectOutputChannel, rectInfo, 0);
+            AddSkipCounter(rectOutputChannel, rectInfo.name);
+        }
+
+        if(stereoMatcher != NULL){
+            disparityOutputChannel = pipe_server_get_next_available_channel();
+
+            pipe_info_t disparityInfo = info;
+            snprintf(disparityInfo.name, 31, "%s_disparity", name);
+
+            pipe_server_create(disparityOutputChannel, disparityInfo, 0);
+            AddSkipCounter(disparityOutputChannel, disparityInfo.name);
+        }
+
+        // Tiny fixed size packets, one per frame
+        qualityOutputChannel = pipe_server_get_next_available_channel();
+
+        pipe_info_t qualityInfo = info;
+        snprintf(qualityInfo.name, 31, "%s_quality", name);
+        strcpy(qualityInfo.type, "camera_quality_metadata_t");
+        qualityInfo.size_bytes = 256*1024;
+
+        pipe_server_create(qualityOutputChannel, qualityInfo, 0);
+
+        statsOutputChannel = pipe_server_get_next_available_channel();
+
+        pipe_info_t statsInfo = info;
+        snprintf(statsInfo.name, 31, "%s_stats", name);
+        strcpy(statsInfo.type, "camera_stats_t");
+        statsInfo.size_bytes = 1024*1024;
+
+        pipe_server_create(statsOutputChannel, statsInfo, 0);
+
+        if(clahe[0] != NULL){
+            enhancedOutputChannel = pipe_server_get_next_available_channel();
+
+            pipe_info_t enhancedInfo = info;
+            snprintf(enhancedInfo.name, 31, "%s_enhanced", name);
+
+            pipe_server_create(enhancedOutputChannel, enhancedInfo, 0);
+            AddSkipCounter(enhancedOutputChannel, enhancedInfo.name);
+        }
+
+        for(int i = 0; rgbFrame != NULL && i < NUM_RGB_PIPES; i++){
+            if(!(configInfo.rgb_pipes & (1 << i))) continue;
+
+            rgbOutputChannels[i] = pipe_server_get_next_available_channel();
+
+            pipe_info_t rgbInfo = info;
+            snprintf(rgbInfo.name, 31, "%s_%s", name, RGB_PIPE_NAMES[i]);
+
+            pipe_server_create(rgbOutputChannels[i], rgbInfo, 0);
+            AddSkipCounter(rgbOutputChannels[i], rgbInfo.name);
+        }
+
+        if(colorFrame != NULL){
+            colorOutputChannel = pipe_server_get_next_available_channel();
+
+            pipe_info_t colorInfo = info;
+            snprintf(colorInfo.name, 31, "%s_color", name);
+
+            pipe_server_create(colorOutputChannel, colorInfo, 0);
+            AddSkipCounter(colorOutputChannel, colorInfo.name);
+        }
+
+        if(compressedFrame != NULL){
+            compressedOutputChannel = pipe_server_get_next_available_channel();
+
+            pipe_info_t compressedInfo = info;
+            snprintf(compressedInfo.name, 31, "%s_compressed", name);
+            strcpy(compressedInfo.type, "camera_compressed_metadata_t");
+
+            pipe_server_create(compressedOutputChannel, compressedInfo, 0);
+            AddSkipCounter(compressedOutputChannel, compressedInfo.name);
+        }
+
+        if(configInfo.mjpeg_fps > 0){
+            mjpegOutputChannel = pipe_server_get_next_available_channel();
+
+            pipe_info_t mjpegInfo = info;
+            snprintf(mjpegInfo.name, 31, "%s_mjpeg", name);
+
+            pipe_server_create(mjpegOutputChannel, mjpegInfo, 0);
+            AddSkipCounter(mjpegOutputChannel, mjpegInfo.name);
+        }
+
+        if(tensorPreproc != NULL){
+            tensorOutputChannel = pipe_server_get_next_available_channel();
+
+            pipe_info_t tensorInfo = info;
+            snprintf(tensorInfo.name, 31, "%s_tensor", name);
+            strcpy(tensorInfo.type, "camera_tensor_metadata_t");
+
+            pipe_server_create(tensorOutputChannel, tensorInfo, 0);
+            AddSkipCounter(tensorOutputChannel, tensorInfo.name);
+        }
+
+        if(featureDetector != NULL){
+            featuresOutputChannel = pipe_server_get_next_available_channel();
+
+            pipe_info_t featuresInfo = info;
+            snprintf(featuresInfo.name, 31, "%s_features", name);
+            strcpy(featuresInfo.type, "camera_features_metadata_t");
+
+            pipe_server_create(featuresOutputChannel, featuresInfo, 0);
+            AddSkipCounter(featuresOutputChannel, featuresInfo.name);
+        }
+
+        // Clients that only want luminance get the Y plane of color cameras without the chroma
+        if(p_halFmt == HAL3_FMT_YUV){
+            greyOutputChannel = pipe_server_get_next_available_channel();
+
+            pipe_info_t greyInfo = info;
+            snprintf(greyInfo.name, 31, "%s_grey", name);
+
+            pipe_server_create(greyOutputChannel, greyInfo, 0);
+            AddSkipCounter(greyOutputChannel, greyInfo.name);
+        }
+
+        numDecimatedStreams = configInfo.num_decimated;
+        for(int i = 0; i < numDecimatedStreams; i++){
+            DecimatedStream &d = d_streams[i];
+
+            d.pMgr          = this;
+            d.outputChannel = pipe_server_get_next_available_channel();
+            d.period_ns     = 1000000000LL / configInfo.decimated_fps[i];
+
+            snprintf(info.name, 31, "%s_%dhz", name, configInfo.decimated_fps[i]);
+
+            pipe_server_set_control_cb(
+                    d.outputChannel,
+                    [](int ch, char * string, int bytes, void* context)
+                            {((DecimatedStream*)context)->pMgr->HandleDecimatedControlCmd((DecimatedStream*)context, string);},
+                    &d);
+
+            pipe_server_create(d.outputChannel, info, SERVER_FLAG_EN_CONTROL_PIPE);
+            AddSkipCounter(d.outputChannel, info.name);
+
+            pipe_server_set_available_control_commands(d.outputChannel, DECIMATED_CONTROL_COMMANDS);
+        }
+
+        for(int i = 0; i < numEncodeStreams; i++){
+            snprintf(info.name, MAX_PIPE_NAME_LENGTH + 1, "%s_%s", name, e_streams[i].profile.suffix);
+
+            // New clients need the stream headers and a sync frame before they can decode anything
+            pipe_server_set_connect_cb(
+                    e_streams[i].outputChannel,
+                    [](int ch, int client_id, char* client_name, void* context)
+                            {((VideoEncoder*)context)->RequestSyncFrame();},
+                    e_streams[i].pVideoEncoder);
+
+            pipe_server_set_control_cb(
+                    e_streams[i].outputChannel,
+                    [](int ch, char * string, int bytes, void* context)
+                            {((VideoEncoder*)context)->HandleControlCmd(string);},
+                    e_streams[i].pVideoEncoder);
+
+            pipe_server_create(e_streams[i].outputChannel, info, SERVER_FLAG_EN_CONTROL_PIPE);
+
+            pipe_server_set_available_control_commands(e_streams[i].outputChannel, ENCODE_CONTROL_COMMANDS);
         }
 
     } else {
@@ -1756,6 +3510,34 @@ void PerCameraMgr::HandleControlCmd(char* cmd)
         }
         pthread_mutex_unlock(&aeMutex);
 
+    } else
+    /**************************
+     *
+     * Take snapshot from the preview stream, before "snapshot" which it starts with
+     *
+     */
+    if(strncmp(cmd, CmdStrings[SNAPSHOT_PREVIEW], strlen(CmdStrings[SNAPSHOT_PREVIEW])) == 0){
+        char *filename = (char *)malloc(256);
+
+        if(sscanf(cmd, "%*s %255s", filename) != 1){
+            // Same as the snapshots, but the names are taken as soon as they're handed out since the files only appear
+            // once the next frame comes in
+            for(int i=lastPreviewSnapshotNumber;;i++){
+                sprintf(filename,"/data/snapshots/%s-preview-%d.jpg", name, i);
+                if(!_exists(filename)){
+                    lastPreviewSnapshotNumber = i + 1;
+                    break;
+                }
+            }
+        }
+
+        M_PRINT("Camera: %s taking preview snapshot (destination: %s)\n", name, filename);
+
+        pthread_mutex_lock(&previewSnapshotMutex);
+        previewSnapshotQueue.push_back(filename);
+        numPreviewSnapshots++;
+        pthread_mutex_unlock(&previewSnapshotMutex);
+
     } else
     /**************************
      *
@@ -1789,6 +3571,23 @@ void PerCameraMgr::HandleControlCmd(char* cmd)
         } else {
             M_ERROR("Camera: %s declining to take snapshot, mode not enabled\n", name);
         }
+    } else
+    /**************************
+     *
+     * Raw frame recording
+     *
+     */
+    if(strncmp(cmd, CmdStrings[START_RAW_RECORD], strlen(CmdStrings[START_RAW_RECORD])) == 0){
+        if(rawRecorder != NULL){
+            rawRecorder->Start();
+        } else {
+            M_ERROR("Camera: %s does not support raw recording\n", name);
+        }
+    } else
+    if(strncmp(cmd, CmdStrings[STOP_RAW_RECORD], strlen(CmdStrings[STOP_RAW_RECORD])) == 0){
+        if(rawRecorder != NULL){
+            rawRecorder->Stop();
+        }
     }
     /**************************
      *
@@ -1800,6 +3599,28 @@ void PerCameraMgr::HandleControlCmd(char* cmd)
     }
 }
 
+void PerCameraMgr::HandleDecimatedControlCmd(DecimatedStream* pStream, char* cmd)
+{
+    if(strncmp(cmd, "set_rate", strlen("set_rate")) == 0){
+
+        float fps = -1.0;
+
+        if(sscanf(cmd, "set_rate %f", &fps) == 1){
+            if(fps <= 0.0 || fps > configInfo.fps){
+                M_ERROR("Invalid Control Pipe rate: %f,\n\tShould be above 0 and at most %d\n", fps, configInfo.fps);
+            } else {
+                M_DEBUG("Camera: %s decimated pipe on channel %d set to %.2fhz\n", name, pStream->outputChannel, fps);
+                pStream->period_ns = 1000000000.0 / fps;
+            }
+        } else {
+            M_ERROR("Camera: %s failed to get valid rate from command: %s\n", name, cmd);
+        }
+
+    } else {
+        M_ERROR("Camera: %s got unknown decimated pipe command: %s\n", name, cmd);
+    }
+}
+
 void PerCameraMgr::EStop(){
 
     EStopped = true;
@@ -0,0 +1,259 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "clahe.h"
+#include "imgproc.h"
+
+static const int WEIGHT_BITS = 7;
+static const int WEIGHT_ONE  = 1 << WEIGHT_BITS;
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Tile index and weight for a position, as in OpenCV pixel n is at n and the center of tile t at (t + 0.5) * tileSize.
+// Everything is kept in units of 1 / (2 * tileSize) so that it's exact.
+// -----------------------------------------------------------------------------------------------------------------------------
+static void TileWeight(int pos, int tileSize, int tiles, int* t1, int* t2, int* weight)
+{
+    const int num  = 2 * pos - tileSize;
+    const int den  = 2 * tileSize;
+    const int t    = (num >= 0) ? num / den : -((den - 1 - num) / den);
+    const int frac = num - t * den;
+
+    *weight = (frac * WEIGHT_ONE + tileSize) / den;
+    *t1     = (t < 0) ? 0 : t;
+    *t2     = (t + 1 > tiles - 1) ? tiles - 1 : t + 1;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Constructor
+// -----------------------------------------------------------------------------------------------------------------------------
+Clahe::Clahe(int width, int height, int tilesX, int tilesY, float clipLimit, int numBands) :
+    m_width     (width),
+    m_height    (height),
+    m_tilesX    (tilesX),
+    m_tilesY    (tilesY),
+    m_tileWidth (width / tilesX),
+    m_tileHeight(height / tilesY),
+    m_numBands  (numBands)
+{
+    m_clip = (int)(clipLimit * m_tileWidth * m_tileHeight / 256);
+    if (m_clip < 1) m_clip = 1;
+
+    m_hists   = (uint32_t*)malloc(NumTiles() * 256 * sizeof(uint32_t));
+    m_luts    = (uint8_t*) malloc(NumTiles() * 256);
+    m_colTile = (uint16_t*)malloc(width * 2 * sizeof(uint16_t));
+    m_colW    = (uint8_t*) malloc(width);
+
+    for (int x = 0; x < width; x++)
+    {
+        int t1, t2, w;
+
+        TileWeight(x, m_tileWidth, tilesX, &t1, &t2, &w);
+
+        m_colTile[2 * x]     = t1 * 256;
+        m_colTile[2 * x + 1] = t2 * 256;
+        m_colW[x]            = w;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Destructor
+// -----------------------------------------------------------------------------------------------------------------------------
+Clahe::~Clahe()
+{
+    free(m_hists);
+    free(m_luts);
+    free(m_colTile);
+    free(m_colW);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// The clipped counts are spread evenly, what doesn't divide by 256 goes one at a time to every (256 / rest)'th bin from the
+// start
+// -----------------------------------------------------------------------------------------------------------------------------
+void Clahe::Tile(const uint8_t* src, int tile)
+{
+    const int tx   = tile % m_tilesX;
+    const int ty   = tile / m_tilesX;
+    uint32_t* hist = m_hists + tile * 256;
+    uint8_t*  lut  = m_luts  + tile * 256;
+    int       clipped[256];
+    int       excess = 0;
+
+    memset(hist, 0, 256 * sizeof(uint32_t));
+    imgprocHistogram(src + ty * m_tileHeight * m_width + tx * m_tileWidth, m_width, m_tileWidth, 0, m_tileHeight, hist);
+
+    for (int i = 0; i < 256; i++)
+    {
+        clipped[i] = hist[i];
+
+        if (clipped[i] > m_clip)
+        {
+            excess    += clipped[i] - m_clip;
+            clipped[i] = m_clip;
+        }
+    }
+
+    const int batch = excess / 256;
+    int       rest  = excess - batch * 256;
+
+    for (int i = 0; i < 256; i++)
+    {
+        clipped[i] += batch;
+    }
+
+    if (rest != 0)
+    {
+        const int step = (256 / rest > 1) ? 256 / rest : 1;
+
+        for (int i = 0; i < 256 && rest > 0; i += step, rest--)
+        {
+            clipped[i]++;
+        }
+    }
+
+    const float scale = 255.0f / (m_tileWidth * m_tileHeight);
+    int         sum   = 0;
+
+    for (int i = 0; i < 256; i++)
+    {
+        sum += clipped[i];
+
+        const int v = (int)lrintf(sum * scale);
+        lut[i] = (v > 255) ? 255 : v;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// The table lookups are gathers and stay scalar, 16 pixels at a time go to a small buffer from where NEON blends them
+// -----------------------------------------------------------------------------------------------------------------------------
+void Clahe::Apply(const uint8_t* src, uint8_t* dst, int band)
+{
+    const int rowStart = band * m_height / m_numBands;
+    const int rowEnd   = (band + 1) * m_height / m_numBands;
+
+    for (int y = rowStart; y < rowEnd; y++)
+    {
+        int ty1, ty2, wy;
+
+        TileWeight(y, m_tileHeight, m_tilesY, &ty1, &ty2, &wy);
+
+        const uint8_t* lut1 = m_luts + ty1 * m_tilesX * 256;
+        const uint8_t* lut2 = m_luts + ty2 * m_tilesX * 256;
+        const uint8_t* s    = src + y * m_width;
+        uint8_t*       d    = dst + y * m_width;
+        int            x    = 0;
+
+#ifdef __ARM_NEON
+        const uint16x4_t wy1 = vdup_n_u16(WEIGHT_ONE - wy);
+        const uint16x4_t wy2 = vdup_n_u16(wy);
+
+        for (; x + 16 <= m_width; x += 16)
+        {
+            uint8_t a[16], b[16], c[16], e[16];
+
+            for (int i = 0; i < 16; i++)
+            {
+                const int p  = s[x + i];
+                const int o1 = m_colTile[2 * (x + i)]     + p;
+                const int o2 = m_colTile[2 * (x + i) + 1] + p;
+
+                a[i] = lut1[o1];
+                b[i] = lut1[o2];
+                c[i] = lut2[o1];
+                e[i] = lut2[o2];
+            }
+
+            const uint8x16_t wx2 = vld1q_u8(m_colW + x);
+            const uint8x16_t wx1 = vsubq_u8(vdupq_n_u8(WEIGHT_ONE), wx2);
+            const uint8x16_t va  = vld1q_u8(a);
+            const uint8x16_t vb  = vld1q_u8(b);
+            const uint8x16_t vc  = vld1q_u8(c);
+            const uint8x16_t ve  = vld1q_u8(e);
+
+            uint16x8_t top[2], bot[2];
+
+            top[0] = vmlal_u8(vmull_u8(vget_low_u8(va),  vget_low_u8(wx1)),  vget_low_u8(vb),  vget_low_u8(wx2));
+            top[1] = vmlal_u8(vmull_u8(vget_high_u8(va), vget_high_u8(wx1)), vget_high_u8(vb), vget_high_u8(wx2));
+            bot[0] = vmlal_u8(vmull_u8(vget_low_u8(vc),  vget_low_u8(wx1)),  vget_low_u8(ve),  vget_low_u8(wx2));
+            bot[1] = vmlal_u8(vmull_u8(vget_high_u8(vc), vget_high_u8(wx1)), vget_high_u8(ve), vget_high_u8(wx2));
+
+            uint16x8_t out[2];
+
+            for (int h = 0; h < 2; h++)
+            {
+                uint32x4_t lo = vmlal_u16(vmull_u16(vget_low_u16(top[h]),  wy1), vget_low_u16(bot[h]),  wy2);
+                uint32x4_t hi = vmlal_u16(vmull_u16(vget_high_u16(top[h]), wy1), vget_high_u16(bot[h]), wy2);
+
+                out[h] = vcombine_u16(vrshrn_n_u32(lo, 2 * WEIGHT_BITS), vrshrn_n_u32(hi, 2 * WEIGHT_BITS));
+            }
+
+            vst1q_u8(d + x, vcombine_u8(vmovn_u16(out[0]), vmovn_u16(out[1])));
+        }
+#endif
+
+        for (; x < m_width; x++)
+        {
+            const int p   = s[x];
+            const int o1  = m_colTile[2 * x]     + p;
+            const int o2  = m_colTile[2 * x + 1] + p;
+            const int wx  = m_colW[x];
+            const int top = lut1[o1] * (WEIGHT_ONE - wx) + lut1[o2] * wx;
+            const int bot = lut2[o1] * (WEIGHT_ONE - wx) + lut2[o2] * wx;
+
+            d[x] = (top * (WEIGHT_ONE - wy) + bot * wy + (1 << (2 * WEIGHT_BITS - 1))) >> (2 * WEIGHT_BITS);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Histogram of the whole image from the tiles
+// -----------------------------------------------------------------------------------------------------------------------------
+void Clahe::AddHistograms(uint32_t* hist)
+{
+    for (int t = 0; t < NumTiles(); t++)
+    {
+        const uint32_t* h = m_hists + t * 256;
+
+        for (int i = 0; i < 256; i++)
+        {
+            hist[i] += h[i];
+        }
+    }
+}
@@ -0,0 +1,160 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <algorithm>
+#include <stdlib.h>
+
+#include "feature_detector.h"
+#include "imgproc.h"
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Constructor
+// -----------------------------------------------------------------------------------------------------------------------------
+FeatureDetector::FeatureDetector(int width, int height, int numLevels, int threshold, int cellSize, int perCell) :
+    m_width    (width),
+    m_height   (height),
+    m_numLevels(numLevels),
+    m_threshold(threshold),
+    m_cellSize (cellSize),
+    m_perCell  (perCell)
+{
+    m_maxFeatures = 0;
+
+    for (int l = 0; l < numLevels; l++)
+    {
+        m_maxFeatures += ((width + cellSize - 1) / cellSize) * ((height + cellSize - 1) / cellSize) * perCell;
+
+        width  = (width  + 1) / 2;
+        height = (height + 1) / 2;
+    }
+
+    m_scores = (uint16_t*)malloc(m_width * m_height * sizeof(uint16_t));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Destructor
+// -----------------------------------------------------------------------------------------------------------------------------
+FeatureDetector::~FeatureDetector()
+{
+    free(m_scores);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Every level of one image
+// -----------------------------------------------------------------------------------------------------------------------------
+int FeatureDetector::Detect(const uint8_t* image, const uint8_t* pyramid, uint8_t imageIndex, camera_feature_t* features)
+{
+    const int numLevels = (pyramid != NULL) ? m_numLevels : 1;
+    int       w         = m_width;
+    int       h         = m_height;
+    int       count     = DetectLevel(image, w, h, 0, imageIndex, features);
+
+    for (int l = 1; l < numLevels; l++)
+    {
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+
+        count   += DetectLevel(pyramid, w, h, l, imageIndex, features + count);
+        pyramid += w * h;
+    }
+
+    return count;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Scores, 3x3 non-max suppression and the per cell budget for one level
+// -----------------------------------------------------------------------------------------------------------------------------
+int FeatureDetector::DetectLevel(const uint8_t* src, int width, int height, uint8_t level, uint8_t imageIndex,
+                                 camera_feature_t* features)
+{
+    const int cellsX = (width + m_cellSize - 1) / m_cellSize;
+
+    imgprocFast9(src, width, width, height, m_threshold, m_scores, 0, height);
+
+    m_candidates.clear();
+
+    for (int y = 1; y < height - 1; y++)
+    {
+        const uint16_t* up  = m_scores + (y - 1) * width;
+        const uint16_t* row = m_scores + y * width;
+        const uint16_t* dn  = m_scores + (y + 1) * width;
+
+        for (int x = 1; x < width - 1; x++)
+        {
+            const uint16_t s = row[x];
+
+            if (s == 0) continue;
+
+            // Ties go to the neighbour that comes first
+            if (s <= up[x - 1] || s <= up[x] || s <= up[x + 1] || s <= row[x - 1] ||
+                s <  row[x + 1] || s <  dn[x - 1] || s <  dn[x] || s <  dn[x + 1])
+            {
+                continue;
+            }
+
+            Candidate c;
+            c.key             = ((uint32_t)((y / m_cellSize) * cellsX + x / m_cellSize) << 16) | (0xFFFF - s);
+            c.feature.x       = x;
+            c.feature.y       = y;
+            c.feature.score   = s;
+            c.feature.level   = level;
+            c.feature.image   = imageIndex;
+            m_candidates.push_back(c);
+        }
+    }
+
+    // Strongest first within each cell, position order between equal scores
+    std::stable_sort(m_candidates.begin(), m_candidates.end(),
+                     [](const Candidate& a, const Candidate& b){ return a.key < b.key; });
+
+    int      count    = 0;
+    int      inCell   = 0;
+    uint32_t lastCell = 0xFFFFFFFF;
+
+    for (const Candidate& c : m_candidates)
+    {
+        uint32_t cell = c.key >> 16;
+
+        if (cell != lastCell)
+        {
+            lastCell = cell;
+            inCell   = 0;
+        }
+
+        if (inCell++ < m_perCell)
+        {
+            features[count++] = c.feature;
+        }
+    }
+
+    return count;
+}
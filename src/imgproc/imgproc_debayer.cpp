@@ -0,0 +1,254 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <stdint.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "imgproc.h"
+
+static inline int Mirror(int i, int size)
+{
+    return (i < 0) ? -i : (i >= size) ? 2 * size - 2 - i : i;
+}
+
+static inline int Avg(int a, int b)
+{
+    return (a + b + 1) >> 1;
+}
+
+static inline int AbsDiff(int a, int b)
+{
+    return (a > b) ? a - b : b - a;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// One pixel of a row whose own colour (red or blue) is at the site columns, with the neighbours mirrored at the borders
+// -----------------------------------------------------------------------------------------------------------------------------
+static inline void DebayerPixel(const uint8_t* up, const uint8_t* cur, const uint8_t* down, int x, int width, int site,
+                                int own, bool edgeAware, uint8_t* out)
+{
+    const int xl = Mirror(x - 1, width);
+    const int xr = Mirror(x + 1, width);
+    const int h  = Avg(cur[xl], cur[xr]);
+    const int v  = Avg(up[x], down[x]);
+    uint8_t*  o  = out + x * 3;
+
+    if ((x & 1) == site)
+    {
+        int green = Avg(h, v);
+
+        if (edgeAware)
+        {
+            const int dh = AbsDiff(cur[xl], cur[xr]);
+            const int dv = AbsDiff(up[x], down[x]);
+
+            green = (dh < dv) ? h : (dv < dh) ? v : green;
+        }
+
+        o[own]     = cur[x];
+        o[1]       = green;
+        o[2 - own] = Avg(Avg(up[xl], up[xr]), Avg(down[xl], down[xr]));
+    }
+    else
+    {
+        o[own]     = h;
+        o[1]       = cur[x];
+        o[2 - own] = v;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Each row is either a red one or a blue one. Its own colour and green alternate, the other colour is only found on the rows
+// above and below. NEON computes the values of every case for 16 interior pixels and selects between them by column parity,
+// the first and last pixels of a row take the scalar path.
+// -----------------------------------------------------------------------------------------------------------------------------
+static void DebayerRow(const uint8_t* src, int stride, int width, int height, ImgprocBayer pattern, bool edgeAware,
+                       int row, uint8_t* out)
+{
+    const bool     isRed = ((row & 1) == (pattern >> 1));
+    const int      site  = isRed ? (pattern & 1) : 1 - (pattern & 1);
+    const int      own   = isRed ? 0 : 2;
+    const uint8_t* up    = src + Mirror(row - 1, height) * stride;
+    const uint8_t* cur   = src + row * stride;
+    const uint8_t* down  = src + Mirror(row + 1, height) * stride;
+
+    DebayerPixel(up, cur, down, 0, width, site, own, edgeAware, out);
+
+    int x = 1;
+
+#ifdef __ARM_NEON
+    // Lane i is column x + i and x is always odd
+    static const uint8_t alternate[17] = {0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF, 0, 0xFF};
+    const uint8x16_t     isSite        = vld1q_u8(alternate + (site == 0));
+
+    for (; x + 17 <= width; x += 16)
+    {
+        const uint8x16_t a0 = vld1q_u8(up   + x - 1);
+        const uint8x16_t a1 = vld1q_u8(up   + x);
+        const uint8x16_t a2 = vld1q_u8(up   + x + 1);
+        const uint8x16_t b0 = vld1q_u8(cur  + x - 1);
+        const uint8x16_t b1 = vld1q_u8(cur  + x);
+        const uint8x16_t b2 = vld1q_u8(cur  + x + 1);
+        const uint8x16_t c0 = vld1q_u8(down + x - 1);
+        const uint8x16_t c1 = vld1q_u8(down + x);
+        const uint8x16_t c2 = vld1q_u8(down + x + 1);
+
+        const uint8x16_t h    = vrhaddq_u8(b0, b2);
+        const uint8x16_t v    = vrhaddq_u8(a1, c1);
+        const uint8x16_t diag = vrhaddq_u8(vrhaddq_u8(a0, a2), vrhaddq_u8(c0, c2));
+        uint8x16_t       g    = vrhaddq_u8(h, v);
+
+        if (edgeAware)
+        {
+            const uint8x16_t dh = vabdq_u8(b0, b2);
+            const uint8x16_t dv = vabdq_u8(a1, c1);
+
+            g = vbslq_u8(vcltq_u8(dh, dv), h, vbslq_u8(vcltq_u8(dv, dh), v, g));
+        }
+
+        uint8x16x3_t rgb;
+        rgb.val[own]     = vbslq_u8(isSite, b1, h);
+        rgb.val[1]       = vbslq_u8(isSite, g, b1);
+        rgb.val[2 - own] = vbslq_u8(isSite, diag, v);
+
+        vst3q_u8(out + x * 3, rgb);
+    }
+#endif
+
+    for (; x < width; x++)
+    {
+        DebayerPixel(up, cur, down, x, width, site, own, edgeAware, out);
+    }
+}
+
+void imgprocDebayer(const uint8_t* src, int stride, int width, int height, ImgprocBayer pattern, bool edgeAware,
+                    uint8_t* dst, int dstStride, int rowStart, int rowEnd)
+{
+    for (int row = rowStart; row < rowEnd; row++)
+    {
+        DebayerRow(src, stride, width, height, pattern, edgeAware, row, dst + row * dstStride);
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// One pair of RGB rows to NV12: Y = (66R + 129G + 25B) / 256 + 16, U = (-38R - 74G + 112B) / 256 + 128 and
+// V = (112R - 94G - 18B) / 256 + 128, rounded. NEON does 16 pixels of both rows at a time, the sums of the 2x2 blocks come
+// from pairwise adds.
+// -----------------------------------------------------------------------------------------------------------------------------
+static inline uint8_t Luma(const uint8_t* p)
+{
+    return ((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8) + 16;
+}
+
+static void RGBToNV12(const uint8_t* s0, const uint8_t* s1, uint8_t* y0, uint8_t* y1, uint8_t* c, int width)
+{
+    int x = 0;
+
+#ifdef __ARM_NEON
+    for (; x + 16 <= width; x += 16)
+    {
+        const uint8x16x3_t p0 = vld3q_u8(s0 + x * 3);
+        const uint8x16x3_t p1 = vld3q_u8(s1 + x * 3);
+        const uint8x16x3_t* rows[2] = {&p0, &p1};
+        uint8_t*            dsts[2] = {y0, y1};
+
+        for (int i = 0; i < 2; i++)
+        {
+            const uint8x16x3_t& p = *rows[i];
+
+            const uint16x8_t lo = vmlal_u8(vmlal_u8(vmull_u8(vget_low_u8(p.val[0]),  vdup_n_u8(66)),
+                                                    vget_low_u8(p.val[1]),  vdup_n_u8(129)),
+                                           vget_low_u8(p.val[2]),  vdup_n_u8(25));
+            const uint16x8_t hi = vmlal_u8(vmlal_u8(vmull_u8(vget_high_u8(p.val[0]), vdup_n_u8(66)),
+                                                    vget_high_u8(p.val[1]), vdup_n_u8(129)),
+                                           vget_high_u8(p.val[2]), vdup_n_u8(25));
+
+            vst1q_u8(dsts[i] + x, vaddq_u8(vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)), vdupq_n_u8(16)));
+        }
+
+        int16x8_t mean[3];
+        for (int i = 0; i < 3; i++)
+        {
+            mean[i] = vreinterpretq_s16_u16(vrshrq_n_u16(vaddq_u16(vpaddlq_u8(p0.val[i]), vpaddlq_u8(p1.val[i])), 2));
+        }
+
+        const int16x8_t u = vmlaq_n_s16(vmlaq_n_s16(vmulq_n_s16(mean[0], -38), mean[1], -74), mean[2], 112);
+        const int16x8_t v = vmlaq_n_s16(vmlaq_n_s16(vmulq_n_s16(mean[0], 112), mean[1], -94), mean[2], -18);
+
+        uint8x8x2_t out;
+        out.val[0] = vqmovun_s16(vaddq_s16(vrshrq_n_s16(u, 8), vdupq_n_s16(128)));
+        out.val[1] = vqmovun_s16(vaddq_s16(vrshrq_n_s16(v, 8), vdupq_n_s16(128)));
+
+        vst2_u8(c + x, out);
+    }
+#endif
+
+    for (; x < width; x += 2)
+    {
+        const uint8_t* p[4] = {s0 + x * 3, s0 + x * 3 + 3, s1 + x * 3, s1 + x * 3 + 3};
+        int            mean[3];
+
+        y0[x]     = Luma(p[0]);
+        y0[x + 1] = Luma(p[1]);
+        y1[x]     = Luma(p[2]);
+        y1[x + 1] = Luma(p[3]);
+
+        for (int i = 0; i < 3; i++)
+        {
+            mean[i] = (p[0][i] + p[1][i] + p[2][i] + p[3][i] + 2) >> 2;
+        }
+
+        c[x]     = ((-38 * mean[0] -  74 * mean[1] + 112 * mean[2] + 128) >> 8) + 128;
+        c[x + 1] = ((112 * mean[0] -  94 * mean[1] -  18 * mean[2] + 128) >> 8) + 128;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Rows go through the scratch buffer two at a time, so the RGB pair is still in cache for the conversion
+// -----------------------------------------------------------------------------------------------------------------------------
+void imgprocDebayerNV12(const uint8_t* src, int stride, int width, int height, ImgprocBayer pattern, bool edgeAware,
+                        uint8_t* y, uint8_t* uv, int dstStride, uint8_t* scratch, int rowStart, int rowEnd)
+{
+    uint8_t* rgb0 = scratch;
+    uint8_t* rgb1 = scratch + width * 3;
+
+    for (int row = rowStart; row < rowEnd; row += 2)
+    {
+        DebayerRow(src, stride, width, height, pattern, edgeAware, row,     rgb0);
+        DebayerRow(src, stride, width, height, pattern, edgeAware, row + 1, rgb1);
+
+        RGBToNV12(rgb0, rgb1, y + row * dstStride, y + (row + 1) * dstStride, uv + (row / 2) * dstStride, width);
+    }
+}
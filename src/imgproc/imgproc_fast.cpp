@@ -0,0 +1,196 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "imgproc.h"
+
+static const int FAST_RADIUS = 3;
+static const int FAST_ARC    = 9;
+
+// Bresenham circle of radius 3, clockwise from the top
+static const int circleX[16] = { 0,  1,  2,  3, 3, 3, 2, 1, 0, -1, -2, -3, -3, -3, -2, -1};
+static const int circleY[16] = {-3, -3, -2, -1, 0, 1, 2, 3, 3,  3,  2,  1,  0, -1, -2, -3};
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Any arc of 9 contains two neighbouring ones of the pixels at 0, 4, 8 and 12, which rules out most pixels after four loads.
+// The NEON version does the full test on 16 pixels at once: a run length per lane is counted up while the circle pixels
+// pass and reset when they don't, going around once and then 8 more so that arcs across the start are seen.
+// -----------------------------------------------------------------------------------------------------------------------------
+void imgprocFast9(const uint8_t* src, int stride, int width, int height, int threshold, uint16_t* scores, int rowStart, int rowEnd)
+{
+    int offsets[16];
+
+    for (int i = 0; i < 16; i++)
+    {
+        offsets[i] = circleY[i] * stride + circleX[i];
+    }
+
+    for (int y = rowStart; y < rowEnd; y++)
+    {
+        uint16_t* s = scores + y * width;
+
+        if (y < FAST_RADIUS || y >= height - FAST_RADIUS)
+        {
+            memset(s, 0, width * sizeof(uint16_t));
+            continue;
+        }
+
+        const uint8_t* row = src + y * stride;
+        int            x   = FAST_RADIUS;
+
+        memset(s, 0, FAST_RADIUS * sizeof(uint16_t));
+        memset(s + width - FAST_RADIUS, 0, FAST_RADIUS * sizeof(uint16_t));
+
+#ifdef __ARM_NEON
+        const uint8x16_t t     = vdupq_n_u8(threshold);
+        const uint8x16_t arc   = vdupq_n_u8(FAST_ARC);
+        const uint16x8_t zero  = vdupq_n_u16(0);
+
+        for (; x + 16 <= width - FAST_RADIUS; x += 16)
+        {
+            const uint8_t*   p  = row + x;
+            const uint8x16_t c  = vld1q_u8(p);
+            const uint8x16_t hi = vqaddq_u8(c, t);
+            const uint8x16_t lo = vqsubq_u8(c, t);
+
+            uint8x16_t b[4], d[4];
+            for (int k = 0; k < 4; k++)
+            {
+                uint8x16_t v = vld1q_u8(p + offsets[4 * k]);
+                b[k] = vcgtq_u8(v, hi);
+                d[k] = vcltq_u8(v, lo);
+            }
+
+            uint8x16_t maybe = vorrq_u8(vorrq_u8(vandq_u8(b[0], b[1]), vandq_u8(b[1], b[2])),
+                                        vorrq_u8(vandq_u8(b[2], b[3]), vandq_u8(b[3], b[0])));
+            maybe = vorrq_u8(maybe, vorrq_u8(vorrq_u8(vandq_u8(d[0], d[1]), vandq_u8(d[1], d[2])),
+                                             vorrq_u8(vandq_u8(d[2], d[3]), vandq_u8(d[3], d[0]))));
+
+            uint64x2_t any = vreinterpretq_u64_u8(maybe);
+            if ((vgetq_lane_u64(any, 0) | vgetq_lane_u64(any, 1)) == 0)
+            {
+                vst1q_u16(s + x,     zero);
+                vst1q_u16(s + x + 8, zero);
+                continue;
+            }
+
+            uint8x16_t runB = vdupq_n_u8(0), runD = vdupq_n_u8(0);
+            uint8x16_t maxB = vdupq_n_u8(0), maxD = vdupq_n_u8(0);
+            uint16x8_t sumB[2] = {zero, zero}, sumD[2] = {zero, zero};
+
+            for (int k = 0; k < 16 + FAST_ARC - 1; k++)
+            {
+                uint8x16_t v  = vld1q_u8(p + offsets[k & 15]);
+                uint8x16_t mb = vcgtq_u8(v, hi);
+                uint8x16_t md = vcltq_u8(v, lo);
+
+                // Masks are 0 or -1, so subtracting one counts up and the and resets
+                runB = vandq_u8(vsubq_u8(runB, mb), mb);
+                runD = vandq_u8(vsubq_u8(runD, md), md);
+                maxB = vmaxq_u8(maxB, runB);
+                maxD = vmaxq_u8(maxD, runD);
+
+                if (k < 16)
+                {
+                    // Saturation makes these 0 for pixels that aren't brighter/darker
+                    uint8x16_t eb = vqsubq_u8(v, hi);
+                    uint8x16_t ed = vqsubq_u8(lo, v);
+
+                    sumB[0] = vaddw_u8(sumB[0], vget_low_u8(eb));
+                    sumB[1] = vaddw_u8(sumB[1], vget_high_u8(eb));
+                    sumD[0] = vaddw_u8(sumD[0], vget_low_u8(ed));
+                    sumD[1] = vaddw_u8(sumD[1], vget_high_u8(ed));
+                }
+            }
+
+            uint8x16_t corner = vorrq_u8(vcgeq_u8(maxB, arc), vcgeq_u8(maxD, arc));
+
+            for (int h = 0; h < 2; h++)
+            {
+                uint8x8_t  c8    = h ? vget_high_u8(corner) : vget_low_u8(corner);
+                uint16x8_t mask  = vreinterpretq_u16_s16(vmovl_s8(vreinterpret_s8_u8(c8)));
+                uint16x8_t score = vmaxq_u16(sumB[h], sumD[h]);
+
+                vst1q_u16(s + x + 8 * h, vandq_u16(score, mask));
+            }
+        }
+#endif
+
+        for (; x < width - FAST_RADIUS; x++)
+        {
+            const uint8_t* p  = row + x;
+            const int      hi = p[0] + threshold > 255 ? 255 : p[0] + threshold;
+            const int      lo = p[0] - threshold < 0   ? 0   : p[0] - threshold;
+
+            bool b[4], d[4];
+            for (int k = 0; k < 4; k++)
+            {
+                b[k] = p[offsets[4 * k]] > hi;
+                d[k] = p[offsets[4 * k]] < lo;
+            }
+
+            if (!((b[0] && b[1]) || (b[1] && b[2]) || (b[2] && b[3]) || (b[3] && b[0]) ||
+                  (d[0] && d[1]) || (d[1] && d[2]) || (d[2] && d[3]) || (d[3] && d[0])))
+            {
+                s[x] = 0;
+                continue;
+            }
+
+            int runB = 0, runD = 0, maxB = 0, maxD = 0, sumB = 0, sumD = 0;
+
+            for (int k = 0; k < 16 + FAST_ARC - 1; k++)
+            {
+                const int v = p[offsets[k & 15]];
+
+                runB = (v > hi) ? runB + 1 : 0;
+                runD = (v < lo) ? runD + 1 : 0;
+                if (runB > maxB) maxB = runB;
+                if (runD > maxD) maxD = runD;
+
+                if (k < 16)
+                {
+                    if (v > hi) sumB += v - hi;
+                    if (v < lo) sumD += lo - v;
+                }
+            }
+
+            s[x] = (maxB >= FAST_ARC || maxD >= FAST_ARC) ? (sumB > sumD ? sumB : sumD) : 0;
+        }
+    }
+}
@@ -0,0 +1,141 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdint.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "imgproc.h"
+
+#ifdef __ARM_NEON
+// Reverse the order of 16 one byte pixels, or of 8 two byte pixels
+static inline uint8x16_t Reverse(uint8x16_t v, int bpp)
+{
+    v = (bpp == 1) ? vrev64q_u8(v) : vreinterpretq_u8_u16(vrev64q_u16(vreinterpretq_u16_u8(v)));
+
+    return vcombine_u8(vget_high_u8(v), vget_low_u8(v));
+}
+#endif
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Swap row a with row b mirrored left to right. When a and b are the same row only the left half is walked, swapping with
+// the right half, which mirrors the row in place.
+// -----------------------------------------------------------------------------------------------------------------------------
+static void SwapMirrored(uint8_t* a, uint8_t* b, int bytes, int bpp)
+{
+    const bool same = (a == b);
+    int        x    = 0;
+
+#ifdef __ARM_NEON
+    for (; same ? (2 * x + 32 <= bytes) : (x + 16 <= bytes); x += 16)
+    {
+        uint8x16_t va = vld1q_u8(a + x);
+        uint8x16_t vb = vld1q_u8(b + bytes - x - 16);
+        vst1q_u8(a + x,              Reverse(vb, bpp));
+        vst1q_u8(b + bytes - x - 16, Reverse(va, bpp));
+    }
+#endif
+
+    for (; same ? (2 * x + 2 * bpp <= bytes) : (x < bytes); x += bpp)
+    {
+        for (int i = 0; i < bpp; i++)
+        {
+            uint8_t t              = a[x + i];
+            a[x + i]               = b[bytes - x - bpp + i];
+            b[bytes - x - bpp + i] = t;
+        }
+    }
+}
+
+static void Rotate180Rows(uint8_t* buf, int stride, int bytes, int height, int rowStart, int rowEnd, int bpp)
+{
+    for (int y = rowStart; y < rowEnd; y++)
+    {
+        const int mirror = height - 1 - y;
+
+        // Rows past the middle were swapped into place along with their mirror row
+        if (y <= mirror)
+        {
+            SwapMirrored(buf + y * stride, buf + mirror * stride, bytes, bpp);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// In place 180 degree rotation
+// -----------------------------------------------------------------------------------------------------------------------------
+void imgprocRot180Raw8(uint8_t* buf, int stride, int width, int height, int rowStart, int rowEnd)
+{
+    Rotate180Rows(buf, stride, width, height, rowStart, rowEnd, 1);
+}
+
+void imgprocRot180UV(uint8_t* buf, int stride, int width, int height, int rowStart, int rowEnd)
+{
+    Rotate180Rows(buf, stride, width * 2, height, rowStart, rowEnd, 2);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// RAW10 to RAW8 and 180 degree rotation in one go, see imgprocRaw10ToRaw8 for the format
+// -----------------------------------------------------------------------------------------------------------------------------
+void imgprocRaw10ToRaw8Rot180(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int rows)
+{
+    for (int y = 0; y < rows; y++)
+    {
+        const uint8_t* s = src + (rows - 1 - y) * srcStride;
+        uint8_t*       d = dst + y * dstStride + width;
+        int            x = 0;
+
+#ifdef __ARM_NEON
+        // Same loads as the plain conversion, the eight pixels are reversed and stored counting down from the end of the row
+        static const uint8_t idx[8] = {8, 7, 6, 5, 3, 2, 1, 0};
+        const uint8x8_t      tbl    = vld1_u8(idx);
+
+        for (; x + 16 <= width; x += 8, s += 10)
+        {
+            uint8x16_t  in = vld1q_u8(s);
+            uint8x8x2_t t  = {{vget_low_u8(in), vget_high_u8(in)}};
+            vst1_u8(d - x - 8, vtbl2_u8(t, tbl));
+        }
+#endif
+
+        for (; x < width; x += 4, s += 5)
+        {
+            d[-x - 1] = s[0];
+            d[-x - 2] = s[1];
+            d[-x - 3] = s[2];
+            d[-x - 4] = s[3];
+        }
+    }
+}
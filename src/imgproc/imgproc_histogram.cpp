@@ -0,0 +1,99 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "imgproc.h"
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// A histogram is a scatter, there is nothing to gain from doing the increments in vector registers. What does cost time is
+// the same bin being incremented back to back (flat image areas), each increment then waits for the store of the one before
+// it. Consecutive pixels go to four separate tables instead, eight pixels are read at a time, and the tables are added up
+// with NEON at the end.
+// -----------------------------------------------------------------------------------------------------------------------------
+void imgprocHistogram(const uint8_t* src, int stride, int width, int rowStart, int rowEnd, uint32_t* hist)
+{
+    uint32_t sub[4][256];
+
+    memset(sub, 0, sizeof(sub));
+
+    for (int y = rowStart; y < rowEnd; y++)
+    {
+        const uint8_t* row = src + y * stride;
+        int            x   = 0;
+
+        for (; x + 8 <= width; x += 8)
+        {
+            uint32_t lo, hi;
+
+            memcpy(&lo, row + x,     4);
+            memcpy(&hi, row + x + 4, 4);
+
+            sub[0][lo         & 0xFF]++;
+            sub[1][(lo >>  8) & 0xFF]++;
+            sub[2][(lo >> 16) & 0xFF]++;
+            sub[3][ lo >> 24        ]++;
+            sub[0][hi         & 0xFF]++;
+            sub[1][(hi >>  8) & 0xFF]++;
+            sub[2][(hi >> 16) & 0xFF]++;
+            sub[3][ hi >> 24        ]++;
+        }
+
+        for (; x < width; x++)
+        {
+            sub[0][row[x]]++;
+        }
+    }
+
+    int i = 0;
+
+#ifdef __ARM_NEON
+    for (; i < 256; i += 4)
+    {
+        uint32x4_t a = vaddq_u32(vld1q_u32(&sub[0][i]), vld1q_u32(&sub[1][i]));
+        uint32x4_t b = vaddq_u32(vld1q_u32(&sub[2][i]), vld1q_u32(&sub[3][i]));
+
+        vst1q_u32(hist + i, vaddq_u32(vld1q_u32(hist + i), vaddq_u32(a, b)));
+    }
+#endif
+
+    for (; i < 256; i++)
+    {
+        hist[i] += sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+    }
+}
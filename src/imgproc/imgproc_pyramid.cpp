@@ -0,0 +1,115 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdint.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "imgproc.h"
+
+// Reflect-101 border: -1 -> 1, n -> n-2
+static inline int Reflect101(int i, int n)
+{
+    if (i < 0)  return -i;
+    if (i >= n) return 2 * n - 2 - i;
+    return i;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// The filter is separable. Every output row first gets the vertical pass over all columns of its five source rows into
+// scratch (16 bit, at most 16*255), then the horizontal pass with the decimation reads scratch (at most 256*255, still fits
+// in 16 bits). scratch is padded by two on each side with the reflected border columns so both passes are branch free.
+// -----------------------------------------------------------------------------------------------------------------------------
+void imgprocPyrDown(const uint8_t* src, int srcStride, int width, int height,
+                    uint8_t* dst, int dstStride, int dstRowStart, int dstRowEnd, uint16_t* scratch)
+{
+    const int dstWidth = (width + 1) / 2;
+    uint16_t* v        = scratch + 2;
+
+    for (int y = dstRowStart; y < dstRowEnd; y++)
+    {
+        const uint8_t* r0 = src + Reflect101(2 * y - 2, height) * srcStride;
+        const uint8_t* r1 = src + Reflect101(2 * y - 1, height) * srcStride;
+        const uint8_t* r2 = src + Reflect101(2 * y,     height) * srcStride;
+        const uint8_t* r3 = src + Reflect101(2 * y + 1, height) * srcStride;
+        const uint8_t* r4 = src + Reflect101(2 * y + 2, height) * srcStride;
+        uint8_t*       d  = dst + y * dstStride;
+        int            x  = 0;
+
+#ifdef __ARM_NEON
+        for (; x + 8 <= width; x += 8)
+        {
+            uint16x8_t sum = vaddl_u8(vld1_u8(r0 + x), vld1_u8(r4 + x));
+            sum = vmlal_u8(sum, vld1_u8(r2 + x), vdup_n_u8(6));
+            sum = vaddq_u16(sum, vshlq_n_u16(vaddl_u8(vld1_u8(r1 + x), vld1_u8(r3 + x)), 2));
+            vst1q_u16(v + x, sum);
+        }
+#endif
+
+        for (; x < width; x++)
+        {
+            v[x] = r0[x] + r4[x] + 6 * r2[x] + 4 * (r1[x] + r3[x]);
+        }
+
+        v[-2]        = v[Reflect101(-2, width)];
+        v[-1]        = v[Reflect101(-1, width)];
+        v[width]     = v[Reflect101(width,     width)];
+        v[width + 1] = v[Reflect101(width + 1, width)];
+
+        x = 0;
+
+#ifdef __ARM_NEON
+        // Even/odd deinterleaving loads give the five taps of eight outputs, the last load reaches 2 * x + 17 which has to
+        // stay inside the padded row
+        for (; x + 8 <= dstWidth && 2 * x + 17 <= width + 1; x += 8)
+        {
+            uint16x8x2_t a = vld2q_u16(v + 2 * x - 2);
+            uint16x8x2_t b = vld2q_u16(v + 2 * x);
+            uint16x8_t   c = vld2q_u16(v + 2 * x + 2).val[0];
+
+            uint16x8_t sum = vaddq_u16(a.val[0], c);
+            sum = vaddq_u16(sum, vshlq_n_u16(vaddq_u16(a.val[1], b.val[1]), 2));
+            sum = vmlaq_n_u16(sum, b.val[0], 6);
+            vst1_u8(d + x, vrshrn_n_u16(sum, 8));
+        }
+#endif
+
+        for (; x < dstWidth; x++)
+        {
+            const uint16_t* p = v + 2 * x;
+            d[x] = (p[-2] + p[2] + 4 * (p[-1] + p[1]) + 6 * p[0] + 128) >> 8;
+        }
+    }
+}
@@ -0,0 +1,114 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdint.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "imgproc.h"
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// A quarter of the rows is plenty for a blur or exposure score and keeps this well below the cost of the RAW10 conversion it
+// follows down the frame. The NEON version squares the absolute differences into 16 bits and widens the sums once per lane
+// pair; a row would have to be over 30000 pixels wide before the 32 bit lane sums could overflow.
+// -----------------------------------------------------------------------------------------------------------------------------
+void imgprocQuality(const uint8_t* src, int stride, int width, int rowStart, int rowEnd, ImgprocQuality* quality)
+{
+    // First sampled row at or after rowStart, row 0 has nothing above it
+    int y = rowStart + ((1 - rowStart) % IMGPROC_QUALITY_ROW_STEP + IMGPROC_QUALITY_ROW_STEP) % IMGPROC_QUALITY_ROW_STEP;
+
+    for (; y < rowEnd; y += IMGPROC_QUALITY_ROW_STEP)
+    {
+        const uint8_t* row      = src + y * stride;
+        const uint8_t* up       = row - stride;
+        uint32_t       sum      = 0;
+        uint32_t       gradient = 0;
+        uint32_t       sat      = 0;
+        int            x        = 1;
+
+#ifdef __ARM_NEON
+        uint32x4_t vSum  = vdupq_n_u32(0);
+        uint32x4_t vGrad = vdupq_n_u32(0);
+        uint16x8_t vSat  = vdupq_n_u16(0);
+
+        const uint8x16_t satLevel = vdupq_n_u8(IMGPROC_QUALITY_SATURATED);
+
+        for (; x + 16 <= width; x += 16)
+        {
+            const uint8x16_t p    = vld1q_u8(row + x);
+            const uint8x16_t dx   = vabdq_u8(p, vld1q_u8(row + x - 1));
+            const uint8x16_t dy   = vabdq_u8(p, vld1q_u8(up + x));
+
+            uint16x8_t grad = vmull_u8(vget_low_u8(dx), vget_low_u8(dx));
+            vGrad = vpadalq_u16(vGrad, grad);
+            grad  = vmull_u8(vget_high_u8(dx), vget_high_u8(dx));
+            vGrad = vpadalq_u16(vGrad, grad);
+            grad  = vmull_u8(vget_low_u8(dy), vget_low_u8(dy));
+            vGrad = vpadalq_u16(vGrad, grad);
+            grad  = vmull_u8(vget_high_u8(dy), vget_high_u8(dy));
+            vGrad = vpadalq_u16(vGrad, grad);
+
+            vSum = vpadalq_u16(vSum, vpaddlq_u8(p));
+            vSat = vpadalq_u8(vSat, vshrq_n_u8(vcgeq_u8(p, satLevel), 7));
+        }
+
+        uint64x2_t s2 = vpaddlq_u32(vSum);
+        uint64x2_t g2 = vpaddlq_u32(vGrad);
+        uint64x2_t c2 = vpaddlq_u32(vpaddlq_u16(vSat));
+
+        sum      = (uint32_t)(vgetq_lane_u64(s2, 0) + vgetq_lane_u64(s2, 1));
+        gradient = (uint32_t)(vgetq_lane_u64(g2, 0) + vgetq_lane_u64(g2, 1));
+        sat      = (uint32_t)(vgetq_lane_u64(c2, 0) + vgetq_lane_u64(c2, 1));
+#endif
+
+        uint64_t tailGradient = 0;
+
+        for (; x < width; x++)
+        {
+            const int p  = row[x];
+            const int dx = p - row[x - 1];
+            const int dy = p - up[x];
+
+            sum          += p;
+            tailGradient += dx * dx + dy * dy;
+            sat          += (p >= IMGPROC_QUALITY_SATURATED);
+        }
+
+        quality->sum       += sum;
+        quality->gradient  += gradient + tailGradient;
+        quality->saturated += sat;
+        quality->samples   += width - 1;
+    }
+}
@@ -0,0 +1,108 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "imgproc.h"
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Bilinear remap. With 4 bit fractions each of the two interpolation steps fits in 16 bits: the horizontal one is at most
+// 255 * 16 and the vertical one at most 255 * 16 * 16.
+// -----------------------------------------------------------------------------------------------------------------------------
+void imgprocRemapBilinear(const ImgprocRemap* map, const uint8_t* src, uint8_t* dst, int dstStride, int rowStart, int rowEnd)
+{
+    const int one    = 1 << IMGPROC_REMAP_FRAC_BITS;
+    const int mask   = one - 1;
+    const int stride = map->srcStride;
+
+    for (int y = rowStart; y < rowEnd; y++)
+    {
+        const uint32_t* off   = map->offsets + y * map->width;
+        const uint8_t*  wgt   = map->weights + y * map->width;
+        const int       start = map->spans[2 * y];
+        const int       end   = map->spans[2 * y + 1];
+        uint8_t*        d     = dst + y * dstStride;
+        int             x     = start;
+
+        memset(d, 0, start);
+        memset(d + end, 0, map->width - end);
+
+#ifdef __ARM_NEON
+        // The source pixels are scattered so they are gathered one by one, the interpolation runs 8 wide
+        const uint8x8_t  vmask = vdup_n_u8(mask);
+        const uint8x8_t  vone  = vdup_n_u8(one);
+        const uint16x8_t vone16 = vdupq_n_u16(one);
+
+        for (; x + 8 <= end; x += 8)
+        {
+            uint8_t p00[8], p01[8], p10[8], p11[8];
+
+            for (int i = 0; i < 8; i++)
+            {
+                const uint8_t* s = src + off[x + i];
+                p00[i] = s[0];
+                p01[i] = s[1];
+                p10[i] = s[stride];
+                p11[i] = s[stride + 1];
+            }
+
+            const uint8x8_t  w   = vld1_u8(wgt + x);
+            const uint8x8_t  wx  = vand_u8(w, vmask);
+            const uint8x8_t  wx0 = vsub_u8(vone, wx);
+            const uint16x8_t wy  = vmovl_u8(vshr_n_u8(w, IMGPROC_REMAP_FRAC_BITS));
+
+            uint16x8_t top = vmlal_u8(vmull_u8(vld1_u8(p00), wx0), vld1_u8(p01), wx);
+            uint16x8_t bot = vmlal_u8(vmull_u8(vld1_u8(p10), wx0), vld1_u8(p11), wx);
+            uint16x8_t sum = vmlaq_u16(vmulq_u16(top, vsubq_u16(vone16, wy)), bot, wy);
+
+            vst1_u8(d + x, vrshrn_n_u16(sum, 2 * IMGPROC_REMAP_FRAC_BITS));
+        }
+#endif
+
+        for (; x < end; x++)
+        {
+            const uint8_t* s  = src + off[x];
+            const int      wx = wgt[x] & mask;
+            const int      wy = wgt[x] >> IMGPROC_REMAP_FRAC_BITS;
+            const int      t  = s[0]      * (one - wx) + s[1]          * wx;
+            const int      b  = s[stride] * (one - wx) + s[stride + 1] * wx;
+
+            d[x] = (t * (one - wy) + b * wy + (1 << (2 * IMGPROC_REMAP_FRAC_BITS - 1))) >> (2 * IMGPROC_REMAP_FRAC_BITS);
+        }
+    }
+}
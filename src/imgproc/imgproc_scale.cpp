@@ -0,0 +1,256 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "imgproc.h"
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Convert RAW10 to RAW8
+// -----------------------------------------------------------------------------------------------------------------------------
+void imgprocRaw10ToRaw8(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int rows)
+{
+    // This link has the description of the RAW10 format:
+    // https://gitlab.com/SaberMod/pa-android-frameworks-base/commit/d1988a98ed69db8c33b77b5c085ab91d22ef3bbc
+
+    for (int y = 0; y < rows; y++)
+    {
+        const uint8_t* s = src + y * srcStride;
+        uint8_t*       d = dst + y * dstStride;
+        int            x = 0;
+
+#ifdef __ARM_NEON
+        // Two groups of four pixels out of every 16 bytes loaded, the load runs 6 bytes past the groups so stop early enough
+        // not to read past the end of the row
+        static const uint8_t idx[8] = {0, 1, 2, 3, 5, 6, 7, 8};
+        const uint8x8_t      tbl    = vld1_u8(idx);
+
+        for (; x + 16 <= width; x += 8, s += 10)
+        {
+            uint8x16_t  in = vld1q_u8(s);
+            uint8x8x2_t t  = {{vget_low_u8(in), vget_high_u8(in)}};
+            vst1_u8(d + x, vtbl2_u8(t, tbl));
+        }
+#endif
+
+        // Skip every fifth byte because that is just a collection of the 2 least significant bits from the previous four
+        // pixels. We don't want those least significant bits.
+        for (; x < width; x += 4, s += 5)
+        {
+            d[x]     = s[0];
+            d[x + 1] = s[1];
+            d[x + 2] = s[2];
+            d[x + 3] = s[3];
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// 2x2 and 4x4 box filters on a single channel plane
+// -----------------------------------------------------------------------------------------------------------------------------
+static void Downscale2x(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int rows)
+{
+    for (int y = 0; y < rows; y += 2)
+    {
+        const uint8_t* r0 = src + y * srcStride;
+        const uint8_t* r1 = r0 + srcStride;
+        uint8_t*       d  = dst + (y / 2) * dstStride;
+        int            x  = 0;
+
+#ifdef __ARM_NEON
+        for (; x + 16 <= width; x += 16)
+        {
+            uint16x8_t sum = vpaddlq_u8(vld1q_u8(r0 + x));
+            sum            = vpadalq_u8(sum, vld1q_u8(r1 + x));
+            vst1_u8(d + x / 2, vrshrn_n_u16(sum, 2));
+        }
+#endif
+
+        for (; x < width; x += 2)
+        {
+            d[x / 2] = (r0[x] + r0[x + 1] + r1[x] + r1[x + 1] + 2) >> 2;
+        }
+    }
+}
+
+static void Downscale4x(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int rows)
+{
+    for (int y = 0; y < rows; y += 4)
+    {
+        const uint8_t* r0 = src + y * srcStride;
+        uint8_t*       d  = dst + (y / 4) * dstStride;
+        int            x  = 0;
+
+#ifdef __ARM_NEON
+        for (; x + 32 <= width; x += 32)
+        {
+            uint16x8_t lo = vdupq_n_u16(0);
+            uint16x8_t hi = vdupq_n_u16(0);
+
+            for (int i = 0; i < 4; i++)
+            {
+                lo = vpadalq_u8(lo, vld1q_u8(r0 + i * srcStride + x));
+                hi = vpadalq_u8(hi, vld1q_u8(r0 + i * srcStride + x + 16));
+            }
+
+            uint16x8_t sum = vcombine_u16(vpadd_u16(vget_low_u16(lo), vget_high_u16(lo)),
+                                          vpadd_u16(vget_low_u16(hi), vget_high_u16(hi)));
+            vst1_u8(d + x / 4, vrshrn_n_u16(sum, 4));
+        }
+#endif
+
+        for (; x < width; x += 4)
+        {
+            int sum = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                const uint8_t* r = r0 + i * srcStride + x;
+                sum += r[0] + r[1] + r[2] + r[3];
+            }
+            d[x / 4] = (sum + 8) >> 4;
+        }
+    }
+}
+
+void imgprocDownscaleRaw8(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int rows, int factor)
+{
+    if (factor == 2)
+    {
+        Downscale2x(src, srcStride, dst, dstStride, width, rows);
+    }
+    else if (factor == 4)
+    {
+        Downscale4x(src, srcStride, dst, dstStride, width, rows);
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Same filters on an interleaved two channel plane
+// -----------------------------------------------------------------------------------------------------------------------------
+static void Downscale2xUV(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int rows)
+{
+    for (int y = 0; y < rows; y += 2)
+    {
+        const uint8_t* r0 = src + y * srcStride;
+        const uint8_t* r1 = r0 + srcStride;
+        uint8_t*       d  = dst + (y / 2) * dstStride;
+        int            x  = 0;
+
+#ifdef __ARM_NEON
+        for (; x + 16 <= width; x += 16)
+        {
+            uint8x16x2_t a = vld2q_u8(r0 + 2 * x);
+            uint8x16x2_t b = vld2q_u8(r1 + 2 * x);
+            uint8x8x2_t  out;
+
+            out.val[0] = vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(a.val[0]), b.val[0]), 2);
+            out.val[1] = vrshrn_n_u16(vpadalq_u8(vpaddlq_u8(a.val[1]), b.val[1]), 2);
+            vst2_u8(d + x, out);
+        }
+#endif
+
+        for (; x < width; x += 2)
+        {
+            const uint8_t* p0 = r0 + 2 * x;
+            const uint8_t* p1 = r1 + 2 * x;
+            d[x]     = (p0[0] + p0[2] + p1[0] + p1[2] + 2) >> 2;
+            d[x + 1] = (p0[1] + p0[3] + p1[1] + p1[3] + 2) >> 2;
+        }
+    }
+}
+
+static void Downscale4xUV(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int rows)
+{
+    for (int y = 0; y < rows; y += 4)
+    {
+        const uint8_t* r0 = src + y * srcStride;
+        uint8_t*       d  = dst + (y / 4) * dstStride;
+        int            x  = 0;
+
+#ifdef __ARM_NEON
+        for (; x + 32 <= width; x += 32)
+        {
+            uint16x8_t u[2] = {vdupq_n_u16(0), vdupq_n_u16(0)};
+            uint16x8_t v[2] = {vdupq_n_u16(0), vdupq_n_u16(0)};
+
+            for (int i = 0; i < 4; i++)
+            {
+                for (int j = 0; j < 2; j++)
+                {
+                    uint8x16x2_t a = vld2q_u8(r0 + i * srcStride + 2 * (x + 16 * j));
+                    u[j] = vpadalq_u8(u[j], a.val[0]);
+                    v[j] = vpadalq_u8(v[j], a.val[1]);
+                }
+            }
+
+            uint8x8x2_t out;
+            out.val[0] = vrshrn_n_u16(vcombine_u16(vpadd_u16(vget_low_u16(u[0]), vget_high_u16(u[0])),
+                                                   vpadd_u16(vget_low_u16(u[1]), vget_high_u16(u[1]))), 4);
+            out.val[1] = vrshrn_n_u16(vcombine_u16(vpadd_u16(vget_low_u16(v[0]), vget_high_u16(v[0])),
+                                                   vpadd_u16(vget_low_u16(v[1]), vget_high_u16(v[1]))), 4);
+            vst2_u8(d + x / 2, out);
+        }
+#endif
+
+        for (; x < width; x += 4)
+        {
+            int sumU = 0;
+            int sumV = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                const uint8_t* p = r0 + i * srcStride + 2 * x;
+                sumU += p[0] + p[2] + p[4] + p[6];
+                sumV += p[1] + p[3] + p[5] + p[7];
+            }
+            d[x / 2]     = (sumU + 8) >> 4;
+            d[x / 2 + 1] = (sumV + 8) >> 4;
+        }
+    }
+}
+
+void imgprocDownscaleUV(const uint8_t* src, int srcStride, uint8_t* dst, int dstStride, int width, int rows, int factor)
+{
+    if (factor == 2)
+    {
+        Downscale2xUV(src, srcStride, dst, dstStride, width, rows);
+    }
+    else if (factor == 4)
+    {
+        Downscale4xUV(src, srcStride, dst, dstStride, width, rows);
+    }
+}
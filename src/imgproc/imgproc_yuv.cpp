@@ -0,0 +1,185 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdint.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "imgproc.h"
+
+// Coefficients in 1/2^20, the BT.601 ones are OpenCV's
+static const int YUV_SHIFT = 20;
+
+typedef struct YuvCoeffs
+{
+    int y;
+    int vr;
+    int ug;
+    int vg;
+    int ub;
+} YuvCoeffs;
+
+static const YuvCoeffs coeffs[2] =
+{
+    {1220542, 1673527, -409993, -852492, 2116026},     // 1.164, 1.596, -0.391, -0.813, 2.018
+    {1220542, 1880097, -223347, -558891, 2214593},     // 1.164, 1.793, -0.213, -0.533, 2.112
+};
+
+static inline uint8_t Clamp8(int v)
+{
+    return (v < 0) ? 0 : (v > 255) ? 255 : v;
+}
+
+#ifdef __ARM_NEON
+// 4 pixels from (y - 16) * cy and the chroma term of their pairs, shifted down and saturated to 16 bits
+static inline uint16x4_t Channel(int32x4_t y, int32x4_t c)
+{
+    return vqmovun_s32(vshrq_n_s32(vaddq_s32(y, c), YUV_SHIFT));
+}
+
+// 16 pixels of one channel from 4 vectors of luma terms and the chroma terms of their 8 pairs
+static inline uint8x16_t Channel16(const int32x4_t* y, int32x4_t cLo, int32x4_t cHi)
+{
+    const int32x4x2_t lo = vzipq_s32(cLo, cLo);
+    const int32x4x2_t hi = vzipq_s32(cHi, cHi);
+
+    const uint16x8_t a = vcombine_u16(Channel(y[0], lo.val[0]), Channel(y[1], lo.val[1]));
+    const uint16x8_t b = vcombine_u16(Channel(y[2], hi.val[0]), Channel(y[3], hi.val[1]));
+
+    return vcombine_u8(vqmovn_u16(a), vqmovn_u16(b));
+}
+#endif
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Everything is done in 32 bits with OpenCV's rounding so that the results are identical to cvtColor. Each pair of pixels
+// shares one chroma term per channel, NEON computes those for 8 pairs and duplicates them with a zip.
+// -----------------------------------------------------------------------------------------------------------------------------
+void imgprocNV12ToRGB(const uint8_t* y, const uint8_t* uv, int stride, uint8_t* dst, int width, int height,
+                      ImgprocRgbLayout layout, ImgprocYuvMatrix matrix, int rowStart, int rowEnd)
+{
+    const YuvCoeffs& k    = coeffs[matrix];
+    const int        half = 1 << (YUV_SHIFT - 1);
+    const int        ri   = (layout == IMGPROC_BGR24) ? 2 : 0;
+    const int        bi   = 2 - ri;
+
+    for (int row = rowStart; row < rowEnd; row++)
+    {
+        const uint8_t* py  = y  + row * stride;
+        const uint8_t* puv = uv + (row / 2) * stride;
+        uint8_t*       out[3];
+        int            step;
+
+        if (layout == IMGPROC_RGB_PLANAR)
+        {
+            out[0] = dst + row * width;
+            out[1] = out[0] + width * height;
+            out[2] = out[1] + width * height;
+            step   = 1;
+        }
+        else
+        {
+            out[0] = dst + row * width * 3 + ri;
+            out[1] = dst + row * width * 3 + 1;
+            out[2] = dst + row * width * 3 + bi;
+            step   = 3;
+        }
+
+        int x = 0;
+
+#ifdef __ARM_NEON
+        const uint8x16_t y16   = vdupq_n_u8(16);
+        const uint8x8_t  c128  = vdup_n_u8(128);
+        const int32x4_t  vHalf = vdupq_n_s32(half);
+
+        for (; x + 16 <= width; x += 16)
+        {
+            const uint8x16_t  luma = vqsubq_u8(vld1q_u8(py + x), y16);
+            const uint8x8x2_t cuv  = vld2_u8(puv + x);
+            const int16x8_t   u    = vreinterpretq_s16_u16(vsubl_u8(cuv.val[0], c128));
+            const int16x8_t   v    = vreinterpretq_s16_u16(vsubl_u8(cuv.val[1], c128));
+
+            const uint16x8_t lLo = vmovl_u8(vget_low_u8(luma));
+            const uint16x8_t lHi = vmovl_u8(vget_high_u8(luma));
+
+            int32x4_t yy[4];
+            yy[0] = vmulq_n_s32(vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(lLo))),  k.y);
+            yy[1] = vmulq_n_s32(vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(lLo))), k.y);
+            yy[2] = vmulq_n_s32(vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(lHi))),  k.y);
+            yy[3] = vmulq_n_s32(vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(lHi))), k.y);
+
+            const int32x4_t uLo = vmovl_s16(vget_low_s16(u));
+            const int32x4_t uHi = vmovl_s16(vget_high_s16(u));
+            const int32x4_t vLo = vmovl_s16(vget_low_s16(v));
+            const int32x4_t vHi = vmovl_s16(vget_high_s16(v));
+
+            uint8x16x3_t rgb;
+            rgb.val[0] = Channel16(yy, vmlaq_n_s32(vHalf, vLo, k.vr), vmlaq_n_s32(vHalf, vHi, k.vr));
+            rgb.val[1] = Channel16(yy, vmlaq_n_s32(vmlaq_n_s32(vHalf, vLo, k.vg), uLo, k.ug),
+                                       vmlaq_n_s32(vmlaq_n_s32(vHalf, vHi, k.vg), uHi, k.ug));
+            rgb.val[2] = Channel16(yy, vmlaq_n_s32(vHalf, uLo, k.ub), vmlaq_n_s32(vHalf, uHi, k.ub));
+
+            if (layout == IMGPROC_RGB_PLANAR)
+            {
+                vst1q_u8(out[0] + x, rgb.val[0]);
+                vst1q_u8(out[1] + x, rgb.val[1]);
+                vst1q_u8(out[2] + x, rgb.val[2]);
+            }
+            else
+            {
+                if (layout == IMGPROC_BGR24)
+                {
+                    const uint8x16_t r = rgb.val[0];
+                    rgb.val[0] = rgb.val[2];
+                    rgb.val[2] = r;
+                }
+
+                vst3q_u8(dst + row * width * 3 + x * 3, rgb);
+            }
+        }
+#endif
+
+        for (; x < width; x++)
+        {
+            const int c  = x & ~1;
+            const int uu = puv[c]     - 128;
+            const int vv = puv[c + 1] - 128;
+            const int l  = (py[x] > 16 ? py[x] - 16 : 0) * k.y;
+
+            out[0][x * step] = Clamp8((l + half + k.vr * vv)            >> YUV_SHIFT);
+            out[1][x * step] = Clamp8((l + half + k.vg * vv + k.ug * uu) >> YUV_SHIFT);
+            out[2][x * step] = Clamp8((l + half + k.ub * uu)            >> YUV_SHIFT);
+        }
+    }
+}
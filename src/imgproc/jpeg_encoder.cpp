@@ -0,0 +1,734 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "jpeg_encoder.h"
+
+// Room the headers get at the start of the arena
+static const int HEADER_MAX_BYTES = 1024;
+// Most an MCU of six blocks can take with every byte stuffed, checked for before each MCU
+static const int MCU_MAX_BYTES    = 4096;
+
+// Natural (row major) position of each zigzag index
+static const uint8_t ZigzagNatural[64] =
+{
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// Quantization tables of the standard (K.1 and K.2) for quality 50, row major
+static const uint8_t StdQuant[2][64] =
+{
+    {
+        16,  11,  10,  16,  24,  40,  51,  61,
+        12,  12,  14,  19,  26,  58,  60,  55,
+        14,  13,  16,  24,  40,  57,  69,  56,
+        14,  17,  22,  29,  51,  87,  80,  62,
+        18,  22,  37,  56,  68, 109, 103,  77,
+        24,  35,  55,  64,  81, 104, 113,  92,
+        49,  64,  78,  87, 103, 121, 120, 101,
+        72,  92,  95,  98, 112, 100, 103,  99
+    },
+    {
+        17,  18,  24,  47,  99,  99,  99,  99,
+        18,  21,  26,  66,  99,  99,  99,  99,
+        24,  26,  56,  99,  99,  99,  99,  99,
+        47,  66,  99,  99,  99,  99,  99,  99,
+        99,  99,  99,  99,  99,  99,  99,  99,
+        99,  99,  99,  99,  99,  99,  99,  99,
+        99,  99,  99,  99,  99,  99,  99,  99,
+        99,  99,  99,  99,  99,  99,  99,  99
+    }
+};
+
+// Huffman tables of the standard (K.3), code counts per length and the symbols in code order
+static const uint8_t DcBits[2][16] =
+{
+    {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
+    {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0}
+};
+
+static const uint8_t DcVals[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+static const uint8_t AcBits[2][16] =
+{
+    {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d},
+    {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77}
+};
+
+static const uint8_t AcVals[2][162] =
+{
+    {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+        0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+        0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+        0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+        0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+        0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+        0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+        0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+        0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa
+    },
+    {
+        0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+        0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+        0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+        0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+        0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+        0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+        0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+        0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+        0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+        0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa
+    }
+};
+
+// Output scale of the AAN DCT for each frequency, cos(k * pi / 16) * sqrt(2) for k > 0
+static const double AanScale[8] = {1.0, 1.387039845, 1.306562965, 1.175875602, 1.0, 0.785694958, 0.541196100, 0.275899379};
+
+// DCT multipliers in Q15, 1.306562965 is done as x + x * 0.306562965
+static const int16_t FIX_0_382683433 = 12540;
+static const int16_t FIX_0_541196100 = 17734;
+static const int16_t FIX_0_707106781 = 23170;
+static const int16_t FIX_0_306562965 = 10045;
+
+// Where a natural order coefficient ends up in the block the DCT leaves, which is transposed
+static inline int Stored(int natural)
+{
+    return (natural % 8) * 8 + natural / 8;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Code and length of every symbol of a Huffman table, as in Annex C of the standard
+// -----------------------------------------------------------------------------------------------------------------------------
+static void MakeHuffTable(const uint8_t* bits, const uint8_t* vals, uint16_t* codes, uint8_t* sizes)
+{
+    int code = 0;
+    int k    = 0;
+
+    memset(sizes, 0, 256);
+
+    for(int len = 1; len <= 16; len++){
+        for(int i = 0; i < bits[len - 1]; i++, k++){
+            codes[vals[k]] = code++;
+            sizes[vals[k]] = len;
+        }
+        code <<= 1;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Entropy coded output with the 0 after every 0xFF byte
+// -----------------------------------------------------------------------------------------------------------------------------
+typedef struct BitWriter
+{
+    uint8_t* out;
+    uint64_t acc;                       ///< The low bits bits are waiting to go out
+    int      bits;
+} BitWriter;
+
+static inline void EmitByte(BitWriter* w, uint8_t b)
+{
+    *w->out++ = b;
+    if(b == 0xFF) *w->out++ = 0;
+}
+
+static inline void PutBits(BitWriter* w, uint32_t code, int size)
+{
+    w->acc   = (w->acc << size) | code;
+    w->bits += size;
+
+    if(w->bits >= 32){
+        w->bits -= 32;
+
+        const uint32_t word = (uint32_t)(w->acc >> w->bits);
+        const uint32_t inv  = ~word;
+
+        // Any 0xFF byte is a 0 byte of the inverse, without one the word goes out as it is
+        if(((inv - 0x01010101) & ~inv & 0x80808080) == 0){
+            w->out[0] = word >> 24;
+            w->out[1] = word >> 16;
+            w->out[2] = word >> 8;
+            w->out[3] = word;
+            w->out   += 4;
+        } else {
+            EmitByte(w, word >> 24);
+            EmitByte(w, word >> 16);
+            EmitByte(w, word >> 8);
+            EmitByte(w, word);
+        }
+    }
+}
+
+// Pad to a byte with 1 bits, before a restart marker
+static inline void FlushBits(BitWriter* w)
+{
+    const int pad = (8 - (w->bits & 7)) & 7;
+
+    PutBits(w, (1 << pad) - 1, pad);
+
+    while(w->bits >= 8){
+        w->bits -= 8;
+        EmitByte(w, (uint8_t)(w->acc >> w->bits));
+    }
+}
+
+// Bits of a coefficient's magnitude, and the bits that go out for it (one's complement for negative values)
+static inline int Category(int value, uint32_t* bits)
+{
+    const int mag  = (value < 0) ? -value : value;
+    const int size = mag ? 32 - __builtin_clz(mag) : 0;
+
+    *bits = (uint32_t)((value < 0) ? value - 1 : value) & ((1u << size) - 1);
+
+    return size;
+}
+
+static inline void Put16(uint8_t** out, int value)
+{
+    (*out)[0] = value >> 8;
+    (*out)[1] = value;
+    *out += 2;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// One 8 point AAN DCT, in 16 bit with the multiplies done like vqdmulh does them
+// -----------------------------------------------------------------------------------------------------------------------------
+static inline int16_t Mul15(int x, int16_t c)
+{
+    return (int16_t)((x * c) >> 15);
+}
+
+static void Dct8(const int16_t* in, int inStep, int16_t* out, int outStep)
+{
+    const int16_t tmp0 = in[0 * inStep] + in[7 * inStep];
+    const int16_t tmp7 = in[0 * inStep] - in[7 * inStep];
+    const int16_t tmp1 = in[1 * inStep] + in[6 * inStep];
+    const int16_t tmp6 = in[1 * inStep] - in[6 * inStep];
+    const int16_t tmp2 = in[2 * inStep] + in[5 * inStep];
+    const int16_t tmp5 = in[2 * inStep] - in[5 * inStep];
+    const int16_t tmp3 = in[3 * inStep] + in[4 * inStep];
+    const int16_t tmp4 = in[3 * inStep] - in[4 * inStep];
+
+    // Even part
+    const int16_t tmp10 = tmp0 + tmp3;
+    const int16_t tmp13 = tmp0 - tmp3;
+    const int16_t tmp11 = tmp1 + tmp2;
+    const int16_t tmp12 = tmp1 - tmp2;
+    const int16_t z1    = Mul15((int16_t)(tmp12 + tmp13), FIX_0_707106781);
+
+    out[0 * outStep] = tmp10 + tmp11;
+    out[4 * outStep] = tmp10 - tmp11;
+    out[2 * outStep] = tmp13 + z1;
+    out[6 * outStep] = tmp13 - z1;
+
+    // Odd part
+    const int16_t odd10 = tmp4 + tmp5;
+    const int16_t odd11 = tmp5 + tmp6;
+    const int16_t odd12 = tmp6 + tmp7;
+    const int16_t z5    = Mul15((int16_t)(odd10 - odd12), FIX_0_382683433);
+    const int16_t z2    = Mul15(odd10, FIX_0_541196100) + z5;
+    const int16_t z4    = odd12 + Mul15(odd12, FIX_0_306562965) + z5;
+    const int16_t z3    = Mul15(odd11, FIX_0_707106781);
+    const int16_t z11   = tmp7 + z3;
+    const int16_t z13   = tmp7 - z3;
+
+    out[5 * outStep] = z13 + z2;
+    out[3 * outStep] = z13 - z2;
+    out[1 * outStep] = z11 + z4;
+    out[7 * outStep] = z11 - z4;
+}
+
+#ifdef __ARM_NEON
+static inline void Dct8(int16x8_t* v)
+{
+    const int16x8_t tmp0 = vaddq_s16(v[0], v[7]);
+    const int16x8_t tmp7 = vsubq_s16(v[0], v[7]);
+    const int16x8_t tmp1 = vaddq_s16(v[1], v[6]);
+    const int16x8_t tmp6 = vsubq_s16(v[1], v[6]);
+    const int16x8_t tmp2 = vaddq_s16(v[2], v[5]);
+    const int16x8_t tmp5 = vsubq_s16(v[2], v[5]);
+    const int16x8_t tmp3 = vaddq_s16(v[3], v[4]);
+    const int16x8_t tmp4 = vsubq_s16(v[3], v[4]);
+
+    const int16x8_t tmp10 = vaddq_s16(tmp0, tmp3);
+    const int16x8_t tmp13 = vsubq_s16(tmp0, tmp3);
+    const int16x8_t tmp11 = vaddq_s16(tmp1, tmp2);
+    const int16x8_t tmp12 = vsubq_s16(tmp1, tmp2);
+    const int16x8_t z1    = vqdmulhq_n_s16(vaddq_s16(tmp12, tmp13), FIX_0_707106781);
+
+    v[0] = vaddq_s16(tmp10, tmp11);
+    v[4] = vsubq_s16(tmp10, tmp11);
+    v[2] = vaddq_s16(tmp13, z1);
+    v[6] = vsubq_s16(tmp13, z1);
+
+    const int16x8_t odd10 = vaddq_s16(tmp4, tmp5);
+    const int16x8_t odd11 = vaddq_s16(tmp5, tmp6);
+    const int16x8_t odd12 = vaddq_s16(tmp6, tmp7);
+    const int16x8_t z5    = vqdmulhq_n_s16(vsubq_s16(odd10, odd12), FIX_0_382683433);
+    const int16x8_t z2    = vaddq_s16(vqdmulhq_n_s16(odd10, FIX_0_541196100), z5);
+    const int16x8_t z4    = vaddq_s16(vaddq_s16(odd12, vqdmulhq_n_s16(odd12, FIX_0_306562965)), z5);
+    const int16x8_t z3    = vqdmulhq_n_s16(odd11, FIX_0_707106781);
+    const int16x8_t z11   = vaddq_s16(tmp7, z3);
+    const int16x8_t z13   = vsubq_s16(tmp7, z3);
+
+    v[5] = vaddq_s16(z13, z2);
+    v[3] = vsubq_s16(z13, z2);
+    v[1] = vaddq_s16(z11, z4);
+    v[7] = vsubq_s16(z11, z4);
+}
+
+static inline void Transpose8x8(int16x8_t* v)
+{
+    const int16x8x2_t t01 = vtrnq_s16(v[0], v[1]);
+    const int16x8x2_t t23 = vtrnq_s16(v[2], v[3]);
+    const int16x8x2_t t45 = vtrnq_s16(v[4], v[5]);
+    const int16x8x2_t t67 = vtrnq_s16(v[6], v[7]);
+
+    const int32x4x2_t u02 = vtrnq_s32(vreinterpretq_s32_s16(t01.val[0]), vreinterpretq_s32_s16(t23.val[0]));
+    const int32x4x2_t u13 = vtrnq_s32(vreinterpretq_s32_s16(t01.val[1]), vreinterpretq_s32_s16(t23.val[1]));
+    const int32x4x2_t u46 = vtrnq_s32(vreinterpretq_s32_s16(t45.val[0]), vreinterpretq_s32_s16(t67.val[0]));
+    const int32x4x2_t u57 = vtrnq_s32(vreinterpretq_s32_s16(t45.val[1]), vreinterpretq_s32_s16(t67.val[1]));
+
+    v[0] = vcombine_s16(vget_low_s16 (vreinterpretq_s16_s32(u02.val[0])), vget_low_s16 (vreinterpretq_s16_s32(u46.val[0])));
+    v[4] = vcombine_s16(vget_high_s16(vreinterpretq_s16_s32(u02.val[0])), vget_high_s16(vreinterpretq_s16_s32(u46.val[0])));
+    v[2] = vcombine_s16(vget_low_s16 (vreinterpretq_s16_s32(u02.val[1])), vget_low_s16 (vreinterpretq_s16_s32(u46.val[1])));
+    v[6] = vcombine_s16(vget_high_s16(vreinterpretq_s16_s32(u02.val[1])), vget_high_s16(vreinterpretq_s16_s32(u46.val[1])));
+    v[1] = vcombine_s16(vget_low_s16 (vreinterpretq_s16_s32(u13.val[0])), vget_low_s16 (vreinterpretq_s16_s32(u57.val[0])));
+    v[5] = vcombine_s16(vget_high_s16(vreinterpretq_s16_s32(u13.val[0])), vget_high_s16(vreinterpretq_s16_s32(u57.val[0])));
+    v[3] = vcombine_s16(vget_low_s16 (vreinterpretq_s16_s32(u13.val[1])), vget_low_s16 (vreinterpretq_s16_s32(u57.val[1])));
+    v[7] = vcombine_s16(vget_high_s16(vreinterpretq_s16_s32(u13.val[1])), vget_high_s16(vreinterpretq_s16_s32(u57.val[1])));
+}
+#endif
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// DCT and quantization of a level shifted block in place. The columns go first and the rows second, which leaves the
+// coefficients transposed, the quantization tables and the zigzag order account for that. The quantized value is
+// (|x| + divisor / 2) / divisor with the division done as a multiply by the reciprocal.
+// -----------------------------------------------------------------------------------------------------------------------------
+static inline int16_t Quantize(int16_t x, uint16_t recip, uint16_t half)
+{
+    const int16_t  sign = x >> 15;
+    const uint16_t n    = (uint16_t)((x ^ sign) - sign) + half;
+    const int16_t  q    = (int16_t)(((uint32_t)n * recip) >> 16);
+
+    return (q ^ sign) - sign;
+}
+
+static void DctQuant(int16_t* block, const uint16_t* recip, const uint16_t* half)
+{
+#ifdef __ARM_NEON
+    int16x8_t v[8];
+
+    for(int i = 0; i < 8; i++) v[i] = vld1q_s16(block + 8 * i);
+
+    Dct8(v);
+    Transpose8x8(v);
+    Dct8(v);
+
+    for(int i = 0; i < 8; i++){
+        const int16x8_t  sign = vshrq_n_s16(v[i], 15);
+        const uint16x8_t n    = vaddq_u16(vreinterpretq_u16_s16(vabsq_s16(v[i])), vld1q_u16(half + 8 * i));
+        const uint16x8_t r    = vld1q_u16(recip + 8 * i);
+        const uint16x8_t q    = vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(n),  vget_low_u16(r)),  16),
+                                             vshrn_n_u32(vmull_u16(vget_high_u16(n), vget_high_u16(r)), 16));
+
+        vst1q_s16(block + 8 * i, vsubq_s16(veorq_s16(vreinterpretq_s16_u16(q), sign), sign));
+    }
+#else
+    int16_t tmp[64];
+
+    for(int c = 0; c < 8; c++) Dct8(block + c, 8, tmp + c, 8);
+    for(int k = 0; k < 8; k++) Dct8(tmp + 8 * k, 1, block + k, 8);
+
+    for(int i = 0; i < 64; i++) block[i] = Quantize(block[i], recip[i], half[i]);
+#endif
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Level shifted 8x8 block of a grey (or luma) image, and of the Cb and Cr of an interleaved chroma plane. x and width are in
+// samples of the plane, the last column is repeated past the right edge.
+// -----------------------------------------------------------------------------------------------------------------------------
+static void LoadBlock(const uint8_t* const* rows, int x, int width, int16_t* block)
+{
+#ifdef __ARM_NEON
+    if(x + 8 <= width){
+        for(int r = 0; r < 8; r++){
+            vst1q_s16(block + 8 * r, vreinterpretq_s16_u16(vsubl_u8(vld1_u8(rows[r] + x), vdup_n_u8(128))));
+        }
+        return;
+    }
+#endif
+
+    for(int r = 0; r < 8; r++){
+        for(int i = 0; i < 8; i++){
+            block[8 * r + i] = rows[r][(x + i < width) ? x + i : width - 1] - 128;
+        }
+    }
+}
+
+static void LoadChroma(const uint8_t* const* rows, int x, int width, int16_t* cb, int16_t* cr)
+{
+#ifdef __ARM_NEON
+    if(x + 8 <= width){
+        for(int r = 0; r < 8; r++){
+            const uint8x8x2_t uv = vld2_u8(rows[r] + 2 * x);
+
+            vst1q_s16(cb + 8 * r, vreinterpretq_s16_u16(vsubl_u8(uv.val[0], vdup_n_u8(128))));
+            vst1q_s16(cr + 8 * r, vreinterpretq_s16_u16(vsubl_u8(uv.val[1], vdup_n_u8(128))));
+        }
+        return;
+    }
+#endif
+
+    for(int r = 0; r < 8; r++){
+        for(int i = 0; i < 8; i++){
+            const int c = (x + i < width) ? x + i : width - 1;
+
+            cb[8 * r + i] = rows[r][2 * c]     - 128;
+            cr[8 * r + i] = rows[r][2 * c + 1] - 128;
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Huffman codes of a quantized block. The zigzag pass also makes a mask of the non zero coefficients so that the runs of
+// zeros are found with a count of trailing zeros instead of a test per coefficient.
+// -----------------------------------------------------------------------------------------------------------------------------
+static void EncodeBlock(BitWriter* w, const int16_t* block, int* lastDc, const uint16_t* dcCode, const uint8_t* dcSize,
+                        const uint16_t* acCode, const uint8_t* acSize)
+{
+    int16_t  zz[64];
+    uint64_t nonZero = 0;
+
+    for(int i = 1; i < 64; i++){
+        zz[i]    = block[Stored(ZigzagNatural[i])];
+        nonZero |= (uint64_t)(zz[i] != 0) << i;
+    }
+
+    uint32_t bits;
+    int      size = Category(block[0] - *lastDc, &bits);
+
+    *lastDc = block[0];
+    PutBits(w, dcCode[size], dcSize[size]);
+    if(size) PutBits(w, bits, size);
+
+    int last = 0;
+    while(nonZero){
+        const int i   = __builtin_ctzll(nonZero);
+        int       run = i - last - 1;
+
+        for(; run >= 16; run -= 16){
+            PutBits(w, acCode[0xF0], acSize[0xF0]);
+        }
+
+        // Baseline AC values have at most 10 bits
+        const int value = (zz[i] > 1023) ? 1023 : (zz[i] < -1023) ? -1023 : zz[i];
+        size = Category(value, &bits);
+
+        const int symbol = (run << 4) | size;
+        PutBits(w, (acCode[symbol] << size) | bits, acSize[symbol] + size);
+
+        last     = i;
+        nonZero &= nonZero - 1;
+    }
+
+    if(last != 63){
+        PutBits(w, acCode[0x00], acSize[0x00]);
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Constructor
+// -----------------------------------------------------------------------------------------------------------------------------
+JpegEncoder::JpegEncoder(int width, int height, int numImages, bool colour, int quality, int numBands) :
+    m_width    (width),
+    m_height   (height),
+    m_numImages(numImages),
+    m_colour   (colour),
+    m_numBands (numBands),
+    m_mcuSize  (colour ? 16 : 8)
+{
+    m_mcusX   = (width + m_mcuSize - 1) / m_mcuSize;
+    m_mcuRows = (height * numImages + m_mcuSize - 1) / m_mcuSize;
+
+    if(m_numBands > m_mcuRows) m_numBands = m_mcuRows;
+    if(m_numBands < 1)         m_numBands = 1;
+
+    // The IJG scaling of the standard tables, and the divisors with the DCT scale factors and its 8x gain folded in. A
+    // divisor of 1 would need a 17 bit reciprocal, only quality 100 gets there and then 2 costs very little.
+    const int scale = (quality < 50) ? 5000 / quality : 200 - 2 * quality;
+    uint8_t   tables[2][64];
+
+    for(int t = 0; t < 2; t++){
+        for(int n = 0; n < 64; n++){
+            int q = (StdQuant[t][n] * scale + 50) / 100;
+            q = (q < 1) ? 1 : (q > 255) ? 255 : q;
+            tables[t][n] = q;
+
+            int divisor = (int)lround(q * AanScale[n / 8] * AanScale[n % 8] * 8);
+            if(divisor < 2) divisor = 2;
+
+            m_quant[t].recip[Stored(n)] = (65536 + divisor - 1) / divisor;
+            m_quant[t].half [Stored(n)] = divisor / 2;
+        }
+
+        MakeHuffTable(DcBits[t], DcVals,    m_dc[t].code, m_dc[t].size);
+        MakeHuffTable(AcBits[t], AcVals[t], m_ac[t].code, m_ac[t].size);
+    }
+
+    // Every band gets a byte per sample, more than any but the noisiest images at the highest qualities need
+    const int mcuBytes = colour ? 6 * 64 : 64;
+
+    m_bandRow   = (int*)     malloc((m_numBands + 1) * sizeof(int));
+    m_bandStart = (uint8_t**)malloc((m_numBands + 1) * sizeof(uint8_t*));
+    m_bandSize  = (int*)     malloc(m_numBands * sizeof(int));
+
+    size_t arenaSize = HEADER_MAX_BYTES;
+    for(int b = 0; b <= m_numBands; b++){
+        m_bandRow[b] = b * m_mcuRows / m_numBands;
+
+        if(b > 0) arenaSize += (size_t)(m_bandRow[b] - m_bandRow[b - 1]) * m_mcusX * mcuBytes + MCU_MAX_BYTES;
+    }
+
+    m_arena = (uint8_t*)malloc(arenaSize);
+
+    size_t offset = HEADER_MAX_BYTES;
+    for(int b = 0; b <= m_numBands; b++){
+        m_bandStart[b] = m_arena + offset;
+
+        if(b < m_numBands) offset += (size_t)(m_bandRow[b + 1] - m_bandRow[b]) * m_mcusX * mcuBytes + MCU_MAX_BYTES;
+    }
+
+    WriteHeaders(tables);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Destructor
+// -----------------------------------------------------------------------------------------------------------------------------
+JpegEncoder::~JpegEncoder()
+{
+    free(m_arena);
+    free(m_bandRow);
+    free(m_bandStart);
+    free(m_bandSize);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Everything up to the entropy coded data, it's the same for every frame
+// -----------------------------------------------------------------------------------------------------------------------------
+void JpegEncoder::WriteHeaders(const uint8_t tables[2][64])
+{
+    static const uint8_t jfif[] = {0xFF, 0xD8, 0xFF, 0xE0, 0x00, 0x10, 'J', 'F', 'I', 'F', 0x00,
+                                   0x01, 0x01, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00};
+
+    const int numTables     = m_colour ? 2 : 1;
+    const int numComponents = m_colour ? 3 : 1;
+    uint8_t*  out           = m_arena;
+
+    memcpy(out, jfif, sizeof(jfif));
+    out += sizeof(jfif);
+
+    // Quantization tables, in zigzag order
+    *out++ = 0xFF;
+    *out++ = 0xDB;
+    Put16(&out, 2 + 65 * numTables);
+    for(int t = 0; t < numTables; t++){
+        *out++ = t;
+        for(int i = 0; i < 64; i++) *out++ = tables[t][ZigzagNatural[i]];
+    }
+
+    // Frame header, luma is sampled 2x2 in an MCU of 4:2:0
+    *out++ = 0xFF;
+    *out++ = 0xC0;
+    Put16(&out, 8 + 3 * numComponents);
+    *out++ = 8;
+    Put16(&out, m_height * m_numImages);
+    Put16(&out, m_width);
+    *out++ = numComponents;
+    for(int c = 0; c < numComponents; c++){
+        *out++ = c + 1;
+        *out++ = (m_colour && c == 0) ? 0x22 : 0x11;
+        *out++ = (c == 0) ? 0 : 1;
+    }
+
+    // A restart marker after every MCU row
+    *out++ = 0xFF;
+    *out++ = 0xDD;
+    Put16(&out, 4);
+    Put16(&out, m_mcusX);
+
+    // Huffman tables
+    *out++ = 0xFF;
+    *out++ = 0xC4;
+    Put16(&out, 2 + numTables * (2 * 17 + sizeof(DcVals) + sizeof(AcVals[0])));
+    for(int t = 0; t < numTables; t++){
+        *out++ = 0x00 | t;
+        memcpy(out, DcBits[t], 16);
+        memcpy(out + 16, DcVals, sizeof(DcVals));
+        out += 16 + sizeof(DcVals);
+
+        *out++ = 0x10 | t;
+        memcpy(out, AcBits[t], 16);
+        memcpy(out + 16, AcVals[t], sizeof(AcVals[t]));
+        out += 16 + sizeof(AcVals[t]);
+    }
+
+    // Scan header
+    *out++ = 0xFF;
+    *out++ = 0xDA;
+    Put16(&out, 6 + 2 * numComponents);
+    *out++ = numComponents;
+    for(int c = 0; c < numComponents; c++){
+        *out++ = c + 1;
+        *out++ = (c == 0) ? 0x00 : 0x11;
+    }
+    *out++ = 0;
+    *out++ = 63;
+    *out++ = 0;
+
+    m_headerSize = out - m_arena;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// One row of MCUs and the restart marker after it. The rows of the stacked images come from the image they're in, and the
+// last row is repeated past the bottom.
+// -----------------------------------------------------------------------------------------------------------------------------
+void JpegEncoder::EncodeMcuRow(const uint8_t* const* y, const uint8_t* const* uv, const int* stride, int row, int band)
+{
+    const uint8_t* yRows[16];
+    const uint8_t* uvRows[8];
+
+    for(int i = 0; i < m_mcuSize; i++){
+        int r = row * m_mcuSize + i;
+        if(r > m_height * m_numImages - 1) r = m_height * m_numImages - 1;
+
+        yRows[i] = y[r / m_height] + (r % m_height) * stride[r / m_height];
+    }
+
+    if(m_colour){
+        const int chromaHeight = m_height / 2;
+
+        for(int i = 0; i < 8; i++){
+            int r = row * 8 + i;
+            if(r > chromaHeight * m_numImages - 1) r = chromaHeight * m_numImages - 1;
+
+            uvRows[i] = uv[r / chromaHeight] + (r % chromaHeight) * stride[r / chromaHeight];
+        }
+    }
+
+    BitWriter w;
+    w.out  = m_bandStart[band] + m_bandSize[band];
+    w.acc  = 0;
+    w.bits = 0;
+
+    int     lastDc[3] = {0, 0, 0};
+    int16_t block[64];
+    int16_t cr[64];
+
+    for(int mx = 0; mx < m_mcusX; mx++){
+        if(m_bandStart[band + 1] - w.out < MCU_MAX_BYTES){
+            m_bandSize[band] = -1;
+            return;
+        }
+
+        if(m_colour){
+            for(int i = 0; i < 4; i++){
+                LoadBlock(yRows + 8 * (i >> 1), mx * 16 + 8 * (i & 1), m_width, block);
+                DctQuant(block, m_quant[0].recip, m_quant[0].half);
+                EncodeBlock(&w, block, &lastDc[0], m_dc[0].code, m_dc[0].size, m_ac[0].code, m_ac[0].size);
+            }
+
+            LoadChroma(uvRows, mx * 8, m_width / 2, block, cr);
+            DctQuant(block, m_quant[1].recip, m_quant[1].half);
+            DctQuant(cr,    m_quant[1].recip, m_quant[1].half);
+            EncodeBlock(&w, block, &lastDc[1], m_dc[1].code, m_dc[1].size, m_ac[1].code, m_ac[1].size);
+            EncodeBlock(&w, cr,    &lastDc[2], m_dc[1].code, m_dc[1].size, m_ac[1].code, m_ac[1].size);
+        } else {
+            LoadBlock(yRows, mx * 8, m_width, block);
+            DctQuant(block, m_quant[0].recip, m_quant[0].half);
+            EncodeBlock(&w, block, &lastDc[0], m_dc[0].code, m_dc[0].size, m_ac[0].code, m_ac[0].size);
+        }
+    }
+
+    FlushBits(&w);
+
+    if(row != m_mcuRows - 1){
+        *w.out++ = 0xFF;
+        *w.out++ = 0xD0 | (row & 7);
+    }
+
+    m_bandSize[band] = w.out - m_bandStart[band];
+}
+
+void JpegEncoder::EncodeBand(const uint8_t* const* y, const uint8_t* const* uv, const int* stride, int band)
+{
+    m_bandSize[band] = 0;
+
+    for(int row = m_bandRow[band]; row < m_bandRow[band + 1] && m_bandSize[band] >= 0; row++){
+        EncodeMcuRow(y, uv, stride, row, band);
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// The bands are moved down to follow each other, each one starts at or after where it's going
+// -----------------------------------------------------------------------------------------------------------------------------
+const uint8_t* JpegEncoder::Finish(int* size)
+{
+    uint8_t* out = m_arena + m_headerSize;
+
+    for(int b = 0; b < m_numBands; b++){
+        if(m_bandSize[b] < 0) return NULL;
+
+        memmove(out, m_bandStart[b], m_bandSize[b]);
+        out += m_bandSize[b];
+    }
+
+    *out++ = 0xFF;
+    *out++ = 0xD9;
+
+    *size = out - m_arena;
+
+    return m_arena;
+}
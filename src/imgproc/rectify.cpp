@@ -0,0 +1,552 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <modal_journal.h>
+
+#include "rectify.h"
+
+typedef struct CameraModel
+{
+    double K[9];        ///< Camera matrix
+    double D[8];        ///< Distortion coefficients, k1..k4 for fisheye, otherwise k1 k2 p1 p2 [k3 [k4 k5 k6]]
+    int    numD;        ///< Number of distortion coefficients
+    bool   fisheye;     ///< Equidistant fisheye model
+} CameraModel;
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Minimal reader for the OpenCV FileStorage yaml format, just enough to get at the matrices and strings we need
+// -----------------------------------------------------------------------------------------------------------------------------
+static bool ReadFile(const char* path, std::string& text)
+{
+    FILE* file = fopen(path, "r");
+
+    if (file == NULL)
+    {
+        M_ERROR("Failed to open calibration file: %s\n", path);
+        return false;
+    }
+
+    char buf[4096];
+    size_t len;
+
+    while ((len = fread(buf, 1, sizeof(buf), file)) > 0)
+    {
+        text.append(buf, len);
+    }
+
+    fclose(file);
+
+    return true;
+}
+
+// Top level keys start a line and are followed by a colon
+static const char* FindKey(const std::string& text, const char* key)
+{
+    size_t keyLen = strlen(key);
+
+    for (size_t pos = text.find(key); pos != std::string::npos; pos = text.find(key, pos + 1))
+    {
+        if ((pos == 0 || text[pos - 1] == '\n') && text[pos + keyLen] == ':')
+        {
+            return text.c_str() + pos + keyLen + 1;
+        }
+    }
+
+    return NULL;
+}
+
+// Returns the number of values read, -1 if the key isn't there
+static int ReadMatrix(const std::string& text, const char* key, double* values, int maxValues)
+{
+    const char* p = FindKey(text, key);
+
+    if (p == NULL || (p = strstr(p, "data:")) == NULL || (p = strchr(p, '[')) == NULL) return -1;
+
+    int count = 0;
+
+    for (p++; count < maxValues; count++)
+    {
+        char* end;
+        double value = strtod(p, &end);
+
+        if (end == p) break;
+
+        values[count] = value;
+        p = end + strspn(end, " \t\r\n,");
+    }
+
+    return count;
+}
+
+static bool ReadString(const std::string& text, const char* key, char* value, int maxLen)
+{
+    const char* p = FindKey(text, key);
+
+    if (p == NULL) return false;
+
+    p += strspn(p, " \t\"");
+    int len = strcspn(p, "\"\r\n");
+    if (len >= maxLen) len = maxLen - 1;
+
+    memcpy(value, p, len);
+    value[len] = 0;
+
+    return true;
+}
+
+static bool ReadCamera(const std::string& text, const char* path, const char* kKey, const char* dKey, CameraModel* cam)
+{
+    char model[32] = "";
+    ReadString(text, "distortion_model", model, sizeof(model));
+
+    cam->fisheye = !strcmp(model, "fisheye") || !strcmp(model, "equidistant");
+
+    if (ReadMatrix(text, kKey, cam->K, 9) != 9)
+    {
+        M_ERROR("Calibration file %s has no 3x3 %s\n", path, kKey);
+        return false;
+    }
+
+    memset(cam->D, 0, sizeof(cam->D));
+    cam->numD = ReadMatrix(text, dKey, cam->D, 8);
+
+    if (cam->fisheye ? (cam->numD != 4) : (cam->numD != 4 && cam->numD != 5 && cam->numD != 8))
+    {
+        M_ERROR("Calibration file %s has an invalid %s for the %s model\n", path, dKey, cam->fisheye ? "fisheye" : "plumb bob");
+        return false;
+    }
+
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// 3x3 helpers, row major
+// -----------------------------------------------------------------------------------------------------------------------------
+static void MatMul(const double* a, const double* b, double* out, bool transposeB)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            out[i * 3 + j] = 0;
+            for (int k = 0; k < 3; k++)
+            {
+                out[i * 3 + j] += a[i * 3 + k] * (transposeB ? b[j * 3 + k] : b[k * 3 + j]);
+            }
+        }
+    }
+}
+
+static void RodriguesToMatrix(const double* r, double* R)
+{
+    double theta = sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+
+    if (theta < 1e-12)
+    {
+        const double identity[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+        memcpy(R, identity, sizeof(identity));
+        return;
+    }
+
+    double k[3] = {r[0] / theta, r[1] / theta, r[2] / theta};
+    double c = cos(theta), s = sin(theta);
+
+    R[0] = c + (1 - c) * k[0] * k[0];        R[1] = (1 - c) * k[0] * k[1] - s * k[2]; R[2] = (1 - c) * k[0] * k[2] + s * k[1];
+    R[3] = (1 - c) * k[1] * k[0] + s * k[2]; R[4] = c + (1 - c) * k[1] * k[1];        R[5] = (1 - c) * k[1] * k[2] - s * k[0];
+    R[6] = (1 - c) * k[2] * k[0] - s * k[1]; R[7] = (1 - c) * k[2] * k[1] + s * k[0]; R[8] = c + (1 - c) * k[2] * k[2];
+}
+
+// The cameras of a stereo pair are nearly parallel so the angle never gets close to pi
+static void MatrixToRodrigues(const double* R, double* r)
+{
+    double c     = (R[0] + R[4] + R[8] - 1) / 2;
+    double theta = acos(c < -1 ? -1 : (c > 1 ? 1 : c));
+    double s     = sin(theta);
+
+    if (s < 1e-9)
+    {
+        r[0] = r[1] = r[2] = 0;
+        return;
+    }
+
+    r[0] = (R[7] - R[5]) * theta / (2 * s);
+    r[1] = (R[2] - R[6]) * theta / (2 * s);
+    r[2] = (R[3] - R[1]) * theta / (2 * s);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Lens models. Distort() goes from a ray in the camera frame to a pixel, false if the ray can't be seen. Undistort() goes from
+// a pixel back to a point on the z = 1 plane, iteratively like cv::undistortPoints().
+// -----------------------------------------------------------------------------------------------------------------------------
+static bool Distort(const CameraModel* cam, double X, double Y, double Z, double* u, double* v)
+{
+    const double* K = cam->K;
+    const double* D = cam->D;
+    double        xd, yd;
+
+    if (cam->fisheye)
+    {
+        double r      = sqrt(X * X + Y * Y);
+        double theta  = atan2(r, Z);
+        double theta2 = theta * theta;
+        double thetaD = theta * (1 + theta2 * (D[0] + theta2 * (D[1] + theta2 * (D[2] + theta2 * D[3]))));
+        double scale  = r > 1e-12 ? thetaD / r : 0;
+
+        xd = X * scale;
+        yd = Y * scale;
+    }
+    else
+    {
+        if (Z < 1e-12) return false;
+
+        double x      = X / Z;
+        double y      = Y / Z;
+        double r2     = x * x + y * y;
+        double radial = 1 + r2 * (D[0] + r2 * (D[1] + r2 * D[4]));
+
+        if (cam->numD == 8) radial /= 1 + r2 * (D[5] + r2 * (D[6] + r2 * D[7]));
+
+        xd = x * radial + 2 * D[2] * x * y + D[3] * (r2 + 2 * x * x);
+        yd = y * radial + D[2] * (r2 + 2 * y * y) + 2 * D[3] * x * y;
+    }
+
+    *u = K[0] * xd + K[1] * yd + K[2];
+    *v = K[4] * yd + K[5];
+
+    return true;
+}
+
+static void Undistort(const CameraModel* cam, double u, double v, double* x, double* y)
+{
+    const double* K  = cam->K;
+    const double* D  = cam->D;
+    double        yd = (v - K[5]) / K[4];
+    double        xd = (u - K[2] - K[1] * yd) / K[0];
+
+    *x = xd;
+    *y = yd;
+
+    if (cam->fisheye)
+    {
+        double thetaD = sqrt(xd * xd + yd * yd);
+        double theta  = thetaD;
+
+        if (thetaD < 1e-12) return;
+
+        for (int i = 0; i < 10; i++)
+        {
+            double theta2 = theta * theta;
+            theta = thetaD / (1 + theta2 * (D[0] + theta2 * (D[1] + theta2 * (D[2] + theta2 * D[3]))));
+        }
+
+        *x = xd * tan(theta) / thetaD;
+        *y = yd * tan(theta) / thetaD;
+        return;
+    }
+
+    for (int i = 0; i < 10; i++)
+    {
+        double r2     = *x * *x + *y * *y;
+        double radial = 1 + r2 * (D[0] + r2 * (D[1] + r2 * D[4]));
+
+        if (cam->numD == 8) radial /= 1 + r2 * (D[5] + r2 * (D[6] + r2 * D[7]));
+
+        double dx = 2 * D[2] * *x * *y + D[3] * (r2 + 2 * *x * *x);
+        double dy = D[2] * (r2 + 2 * *y * *y) + 2 * D[3] * *x * *y;
+
+        *x = (xd - dx) / radial;
+        *y = (yd - dy) / radial;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Bouguet's rectification as in cv::stereoRectify() with CALIB_ZERO_DISPARITY: both cameras are rotated half way towards each
+// other and then together so that the baseline lines up with the x (or y) axis. Both get the same new camera matrix, the mean
+// of the two focal lengths and a principal point that centers the image corners. Like OpenCV's default (alpha = -1) the result
+// isn't scaled to show all or only valid pixels.
+// -----------------------------------------------------------------------------------------------------------------------------
+static void StereoRectify(const CameraModel* cams, const double* R, const double* T, int width, int height,
+                          double* Rrect, double* Pnew)
+{
+    double om[3], rr[9], t[3];
+
+    MatrixToRodrigues(R, om);
+    for (int i = 0; i < 3; i++) om[i] *= -0.5;
+    RodriguesToMatrix(om, rr);
+
+    for (int i = 0; i < 3; i++)
+    {
+        t[i] = rr[i * 3] * T[0] + rr[i * 3 + 1] * T[1] + rr[i * 3 + 2] * T[2];
+    }
+
+    int    idx = fabs(t[0]) > fabs(t[1]) ? 0 : 1;
+    double c   = t[idx];
+    double nt  = sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+    double uu[3] = {0, 0, 0};
+    uu[idx] = c > 0 ? 1 : -1;
+
+    double ww[3] = {t[1] * uu[2] - t[2] * uu[1], t[2] * uu[0] - t[0] * uu[2], t[0] * uu[1] - t[1] * uu[0]};
+    double nw    = sqrt(ww[0] * ww[0] + ww[1] * ww[1] + ww[2] * ww[2]);
+
+    if (nw > 0)
+    {
+        double scale = acos(fabs(c) / nt) / nw;
+        for (int i = 0; i < 3; i++) ww[i] *= scale;
+    }
+
+    double wR[9];
+    RodriguesToMatrix(ww, wR);
+
+    MatMul(wR, rr, &Rrect[0], true);
+    MatMul(wR, rr, &Rrect[9], false);
+
+    // Both cameras get the mean focal length along the other axis than the baseline
+    double fNew = (cams[0].K[idx ? 0 : 4] + cams[1].K[idx ? 0 : 4]) / 2;
+    double cc[2] = {0, 0};
+
+    // The principal point is chosen so that the centroid of the rectified image corners ends up in the middle
+    for (int k = 0; k < 2; k++)
+    {
+        const double* Rk = &Rrect[k * 9];
+
+        for (int i = 0; i < 4; i++)
+        {
+            double x, y, q[3];
+
+            Undistort(&cams[k], (i % 2) * (width - 1), (i / 2) * (height - 1), &x, &y);
+
+            for (int j = 0; j < 3; j++) q[j] = Rk[j * 3] * x + Rk[j * 3 + 1] * y + Rk[j * 3 + 2];
+
+            cc[0] -= fNew * q[0] / q[2] / 8;
+            cc[1] -= fNew * q[1] / q[2] / 8;
+        }
+    }
+
+    cc[0] += (width  - 1) / 2.0;
+    cc[1] += (height - 1) / 2.0;
+
+    for (int k = 0; k < 2; k++)
+    {
+        Pnew[k * 4 + 0] = fNew;
+        Pnew[k * 4 + 1] = fNew;
+        Pnew[k * 4 + 2] = cc[0];
+        Pnew[k * 4 + 3] = cc[1];
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Fills the remap table of one camera. Rrect rotates the camera into the rectified frame, Pnew is fx fy cx cy of the output.
+// -----------------------------------------------------------------------------------------------------------------------------
+static int BuildMap(const CameraModel* cam, const double* Rrect, const double* Pnew, int width, int height, ImgprocRemap* map)
+{
+    const int one = 1 << IMGPROC_REMAP_FRAC_BITS;
+
+    map->width     = width;
+    map->height    = height;
+    map->srcStride = width;
+    map->offsets   = (uint32_t*)malloc(width * height * sizeof(uint32_t));
+    map->weights   = (uint8_t*) malloc(width * height);
+    map->spans     = (uint16_t*)malloc(2 * height * sizeof(uint16_t));
+
+    if (map->offsets == NULL || map->weights == NULL || map->spans == NULL)
+    {
+        M_ERROR("Failed to allocate %dx%d remap table\n", width, height);
+        rectifyFreeMap(map);
+        return -1;
+    }
+
+    for (int v = 0; v < height; v++)
+    {
+        uint32_t* off   = map->offsets + v * width;
+        uint8_t*  wgt   = map->weights + v * width;
+        int       first = width;
+        int       last  = -1;
+
+        for (int u = 0; u < width; u++)
+        {
+            double px = (u - Pnew[2]) / Pnew[0];
+            double py = (v - Pnew[3]) / Pnew[1];
+
+            // Ray in the camera frame
+            double X = Rrect[0] * px + Rrect[3] * py + Rrect[6];
+            double Y = Rrect[1] * px + Rrect[4] * py + Rrect[7];
+            double Z = Rrect[2] * px + Rrect[5] * py + Rrect[8];
+
+            double sx, sy;
+            bool   valid = Distort(cam, X, Y, Z, &sx, &sy);
+            int    ix = 0, iy = 0, fx = 0, fy = 0;
+
+            if (valid && sx > -1 && sy > -1 && sx < width && sy < height)
+            {
+                ix = (int)floor(sx);
+                iy = (int)floor(sy);
+                fx = (int)lround((sx - ix) * one);
+                fy = (int)lround((sy - iy) * one);
+
+                if (fx == one) { ix++; fx = 0; }
+                if (fy == one) { iy++; fy = 0; }
+            }
+            else
+            {
+                valid = false;
+            }
+
+            // The whole 2x2 neighbourhood has to be inside the image
+            valid = valid && ix >= 0 && iy >= 0 && ix <= width - 2 && iy <= height - 2;
+
+            if (valid)
+            {
+                if (first == width) first = u;
+                last = u;
+            }
+            else
+            {
+                // Only sampled if it's in between valid pixels, clamp it to the nearest edge pixel
+                ix = ix < 0 ? 0 : (ix > width  - 2 ? width  - 2 : ix);
+                iy = iy < 0 ? 0 : (iy > height - 2 ? height - 2 : iy);
+                fx = 0;
+                fy = 0;
+            }
+
+            off[u] = iy * width + ix;
+            wgt[u] = (fy << IMGPROC_REMAP_FRAC_BITS) | fx;
+        }
+
+        map->spans[2 * v]     = last < 0 ? 0 : first;
+        map->spans[2 * v + 1] = last < 0 ? 0 : last + 1;
+    }
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Loads the calibration and builds the tables
+// -----------------------------------------------------------------------------------------------------------------------------
+int rectifyBuildMaps(const char* intrinsicsFile, const char* extrinsicsFile, int width, int height, ImgprocRemap* maps)
+{
+    const bool  stereo = (extrinsicsFile != NULL);
+    std::string intrinsics;
+    CameraModel cams[2];
+    double      Rrect[18];
+    double      Pnew[8];
+
+    if (width < 2 || height < 2 || width > 65535)
+    {
+        M_ERROR("Can't rectify %dx%d images\n", width, height);
+        return -1;
+    }
+
+    if (!ReadFile(intrinsicsFile, intrinsics)) return -1;
+
+    if (!stereo)
+    {
+        // Undistort into the original camera matrix
+        const double identity[9] = {1, 0, 0, 0, 1, 0, 0, 0, 1};
+
+        if (FindKey(intrinsics, "M") != NULL)
+        {
+            if (!ReadCamera(intrinsics, intrinsicsFile, "M", "D", &cams[0])) return -1;
+        }
+        else if (!ReadCamera(intrinsics, intrinsicsFile, "M1", "D1", &cams[0])) return -1;
+
+        memcpy(Rrect, identity, sizeof(identity));
+        Pnew[0] = cams[0].K[0];
+        Pnew[1] = cams[0].K[4];
+        Pnew[2] = cams[0].K[2];
+        Pnew[3] = cams[0].K[5];
+
+        M_DEBUG("Building undistortion table from %s\n", intrinsicsFile);
+
+        return BuildMap(&cams[0], Rrect, Pnew, width, height, &maps[0]);
+    }
+
+    std::string extrinsics;
+    double      R[9], T[3], P[24];
+
+    if (!ReadCamera(intrinsics, intrinsicsFile, "M1", "D1", &cams[0]) ||
+        !ReadCamera(intrinsics, intrinsicsFile, "M2", "D2", &cams[1]) ||
+        !ReadFile(extrinsicsFile, extrinsics))
+    {
+        return -1;
+    }
+
+    if (ReadMatrix(extrinsics, "R1", &Rrect[0], 9) == 9 && ReadMatrix(extrinsics, "R2", &Rrect[9], 9) == 9 &&
+        ReadMatrix(extrinsics, "P1", &P[0],    12) == 12 && ReadMatrix(extrinsics, "P2", &P[12],  12) == 12)
+    {
+        M_DEBUG("Using the rectification from %s\n", extrinsicsFile);
+
+        for (int k = 0; k < 2; k++)
+        {
+            Pnew[k * 4 + 0] = P[k * 12 + 0];
+            Pnew[k * 4 + 1] = P[k * 12 + 5];
+            Pnew[k * 4 + 2] = P[k * 12 + 2];
+            Pnew[k * 4 + 3] = P[k * 12 + 6];
+        }
+    }
+    else if (ReadMatrix(extrinsics, "R", R, 9) == 9 && ReadMatrix(extrinsics, "T", T, 3) == 3)
+    {
+        M_DEBUG("Computing the rectification from R and T in %s\n", extrinsicsFile);
+
+        StereoRectify(cams, R, T, width, height, Rrect, Pnew);
+    }
+    else
+    {
+        M_ERROR("Calibration file %s has neither R1/R2/P1/P2 nor R and T\n", extrinsicsFile);
+        return -1;
+    }
+
+    if (BuildMap(&cams[0], &Rrect[0], &Pnew[0], width, height, &maps[0])) return -1;
+
+    if (BuildMap(&cams[1], &Rrect[9], &Pnew[4], width, height, &maps[1]))
+    {
+        rectifyFreeMap(&maps[0]);
+        return -1;
+    }
+
+    return 0;
+}
+
+void rectifyFreeMap(ImgprocRemap* map)
+{
+    free(map->offsets);
+    free(map->weights);
+    free(map->spans);
+
+    map->offsets = NULL;
+    map->weights = NULL;
+    map->spans   = NULL;
+}
@@ -0,0 +1,499 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <modal_journal.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "stereo_bm.h"
+
+static const int CENSUS_RADIUS = 2;
+static const int MAX_COST      = 24;     // 5x5 census has 24 bits
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Constructor, everything is allocated up front
+// -----------------------------------------------------------------------------------------------------------------------------
+StereoMatcher::StereoMatcher(int width, int height, int numDisparities, int blockSize, int uniqueness, int numBands) :
+    m_width         (width),
+    m_height        (height),
+    m_numDisparities(numDisparities),
+    m_blockSize     (blockSize),
+    m_uniqueness    (uniqueness * 128 / 100),
+    m_numBands      (numBands),
+    m_border        (CENSUS_RADIUS + blockSize / 2),
+    m_aggStride     (width + numDisparities + 8)
+{
+    if (numDisparities < 8 || numDisparities % 8 != 0 || blockSize < 3 || blockSize > 11 || blockSize % 2 == 0 ||
+        uniqueness < 0 || uniqueness > 100 || numBands < 1 || width < numDisparities + 2 * m_border)
+    {
+        M_ERROR("Invalid stereo matcher setup: %dx%d, %d disparities, block %d, uniqueness %d, %d bands\n",
+            width, height, numDisparities, blockSize, uniqueness, numBands);
+        throw -EINVAL;
+    }
+
+    m_census  = (uint8_t*) malloc(6 * width * height);
+    m_rowCost = (uint8_t*) malloc(numBands * blockSize * numDisparities * width);
+    m_colSum  = (uint16_t*)malloc(numBands * numDisparities * width * sizeof(uint16_t));
+    m_agg     = (uint16_t*)malloc(numBands * numDisparities * m_aggStride * sizeof(uint16_t));
+    m_right   = (uint16_t*)malloc(numBands * 3 * m_aggStride * sizeof(uint16_t));
+
+    if (m_census == NULL || m_rowCost == NULL || m_colSum == NULL || m_agg == NULL || m_right == NULL)
+    {
+        M_ERROR("Failed to allocate the stereo matcher\n");
+        free(m_census);
+        free(m_rowCost);
+        free(m_colSum);
+        free(m_agg);
+        free(m_right);
+        throw -ENOMEM;
+    }
+
+    // Never written again, the right to left check reads past the end of the rows
+    for (int i = 0; i < numBands * numDisparities * m_aggStride; i++)
+    {
+        m_agg[i] = 0xFFFF;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Destructor
+// -----------------------------------------------------------------------------------------------------------------------------
+StereoMatcher::~StereoMatcher()
+{
+    free(m_census);
+    free(m_rowCost);
+    free(m_colSum);
+    free(m_agg);
+    free(m_right);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// 5x5 census: one bit per neighbour, set if it is darker than the center. The 24 bits are kept in 3 byte planes so that the
+// hamming distance is 3 byte wide popcounts. Neighbour n of the window (row major, center skipped) is bit 7 - n % 8 of plane
+// n / 8. The border that doesn't have a full window is 0.
+// -----------------------------------------------------------------------------------------------------------------------------
+void StereoMatcher::Census(int image, const uint8_t* src, int band)
+{
+    const int w    = m_width;
+    const int size = m_width * m_height;
+    int       rowStart, rowEnd;
+
+    BandRows(band, &rowStart, &rowEnd);
+
+    uint8_t* planes[3];
+    for (int p = 0; p < 3; p++)
+    {
+        planes[p] = m_census + (image * 3 + p) * size;
+    }
+
+    for (int y = rowStart; y < rowEnd; y++)
+    {
+        if (y < CENSUS_RADIUS || y >= m_height - CENSUS_RADIUS)
+        {
+            for (int p = 0; p < 3; p++) memset(planes[p] + y * w, 0, w);
+            continue;
+        }
+
+        const uint8_t* s = src + y * w;
+        int            x = CENSUS_RADIUS;
+
+        for (int p = 0; p < 3; p++)
+        {
+            memset(planes[p] + y * w, 0, CENSUS_RADIUS);
+            memset(planes[p] + y * w + w - CENSUS_RADIUS, 0, CENSUS_RADIUS);
+        }
+
+#ifdef __ARM_NEON
+        for (; x + 8 <= w - CENSUS_RADIUS; x += 8)
+        {
+            const uint8x8_t center = vld1_u8(s + x);
+            uint8x8_t       acc[3] = {vdup_n_u8(0), vdup_n_u8(0), vdup_n_u8(0)};
+            int             n      = 0;
+
+            for (int dy = -CENSUS_RADIUS; dy <= CENSUS_RADIUS; dy++)
+            {
+                for (int dx = -CENSUS_RADIUS; dx <= CENSUS_RADIUS; dx++)
+                {
+                    if (dx == 0 && dy == 0) continue;
+
+                    uint8x8_t bit = vshr_n_u8(vclt_u8(vld1_u8(s + dy * w + x + dx), center), 7);
+                    acc[n / 8] = vorr_u8(vshl_n_u8(acc[n / 8], 1), bit);
+                    n++;
+                }
+            }
+
+            for (int p = 0; p < 3; p++) vst1_u8(planes[p] + y * w + x, acc[p]);
+        }
+#endif
+
+        for (; x < w - CENSUS_RADIUS; x++)
+        {
+            uint8_t acc[3] = {0, 0, 0};
+            int     n      = 0;
+
+            for (int dy = -CENSUS_RADIUS; dy <= CENSUS_RADIUS; dy++)
+            {
+                for (int dx = -CENSUS_RADIUS; dx <= CENSUS_RADIUS; dx++)
+                {
+                    if (dx == 0 && dy == 0) continue;
+
+                    acc[n / 8] = (acc[n / 8] << 1) | (s[dy * w + x + dx] < s[x]);
+                    n++;
+                }
+            }
+
+            for (int p = 0; p < 3; p++) planes[p][y * w + x] = acc[p];
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Hamming distances of one row for every disparity, numDisparities planes of width costs. Left pixels whose match would be
+// outside the right image's census get the maximum cost.
+// -----------------------------------------------------------------------------------------------------------------------------
+void StereoMatcher::RowCost(int y, uint8_t* cost)
+{
+    const int      w    = m_width;
+    const int      size = m_width * m_height;
+    const uint8_t* l0   = m_census + 0 * size + y * w;
+    const uint8_t* l1   = m_census + 1 * size + y * w;
+    const uint8_t* l2   = m_census + 2 * size + y * w;
+    const uint8_t* r0   = m_census + 3 * size + y * w;
+    const uint8_t* r1   = m_census + 4 * size + y * w;
+    const uint8_t* r2   = m_census + 5 * size + y * w;
+
+    for (int d = 0; d < m_numDisparities; d++)
+    {
+        uint8_t* c     = cost + d * w;
+        int      start = d + CENSUS_RADIUS;
+        int      end   = w - CENSUS_RADIUS;
+        int      x     = start;
+
+        memset(c, MAX_COST, start);
+        memset(c + end, MAX_COST, w - end);
+
+#ifdef __ARM_NEON
+        for (; x + 8 <= end; x += 8)
+        {
+            uint8x8_t sum = vcnt_u8(veor_u8(vld1_u8(l0 + x), vld1_u8(r0 + x - d)));
+            sum = vadd_u8(sum, vcnt_u8(veor_u8(vld1_u8(l1 + x), vld1_u8(r1 + x - d))));
+            sum = vadd_u8(sum, vcnt_u8(veor_u8(vld1_u8(l2 + x), vld1_u8(r2 + x - d))));
+
+            vst1_u8(c + x, sum);
+        }
+#endif
+
+        for (; x < end; x++)
+        {
+            c[x] = __builtin_popcount(l0[x] ^ r0[x - d]) +
+                   __builtin_popcount(l1[x] ^ r1[x - d]) +
+                   __builtin_popcount(l2[x] ^ r2[x - d]);
+        }
+    }
+}
+
+// Adds (or subtracts) one row of costs to the running column sums
+static void AccumulateCost(uint16_t* sum, const uint8_t* cost, int n, bool add)
+{
+    int i = 0;
+
+#ifdef __ARM_NEON
+    for (; i + 8 <= n; i += 8)
+    {
+        uint16x8_t s = vld1q_u16(sum + i);
+        uint8x8_t  c = vld1_u8(cost + i);
+
+        vst1q_u16(sum + i, add ? vaddw_u8(s, c) : vsubw_u8(s, c));
+    }
+#endif
+
+    for (; i < n; i++)
+    {
+        sum[i] = add ? sum[i] + cost[i] : sum[i] - cost[i];
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Matches one band, the block's column sums are slid down the band one row at a time
+// -----------------------------------------------------------------------------------------------------------------------------
+void StereoMatcher::Match(int band, uint16_t* disparity, uint8_t* valid)
+{
+    const int w      = m_width;
+    const int radius = m_blockSize / 2;
+    const int plane  = m_numDisparities * w;
+    uint8_t*  ring   = m_rowCost + band * m_blockSize * plane;
+    uint16_t* colSum = m_colSum  + band * plane;
+    int       rowStart, rowEnd;
+
+    BandRows(band, &rowStart, &rowEnd);
+
+    int ys = rowStart > m_border ? rowStart : m_border;
+    int ye = rowEnd < m_height - m_border ? rowEnd : m_height - m_border;
+
+    for (int y = rowStart; y < rowEnd; y++)
+    {
+        if (y >= ys && y < ye) continue;
+
+        memset(disparity + y * w, 0, w * sizeof(uint16_t));
+        memset(valid + y * w, 0, w);
+    }
+
+    if (ys >= ye) return;
+
+    memset(colSum, 0, plane * sizeof(uint16_t));
+
+    for (int y = ys - radius; y <= ys + radius; y++)
+    {
+        uint8_t* cost = ring + (y % m_blockSize) * plane;
+
+        RowCost(y, cost);
+        AccumulateCost(colSum, cost, plane, true);
+    }
+
+    for (int y = ys; y < ye; y++)
+    {
+        if (y > ys)
+        {
+            // The row leaving the block and the one coming in share a slot
+            uint8_t* cost = ring + ((y + radius) % m_blockSize) * plane;
+
+            AccumulateCost(colSum, cost, plane, false);
+            RowCost(y + radius, cost);
+            AccumulateCost(colSum, cost, plane, true);
+        }
+
+        MatchRow(band, disparity + y * w, valid + y * w);
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Block sums, winner takes all, uniqueness and left right checks and the subpixel fit for one row
+// -----------------------------------------------------------------------------------------------------------------------------
+void StereoMatcher::MatchRow(int band, uint16_t* disparity, uint8_t* valid)
+{
+    const int       w      = m_width;
+    const int       nd     = m_numDisparities;
+    const int       stride = m_aggStride;
+    const int       radius = m_blockSize / 2;
+    const int       xMin   = m_border + nd - 1;
+    const int       xMax   = w - m_border;
+    const uint16_t* colSum = m_colSum + band * nd * w;
+    uint16_t*       agg    = m_agg    + band * nd * stride;
+    uint16_t*       right  = m_right  + band * 3 * stride;
+    uint16_t*       bestD  = right + stride;
+    uint16_t*       amb    = right + 2 * stride;
+
+    // Sum the columns over the block width, the edges stay at 0xFFFF
+    for (int d = 0; d < nd; d++)
+    {
+        const uint16_t* cs = colSum + d * w;
+        uint16_t*       a  = agg + d * stride;
+        int             x  = radius;
+
+#ifdef __ARM_NEON
+        for (; x + 8 <= w - radius; x += 8)
+        {
+            uint16x8_t s = vld1q_u16(cs + x - radius);
+
+            for (int k = 1; k < m_blockSize; k++)
+            {
+                s = vaddq_u16(s, vld1q_u16(cs + x - radius + k));
+            }
+
+            vst1q_u16(a + x, s);
+        }
+#endif
+
+        for (; x < w - radius; x++)
+        {
+            uint16_t s = 0;
+
+            for (int k = 0; k < m_blockSize; k++) s += cs[x - radius + k];
+
+            a[x] = s;
+        }
+    }
+
+    // Best disparity of every pixel, and whether there is another one almost as good that isn't its neighbour
+    int x = xMin;
+
+#ifdef __ARM_NEON
+    const uint16x8_t one = vdupq_n_u16(1);
+
+    for (; x + 8 <= xMax; x += 8)
+    {
+        uint16x8_t best = vdupq_n_u16(0xFFFF);
+        uint16x8_t bd   = vdupq_n_u16(0);
+
+        for (int d = 0; d < nd; d++)
+        {
+            uint16x8_t c = vld1q_u16(agg + d * stride + x);
+
+            bd   = vbslq_u16(vcltq_u16(c, best), vdupq_n_u16(d), bd);
+            best = vminq_u16(c, best);
+        }
+
+        uint16x8_t ambiguous = vdupq_n_u16(0);
+
+        if (m_uniqueness > 0)
+        {
+            uint16x8_t threshold = vaddq_u16(best, vshrq_n_u16(vmulq_n_u16(vshrq_n_u16(best, 3), m_uniqueness), 4));
+
+            for (int d = 0; d < nd; d++)
+            {
+                uint16x8_t c    = vld1q_u16(agg + d * stride + x);
+                uint16x8_t near = vcleq_u16(vabdq_u16(vdupq_n_u16(d), bd), one);
+
+                ambiguous = vorrq_u16(ambiguous, vbicq_u16(vcleq_u16(c, threshold), near));
+            }
+        }
+
+        vst1q_u16(bestD + x, bd);
+        vst1q_u16(amb + x, ambiguous);
+    }
+#endif
+
+    for (; x < xMax; x++)
+    {
+        uint16_t best = 0xFFFF;
+        uint16_t bd   = 0;
+
+        for (int d = 0; d < nd; d++)
+        {
+            uint16_t c = agg[d * stride + x];
+
+            if (c < best)
+            {
+                best = c;
+                bd   = d;
+            }
+        }
+
+        uint16_t ambiguous = 0;
+
+        if (m_uniqueness > 0)
+        {
+            uint16_t threshold = best + ((uint16_t)((best >> 3) * m_uniqueness) >> 4);
+
+            for (int d = 0; d < nd; d++)
+            {
+                if (agg[d * stride + x] <= threshold && abs(d - bd) > 1) ambiguous = 0xFFFF;
+            }
+        }
+
+        bestD[x] = bd;
+        amb[x]   = ambiguous;
+    }
+
+    // Best match of every right image pixel that a valid left pixel can land on, the padding keeps the reads in the rows
+    x = m_border;
+
+#ifdef __ARM_NEON
+    for (; x < xMax; x += 8)
+    {
+        uint16x8_t best = vdupq_n_u16(0xFFFF);
+        uint16x8_t bd   = vdupq_n_u16(0);
+
+        for (int d = 0; d < nd; d++)
+        {
+            uint16x8_t c = vld1q_u16(agg + d * stride + x + d);
+
+            bd   = vbslq_u16(vcltq_u16(c, best), vdupq_n_u16(d), bd);
+            best = vminq_u16(c, best);
+        }
+
+        vst1q_u16(right + x, bd);
+    }
+#endif
+
+    for (; x < xMax; x++)
+    {
+        uint16_t best = 0xFFFF;
+        uint16_t bd   = 0;
+
+        for (int d = 0; d < nd; d++)
+        {
+            uint16_t c = agg[d * stride + x + d];
+
+            if (c < best)
+            {
+                best = c;
+                bd   = d;
+            }
+        }
+
+        right[x] = bd;
+    }
+
+    memset(disparity, 0, xMin * sizeof(uint16_t));
+    memset(valid, 0, xMin);
+
+    for (x = xMin; x < xMax; x++)
+    {
+        int d = bestD[x];
+
+        if (amb[x] || abs(right[x - d] - d) > 1)
+        {
+            disparity[x] = 0;
+            valid[x]     = 0;
+            continue;
+        }
+
+        // Parabola through the costs around the minimum, |sub| is at most half a pixel since the middle one is the lowest
+        int sub = 0;
+
+        if (d > 0 && d < nd - 1)
+        {
+            int c0  = agg[(d - 1) * stride + x];
+            int c1  = agg[d * stride + x];
+            int c2  = agg[(d + 1) * stride + x];
+            int den = c0 + c2 - 2 * c1;
+
+            if (den > 0)
+            {
+                int num = (c0 - c2) * (1 << STEREO_BM_SUBPIXEL_BITS);
+                sub = (num >= 0 ? num + den : num - den) / (2 * den);
+            }
+        }
+
+        disparity[x] = (d << STEREO_BM_SUBPIXEL_BITS) + sub;
+        valid[x]     = 255;
+    }
+
+    memset(disparity + xMax, 0, (w - xMax) * sizeof(uint16_t));
+    memset(valid + xMax, 0, w - xMax);
+}
@@ -0,0 +1,373 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+#include "tensor_preproc.h"
+#include "voxl_camera_server.h"
+
+static const int WEIGHT_BITS = 7;
+static const int WEIGHT_ONE  = 1 << WEIGHT_BITS;
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Index of the first of the two samples around a source position (pixel centers at whole numbers) and the weight of the
+// second one. Positions outside the axis are clamped to its ends like OpenCV's resize does.
+// -----------------------------------------------------------------------------------------------------------------------------
+static void Tap(float pos, int size, int* index, uint8_t* weight)
+{
+    if (pos < 0.0f)     pos = 0.0f;
+    if (pos > size - 1) pos = size - 1;
+
+    int i = (int)pos;
+    if (i > size - 2) i = size - 2;
+
+    *index  = i;
+    *weight = (uint8_t)lrintf((pos - i) * WEIGHT_ONE);
+}
+
+static inline uint8_t Lerp(int a, int b, int weight)
+{
+    return (a * (WEIGHT_ONE - weight) + b * weight + WEIGHT_ONE / 2) >> WEIGHT_BITS;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Blend two source rows into one
+// -----------------------------------------------------------------------------------------------------------------------------
+static void BlendRows(const uint8_t* a, const uint8_t* b, int weight, uint8_t* dst, int count)
+{
+    if (weight == 0 || weight == WEIGHT_ONE)
+    {
+        memcpy(dst, (weight == 0) ? a : b, count);
+        return;
+    }
+
+    int x = 0;
+
+#ifdef __ARM_NEON
+    const uint8x8_t wa = vdup_n_u8(WEIGHT_ONE - weight);
+    const uint8x8_t wb = vdup_n_u8(weight);
+
+    for (; x + 16 <= count; x += 16)
+    {
+        const uint8x16_t va = vld1q_u8(a + x);
+        const uint8x16_t vb = vld1q_u8(b + x);
+
+        const uint16x8_t lo = vmlal_u8(vmull_u8(vget_low_u8(va),  wa), vget_low_u8(vb),  wb);
+        const uint16x8_t hi = vmlal_u8(vmull_u8(vget_high_u8(va), wa), vget_high_u8(vb), wb);
+
+        vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(lo, WEIGHT_BITS), vrshrn_n_u16(hi, WEIGHT_BITS)));
+    }
+#endif
+
+    for (; x < count; x++)
+    {
+        dst[x] = Lerp(a[x], b[x], weight);
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// One channel of one tensor row: padding, the converted pixels and padding again
+// -----------------------------------------------------------------------------------------------------------------------------
+template <typename T>
+static void StoreChannel(T* out, int step, const T* lut, const uint8_t* src, int left, int width, int right, int pad)
+{
+    const T padValue = lut[pad];
+
+    for (int i = 0; i < left; i++, out += step)
+    {
+        *out = padValue;
+    }
+
+    for (int i = 0; i < width; i++, out += step)
+    {
+        *out = lut[src[i]];
+    }
+
+    for (int i = 0; i < right; i++, out += step)
+    {
+        *out = padValue;
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Constructor
+// -----------------------------------------------------------------------------------------------------------------------------
+TensorPreproc::TensorPreproc(const TensorConfig* config, int srcWidth, int srcHeight, bool colour, ImgprocYuvMatrix matrix,
+                             int numBands, int numImages) :
+    m_config   (*config),
+    m_colour   (colour),
+    m_matrix   (matrix),
+    m_srcWidth (srcWidth),
+    m_srcHeight(srcHeight),
+    m_numBands (numBands),
+    m_numImages(numImages)
+{
+    m_channels = (config->channels == CAMERA_TENSOR_GREY) ? 1 : 3;
+    m_elemSize = (config->type == CAMERA_TENSOR_FLOAT32) ? sizeof(float) : 1;
+
+    // Letterboxing fits the whole frame in the tensor, cropping fills the tensor and cuts off the sides of the frame
+    const float scaleX = (float)config->width  / srcWidth;
+    const float scaleY = (float)config->height / srcHeight;
+
+    if (config->crop)
+    {
+        const float scale = (scaleX > scaleY) ? scaleX : scaleY;
+
+        m_dstWidth      = config->width;
+        m_dstHeight     = config->height;
+        m_srcWidthUsed  = config->width  / scale;
+        m_srcHeightUsed = config->height / scale;
+    }
+    else
+    {
+        const float scale = (scaleX < scaleY) ? scaleX : scaleY;
+
+        m_dstWidth      = (int)lrintf(srcWidth  * scale);
+        m_dstHeight     = (int)lrintf(srcHeight * scale);
+        m_srcWidthUsed  = srcWidth;
+        m_srcHeightUsed = srcHeight;
+
+        if (m_dstWidth  > config->width)  m_dstWidth  = config->width;
+        if (m_dstHeight > config->height) m_dstHeight = config->height;
+    }
+
+    m_dstX = (config->width  - m_dstWidth)  / 2;
+    m_dstY = (config->height - m_dstHeight) / 2;
+    m_srcX = (srcWidth  - m_srcWidthUsed)  / 2;
+    m_srcY = (srcHeight - m_srcHeightUsed) / 2;
+
+    // Luma samples are at the centers of the tensor pixels, chroma ones at the center of every pair of tensor columns
+    const float stepX = m_srcWidthUsed  / m_dstWidth;
+    const float stepY = m_srcHeightUsed / m_dstHeight;
+    const int   pairs = (m_dstWidth + 1) / 2;
+
+    m_colOffset = (uint16_t*)malloc((m_dstWidth + pairs) * sizeof(uint16_t));
+    m_colWeight = (uint8_t*) malloc(m_dstWidth + pairs);
+    m_rowOffset = (int*)     malloc(m_dstHeight * 2 * sizeof(int));
+    m_rowWeight = (uint8_t*) malloc(m_dstHeight * 2);
+
+    for (int x = 0; x < m_dstWidth; x++)
+    {
+        int i;
+        Tap(m_srcX + (x + 0.5f) * stepX - 0.5f, srcWidth, &i, &m_colWeight[x]);
+        m_colOffset[x] = i;
+    }
+
+    for (int p = 0; p < pairs; p++)
+    {
+        int i;
+        Tap((m_srcX + (2 * p + 1) * stepX) / 2 - 0.5f, srcWidth / 2, &i, &m_colWeight[m_dstWidth + p]);
+        m_colOffset[m_dstWidth + p] = i;
+    }
+
+    for (int y = 0; y < m_dstHeight; y++)
+    {
+        Tap(m_srcY + (y + 0.5f) * stepY - 0.5f, srcHeight, &m_rowOffset[y], &m_rowWeight[y]);
+        Tap((m_srcY + (y + 0.5f) * stepY) / 2 - 0.5f, srcHeight / 2, &m_rowOffset[m_dstHeight + y], &m_rowWeight[m_dstHeight + y]);
+    }
+
+    // Offsets only go up, so the samples of a row are between those of its first and last pixel
+    m_lumaSpan[0]   = m_colOffset[0];
+    m_lumaSpan[1]   = m_colOffset[m_dstWidth - 1] + 2;
+    m_chromaSpan[0] = m_colOffset[m_dstWidth] * 2;
+    m_chromaSpan[1] = m_colOffset[m_dstWidth + pairs - 1] * 2 + 4;
+
+    // (v - mean) / std for float tensors, then divided by the quantization step for the others
+    for (int c = 0; c < 3; c++)
+    {
+        for (int v = 0; v < 256; v++)
+        {
+            const float n = (v - config->mean[c]) / config->std[c];
+
+            m_lutFloat[c][v] = n;
+
+            if (config->type != CAMERA_TENSOR_FLOAT32)
+            {
+                const int lo = (config->type == CAMERA_TENSOR_INT8) ? -128 : 0;
+                int       q  = (int)lrintf(n / config->scale) + config->zero_point;
+
+                if (q < lo)       q = lo;
+                if (q > lo + 255) q = lo + 255;
+
+                m_lutQuant[c][v] = (uint8_t)q;
+            }
+        }
+    }
+
+    // Blended luma and chroma rows, the resampled luma and chroma (with room for the odd last pair) and the planar RGB
+    m_scratchSize = (2 * srcWidth + m_dstWidth + 2 * pairs + 2 + 3 * m_dstWidth + 63) & ~63;
+    m_scratch     = (uint8_t*)malloc(m_scratchSize * numBands * numImages);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Destructor
+// -----------------------------------------------------------------------------------------------------------------------------
+TensorPreproc::~TensorPreproc()
+{
+    free(m_colOffset);
+    free(m_colWeight);
+    free(m_rowOffset);
+    free(m_rowWeight);
+    free(m_scratch);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Placement of the frame in the tensor, for mapping results back to the image
+// -----------------------------------------------------------------------------------------------------------------------------
+void TensorPreproc::Placement(float* scaleX, float* scaleY, float* offsetX, float* offsetY)
+{
+    *scaleX  = m_dstWidth  / m_srcWidthUsed;
+    *scaleY  = m_dstHeight / m_srcHeightUsed;
+    *offsetX = m_dstX - m_srcX * *scaleX;
+    *offsetY = m_dstY - m_srcY * *scaleY;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Resample one row of the image area and convert it, planes get the rows of the tensor channels in order
+// -----------------------------------------------------------------------------------------------------------------------------
+void TensorPreproc::Sample(const uint8_t* y, const uint8_t* uv, int stride, int row, uint8_t* scratch, const uint8_t* planes[3])
+{
+    const int pairs   = (m_dstWidth + 1) / 2;
+    uint8_t*  lumaBuf = scratch;
+    uint8_t*  chrBuf  = lumaBuf + m_srcWidth;
+    uint8_t*  lumaRow = chrBuf  + m_srcWidth;
+    uint8_t*  chrRow  = lumaRow + m_dstWidth;
+    uint8_t*  rgb     = chrRow  + 2 * pairs + 2;
+
+    const int ly = m_rowOffset[row];
+    BlendRows(y + ly * stride + m_lumaSpan[0], y + (ly + 1) * stride + m_lumaSpan[0], m_rowWeight[row],
+              lumaBuf + m_lumaSpan[0], m_lumaSpan[1] - m_lumaSpan[0]);
+
+    for (int x = 0; x < m_dstWidth; x++)
+    {
+        const int o = m_colOffset[x];
+        lumaRow[x] = Lerp(lumaBuf[o], lumaBuf[o + 1], m_colWeight[x]);
+    }
+
+    if (!m_colour)
+    {
+        planes[0] = planes[1] = planes[2] = lumaRow;
+        return;
+    }
+
+    const int cy = m_rowOffset[m_dstHeight + row];
+    BlendRows(uv + cy * stride + m_chromaSpan[0], uv + (cy + 1) * stride + m_chromaSpan[0], m_rowWeight[m_dstHeight + row],
+              chrBuf + m_chromaSpan[0], m_chromaSpan[1] - m_chromaSpan[0]);
+
+    for (int p = 0; p < pairs; p++)
+    {
+        const int o = m_colOffset[m_dstWidth + p] * 2;
+        const int w = m_colWeight[m_dstWidth + p];
+
+        chrRow[2 * p]     = Lerp(chrBuf[o],     chrBuf[o + 2], w);
+        chrRow[2 * p + 1] = Lerp(chrBuf[o + 1], chrBuf[o + 3], w);
+    }
+
+    // One row of NV12 with the chroma at full vertical resolution
+    imgprocNV12ToRGB(lumaRow, chrRow, 0, rgb, m_dstWidth, 1, IMGPROC_RGB_PLANAR, m_matrix, 0, 1);
+
+    const bool bgr = (m_config.channels == CAMERA_TENSOR_BGR);
+    planes[0] = rgb + (bgr ? 2 : 0) * m_dstWidth;
+    planes[1] = rgb + m_dstWidth;
+    planes[2] = rgb + (bgr ? 0 : 2) * m_dstWidth;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Normalize one tensor row into place, planes is NULL for the rows above and below the image area
+// -----------------------------------------------------------------------------------------------------------------------------
+void TensorPreproc::Store(const uint8_t* const* planes, uint8_t* dst, int row)
+{
+    const int width = m_config.width;
+    const int left  = (planes != NULL) ? m_dstX : width;
+    const int used  = (planes != NULL) ? m_dstWidth : 0;
+    const int right = width - left - used;
+
+    for (int c = 0; c < m_channels; c++)
+    {
+        const uint8_t* src = (planes != NULL) ? planes[c] : NULL;
+        size_t         first;
+        int            step;
+
+        if (m_config.layout == CAMERA_TENSOR_NCHW)
+        {
+            first = ((size_t)c * m_config.height + row) * width;
+            step  = 1;
+        }
+        else
+        {
+            first = (size_t)row * width * m_channels + c;
+            step  = m_channels;
+        }
+
+        if (m_config.type == CAMERA_TENSOR_FLOAT32)
+        {
+            StoreChannel((float*)dst + first, step, m_lutFloat[c], src, left, used, right, m_config.pad);
+        }
+        else
+        {
+            StoreChannel(dst + first, step, m_lutQuant[c], src, left, used, right, m_config.pad);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Rows are handed out in bands of the tensor, each band of each image has its own row buffers
+// -----------------------------------------------------------------------------------------------------------------------------
+void TensorPreproc::Process(const uint8_t* y, const uint8_t* uv, int stride, uint8_t* dst, int image, int band)
+{
+    const int rowStart = band * m_config.height / m_numBands;
+    const int rowEnd   = (band + 1) * m_config.height / m_numBands;
+    uint8_t*  scratch  = m_scratch + (image * m_numBands + band) * m_scratchSize;
+    uint8_t*  out      = dst + image * ImageBytes();
+
+    for (int row = rowStart; row < rowEnd; row++)
+    {
+        const int r = row - m_dstY;
+
+        if (r < 0 || r >= m_dstHeight)
+        {
+            Store(NULL, out, row);
+            continue;
+        }
+
+        const uint8_t* planes[3];
+
+        Sample(y, uv, stride, r, scratch, planes);
+        Store(planes, out, row);
+    }
+}
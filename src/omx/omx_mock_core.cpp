@@ -0,0 +1,817 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <OMX_Component.h>
+#include <OMX_IndexExt.h>
+#include <OMX_QCOMExtns.h>
+#include <OMX_VideoExt.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <list>
+#include <modal_journal.h>
+
+#include "omx_mock_core.h"
+
+#define MOCK_NUM_PORTS          2       // 0 is the raw input, 1 is the encoded output, same as the vendor encoders
+#define MOCK_MIN_BUFFER_COUNT   2
+#define MOCK_DEFAULT_WIDTH      1920
+#define MOCK_DEFAULT_HEIGHT     1080
+#define MOCK_DEFAULT_FPS        30
+#define MOCK_DEFAULT_BITRATE    (8*1024*1024)
+#define MOCK_DEFAULT_DELAY_US   5000
+#define MOCK_IDR_SIZE_FACTOR    4       // IDR frames come out this much bigger than the others
+#define MOCK_PAYLOAD_BYTE       0xAA    // Filler for the slice payloads, can never form a start code
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Everything a mock component needs. The OMX_COMPONENTTYPE has to come first since the handle we give out points to it.
+// -----------------------------------------------------------------------------------------------------------------------------
+typedef struct MockComponent
+{
+    OMX_COMPONENTTYPE            omx;                       ///< What the client sees as the component handle
+    OMX_CALLBACKTYPE             callbacks;                 ///< Client callbacks
+    OMX_PTR                      appData;                   ///< Client data passed back with every callback
+    OMX_STATETYPE                state;                     ///< Current component state
+    bool                         isH265;                    ///< hevc or avc component
+    OMX_PARAM_PORTDEFINITIONTYPE ports[MOCK_NUM_PORTS];     ///< Input and output port definitions
+    int                          delayUs;                   ///< Time each frame spends "encoding"
+    uint32_t                     idrPeriod;                 ///< Frames between IDR frames
+    uint32_t                     numSlices;                 ///< Slices per frame
+    bool                         sliceDelivery;             ///< Hand back each slice in its own buffer
+    bool                         sentCodecConfig;           ///< Stream headers have been sent
+    bool                         forceSync;                 ///< Make the next frame an IDR frame
+    uint32_t                     frameCount;                ///< Frames encoded so far
+
+    pthread_t                    thread;                    ///< Worker thread standing in for the hardware
+    bool                         threadRunning;             ///< Worker thread has been started
+    bool                         stop;                      ///< Worker thread terminate indicator
+    pthread_mutex_t              mutex;                     ///< Protects everything the worker thread looks at
+    pthread_cond_t               cond;                      ///< Wakes the worker thread up
+    std::list<OMX_BUFFERHEADERTYPE*> inputQueue;            ///< Input buffers waiting to be encoded
+    std::list<OMX_BUFFERHEADERTYPE*> outputQueue;           ///< Output buffers waiting to be filled
+} MockComponent;
+
+static const uint8_t startCode[] = {0x00, 0x00, 0x00, 0x01};
+
+// NAL unit headers, h264 is one byte and h265 two
+static const uint8_t avcSps[]       = {0x67};
+static const uint8_t avcPps[]       = {0x68};
+static const uint8_t avcIdr[]       = {0x65};
+static const uint8_t avcNonIdr[]    = {0x41};
+static const uint8_t hevcVps[]      = {0x40, 0x01};
+static const uint8_t hevcSps[]      = {0x42, 0x01};
+static const uint8_t hevcPps[]      = {0x44, 0x01};
+static const uint8_t hevcIdr[]      = {0x26, 0x01};
+static const uint8_t hevcTrail[]    = {0x02, 0x01};
+
+static void* MockWorker(MockComponent* c);
+
+static inline MockComponent* MockFromHandle(OMX_HANDLETYPE hComponent)
+{
+    return (MockComponent*)hComponent;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Buffer size the port asks for, based on its current resolution
+// -----------------------------------------------------------------------------------------------------------------------------
+static void MockUpdateBufferSize(OMX_PARAM_PORTDEFINITIONTYPE* port)
+{
+    OMX_U32 pixels = port->format.video.nFrameWidth * port->format.video.nFrameHeight;
+
+    // Raw frames are NV21, the output just has to be big enough for an IDR frame at any sane bitrate
+    port->nBufferSize = (port->eDir == OMX_DirInput) ? pixels * 3 / 2 : pixels;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Appends one NAL unit with a start code to the buffer, returns the number of bytes written
+// -----------------------------------------------------------------------------------------------------------------------------
+static OMX_U32 MockWriteNal(OMX_BUFFERHEADERTYPE* pBuffer,
+                            const uint8_t*        header,
+                            OMX_U32               headerSize,
+                            OMX_U32               payloadSize)
+{
+    OMX_U32 space = pBuffer->nAllocLen - pBuffer->nOffset - pBuffer->nFilledLen;
+    OMX_U32 size  = sizeof(startCode) + headerSize + payloadSize + 1;
+
+    if (size > space)
+    {
+        if (space <= sizeof(startCode) + headerSize + 1) return 0;
+
+        payloadSize = space - sizeof(startCode) - headerSize - 1;
+        size        = space;
+    }
+
+    uint8_t* dst = pBuffer->pBuffer + pBuffer->nOffset + pBuffer->nFilledLen;
+
+    memcpy(dst, startCode, sizeof(startCode));
+    dst += sizeof(startCode);
+    memcpy(dst, header, headerSize);
+    dst += headerSize;
+    memset(dst, MOCK_PAYLOAD_BYTE, payloadSize);
+    dst += payloadSize;
+    // rbsp stop bit
+    *dst = 0x80;
+
+    pBuffer->nFilledLen += size;
+
+    return size;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Waits for the client to give us an output buffer, called and returns with the mutex held. NULL means we are stopping.
+// -----------------------------------------------------------------------------------------------------------------------------
+static OMX_BUFFERHEADERTYPE* MockTakeOutput(MockComponent* c)
+{
+    while (c->outputQueue.empty() && !c->stop)
+    {
+        pthread_cond_wait(&c->cond, &c->mutex);
+    }
+
+    if (c->stop) return NULL;
+
+    OMX_BUFFERHEADERTYPE* pBuffer = c->outputQueue.front();
+    c->outputQueue.pop_front();
+
+    pBuffer->nOffset    = 0;
+    pBuffer->nFilledLen = 0;
+    pBuffer->nFlags     = 0;
+
+    return pBuffer;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Hands a filled output buffer back to the client, called with the mutex held. The client may call straight back into us from
+// the callback so it can't be held across it.
+// -----------------------------------------------------------------------------------------------------------------------------
+static void MockReturnOutput(MockComponent* c, OMX_BUFFERHEADERTYPE* pBuffer)
+{
+    pthread_mutex_unlock(&c->mutex);
+    c->callbacks.FillBufferDone((OMX_HANDLETYPE)c, c->appData, pBuffer);
+    pthread_mutex_lock(&c->mutex);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Starts / stops the worker thread
+// -----------------------------------------------------------------------------------------------------------------------------
+static void MockStartWorker(MockComponent* c)
+{
+    if (c->threadRunning) return;
+
+    c->stop = false;
+    pthread_create(&c->thread, NULL, [](void* data){return MockWorker((MockComponent*)data);}, c);
+    c->threadRunning = true;
+}
+
+static void MockStopWorker(MockComponent* c)
+{
+    if (!c->threadRunning) return;
+
+    pthread_mutex_lock(&c->mutex);
+    c->stop = true;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->mutex);
+
+    pthread_join(c->thread, NULL);
+    c->threadRunning = false;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Returns every buffer we are holding on the given port (or all ports) to the client, the worker must not be running
+// -----------------------------------------------------------------------------------------------------------------------------
+static void MockReturnAll(MockComponent* c, OMX_U32 portIndex)
+{
+    std::list<OMX_BUFFERHEADERTYPE*> inputs;
+    std::list<OMX_BUFFERHEADERTYPE*> outputs;
+
+    pthread_mutex_lock(&c->mutex);
+    if (portIndex == 0 || portIndex == OMX_ALL) inputs.swap(c->inputQueue);
+    if (portIndex == 1 || portIndex == OMX_ALL) outputs.swap(c->outputQueue);
+    pthread_mutex_unlock(&c->mutex);
+
+    for (OMX_BUFFERHEADERTYPE* pBuffer : inputs)
+    {
+        c->callbacks.EmptyBufferDone((OMX_HANDLETYPE)c, c->appData, pBuffer);
+    }
+
+    for (OMX_BUFFERHEADERTYPE* pBuffer : outputs)
+    {
+        pBuffer->nFilledLen = 0;
+        pBuffer->nFlags     = 0;
+        c->callbacks.FillBufferDone((OMX_HANDLETYPE)c, c->appData, pBuffer);
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Stands in for the hardware: takes input frames in order, holds on to each for the configured delay, releases it and then
+// produces the "encoded" output
+// -----------------------------------------------------------------------------------------------------------------------------
+static void* MockWorker(MockComponent* c)
+{
+    pthread_setname_np(pthread_self(), "omx_mock");
+
+    pthread_mutex_lock(&c->mutex);
+
+    while (!c->stop)
+    {
+        if (c->inputQueue.empty())
+        {
+            pthread_cond_wait(&c->cond, &c->mutex);
+            continue;
+        }
+
+        OMX_BUFFERHEADERTYPE* pInput = c->inputQueue.front();
+        c->inputQueue.pop_front();
+        OMX_TICKS timestamp = pInput->nTimeStamp;
+
+        pthread_mutex_unlock(&c->mutex);
+        usleep(c->delayUs);
+        c->callbacks.EmptyBufferDone((OMX_HANDLETYPE)c, c->appData, pInput);
+        pthread_mutex_lock(&c->mutex);
+
+        OMX_BUFFERHEADERTYPE* pOutput;
+
+        // Stream headers go out once, ahead of the first frame
+        if (!c->sentCodecConfig)
+        {
+            if ((pOutput = MockTakeOutput(c)) == NULL) break;
+
+            if (c->isH265)
+            {
+                MockWriteNal(pOutput, hevcVps, sizeof(hevcVps), 16);
+                MockWriteNal(pOutput, hevcSps, sizeof(hevcSps), 32);
+                MockWriteNal(pOutput, hevcPps, sizeof(hevcPps), 8);
+            }
+            else
+            {
+                MockWriteNal(pOutput, avcSps, sizeof(avcSps), 16);
+                MockWriteNal(pOutput, avcPps, sizeof(avcPps), 4);
+            }
+
+            pOutput->nFlags     = OMX_BUFFERFLAG_CODECCONFIG | OMX_BUFFERFLAG_ENDOFFRAME;
+            pOutput->nTimeStamp = timestamp;
+            c->sentCodecConfig  = true;
+
+            MockReturnOutput(c, pOutput);
+        }
+
+        bool isIdr = c->forceSync || (c->idrPeriod != 0 && (c->frameCount % c->idrPeriod) == 0);
+        c->forceSync = false;
+        c->frameCount++;
+
+        // Size the frame to roughly match the configured bitrate
+        OMX_U32 fps = c->ports[1].format.video.xFramerate >> 16;
+        if (fps == 0) fps = MOCK_DEFAULT_FPS;
+
+        OMX_U32 frameSize = c->ports[1].format.video.nBitrate / 8 / fps;
+        if (isIdr) frameSize *= MOCK_IDR_SIZE_FACTOR;
+
+        OMX_U32 numSlices = c->numSlices ? c->numSlices : 1;
+        OMX_U32 sliceSize = frameSize / numSlices;
+
+        const uint8_t* sliceHeader;
+        OMX_U32        sliceHeaderSize;
+
+        if (c->isH265)
+        {
+            sliceHeader     = isIdr ? hevcIdr : hevcTrail;
+            sliceHeaderSize = sizeof(hevcIdr);
+        }
+        else
+        {
+            sliceHeader     = isIdr ? avcIdr : avcNonIdr;
+            sliceHeaderSize = sizeof(avcIdr);
+        }
+
+        pOutput = NULL;
+
+        for (OMX_U32 i = 0; i < numSlices; i++)
+        {
+            bool isLastSlice = (i == numSlices - 1);
+
+            if (pOutput == NULL && (pOutput = MockTakeOutput(c)) == NULL) break;
+
+            MockWriteNal(pOutput, sliceHeader, sliceHeaderSize, sliceSize);
+
+            if (c->sliceDelivery || isLastSlice)
+            {
+                pOutput->nTimeStamp = timestamp;
+                pOutput->nFlags     = (isIdr ? OMX_BUFFERFLAG_SYNCFRAME : 0) | (isLastSlice ? OMX_BUFFERFLAG_ENDOFFRAME : 0);
+
+                MockReturnOutput(c, pOutput);
+                pOutput = NULL;
+            }
+        }
+
+        // Stopped while waiting for an output buffer
+        if (pOutput != NULL)
+        {
+            c->outputQueue.push_front(pOutput);
+        }
+    }
+
+    pthread_mutex_unlock(&c->mutex);
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Component entry points
+// -----------------------------------------------------------------------------------------------------------------------------
+static OMX_ERRORTYPE MockSendCommand(OMX_HANDLETYPE hComponent, OMX_COMMANDTYPE cmd, OMX_U32 nParam, OMX_PTR pCmdData)
+{
+    MockComponent* c = MockFromHandle(hComponent);
+
+    switch (cmd)
+    {
+        case OMX_CommandStateSet:
+        {
+            OMX_STATETYPE newState = (OMX_STATETYPE)nParam;
+
+            if (newState == c->state)
+            {
+                c->callbacks.EventHandler(hComponent, c->appData, OMX_EventError, OMX_ErrorSameState, 0, NULL);
+                return OMX_ErrorNone;
+            }
+
+            if (newState == OMX_StateExecuting)
+            {
+                MockStartWorker(c);
+            }
+            else if (c->state == OMX_StateExecuting)
+            {
+                MockStopWorker(c);
+                MockReturnAll(c, OMX_ALL);
+            }
+
+            c->state = newState;
+            break;
+        }
+
+        case OMX_CommandFlush:
+        {
+            bool wasRunning = c->threadRunning;
+
+            MockStopWorker(c);
+            MockReturnAll(c, nParam);
+            if (wasRunning) MockStartWorker(c);
+            break;
+        }
+
+        case OMX_CommandPortDisable:
+        case OMX_CommandPortEnable:
+            break;
+
+        default:
+            return OMX_ErrorUnsupportedSetting;
+    }
+
+    c->callbacks.EventHandler(hComponent, c->appData, OMX_EventCmdComplete, cmd, nParam, NULL);
+
+    return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE MockGetParameter(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nIndex, OMX_PTR pParam)
+{
+    MockComponent* c = MockFromHandle(hComponent);
+
+    if (pParam == NULL) return OMX_ErrorBadParameter;
+
+    pthread_mutex_lock(&c->mutex);
+
+    OMX_ERRORTYPE ret = OMX_ErrorNone;
+
+    switch ((int)nIndex)
+    {
+        case OMX_IndexParamPortDefinition:
+        {
+            OMX_PARAM_PORTDEFINITIONTYPE* pPort = (OMX_PARAM_PORTDEFINITIONTYPE*)pParam;
+
+            if (pPort->nPortIndex >= MOCK_NUM_PORTS)
+            {
+                ret = OMX_ErrorBadPortIndex;
+                break;
+            }
+
+            *pPort = c->ports[pPort->nPortIndex];
+            break;
+        }
+
+        case OMX_IndexParamVideoPortFormat:
+        {
+            OMX_VIDEO_PARAM_PORTFORMATTYPE* pFormat = (OMX_VIDEO_PARAM_PORTFORMATTYPE*)pParam;
+
+            // Only the one format we actually get from the camera
+            if (pFormat->nIndex > 0)
+            {
+                ret = OMX_ErrorNoMore;
+                break;
+            }
+
+            pFormat->eColorFormat = (OMX_COLOR_FORMATTYPE)OMX_QCOM_COLOR_FormatYVU420SemiPlanar;
+            break;
+        }
+
+        case OMX_IndexParamVideoAvc:
+            ((OMX_VIDEO_PARAM_AVCTYPE*)pParam)->nPFrames = c->idrPeriod ? c->idrPeriod - 1 : 0;
+            break;
+
+        case OMX_IndexParamVideoHevc:
+            ((OMX_VIDEO_PARAM_HEVCTYPE*)pParam)->nKeyFrameInterval = c->idrPeriod;
+            break;
+
+        case OMX_IndexParamVideoBitrate:
+            ((OMX_VIDEO_PARAM_BITRATETYPE*)pParam)->nTargetBitrate = c->ports[1].format.video.nBitrate;
+            break;
+
+        // Anything else is accepted and left as the client set it up
+        default:
+            break;
+    }
+
+    pthread_mutex_unlock(&c->mutex);
+
+    return ret;
+}
+
+static OMX_ERRORTYPE MockSetParameter(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nIndex, OMX_PTR pParam)
+{
+    MockComponent* c = MockFromHandle(hComponent);
+
+    if (pParam == NULL) return OMX_ErrorBadParameter;
+
+    pthread_mutex_lock(&c->mutex);
+
+    OMX_ERRORTYPE ret = OMX_ErrorNone;
+
+    switch ((int)nIndex)
+    {
+        case OMX_IndexParamPortDefinition:
+        {
+            OMX_PARAM_PORTDEFINITIONTYPE* pPort = (OMX_PARAM_PORTDEFINITIONTYPE*)pParam;
+
+            if (pPort->nPortIndex >= MOCK_NUM_PORTS)
+            {
+                ret = OMX_ErrorBadPortIndex;
+                break;
+            }
+
+            OMX_PARAM_PORTDEFINITIONTYPE* pOurs = &c->ports[pPort->nPortIndex];
+
+            if (pPort->nBufferCountActual < pOurs->nBufferCountMin)
+            {
+                ret = OMX_ErrorBadParameter;
+                break;
+            }
+
+            pOurs->nBufferCountActual = pPort->nBufferCountActual;
+            pOurs->format.video       = pPort->format.video;
+            MockUpdateBufferSize(pOurs);
+
+            // Both sides share the resolution and rate
+            OMX_PARAM_PORTDEFINITIONTYPE* pOther = &c->ports[pPort->nPortIndex ^ 1];
+            pOther->format.video.nFrameWidth  = pOurs->format.video.nFrameWidth;
+            pOther->format.video.nFrameHeight = pOurs->format.video.nFrameHeight;
+            pOther->format.video.xFramerate   = pOurs->format.video.xFramerate;
+            MockUpdateBufferSize(pOther);
+            break;
+        }
+
+        case OMX_IndexParamVideoAvc:
+            c->idrPeriod = ((OMX_VIDEO_PARAM_AVCTYPE*)pParam)->nPFrames + 1;
+            break;
+
+        case OMX_IndexParamVideoHevc:
+            c->idrPeriod = ((OMX_VIDEO_PARAM_HEVCTYPE*)pParam)->nKeyFrameInterval;
+            break;
+
+        case OMX_IndexParamVideoBitrate:
+            c->ports[1].format.video.nBitrate = ((OMX_VIDEO_PARAM_BITRATETYPE*)pParam)->nTargetBitrate;
+            break;
+
+        case OMX_QcomIndexParamVideoSliceSpacing:
+        {
+            QOMX_VIDEO_PARAM_SLICE_SPACING_TYPE* pSpacing = (QOMX_VIDEO_PARAM_SLICE_SPACING_TYPE*)pParam;
+
+            OMX_U32 numMBs = ((c->ports[0].format.video.nFrameWidth  + 15) / 16) *
+                             ((c->ports[0].format.video.nFrameHeight + 15) / 16);
+
+            if (pSpacing->eSliceMode == QOMX_SLICEMODE_MB_COUNT && pSpacing->nSliceSize != 0)
+            {
+                c->numSlices = (numMBs + pSpacing->nSliceSize - 1) / pSpacing->nSliceSize;
+            }
+            break;
+        }
+
+        case OMX_QcomIndexEnableSliceDeliveryMode:
+            c->sliceDelivery = ((QOMX_EXTNINDEX_PARAMTYPE*)pParam)->bEnable == OMX_TRUE;
+            break;
+
+        default:
+            break;
+    }
+
+    pthread_mutex_unlock(&c->mutex);
+
+    return ret;
+}
+
+static OMX_ERRORTYPE MockGetConfig(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nIndex, OMX_PTR pConfig)
+{
+    MockComponent* c = MockFromHandle(hComponent);
+
+    if (pConfig == NULL) return OMX_ErrorBadParameter;
+
+    if ((int)nIndex == OMX_IndexConfigVideoFramerate)
+    {
+        pthread_mutex_lock(&c->mutex);
+        ((OMX_CONFIG_FRAMERATETYPE*)pConfig)->xEncodeFramerate = c->ports[1].format.video.xFramerate;
+        pthread_mutex_unlock(&c->mutex);
+    }
+
+    return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE MockSetConfig(OMX_HANDLETYPE hComponent, OMX_INDEXTYPE nIndex, OMX_PTR pConfig)
+{
+    MockComponent* c = MockFromHandle(hComponent);
+
+    if (pConfig == NULL) return OMX_ErrorBadParameter;
+
+    pthread_mutex_lock(&c->mutex);
+
+    switch ((int)nIndex)
+    {
+        case OMX_IndexConfigVideoFramerate:
+            c->ports[1].format.video.xFramerate = ((OMX_CONFIG_FRAMERATETYPE*)pConfig)->xEncodeFramerate;
+            break;
+
+        case OMX_IndexConfigVideoIntraVOPRefresh:
+            if (((OMX_CONFIG_INTRAREFRESHVOPTYPE*)pConfig)->IntraRefreshVOP == OMX_TRUE) c->forceSync = true;
+            break;
+
+        default:
+            break;
+    }
+
+    pthread_mutex_unlock(&c->mutex);
+
+    return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE MockGetState(OMX_HANDLETYPE hComponent, OMX_STATETYPE* pState)
+{
+    if (pState == NULL) return OMX_ErrorBadParameter;
+
+    *pState = MockFromHandle(hComponent)->state;
+
+    return OMX_ErrorNone;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Buffer headers keep the memory we allocated ourselves (if any) in pPlatformPrivate so that FreeBuffer knows what to free
+// -----------------------------------------------------------------------------------------------------------------------------
+static OMX_ERRORTYPE MockNewBufferHeader(MockComponent*         c,
+                                         OMX_BUFFERHEADERTYPE** ppBuffer,
+                                         OMX_U32                nPortIndex,
+                                         OMX_PTR                pAppPrivate,
+                                         OMX_U32                nSizeBytes,
+                                         OMX_U8*                pData,
+                                         OMX_PTR                pOwnedData)
+{
+    if (ppBuffer == NULL || pData == NULL)  return OMX_ErrorBadParameter;
+    if (nPortIndex >= MOCK_NUM_PORTS)       return OMX_ErrorBadPortIndex;
+
+    OMX_BUFFERHEADERTYPE* pBuffer = (OMX_BUFFERHEADERTYPE*)calloc(1, sizeof(OMX_BUFFERHEADERTYPE));
+
+    if (pBuffer == NULL) return OMX_ErrorInsufficientResources;
+
+    pBuffer->nSize             = sizeof(OMX_BUFFERHEADERTYPE);
+    pBuffer->nVersion          = c->omx.nVersion;
+    pBuffer->pBuffer           = pData;
+    pBuffer->nAllocLen         = nSizeBytes;
+    pBuffer->pAppPrivate       = pAppPrivate;
+    pBuffer->pPlatformPrivate  = pOwnedData;
+    pBuffer->nInputPortIndex   = 0;
+    pBuffer->nOutputPortIndex  = 1;
+
+    *ppBuffer = pBuffer;
+
+    return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE MockUseBuffer(OMX_HANDLETYPE         hComponent,
+                                   OMX_BUFFERHEADERTYPE** ppBuffer,
+                                   OMX_U32                nPortIndex,
+                                   OMX_PTR                pAppPrivate,
+                                   OMX_U32                nSizeBytes,
+                                   OMX_U8*                pBuffer)
+{
+    return MockNewBufferHeader(MockFromHandle(hComponent), ppBuffer, nPortIndex, pAppPrivate, nSizeBytes, pBuffer, NULL);
+}
+
+static OMX_ERRORTYPE MockAllocateBuffer(OMX_HANDLETYPE         hComponent,
+                                        OMX_BUFFERHEADERTYPE** ppBuffer,
+                                        OMX_U32                nPortIndex,
+                                        OMX_PTR                pAppPrivate,
+                                        OMX_U32                nSizeBytes)
+{
+    OMX_U8* pData = (OMX_U8*)malloc(nSizeBytes);
+
+    if (pData == NULL) return OMX_ErrorInsufficientResources;
+
+    OMX_ERRORTYPE ret = MockNewBufferHeader(MockFromHandle(hComponent), ppBuffer, nPortIndex, pAppPrivate, nSizeBytes,
+                                            pData, pData);
+
+    if (ret != OMX_ErrorNone) free(pData);
+
+    return ret;
+}
+
+static OMX_ERRORTYPE MockFreeBuffer(OMX_HANDLETYPE hComponent, OMX_U32 nPortIndex, OMX_BUFFERHEADERTYPE* pBuffer)
+{
+    MockComponent* c = MockFromHandle(hComponent);
+
+    if (pBuffer == NULL) return OMX_ErrorBadParameter;
+
+    // Buffers only get freed while the component is being torn down, so there is no point in keeping the worker around
+    MockStopWorker(c);
+
+    pthread_mutex_lock(&c->mutex);
+    c->inputQueue.remove(pBuffer);
+    c->outputQueue.remove(pBuffer);
+    pthread_mutex_unlock(&c->mutex);
+
+    free(pBuffer->pPlatformPrivate);
+    free(pBuffer);
+
+    return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE MockEmptyThisBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE* pBuffer)
+{
+    MockComponent* c = MockFromHandle(hComponent);
+
+    if (pBuffer == NULL) return OMX_ErrorBadParameter;
+
+    if (c->state != OMX_StateExecuting) return OMX_ErrorIncorrectStateOperation;
+
+    pthread_mutex_lock(&c->mutex);
+    c->inputQueue.push_back(pBuffer);
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->mutex);
+
+    return OMX_ErrorNone;
+}
+
+static OMX_ERRORTYPE MockFillThisBuffer(OMX_HANDLETYPE hComponent, OMX_BUFFERHEADERTYPE* pBuffer)
+{
+    MockComponent* c = MockFromHandle(hComponent);
+
+    if (pBuffer == NULL) return OMX_ErrorBadParameter;
+
+    if (c->state != OMX_StateExecuting && c->state != OMX_StateIdle) return OMX_ErrorIncorrectStateOperation;
+
+    pthread_mutex_lock(&c->mutex);
+    c->outputQueue.push_back(pBuffer);
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->mutex);
+
+    return OMX_ErrorNone;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Core entry points
+// -----------------------------------------------------------------------------------------------------------------------------
+OMX_ERRORTYPE MockOMX_Init(void)
+{
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE MockOMX_Deinit(void)
+{
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE MockOMX_GetHandle(OMX_OUT OMX_HANDLETYPE*   handle,
+                                OMX_IN  OMX_STRING        componentName,
+                                OMX_IN  OMX_PTR           appData,
+                                OMX_IN  OMX_CALLBACKTYPE* callBacks)
+{
+    if (handle == NULL || componentName == NULL || callBacks == NULL) return OMX_ErrorBadParameter;
+
+    bool isH265;
+
+    if      (!strcmp(componentName, "OMX.qcom.video.encoder.avc"))  isH265 = false;
+    else if (!strcmp(componentName, "OMX.qcom.video.encoder.hevc")) isH265 = true;
+    else
+    {
+        M_ERROR("Mock OMX core has no component: %s\n", componentName);
+        return OMX_ErrorComponentNotFound;
+    }
+
+    MockComponent* c = new MockComponent();
+
+    c->omx.nSize                   = sizeof(OMX_COMPONENTTYPE);
+    c->omx.nVersion.nVersion       = 0x00000101;
+    c->omx.pComponentPrivate       = c;
+    c->omx.pApplicationPrivate     = appData;
+    c->omx.SendCommand             = MockSendCommand;
+    c->omx.GetParameter            = MockGetParameter;
+    c->omx.SetParameter            = MockSetParameter;
+    c->omx.GetConfig               = MockGetConfig;
+    c->omx.SetConfig               = MockSetConfig;
+    c->omx.GetState                = MockGetState;
+    c->omx.UseBuffer               = MockUseBuffer;
+    c->omx.AllocateBuffer          = MockAllocateBuffer;
+    c->omx.FreeBuffer              = MockFreeBuffer;
+    c->omx.EmptyThisBuffer         = MockEmptyThisBuffer;
+    c->omx.FillThisBuffer          = MockFillThisBuffer;
+
+    c->callbacks = *callBacks;
+    c->appData   = appData;
+    c->state     = OMX_StateLoaded;
+    c->isH265    = isH265;
+    c->idrPeriod = MOCK_DEFAULT_FPS;
+    c->numSlices = 1;
+
+    const char* delay = getenv("VOXL_OMX_MOCK_DELAY_US");
+    c->delayUs = delay ? atoi(delay) : MOCK_DEFAULT_DELAY_US;
+
+    for (int i = 0; i < MOCK_NUM_PORTS; i++)
+    {
+        OMX_PARAM_PORTDEFINITIONTYPE* pPort = &c->ports[i];
+
+        pPort->nSize                          = sizeof(OMX_PARAM_PORTDEFINITIONTYPE);
+        pPort->nVersion.nVersion              = 0x00000101;
+        pPort->nPortIndex                     = i;
+        pPort->eDir                           = (i == 0) ? OMX_DirInput : OMX_DirOutput;
+        pPort->nBufferCountMin                = MOCK_MIN_BUFFER_COUNT;
+        pPort->nBufferCountActual             = MOCK_MIN_BUFFER_COUNT;
+        pPort->bEnabled                       = OMX_TRUE;
+        pPort->eDomain                        = OMX_PortDomainVideo;
+        pPort->format.video.nFrameWidth       = MOCK_DEFAULT_WIDTH;
+        pPort->format.video.nFrameHeight      = MOCK_DEFAULT_HEIGHT;
+        pPort->format.video.nBitrate          = MOCK_DEFAULT_BITRATE;
+        pPort->format.video.xFramerate        = MOCK_DEFAULT_FPS << 16;
+        pPort->format.video.eCompressionFormat = (i == 0) ? OMX_VIDEO_CodingUnused :
+                                                 (isH265 ? (OMX_VIDEO_CODINGTYPE)OMX_VIDEO_CodingHEVC : OMX_VIDEO_CodingAVC);
+        pPort->format.video.eColorFormat      = (i == 0) ? (OMX_COLOR_FORMATTYPE)OMX_QCOM_COLOR_FormatYVU420SemiPlanar :
+                                                           OMX_COLOR_FormatUnused;
+        MockUpdateBufferSize(pPort);
+    }
+
+    pthread_mutex_init(&c->mutex, NULL);
+    pthread_cond_init(&c->cond, NULL);
+
+    M_DEBUG("Created mock %s encoder, %dus per frame\n", isH265 ? "h265" : "h264", c->delayUs);
+
+    *handle = (OMX_HANDLETYPE)c;
+
+    return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE MockOMX_FreeHandle(OMX_IN OMX_HANDLETYPE hComp)
+{
+    MockComponent* c = MockFromHandle(hComp);
+
+    if (c == NULL) return OMX_ErrorBadParameter;
+
+    MockStopWorker(c);
+
+    pthread_mutex_destroy(&c->mutex);
+    pthread_cond_destroy(&c->cond);
+
+    delete c;
+
+    return OMX_ErrorNone;
+}
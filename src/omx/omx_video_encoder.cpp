@@ -35,6 +35,7 @@
 #include <cstring>
 #include <dlfcn.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/resource.h>
 #include <sys/syscall.h>
 #include <errno.h>
@@ -47,6 +48,7 @@
 #include <modal_pipe.h>
 
 #include "omx_video_encoder.h"
+#include "omx_mock_core.h"
 #include "buffer_manager.h"
 #include "common_defs.h"
 
@@ -56,6 +58,20 @@
 #define NUM_INPUT_BUFFERS  11
 #define NUM_OUTPUT_BUFFERS 16
 
+// Number of input frames the encoder may be working on before new ones get skipped. Anything beyond this would just sit in
+// the encoder's queue, adding latency and holding on to buffers the camera needs
+#define MAX_INPUT_IN_FLIGHT             4
+#define MAX_INPUT_IN_FLIGHT_LOW_LATENCY 2
+
+// Low latency mode: number of slices each frame is split into, how long a full intra refresh cycle takes and how often we
+// still send an IDR frame (new clients get one on demand anyway)
+#define LOW_LATENCY_NUM_SLICES       8
+#define LOW_LATENCY_REFRESH_PERIOD_S 1
+#define LOW_LATENCY_IDR_PERIOD_S     60
+
+// How often the running statistics get printed in debug mode
+#define STATS_PERIOD_S 10
+
 
 #ifdef APQ8096
     const char* OMX_LIB_NAME = "/usr/lib/libOmxCore.so";
@@ -105,6 +121,13 @@ OMX_ERRORTYPE OMXFillHandler(OMX_OUT OMX_HANDLETYPE        hComponent,
                              OMX_OUT OMX_PTR               pAppData,
                              OMX_OUT OMX_BUFFERHEADERTYPE* pBuffer);
 
+static int64_t _time_monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 // Investigate build-time linking to omx instead of this mess
 typedef OMX_ERRORTYPE (*OMXGetHandleFunc)(OMX_OUT OMX_HANDLETYPE* handle,
                                           OMX_IN OMX_STRING componentName,
@@ -119,6 +142,17 @@ static OMXFreeHandleFunc OMXFreeHandle;
 
 static void __attribute__((constructor)) setupOMXFuncs()
 {
+    // Lets the encoder path run off target, see omx_mock_core.h
+    const char* core = getenv("VOXL_OMX_CORE");
+
+    if (core != NULL && !strcmp(core, "mock"))
+    {
+        OMXInit       = MockOMX_Init;
+        OMXDeinit     = MockOMX_Deinit;
+        OMXGetHandle  = MockOMX_GetHandle;
+        OMXFreeHandle = MockOMX_FreeHandle;
+        return;
+    }
 
     g_pOmxCoreHandle = dlopen(OMX_LIB_NAME, RTLD_NOW);
 
@@ -152,6 +186,19 @@ VideoEncoder::VideoEncoder(VideoEncoderConfig* pVideoEncoderConfig)
     m_nextInputBufferIndex  = 0;
     m_nextOutputBufferIndex = 0;
 
+    m_maxInputInFlight = m_VideoEncoderConfig.isLowLatency ? MAX_INPUT_IN_FLIGHT_LOW_LATENCY : MAX_INPUT_IN_FLIGHT;
+
+    if (pVideoEncoderConfig->recorder != NULL)
+    {
+        // The recorder asks for a sync frame whenever it wants to start a new file
+        RecorderConfig recorderConfig = *pVideoEncoderConfig->recorder;
+        recorderConfig.requestSync        = [](void* context){ ((VideoEncoder*)context)->RequestSyncFrame(); };
+        recorderConfig.requestSyncContext = this;
+
+        m_pRecorder = new Recorder(&recorderConfig);
+        m_VideoEncoderConfig.recorder = NULL;
+    }
+
     // if (OMXInit())
     // {
     //     M_ERROR("OMX Init failed!\n");
@@ -207,6 +254,10 @@ VideoEncoder::~VideoEncoder()
 
     delete m_ppOutputBuffers;
 
+    free(m_pCodecConfig);
+
+    delete m_pRecorder;
+
     // if (m_OMXHandle != NULL)
     // {
     //     OMXFreeHandle(m_OMXHandle);
@@ -311,6 +362,13 @@ OMX_ERRORTYPE VideoEncoder::SetConfig(VideoEncoderConfig* pVideoEncoderConfig)
         avc.eProfile                  = (OMX_VIDEO_AVCPROFILETYPE)profile;
         avc.eLevel                    = (OMX_VIDEO_AVCLEVELTYPE)level;
         avc.bUseHadamard              = OMX_FALSE;
+
+        if (pVideoEncoderConfig->isLowLatency)
+        {
+            // Intra refresh does the job of periodic IDR frames, only send one every so often
+            avc.nPFrames              = pVideoEncoderConfig->frameRate * LOW_LATENCY_IDR_PERIOD_S - 1;
+        }
+
         avc.nRefFrames                = 1;
         avc.nRefIdx10ActiveMinus1     = 1;
         avc.nRefIdx11ActiveMinus1     = 0;
@@ -382,6 +440,12 @@ OMX_ERRORTYPE VideoEncoder::SetConfig(VideoEncoderConfig* pVideoEncoderConfig)
         hevc.eProfile = (OMX_VIDEO_HEVCPROFILETYPE)profile;
         hevc.eLevel   = (OMX_VIDEO_HEVCLEVELTYPE)level;
 
+        if (pVideoEncoderConfig->isLowLatency)
+        {
+            // Intra refresh does the job of periodic IDR frames, only send one every so often
+            hevc.nKeyFrameInterval = pVideoEncoderConfig->frameRate * LOW_LATENCY_IDR_PERIOD_S;
+        }
+
         OMX_RESET_STRUCT_SIZE_VERSION(&hevc, OMX_VIDEO_PARAM_HEVCTYPE);
 
         if (OMX_SetParameter(m_OMXHandle, (OMX_INDEXTYPE)OMX_IndexParamVideoHevc, (OMX_PTR)&hevc))
@@ -475,6 +539,12 @@ OMX_ERRORTYPE VideoEncoder::SetConfig(VideoEncoderConfig* pVideoEncoderConfig)
         return OMX_ErrorUndefined;
     }
 
+    if (pVideoEncoderConfig->isLowLatency && SetLowLatencyConfig(pVideoEncoderConfig))
+    {
+        M_ERROR("OMX failed to configure low latency mode!\n");
+        return OMX_ErrorUndefined;
+    }
+
     OMX_SendCommand(m_OMXHandle, OMX_CommandPortEnable, PortIndexIn, NULL);
     // Set/Get input port parameters
     if (SetPortParams((OMX_U32)PortIndexIn,
@@ -566,6 +636,71 @@ OMX_ERRORTYPE VideoEncoder::SetConfig(VideoEncoderConfig* pVideoEncoderConfig)
     return OMX_ErrorNone;
 }
 
+// -----------------------------------------------------------------------------------------------------------------------------
+// Low latency mode. Instead of IDR frames, a band of intra coded macroblocks walks across the picture so that every frame is
+// about the same size, and each frame is split into slices that are handed to us (and sent out) as soon as they are encoded.
+// Not every encoder supports all of this, anything missing just costs us some latency so it's not treated as fatal.
+// -----------------------------------------------------------------------------------------------------------------------------
+OMX_ERRORTYPE VideoEncoder::SetLowLatencyConfig(VideoEncoderConfig* pVideoEncoderConfig)
+{
+    OMX_U32 numMBs = ((pVideoEncoderConfig->width + 15) / 16) * ((pVideoEncoderConfig->height + 15) / 16);
+
+    // Cyclic intra refresh
+    OMX_VIDEO_PARAM_INTRAREFRESHTYPE intraRefresh;
+    OMX_RESET_STRUCT(&intraRefresh, OMX_VIDEO_PARAM_INTRAREFRESHTYPE);
+
+    intraRefresh.nPortIndex = PortIndexOut;
+
+    if (OMX_GetParameter(m_OMXHandle, OMX_IndexParamVideoIntraRefresh, (OMX_PTR)&intraRefresh))
+    {
+        M_WARN("OMX_GetParameter of OMX_IndexParamVideoIntraRefresh failed, using periodic IDR frames\n");
+    }
+    else
+    {
+        intraRefresh.eRefreshMode = OMX_VIDEO_IntraRefreshCyclic;
+        intraRefresh.nCirMBs      = numMBs / (pVideoEncoderConfig->frameRate * LOW_LATENCY_REFRESH_PERIOD_S);
+        if (intraRefresh.nCirMBs == 0) intraRefresh.nCirMBs = 1;
+
+        OMX_RESET_STRUCT_SIZE_VERSION(&intraRefresh, OMX_VIDEO_PARAM_INTRAREFRESHTYPE);
+
+        if (OMX_SetParameter(m_OMXHandle, OMX_IndexParamVideoIntraRefresh, (OMX_PTR)&intraRefresh))
+        {
+            M_WARN("OMX_SetParameter of OMX_IndexParamVideoIntraRefresh failed, using periodic IDR frames\n");
+        }
+    }
+
+    // Multiple slices per frame
+    QOMX_VIDEO_PARAM_SLICE_SPACING_TYPE sliceSpacing;
+    OMX_RESET_STRUCT(&sliceSpacing, QOMX_VIDEO_PARAM_SLICE_SPACING_TYPE);
+
+    sliceSpacing.nPortIndex = PortIndexOut;
+    sliceSpacing.eSliceMode = QOMX_SLICEMODE_MB_COUNT;
+    sliceSpacing.nSliceSize = (numMBs + LOW_LATENCY_NUM_SLICES - 1) / LOW_LATENCY_NUM_SLICES;
+
+    if (OMX_SetParameter(m_OMXHandle, (OMX_INDEXTYPE)OMX_QcomIndexParamVideoSliceSpacing, (OMX_PTR)&sliceSpacing))
+    {
+        M_WARN("OMX_SetParameter of OMX_QcomIndexParamVideoSliceSpacing failed, using one slice per frame\n");
+        return OMX_ErrorNone;
+    }
+
+    // Hand each slice back as soon as it's done instead of waiting for the whole frame
+    QOMX_EXTNINDEX_PARAMTYPE sliceDelivery;
+    OMX_RESET_STRUCT(&sliceDelivery, QOMX_EXTNINDEX_PARAMTYPE);
+
+    sliceDelivery.nPortIndex = PortIndexOut;
+    sliceDelivery.bEnable    = OMX_TRUE;
+
+    if (OMX_SetParameter(m_OMXHandle, (OMX_INDEXTYPE)OMX_QcomIndexEnableSliceDeliveryMode, (OMX_PTR)&sliceDelivery))
+    {
+        M_WARN("OMX_SetParameter of OMX_QcomIndexEnableSliceDeliveryMode failed, slices will be sent per frame\n");
+        return OMX_ErrorNone;
+    }
+
+    m_sliceDelivery = true;
+
+    return OMX_ErrorNone;
+}
+
 // -----------------------------------------------------------------------------------------------------------------------------
 // This function sets the input or output port parameters and gets the input or output port buffer sizes and count to allocate
 // -----------------------------------------------------------------------------------------------------------------------------
@@ -657,11 +792,13 @@ OMX_ERRORTYPE VideoEncoder::SetPortParams(OMX_U32  portIndex,               ///<
 // -----------------------------------------------------------------------------------------------------------------------------
 void VideoEncoder::ProcessFrameToEncode(camera_image_metadata_t meta, BufferBlock* buffer)
 {
-    pthread_mutex_lock(&out_mutex);
-    // Queue up work for thread "ThreadProcessOMXOutputPort"
-    out_metaQueue.push_back(meta);
-    pthread_cond_signal(&out_cond);
-    pthread_mutex_unlock(&out_mutex);
+    if ((uint32_t)m_inputInFlight >= m_maxInputInFlight)
+    {
+        M_VERBOSE("Encoder busy, skipping frame: %d\n", meta.frame_id);
+        m_framesSkippedBusy++;
+        bufferPushAddress(*m_pHALInputBuffers, buffer->vaddress);
+        return;
+    }
 
     #ifdef USE_HAL_INPUT_BUFFERS
         OMX_BUFFERHEADERTYPE* OMXBuffer = NULL;
@@ -669,6 +806,7 @@ void VideoEncoder::ProcessFrameToEncode(camera_image_metadata_t meta, BufferBloc
             M_VERBOSE("Encoder Buffer Miss\n");
             if(i == m_pHALInputBuffers->totalBuffers - 1){
                 M_ERROR("Encoder did not find omx-ready buffer for buffer: 0x%lx, skipping encoding\n", buffer->vaddress);
+                bufferPushAddress(*m_pHALInputBuffers, buffer->vaddress);
                 return;
             }
         }
@@ -689,18 +827,96 @@ void VideoEncoder::ProcessFrameToEncode(camera_image_metadata_t meta, BufferBloc
     OMXBuffer->nFilledLen = buffer->size;
     OMXBuffer->nTimeStamp = meta.timestamp_ns;
 
+    pthread_mutex_lock(&out_mutex);
+    // Queue up work for thread "ThreadProcessOMXOutputPort"
+    out_metaQueue.push_back(meta);
+    pthread_cond_signal(&out_cond);
+    pthread_mutex_unlock(&out_mutex);
+
+    m_inputInFlight++;
+
     if (OMX_EmptyThisBuffer(m_OMXHandle, OMXBuffer))
     {
         M_ERROR("OMX_EmptyThisBuffer failed for framebuffer: %d\n", meta.frame_id);
+        m_inputInFlight--;
+
+        pthread_mutex_lock(&out_mutex);
+        out_metaQueue.pop_back();
+        pthread_mutex_unlock(&out_mutex);
+
+        #ifdef USE_HAL_INPUT_BUFFERS
+            bufferPushAddress(*m_pHALInputBuffers, buffer->vaddress);
+        #endif
     }
+
+    // When the encoder reads straight from the HAL buffer it goes back to the camera once the encoder is done with it
+    // (OMXEmptyBufferHandler), otherwise we already copied it
     #ifndef USE_HAL_INPUT_BUFFERS
         bufferPushAddress(*m_pHALInputBuffers, buffer->vaddress);
     #endif
 
-    #ifdef USE_HAL_INPUT_BUFFERS
-        bufferPushAddress(*m_pHALInputBuffers, buffer->vaddress);
-    #endif
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// The encoder only sends the stream headers once when it starts, so a client that connects later would have to wait for them
+// forever. Ask the encoder for a sync frame and resend the cached headers in front of it.
+// -----------------------------------------------------------------------------------------------------------------------------
+void VideoEncoder::RequestSyncFrame()
+{
+    OMX_CONFIG_INTRAREFRESHVOPTYPE vopRefresh;
+    OMX_RESET_STRUCT(&vopRefresh, OMX_CONFIG_INTRAREFRESHVOPTYPE);
+
+    vopRefresh.nPortIndex      = PortIndexOut;
+    vopRefresh.IntraRefreshVOP = OMX_TRUE;
+
+    m_needCodecConfig = true;
+
+    if (OMX_SetConfig(m_OMXHandle, OMX_IndexConfigVideoIntraVOPRefresh, (OMX_PTR)&vopRefresh))
+    {
+        M_WARN("OMX_SetConfig of OMX_IndexConfigVideoIntraVOPRefresh failed, new client will wait for the next sync frame\n");
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// In-server recording. Files have to start on a sync frame so ask for one right away instead of waiting for the next IDR.
+// -----------------------------------------------------------------------------------------------------------------------------
+void VideoEncoder::StartRecording()
+{
+    if (m_pRecorder == NULL || m_pRecorder->IsRecording()) return;
+
+    m_pRecorder->Start();
+    RequestSyncFrame();
+}
+
+void VideoEncoder::StopRecording()
+{
+    if (m_pRecorder == NULL) return;
 
+    m_pRecorder->Stop();
+}
+
+bool VideoEncoder::IsRecording()
+{
+    return m_pRecorder != NULL && m_pRecorder->IsRecording();
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Commands coming in on the encoded pipe's control pipe
+// -----------------------------------------------------------------------------------------------------------------------------
+void VideoEncoder::HandleControlCmd(char* cmd)
+{
+    if (!strncmp(cmd, "start_record", strlen("start_record")))
+    {
+        StartRecording();
+    }
+    else if (!strncmp(cmd, "stop_record", strlen("stop_record")))
+    {
+        StopRecording();
+    }
+    else
+    {
+        M_ERROR("Encoder got unknown control command: %s\n", cmd);
+    }
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------
@@ -724,15 +940,46 @@ void VideoEncoder::Start()
 // -----------------------------------------------------------------------------------------------------------------------------
 void VideoEncoder::Stop()
 {
+    // Under the lock, otherwise the wake up can land between the output thread checking its queue and going to sleep
+    pthread_mutex_lock(&out_mutex);
     stop  = true;
-    // The thread wont finish and the "join" call will not return till the last expected encoded frame is received from
-    // the encoder OMX component
     pthread_cond_signal(&out_cond);
+    pthread_mutex_unlock(&out_mutex);
     pthread_join(out_thread, NULL);
 
+    if (m_pRecorder != NULL)
+    {
+        m_pRecorder->Stop();
+    }
+
     pthread_mutex_destroy(&out_mutex);
     pthread_cond_destroy(&out_cond);
 
+    PrintStats();
+
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Print the running statistics
+// -----------------------------------------------------------------------------------------------------------------------------
+void VideoEncoder::PrintStats()
+{
+    if (m_stats.framesEncoded == 0)
+    {
+        return;
+    }
+
+    M_DEBUG("Encoder %dx%d %s: %llu frames, %llu skipped (encoder busy), %llu skipped (no buffer), "
+            "capture to first byte latency avg: %.2fms min: %.2fms max: %.2fms\n",
+        m_VideoEncoderConfig.width,
+        m_VideoEncoderConfig.height,
+        m_VideoEncoderConfig.isH265 ? "h265" : "h264",
+        (unsigned long long)m_stats.framesEncoded,
+        (unsigned long long)m_framesSkippedBusy,
+        (unsigned long long)m_framesSkippedNoBuffer,
+        (double)m_stats.latencySumNs / m_stats.framesEncoded / 1000000.0,
+        m_stats.latencyMinNs / 1000000.0,
+        m_stats.latencyMaxNs / 1000000.0);
 }
 
 // -----------------------------------------------------------------------------------------------------------------------------
@@ -922,10 +1169,13 @@ OMX_ERRORTYPE OMXEmptyBufferHandler(OMX_IN OMX_HANDLETYPE        hComponent,
                                     OMX_IN OMX_PTR               pAppData,      ///< Any private app data
                                     OMX_IN OMX_BUFFERHEADERTYPE* pBuffer)       ///< Buffer that has been emptied
 {
-    // #ifdef USE_HAL_INPUT_BUFFERS
-    //     VideoEncoder*  pVideoEncoder = (VideoEncoder*)pAppData;
-    //     bufferPushAddress(*pVideoEncoder->m_pHALInputBuffers, pBuffer->pBuffer);
-    // #endif
+    VideoEncoder*  pVideoEncoder = (VideoEncoder*)pAppData;
+
+    #ifdef USE_HAL_INPUT_BUFFERS
+        bufferPushAddress(*pVideoEncoder->m_pHALInputBuffers, pBuffer->pBuffer);
+    #endif
+
+    pVideoEncoder->m_inputInFlight--;
 
     return OMX_ErrorNone;
 }
@@ -986,21 +1236,68 @@ void* VideoEncoder::ThreadProcessOMXOutputPort()
 
 
         camera_image_metadata_t meta     = out_metaQueue.front();
-        // h264 metadata packet, don't associate it with a frame
-        if(pOMXBuffer->pBuffer[4] != 0x67){
-            out_metaQueue.pop_front();
-        } else {
+        bool isCodecConfig = pOMXBuffer->nFlags & OMX_BUFFERFLAG_CODECCONFIG;
+        bool isEndOfFrame  = !m_sliceDelivery || (pOMXBuffer->nFlags & OMX_BUFFERFLAG_ENDOFFRAME);
+
+        // Stream header packet, don't associate it with a frame. When we get slices, the metadata stays around until
+        // the last slice of the frame.
+        if(isCodecConfig){
             meta.frame_id = -1;
+        } else if(isEndOfFrame){
+            out_metaQueue.pop_front();
         }
 
         pthread_mutex_unlock(&out_mutex);
         frameNumber = meta.frame_id;
 
-        meta.size_bytes = pOMXBuffer->nFilledLen;
         meta.format = m_VideoEncoderConfig.isH265 ? IMAGE_FORMAT_H265 : IMAGE_FORMAT_H264;
 
-        pipe_server_write_camera_frame(m_outputPipe, meta, pOMXBuffer->pBuffer);
-        M_WARN("Sent encoded frame: %d\n", frameNumber);
+        if(pOMXBuffer->nFlags & OMX_BUFFERFLAG_CODECCONFIG){
+            // Keep a copy of the headers around for any clients that connect later
+            uint8_t* pCodecConfig = (uint8_t*)realloc(m_pCodecConfig, pOMXBuffer->nFilledLen);
+            if(pCodecConfig != NULL){
+                m_pCodecConfig    = pCodecConfig;
+                m_codecConfigSize = pOMXBuffer->nFilledLen;
+                memcpy(m_pCodecConfig, pOMXBuffer->pBuffer + pOMXBuffer->nOffset, m_codecConfigSize);
+            }
+            m_needCodecConfig = false;
+        } else if(m_needCodecConfig && (pOMXBuffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME) && m_pCodecConfig != NULL){
+            camera_image_metadata_t headerMeta = meta;
+            headerMeta.frame_id   = -1;
+            headerMeta.size_bytes = m_codecConfigSize;
+            pipe_server_write_camera_frame(m_outputPipe, headerMeta, m_pCodecConfig);
+            m_needCodecConfig = false;
+        }
+
+        meta.size_bytes = pOMXBuffer->nFilledLen;
+
+        pipe_server_write_camera_frame(m_outputPipe, meta, pOMXBuffer->pBuffer + pOMXBuffer->nOffset);
+        M_VERBOSE("Sent encoded frame: %d\n", frameNumber);
+
+        if(m_pRecorder != NULL){
+            m_pRecorder->AddBuffer(pOMXBuffer->pBuffer + pOMXBuffer->nOffset,
+                                   pOMXBuffer->nFilledLen,
+                                   meta.timestamp_ns,
+                                   isCodecConfig,
+                                   pOMXBuffer->nFlags & OMX_BUFFERFLAG_SYNCFRAME,
+                                   isEndOfFrame);
+        }
+
+        if(!isCodecConfig){
+            if(!m_frameStarted){
+                int64_t latency = _time_monotonic_ns() - meta.timestamp_ns;
+
+                m_stats.framesEncoded++;
+                m_stats.latencySumNs += latency;
+                if(latency < m_stats.latencyMinNs) m_stats.latencyMinNs = latency;
+                if(latency > m_stats.latencyMaxNs) m_stats.latencyMaxNs = latency;
+
+                if(m_stats.framesEncoded % (m_VideoEncoderConfig.frameRate * STATS_PERIOD_S) == 0){
+                    PrintStats();
+                }
+            }
+            m_frameStarted = !isEndOfFrame;
+        }
 
         // Since we processed the OMX buffer we can immediately recycle it by sending it to the output port of the OMX
         // component
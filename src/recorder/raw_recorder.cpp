@@ -0,0 +1,442 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <modal_journal.h>
+
+#include "raw_recorder.h"
+
+// Frames that can be waiting for the disk at once, anything more is dropped
+#define NUM_SLOTS           16
+
+// File space is reserved this many slots at a time so the file doesn't get fragmented while it grows
+#define PREALLOC_SLOTS      64
+
+// Highest file number for one start time
+#define MAX_FILES           1000
+
+#define ALIGN_UP(x) (((x) + CAMERA_RAW_ALIGN - 1) & ~((uint64_t)CAMERA_RAW_ALIGN - 1))
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Constructor
+// -----------------------------------------------------------------------------------------------------------------------------
+RawRecorder::RawRecorder(const char* name, const char* dir)
+{
+    strncpy(m_name, name, MAX_NAME_LENGTH - 1);
+    m_name[MAX_NAME_LENGTH - 1] = 0;
+    strncpy(m_dir, dir, MAX_DIR_LENGTH - 1);
+    m_dir[MAX_DIR_LENGTH - 1] = 0;
+
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_cond, NULL);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Destructor
+// -----------------------------------------------------------------------------------------------------------------------------
+RawRecorder::~RawRecorder()
+{
+    Stop();
+    FreeSlots();
+
+    pthread_mutex_destroy(&m_mutex);
+    pthread_cond_destroy(&m_cond);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Start recording, the file is opened once the first frame arrives and its size is known
+// -----------------------------------------------------------------------------------------------------------------------------
+void RawRecorder::Start()
+{
+    if (m_recording) return;
+
+    // Stopped but never joined, e.g. after a failed open
+    Stop();
+
+    time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    strftime(m_startTime, sizeof(m_startTime), "%Y%m%d_%H%M%S", &local);
+
+    if (mkdir(m_dir, 0755) && errno != EEXIST)
+    {
+        M_WARN("Raw recorder %s could not create directory %s: %s\n", m_name, m_dir, strerror(errno));
+    }
+
+    pthread_mutex_lock(&m_mutex);
+    // The camera thread may still be copying into a slot it took before the last recording stopped
+    while (m_filling)
+    {
+        pthread_cond_wait(&m_cond, &m_mutex);
+    }
+    // Every slot is free with the writer thread gone, size them again for this recording's frames
+    FreeSlots();
+    m_framesDropped = 0;
+    m_stop          = false;
+    m_recording     = true;
+    pthread_mutex_unlock(&m_mutex);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    pthread_create(&m_thread,
+                   &attr,
+                   [](void* data){return ((RawRecorder*)data)->ThreadWriter();},
+                   this);
+    pthread_attr_destroy(&attr);
+
+    m_threadRunning = true;
+
+    M_PRINT("Raw recorder %s started\n", m_name);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Stop recording, the writer thread finishes whatever is queued and the file index before it exits
+// -----------------------------------------------------------------------------------------------------------------------------
+void RawRecorder::Stop()
+{
+    if (!m_threadRunning) return;
+
+    pthread_mutex_lock(&m_mutex);
+    m_recording = false;
+    m_stop      = true;
+    pthread_cond_signal(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+
+    pthread_join(m_thread, NULL);
+    m_threadRunning = false;
+
+    M_PRINT("Raw recorder %s stopped, %llu frames dropped\n", m_name, (unsigned long long)m_framesDropped);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Slot buffers are sized for the first frame of a recording, called with the mutex held and only when no slot is in use
+// -----------------------------------------------------------------------------------------------------------------------------
+int RawRecorder::AllocateSlots(uint32_t frameBytes)
+{
+    uint64_t slotSize = ALIGN_UP(CAMERA_RAW_DATA_OFFSET + (uint64_t)frameBytes);
+
+    FreeSlots();
+
+    if (posix_memalign((void**)&m_pSlotMem, CAMERA_RAW_ALIGN, slotSize * NUM_SLOTS))
+    {
+        M_ERROR("Raw recorder %s failed to allocate %llu bytes of slot buffers\n",
+                m_name, (unsigned long long)(slotSize * NUM_SLOTS));
+        m_pSlotMem = NULL;
+        return -1;
+    }
+
+    m_slotSize = slotSize;
+
+    for (int i = 0; i < NUM_SLOTS; i++)
+    {
+        uint8_t* pSlot = m_pSlotMem + i * slotSize;
+
+        // The padding is written to the file as well, don't leak old memory into it
+        memset(pSlot, 0, slotSize);
+        m_freeSlots.push_back(pSlot);
+    }
+
+    return 0;
+}
+
+void RawRecorder::FreeSlots()
+{
+    m_queue.clear();
+    m_freeSlots.clear();
+    free(m_pSlotMem);
+    m_pSlotMem = NULL;
+    m_slotSize = 0;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Copies one frame into a free slot for the writer thread, this is the only copy between the camera and the file
+// -----------------------------------------------------------------------------------------------------------------------------
+void RawRecorder::AddFrame(camera_image_metadata_t meta, const uint8_t* data, const uint8_t* data2)
+{
+    pthread_mutex_lock(&m_mutex);
+
+    if (!m_recording)
+    {
+        pthread_mutex_unlock(&m_mutex);
+        return;
+    }
+
+    if (m_slotSize < CAMERA_RAW_DATA_OFFSET + (uint64_t)meta.size_bytes)
+    {
+        // A file has one slot size, the frame size can only change with a new recording
+        if (m_pSlotMem != NULL)
+        {
+            M_ERROR("Raw recorder %s frame grew to %d bytes, stopping\n", m_name, meta.size_bytes);
+            m_recording = false;
+            pthread_mutex_unlock(&m_mutex);
+            return;
+        }
+
+        if (AllocateSlots(meta.size_bytes))
+        {
+            m_recording = false;
+            pthread_mutex_unlock(&m_mutex);
+            return;
+        }
+    }
+
+    if (m_freeSlots.empty())
+    {
+        if (m_framesDropped++ == 0)
+        {
+            M_WARN("Raw recorder %s can't keep up, dropping frames\n", m_name);
+        }
+        pthread_mutex_unlock(&m_mutex);
+        return;
+    }
+
+    uint8_t* pSlot = m_freeSlots.front();
+    m_freeSlots.pop_front();
+    m_filling = true;
+
+    pthread_mutex_unlock(&m_mutex);
+
+    // The slot isn't on either list while we fill it so there's no need to hold the lock, m_filling keeps Start() from
+    // freeing it under us
+    uint32_t bytes = (data2 == NULL) ? meta.size_bytes : meta.size_bytes / 2;
+
+    memcpy(pSlot, &meta, sizeof(meta));
+    memcpy(pSlot + CAMERA_RAW_DATA_OFFSET, data, bytes);
+    if (data2 != NULL)
+    {
+        memcpy(pSlot + CAMERA_RAW_DATA_OFFSET + bytes, data2, bytes);
+    }
+
+    pthread_mutex_lock(&m_mutex);
+    m_filling = false;
+
+    // Stopped while we were copying, the writer thread may already be gone
+    if (m_recording)
+    {
+        m_queue.push_back(pSlot);
+    }
+    else
+    {
+        m_freeSlots.push_back(pSlot);
+    }
+
+    pthread_cond_broadcast(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Writer thread
+// -----------------------------------------------------------------------------------------------------------------------------
+void* RawRecorder::ThreadWriter()
+{
+    pthread_setname_np(pthread_self(), "raw_recorder");
+
+    // Set once a file couldn't be opened or written, whatever is still queued then just goes back to the free list
+    bool failed = false;
+
+    while (true)
+    {
+        pthread_mutex_lock(&m_mutex);
+
+        while (m_queue.empty() && !m_stop)
+        {
+            pthread_cond_wait(&m_cond, &m_mutex);
+        }
+
+        if (m_queue.empty())
+        {
+            pthread_mutex_unlock(&m_mutex);
+            break;
+        }
+
+        uint8_t* pSlot    = m_queue.front();
+        uint64_t slotSize = m_slotSize;
+        m_queue.pop_front();
+
+        pthread_mutex_unlock(&m_mutex);
+
+        if (m_fd < 0 && !failed && OpenFile())
+        {
+            // Nowhere to put anything, stop taking frames and just give the slots back
+            failed = true;
+            pthread_mutex_lock(&m_mutex);
+            m_recording = false;
+            pthread_mutex_unlock(&m_mutex);
+        }
+
+        if (m_fd >= 0)
+        {
+            camera_image_metadata_t* pMeta = (camera_image_metadata_t*)pSlot;
+
+            if (m_nextOffset + slotSize > m_reservedEnd)
+            {
+                if (fallocate(m_fd, FALLOC_FL_KEEP_SIZE, m_reservedEnd, slotSize * PREALLOC_SLOTS))
+                {
+                    M_VERBOSE("Raw recorder %s could not preallocate: %s\n", m_name, strerror(errno));
+                }
+                m_reservedEnd += slotSize * PREALLOC_SLOTS;
+            }
+
+            if (pwrite(m_fd, pSlot, slotSize, m_nextOffset) != (ssize_t)slotSize)
+            {
+                M_ERROR("Raw recorder %s write failed: %s\n", m_name, strerror(errno));
+                failed = true;
+                pthread_mutex_lock(&m_mutex);
+                m_recording = false;
+                pthread_mutex_unlock(&m_mutex);
+                CloseFile();
+            }
+            else
+            {
+                camera_raw_index_t entry;
+                entry.timestamp_ns = pMeta->timestamp_ns;
+                entry.offset       = m_nextOffset;
+                entry.frame_id     = pMeta->frame_id;
+                entry.size_bytes   = pMeta->size_bytes;
+                m_index.push_back(entry);
+
+                m_nextOffset += slotSize;
+            }
+        }
+
+        pthread_mutex_lock(&m_mutex);
+        m_freeSlots.push_back(pSlot);
+        pthread_mutex_unlock(&m_mutex);
+    }
+
+    CloseFile();
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Opens the next file and writes a header without the index, that's all a reader needs to walk the slots if we never get to
+// close the file
+// -----------------------------------------------------------------------------------------------------------------------------
+int RawRecorder::OpenFile()
+{
+    char path[MAX_DIR_LENGTH + MAX_NAME_LENGTH + 64];
+    int  n = 0;
+
+    // Never overwrite anything, recording can be stopped and started again within the same second
+    do
+    {
+        snprintf(path, sizeof(path), "%s/%s_%s_%03d.raw", m_dir, m_name, m_startTime, n);
+        m_fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    } while (m_fd < 0 && errno == EEXIST && ++n < MAX_FILES);
+
+    if (m_fd < 0)
+    {
+        M_ERROR("Raw recorder %s failed to open %s: %s\n", m_name, path, strerror(errno));
+        return -1;
+    }
+
+    m_index.clear();
+    m_nextOffset  = CAMERA_RAW_ALIGN;
+    m_reservedEnd = 0;
+
+    camera_raw_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic             = CAMERA_RAW_MAGIC;
+    header.version           = CAMERA_RAW_VERSION;
+    snprintf(header.name, sizeof(header.name), "%s", m_name);
+    header.slot_size         = m_slotSize;
+    header.first_slot_offset = m_nextOffset;
+
+    if (pwrite(m_fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+    {
+        M_ERROR("Raw recorder %s failed to write header: %s\n", m_name, strerror(errno));
+        close(m_fd);
+        m_fd = -1;
+        return -1;
+    }
+
+    M_DEBUG("Raw recorder %s writing to %s\n", m_name, path);
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Writes the index after the last slot and fills in the header
+// -----------------------------------------------------------------------------------------------------------------------------
+void RawRecorder::CloseFile()
+{
+    if (m_fd < 0) return;
+
+    uint64_t indexBytes = m_index.size() * sizeof(camera_raw_index_t);
+    uint64_t fileBytes  = m_nextOffset + indexBytes;
+
+    camera_raw_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic             = CAMERA_RAW_MAGIC;
+    header.version           = CAMERA_RAW_VERSION;
+    snprintf(header.name, sizeof(header.name), "%s", m_name);
+    header.slot_size         = m_slotSize;
+    header.first_slot_offset = CAMERA_RAW_ALIGN;
+    header.num_frames        = m_index.size();
+    header.index_offset      = m_nextOffset;
+
+    pthread_mutex_lock(&m_mutex);
+    header.frames_dropped    = m_framesDropped;
+    pthread_mutex_unlock(&m_mutex);
+
+    // Index first, the header only points at it once it's there
+    if (indexBytes > 0 && pwrite(m_fd, m_index.data(), indexBytes, m_nextOffset) != (ssize_t)indexBytes)
+    {
+        M_ERROR("Raw recorder %s failed to write index: %s\n", m_name, strerror(errno));
+        fileBytes = m_nextOffset;
+    }
+    else if (fsync(m_fd) || pwrite(m_fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+    {
+        M_ERROR("Raw recorder %s failed to finish header: %s\n", m_name, strerror(errno));
+    }
+
+    if (ftruncate(m_fd, fileBytes))
+    {
+        M_VERBOSE("Raw recorder %s failed to release preallocated space: %s\n", m_name, strerror(errno));
+    }
+
+    close(m_fd);
+    m_fd = -1;
+
+    M_DEBUG("Raw recorder %s wrote %llu frames\n", m_name, (unsigned long long)m_index.size());
+
+    m_index.clear();
+}
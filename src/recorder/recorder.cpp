@@ -0,0 +1,818 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <modal_journal.h>
+
+#include "recorder.h"
+#include "voxl_camera_server.h"
+
+// File writes go out in blocks of this size from an aligned buffer
+#define WRITE_BLOCK_SIZE    (1024*1024)
+#define WRITE_BLOCK_ALIGN   4096
+
+// Space reserved up front for each file when there is no size limit
+#define PREALLOC_DEFAULT_MB 256
+
+// Highest file number for one recording
+#define MAX_SEGMENTS        1000
+
+// Frames are dropped (until the next sync frame) if the disk falls this far behind
+#define MAX_QUEUED_BYTES    (32*1024*1024)
+
+// Matroska element ids
+#define MKV_EBML                0x1A45DFA3
+#define MKV_EBML_VERSION        0x4286
+#define MKV_EBML_READ_VERSION   0x42F7
+#define MKV_EBML_MAX_ID_LEN     0x42F2
+#define MKV_EBML_MAX_SIZE_LEN   0x42F3
+#define MKV_DOCTYPE             0x4282
+#define MKV_DOCTYPE_VERSION     0x4287
+#define MKV_DOCTYPE_READ_VER    0x4285
+#define MKV_SEGMENT             0x18538067
+#define MKV_INFO                0x1549A966
+#define MKV_TIMESTAMP_SCALE     0x2AD7B1
+#define MKV_MUXING_APP          0x4D80
+#define MKV_WRITING_APP         0x5741
+#define MKV_TRACKS              0x1654AE6B
+#define MKV_TRACK_ENTRY         0xAE
+#define MKV_TRACK_NUMBER        0xD7
+#define MKV_TRACK_UID           0x73C5
+#define MKV_TRACK_TYPE          0x83
+#define MKV_FLAG_LACING         0x9C
+#define MKV_CODEC_ID            0x86
+#define MKV_CODEC_PRIVATE       0x63A2
+#define MKV_VIDEO               0xE0
+#define MKV_PIXEL_WIDTH         0xB0
+#define MKV_PIXEL_HEIGHT        0xBA
+#define MKV_CLUSTER             0x1F43B675
+#define MKV_CLUSTER_TIMESTAMP   0xE7
+#define MKV_SIMPLE_BLOCK        0xA3
+
+// Cluster and block timestamps are in ms, blocks store theirs as a signed 16 bit offset from the cluster
+#define MKV_TIMESTAMP_SCALE_NS  1000000
+#define MKV_MAX_BLOCK_OFFSET_MS 32767
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// EBML encoding helpers, these all append to a byte vector
+// -----------------------------------------------------------------------------------------------------------------------------
+static void EbmlId(std::vector<uint8_t>& out, uint32_t id)
+{
+    int bytes = (id > 0xFFFFFF) ? 4 : (id > 0xFFFF) ? 3 : (id > 0xFF) ? 2 : 1;
+
+    for (int i = bytes - 1; i >= 0; i--) out.push_back((id >> (8 * i)) & 0xFF);
+}
+
+static void EbmlSize(std::vector<uint8_t>& out, uint64_t size)
+{
+    int bytes = 1;
+
+    // All ones is reserved for "unknown"
+    while (bytes < 8 && size >= (1ULL << (7 * bytes)) - 1) bytes++;
+
+    uint64_t value = size | (1ULL << (7 * bytes));
+
+    for (int i = bytes - 1; i >= 0; i--) out.push_back((value >> (8 * i)) & 0xFF);
+}
+
+static void EbmlUnknownSize(std::vector<uint8_t>& out)
+{
+    static const uint8_t unknown[] = {0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+    out.insert(out.end(), unknown, unknown + sizeof(unknown));
+}
+
+static void EbmlUInt(std::vector<uint8_t>& out, uint32_t id, uint64_t value)
+{
+    int bytes = 1;
+
+    while (bytes < 8 && (value >> (8 * bytes)) != 0) bytes++;
+
+    EbmlId(out, id);
+    EbmlSize(out, bytes);
+    for (int i = bytes - 1; i >= 0; i--) out.push_back((value >> (8 * i)) & 0xFF);
+}
+
+static void EbmlBinary(std::vector<uint8_t>& out, uint32_t id, const void* data, uint32_t size)
+{
+    EbmlId(out, id);
+    EbmlSize(out, size);
+    out.insert(out.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+}
+
+static void EbmlString(std::vector<uint8_t>& out, uint32_t id, const char* str)
+{
+    EbmlBinary(out, id, str, strlen(str));
+}
+
+static void EbmlMaster(std::vector<uint8_t>& out, uint32_t id, const std::vector<uint8_t>& children)
+{
+    EbmlBinary(out, id, children.data(), children.size());
+}
+
+static void PutBE16(std::vector<uint8_t>& out, uint32_t value)
+{
+    out.push_back((value >> 8) & 0xFF);
+    out.push_back(value & 0xFF);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Splits Annex-B data into NAL units, nals gets an offset and size pair for each one (start codes not included)
+// -----------------------------------------------------------------------------------------------------------------------------
+static void FindNals(const uint8_t* data, uint32_t size, std::vector<uint32_t>& nals)
+{
+    uint32_t i     = 0;
+    uint32_t start = 0;
+    bool     inNal = false;
+
+    nals.clear();
+
+    while (i + 2 < size)
+    {
+        // Can't be part of a start code, skip ahead
+        if (data[i + 2] > 1)
+        {
+            i += 3;
+        }
+        else if (data[i + 2] == 1 && data[i + 1] == 0 && data[i] == 0)
+        {
+            if (inNal)
+            {
+                uint32_t end = i;
+                while (end > start && data[end - 1] == 0) end--;
+                if (end > start)
+                {
+                    nals.push_back(start);
+                    nals.push_back(end - start);
+                }
+            }
+
+            i    += 3;
+            start = i;
+            inNal = true;
+        }
+        else
+        {
+            i++;
+        }
+    }
+
+    if (inNal && start < size)
+    {
+        nals.push_back(start);
+        nals.push_back(size - start);
+    }
+}
+
+static inline int NalType(const uint8_t* nal, bool isH265)
+{
+    return isH265 ? (nal[0] >> 1) & 0x3F : nal[0] & 0x1F;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Builds the avcC / hvcC codec private data Matroska wants from the Annex-B stream headers. NAL units in the file are then
+// stored with 4 byte length prefixes instead of start codes.
+// -----------------------------------------------------------------------------------------------------------------------------
+static bool BuildCodecPrivate(const std::vector<uint8_t>& config, bool isH265, std::vector<uint8_t>& out)
+{
+    std::vector<uint32_t> nals;
+    const uint8_t* ps[3]     = {NULL, NULL, NULL};
+    uint32_t       psSize[3] = {0, 0, 0};
+
+    FindNals(config.data(), config.size(), nals);
+
+    for (size_t i = 0; i < nals.size(); i += 2)
+    {
+        const uint8_t* nal  = config.data() + nals[i];
+        uint32_t       size = nals[i + 1];
+        int            slot = -1;
+
+        if (size < 2) continue;
+
+        int            type = NalType(nal, isH265);
+
+        if (isH265)
+        {
+            if      (type == 32) slot = 0;  // VPS
+            else if (type == 33) slot = 1;  // SPS
+            else if (type == 34) slot = 2;  // PPS
+        }
+        else
+        {
+            if      (type == 7) slot = 1;   // SPS
+            else if (type == 8) slot = 2;   // PPS
+        }
+
+        if (slot >= 0 && ps[slot] == NULL)
+        {
+            ps[slot]     = nal;
+            psSize[slot] = size;
+        }
+    }
+
+    out.clear();
+
+    if (!isH265)
+    {
+        if (ps[1] == NULL || ps[2] == NULL || psSize[1] < 4) return false;
+
+        out.push_back(1);           // configurationVersion
+        out.push_back(ps[1][1]);    // profile
+        out.push_back(ps[1][2]);    // profile compatibility
+        out.push_back(ps[1][3]);    // level
+        out.push_back(0xFF);        // 4 byte NAL lengths
+        out.push_back(0xE1);        // one SPS
+        PutBE16(out, psSize[1]);
+        out.insert(out.end(), ps[1], ps[1] + psSize[1]);
+        out.push_back(1);           // one PPS
+        PutBE16(out, psSize[2]);
+        out.insert(out.end(), ps[2], ps[2] + psSize[2]);
+
+        return true;
+    }
+
+    if (ps[0] == NULL || ps[1] == NULL || ps[2] == NULL) return false;
+
+    // The general profile_tier_level sits right after the first byte of the SPS payload, strip emulation prevention
+    // bytes to get at it
+    uint8_t  ptl[13];
+    uint32_t ptlSize = 0;
+    int      zeros   = 0;
+
+    for (uint32_t i = 2; i < psSize[1] && ptlSize < sizeof(ptl); i++)
+    {
+        if (zeros >= 2 && ps[1][i] == 3)
+        {
+            zeros = 0;
+            continue;
+        }
+
+        zeros = (ps[1][i] == 0) ? zeros + 1 : 0;
+        ptl[ptlSize++] = ps[1][i];
+    }
+
+    if (ptlSize < sizeof(ptl)) return false;
+
+    out.push_back(1);                               // configurationVersion
+    out.insert(out.end(), ptl + 1, ptl + 13);       // profile space/tier/idc, compatibility, constraints, level
+    PutBE16(out, 0xF000);                           // min_spatial_segmentation_idc
+    out.push_back(0xFC);                            // parallelismType
+    out.push_back(0xFD);                            // chroma format 4:2:0
+    out.push_back(0xF8);                            // 8 bit luma
+    out.push_back(0xF8);                            // 8 bit chroma
+    PutBE16(out, 0);                                // avgFrameRate
+    out.push_back(0x0F);                            // 1 temporal layer, nested, 4 byte NAL lengths
+    out.push_back(3);                               // VPS, SPS, PPS arrays
+
+    for (int i = 0; i < 3; i++)
+    {
+        out.push_back(0x80 | (32 + i));             // array_completeness, NAL type
+        PutBE16(out, 1);
+        PutBE16(out, psSize[i]);
+        out.insert(out.end(), ps[i], ps[i] + psSize[i]);
+    }
+
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Constructor
+// -----------------------------------------------------------------------------------------------------------------------------
+Recorder::Recorder(RecorderConfig* pRecorderConfig)
+{
+    m_config = *pRecorderConfig;
+
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_cond, NULL);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Destructor
+// -----------------------------------------------------------------------------------------------------------------------------
+Recorder::~Recorder()
+{
+    Stop();
+
+    for (RecorderFrame* pFrame : m_freeFrames) delete pFrame;
+    delete m_pCurrent;
+
+    pthread_mutex_destroy(&m_mutex);
+    pthread_cond_destroy(&m_cond);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Start recording
+// -----------------------------------------------------------------------------------------------------------------------------
+void Recorder::Start()
+{
+    if (m_recording) return;
+
+    if (posix_memalign((void**)&m_pWriteBuf, WRITE_BLOCK_ALIGN, WRITE_BLOCK_SIZE))
+    {
+        M_ERROR("Recorder %s failed to allocate write buffer\n", m_config.name);
+        m_pWriteBuf = NULL;
+        return;
+    }
+
+    time_t now = time(NULL);
+    struct tm local;
+    localtime_r(&now, &local);
+    strftime(m_startTime, sizeof(m_startTime), "%Y%m%d_%H%M%S", &local);
+    m_segment = 0;
+
+    if (mkdir(m_config.dir, 0755) && errno != EEXIST)
+    {
+        M_WARN("Recorder %s could not create directory %s: %s\n", m_config.name, m_config.dir, strerror(errno));
+    }
+
+    pthread_mutex_lock(&m_mutex);
+    if (m_pCurrent != NULL)
+    {
+        RecycleFrame(m_pCurrent);
+        m_pCurrent = NULL;
+    }
+    m_needConfig  = true;
+    m_waitForSync = true;
+    m_stop        = false;
+    m_recording   = true;
+    pthread_mutex_unlock(&m_mutex);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+    pthread_create(&m_thread,
+                   &attr,
+                   [](void* data){return ((Recorder*)data)->ThreadWriter();},
+                   this);
+    pthread_attr_destroy(&attr);
+
+    m_threadRunning = true;
+
+    M_PRINT("Recorder %s started\n", m_config.name);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Stop recording, the writer thread finishes whatever is queued before it exits
+// -----------------------------------------------------------------------------------------------------------------------------
+void Recorder::Stop()
+{
+    if (!m_threadRunning) return;
+
+    pthread_mutex_lock(&m_mutex);
+    m_recording = false;
+    m_stop      = true;
+    pthread_cond_signal(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+
+    pthread_join(m_thread, NULL);
+    m_threadRunning = false;
+
+    free(m_pWriteBuf);
+    m_pWriteBuf = NULL;
+
+    M_PRINT("Recorder %s stopped\n", m_config.name);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Frame pool, called with the mutex held
+// -----------------------------------------------------------------------------------------------------------------------------
+RecorderFrame* Recorder::GetFrame()
+{
+    RecorderFrame* pFrame;
+
+    if (m_freeFrames.empty())
+    {
+        pFrame = new RecorderFrame();
+    }
+    else
+    {
+        pFrame = m_freeFrames.front();
+        m_freeFrames.pop_front();
+    }
+
+    pFrame->data.clear();
+    pFrame->timestamp_ns  = 0;
+    pFrame->isCodecConfig = false;
+    pFrame->isSyncFrame   = false;
+
+    return pFrame;
+}
+
+void Recorder::QueueFrame(RecorderFrame* pFrame)
+{
+    m_queuedBytes += pFrame->data.size();
+    m_queue.push_back(pFrame);
+    pthread_cond_signal(&m_cond);
+}
+
+void Recorder::RecycleFrame(RecorderFrame* pFrame)
+{
+    m_freeFrames.push_back(pFrame);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Takes one encoder output buffer. The copy made here is the only one between the encoder and the file.
+// -----------------------------------------------------------------------------------------------------------------------------
+void Recorder::AddBuffer(const uint8_t* data,
+                         uint32_t       size,
+                         int64_t        timestamp_ns,
+                         bool           isCodecConfig,
+                         bool           isSyncFrame,
+                         bool           isEndOfFrame)
+{
+    pthread_mutex_lock(&m_mutex);
+
+    // Headers are kept even when we aren't recording since the encoder only sends them out every so often
+    if (isCodecConfig)
+    {
+        m_cachedConfig.assign(data, data + size);
+        m_needConfig = true;
+    }
+
+    if (!m_recording || isCodecConfig)
+    {
+        pthread_mutex_unlock(&m_mutex);
+        return;
+    }
+
+    // Files have to start on a sync frame, nothing before one is any use
+    if (m_pCurrent == NULL && m_waitForSync && !isSyncFrame)
+    {
+        pthread_mutex_unlock(&m_mutex);
+        return;
+    }
+
+    if (m_needConfig)
+    {
+        if (m_cachedConfig.empty())
+        {
+            pthread_mutex_unlock(&m_mutex);
+            return;
+        }
+
+        RecorderFrame* pConfig = GetFrame();
+        pConfig->data          = m_cachedConfig;
+        pConfig->timestamp_ns  = timestamp_ns;
+        pConfig->isCodecConfig = true;
+        QueueFrame(pConfig);
+
+        m_needConfig = false;
+    }
+
+    if (m_pCurrent == NULL)
+    {
+        m_pCurrent               = GetFrame();
+        m_pCurrent->timestamp_ns = timestamp_ns;
+        m_pCurrent->isSyncFrame  = isSyncFrame;
+        m_waitForSync            = false;
+    }
+
+    m_pCurrent->data.insert(m_pCurrent->data.end(), data, data + size);
+
+    if (isEndOfFrame)
+    {
+        if (m_queuedBytes + m_pCurrent->data.size() > MAX_QUEUED_BYTES)
+        {
+            M_WARN("Recorder %s can't keep up, dropping frames until the next sync frame\n", m_config.name);
+            RecycleFrame(m_pCurrent);
+            m_waitForSync = true;
+        }
+        else
+        {
+            QueueFrame(m_pCurrent);
+        }
+
+        m_pCurrent = NULL;
+    }
+
+    pthread_mutex_unlock(&m_mutex);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Writer thread
+// -----------------------------------------------------------------------------------------------------------------------------
+void* Recorder::ThreadWriter()
+{
+    pthread_setname_np(pthread_self(), "recorder");
+
+    while (true)
+    {
+        pthread_mutex_lock(&m_mutex);
+
+        while (m_queue.empty() && !m_stop)
+        {
+            pthread_cond_wait(&m_cond, &m_mutex);
+        }
+
+        if (m_queue.empty())
+        {
+            pthread_mutex_unlock(&m_mutex);
+            break;
+        }
+
+        RecorderFrame* pFrame = m_queue.front();
+        m_queue.pop_front();
+        m_queuedBytes -= pFrame->data.size();
+
+        pthread_mutex_unlock(&m_mutex);
+
+        if (pFrame->isCodecConfig)
+        {
+            // New headers mean a new file, the next frame is a sync frame anyway
+            if (pFrame->data != m_codecConfig)
+            {
+                m_codecConfig.swap(pFrame->data);
+                CloseFile();
+            }
+        }
+        else
+        {
+            if (pFrame->isSyncFrame && m_fd >= 0 && SegmentFull(pFrame->timestamp_ns))
+            {
+                CloseFile();
+            }
+
+            if (m_fd < 0 && pFrame->isSyncFrame)
+            {
+                OpenFile(pFrame->timestamp_ns);
+            }
+
+            if (m_fd >= 0)
+            {
+                WriteFrame(pFrame);
+
+                // Ask for the sync frame to rotate on instead of waiting for the next IDR, which in low latency mode can be
+                // a minute away
+                if (!m_syncRequested && m_config.requestSync != NULL && SegmentFull(pFrame->timestamp_ns))
+                {
+                    m_syncRequested = true;
+                    m_config.requestSync(m_config.requestSyncContext);
+                }
+            }
+        }
+
+        pthread_mutex_lock(&m_mutex);
+        RecycleFrame(pFrame);
+        pthread_mutex_unlock(&m_mutex);
+    }
+
+    CloseFile();
+    m_codecConfig.clear();
+
+    return NULL;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// The current file has reached the configured time or size and should be rotated on the next sync frame
+// -----------------------------------------------------------------------------------------------------------------------------
+bool Recorder::SegmentFull(int64_t timestamp_ns)
+{
+    int64_t elapsedNs = timestamp_ns - m_fileStartNs;
+
+    return (m_config.segmentSec > 0 && elapsedNs >= (int64_t)m_config.segmentSec * 1000000000) ||
+           (m_config.segmentMB  > 0 && m_fileBytes + m_writeBufUsed >= ((uint64_t)m_config.segmentMB << 20));
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Opens the next file and writes the Matroska headers
+// -----------------------------------------------------------------------------------------------------------------------------
+int Recorder::OpenFile(int64_t timestamp_ns)
+{
+    char path[MAX_DIR_LENGTH + MAX_NAME_LENGTH + 64];
+
+    // Never overwrite anything, recording can be stopped and started again within the same second
+    do
+    {
+        snprintf(path, sizeof(path), "%s/%s_%s_%03d.mkv", m_config.dir, m_config.name, m_startTime, m_segment);
+        m_fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    } while (m_fd < 0 && errno == EEXIST && ++m_segment < MAX_SEGMENTS);
+
+    if (m_fd < 0)
+    {
+        M_ERROR("Recorder %s failed to open %s: %s\n", m_config.name, path, strerror(errno));
+        return -1;
+    }
+
+    // Reserve the space up front so the file doesn't get fragmented while it grows, the unused part is given back when the
+    // file is closed
+    off_t prealloc = (off_t)(m_config.segmentMB > 0 ? m_config.segmentMB : PREALLOC_DEFAULT_MB) << 20;
+
+    if (fallocate(m_fd, FALLOC_FL_KEEP_SIZE, 0, prealloc))
+    {
+        M_VERBOSE("Recorder %s could not preallocate %s: %s\n", m_config.name, path, strerror(errno));
+    }
+
+    m_segment++;
+    m_fileBytes     = 0;
+    m_writeBufUsed  = 0;
+    m_fileStartNs   = timestamp_ns;
+    m_clusterMs     = -1;
+    m_syncRequested = false;
+
+    WriteHeaders();
+
+    M_DEBUG("Recorder %s writing to %s\n", m_config.name, path);
+
+    return 0;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Closes the current file if there is one
+// -----------------------------------------------------------------------------------------------------------------------------
+void Recorder::CloseFile()
+{
+    if (m_fd < 0) return;
+
+    Flush();
+
+    if (m_fd < 0) return;
+
+    if (ftruncate(m_fd, m_fileBytes))
+    {
+        M_VERBOSE("Recorder %s failed to release preallocated space: %s\n", m_config.name, strerror(errno));
+    }
+
+    close(m_fd);
+    m_fd = -1;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// EBML header, then the Segment with its Info and Tracks. The Segment size is left unknown.
+// -----------------------------------------------------------------------------------------------------------------------------
+void Recorder::WriteHeaders()
+{
+    std::vector<uint8_t> out;
+    std::vector<uint8_t> children;
+
+    EbmlUInt  (children, MKV_EBML_VERSION,      1);
+    EbmlUInt  (children, MKV_EBML_READ_VERSION, 1);
+    EbmlUInt  (children, MKV_EBML_MAX_ID_LEN,   4);
+    EbmlUInt  (children, MKV_EBML_MAX_SIZE_LEN, 8);
+    EbmlString(children, MKV_DOCTYPE,           "matroska");
+    EbmlUInt  (children, MKV_DOCTYPE_VERSION,   4);
+    EbmlUInt  (children, MKV_DOCTYPE_READ_VER,  2);
+    EbmlMaster(out, MKV_EBML, children);
+
+    EbmlId(out, MKV_SEGMENT);
+    EbmlUnknownSize(out);
+
+    children.clear();
+    EbmlUInt  (children, MKV_TIMESTAMP_SCALE, MKV_TIMESTAMP_SCALE_NS);
+    EbmlString(children, MKV_MUXING_APP,      PROCESS_NAME);
+    EbmlString(children, MKV_WRITING_APP,     PROCESS_NAME);
+    EbmlMaster(out, MKV_INFO, children);
+
+    std::vector<uint8_t> codecPrivate;
+    if (!BuildCodecPrivate(m_codecConfig, m_config.isH265, codecPrivate))
+    {
+        M_WARN("Recorder %s could not parse the stream headers, file may not play everywhere\n", m_config.name);
+    }
+
+    std::vector<uint8_t> video;
+    EbmlUInt(video, MKV_PIXEL_WIDTH,  m_config.width);
+    EbmlUInt(video, MKV_PIXEL_HEIGHT, m_config.height);
+
+    std::vector<uint8_t> track;
+    EbmlUInt  (track, MKV_TRACK_NUMBER, 1);
+    EbmlUInt  (track, MKV_TRACK_UID,    1);
+    EbmlUInt  (track, MKV_TRACK_TYPE,   1);
+    EbmlUInt  (track, MKV_FLAG_LACING,  0);
+    EbmlString(track, MKV_CODEC_ID,     m_config.isH265 ? "V_MPEGH/ISO/HEVC" : "V_MPEG4/ISO/AVC");
+    if (!codecPrivate.empty())
+    {
+        EbmlBinary(track, MKV_CODEC_PRIVATE, codecPrivate.data(), codecPrivate.size());
+    }
+    EbmlMaster(track, MKV_VIDEO, video);
+
+    children.clear();
+    EbmlMaster(children, MKV_TRACK_ENTRY, track);
+    EbmlMaster(out, MKV_TRACKS, children);
+
+    Append(out.data(), out.size());
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Writes one frame as a SimpleBlock, starting a new Cluster at every sync frame or when the block timestamp would overflow
+// -----------------------------------------------------------------------------------------------------------------------------
+void Recorder::WriteFrame(RecorderFrame* pFrame)
+{
+    int64_t timeMs = (pFrame->timestamp_ns - m_fileStartNs) / MKV_TIMESTAMP_SCALE_NS;
+    std::vector<uint8_t> header;
+
+    if (m_clusterMs < 0 || pFrame->isSyncFrame || timeMs - m_clusterMs > MKV_MAX_BLOCK_OFFSET_MS)
+    {
+        m_clusterMs = timeMs;
+
+        EbmlId(header, MKV_CLUSTER);
+        EbmlUnknownSize(header);
+        EbmlUInt(header, MKV_CLUSTER_TIMESTAMP, m_clusterMs);
+    }
+
+    FindNals(pFrame->data.data(), pFrame->data.size(), m_nals);
+
+    uint32_t payloadSize = 0;
+    for (size_t i = 0; i < m_nals.size(); i += 2) payloadSize += 4 + m_nals[i + 1];
+
+    int16_t offset = timeMs - m_clusterMs;
+
+    EbmlId(header, MKV_SIMPLE_BLOCK);
+    EbmlSize(header, 4 + payloadSize);
+    header.push_back(0x81);                                 // track 1
+    PutBE16(header, (uint16_t)offset);
+    header.push_back(pFrame->isSyncFrame ? 0x80 : 0x00);    // keyframe flag
+
+    Append(header.data(), header.size());
+
+    for (size_t i = 0; i < m_nals.size(); i += 2)
+    {
+        uint32_t size = m_nals[i + 1];
+        uint8_t  length[4] = {(uint8_t)(size >> 24), (uint8_t)(size >> 16), (uint8_t)(size >> 8), (uint8_t)size};
+
+        Append(length, sizeof(length));
+        Append(pFrame->data.data() + m_nals[i], size);
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Staged file writes, the disk only ever sees full aligned blocks except for the tail of a file
+// -----------------------------------------------------------------------------------------------------------------------------
+void Recorder::Append(const void* data, uint32_t size)
+{
+    const uint8_t* src = (const uint8_t*)data;
+
+    while (size > 0)
+    {
+        uint32_t chunk = WRITE_BLOCK_SIZE - m_writeBufUsed;
+        if (chunk > size) chunk = size;
+
+        memcpy(m_pWriteBuf + m_writeBufUsed, src, chunk);
+        m_writeBufUsed += chunk;
+        src            += chunk;
+        size           -= chunk;
+
+        if (m_writeBufUsed == WRITE_BLOCK_SIZE) Flush();
+    }
+}
+
+void Recorder::Flush()
+{
+    uint32_t written = 0;
+
+    while (written < m_writeBufUsed)
+    {
+        ssize_t ret = write(m_fd, m_pWriteBuf + written, m_writeBufUsed - written);
+
+        if (ret < 0)
+        {
+            if (errno == EINTR) continue;
+
+            // Most likely out of space, nothing more will make it into this file
+            M_ERROR("Recorder %s write failed, closing file: %s\n", m_config.name, strerror(errno));
+            close(m_fd);
+            m_fd           = -1;
+            m_writeBufUsed = 0;
+            return;
+        }
+
+        written += ret;
+    }
+
+    m_fileBytes   += written;
+    m_writeBufUsed = 0;
+}
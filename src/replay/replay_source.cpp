@@ -0,0 +1,230 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <modal_journal.h>
+
+#include "replay_source.h"
+#include "voxl_camera_server.h"
+
+// Frames the kernel is asked to read ahead of the one being handed out
+#define PREFETCH_FRAMES     8
+
+// Longest single sleep while waiting for a frame, so a stop doesn't have to wait out a gap in the recording
+#define MAX_SLEEP_NS        100000000
+
+static int64_t MonotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Constructor, maps the file and finds every frame in it
+// -----------------------------------------------------------------------------------------------------------------------------
+ReplaySource::ReplaySource(const char* path, float speed)
+{
+    strncpy(m_path, path, sizeof(m_path) - 1);
+    m_path[sizeof(m_path) - 1] = 0;
+    m_speed = speed;
+
+    struct stat st;
+
+    if ((m_fd = open(path, O_RDONLY)) < 0 || fstat(m_fd, &st))
+    {
+        M_ERROR("Replay failed to open %s: %s\n", path, strerror(errno));
+        if (m_fd >= 0) close(m_fd);
+        throw -EINVAL;
+    }
+
+    m_mapSize = st.st_size;
+
+    if (m_mapSize < CAMERA_RAW_ALIGN ||
+        (m_pMap = (uint8_t*)mmap(NULL, m_mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, m_fd, 0)) == MAP_FAILED)
+    {
+        M_ERROR("Replay failed to map %s: %s\n", path, m_mapSize < CAMERA_RAW_ALIGN ? "file too short" : strerror(errno));
+        close(m_fd);
+        throw -EINVAL;
+    }
+
+    const camera_raw_header_t* pHeader = (const camera_raw_header_t*)m_pMap;
+    m_slotSize = pHeader->slot_size;
+
+    if (pHeader->magic != CAMERA_RAW_MAGIC || pHeader->version != CAMERA_RAW_VERSION ||
+        m_slotSize == 0 || m_slotSize % CAMERA_RAW_ALIGN != 0)
+    {
+        M_ERROR("Replay %s is not a raw recording\n", path);
+        munmap(m_pMap, m_mapSize);
+        close(m_fd);
+        throw -EINVAL;
+    }
+
+    if (pHeader->index_offset != 0 &&
+        pHeader->index_offset + pHeader->num_frames * sizeof(camera_raw_index_t) <= m_mapSize)
+    {
+        const camera_raw_index_t* pIndex = (const camera_raw_index_t*)(m_pMap + pHeader->index_offset);
+
+        for (uint64_t i = 0; i < pHeader->num_frames; i++)
+        {
+            if (pIndex[i].offset + m_slotSize <= m_mapSize) m_slots.push_back(pIndex[i].offset);
+        }
+    }
+    else
+    {
+        // Recording never finished, take every slot up to the first one that wasn't written
+        M_WARN("Replay %s has no index, scanning for frames\n", path);
+
+        for (uint64_t offset = pHeader->first_slot_offset; offset + m_slotSize <= m_mapSize; offset += m_slotSize)
+        {
+            if (((const camera_image_metadata_t*)(m_pMap + offset))->magic_number != CAMERA_MAGIC_NUMBER) break;
+
+            m_slots.push_back(offset);
+        }
+    }
+
+    // The sizes in every slot are trusted from here on
+    for (size_t i = 0; i < m_slots.size(); i++)
+    {
+        const camera_image_metadata_t* pMeta = GetMeta(i);
+
+        if (pMeta->magic_number != CAMERA_MAGIC_NUMBER || pMeta->size_bytes < 0 ||
+            CAMERA_RAW_DATA_OFFSET + (uint64_t)pMeta->size_bytes > m_slotSize)
+        {
+            M_WARN("Replay %s frame %d is corrupt, stopping there\n", path, (int)i);
+            m_slots.resize(i);
+            break;
+        }
+    }
+
+    if (m_slots.empty())
+    {
+        M_ERROR("Replay %s has no frames\n", path);
+        munmap(m_pMap, m_mapSize);
+        close(m_fd);
+        throw -EINVAL;
+    }
+
+    madvise(m_pMap, m_mapSize, MADV_SEQUENTIAL);
+
+    M_DEBUG("Replaying %d frames from %s at %s\n", NumFrames(), path, m_speed > 0 ? "recorded timing" : "full speed");
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Destructor
+// -----------------------------------------------------------------------------------------------------------------------------
+ReplaySource::~ReplaySource()
+{
+    munmap(m_pMap, m_mapSize);
+    close(m_fd);
+}
+
+bool ReplaySource::IsStereo()
+{
+    int format = GetMeta(0)->format;
+
+    return format == IMAGE_FORMAT_STEREO_RAW8 || format == IMAGE_FORMAT_STEREO_NV12 || format == IMAGE_FORMAT_STEREO_NV21;
+}
+
+const camera_image_metadata_t* ReplaySource::GetMeta(int frame)
+{
+    return (const camera_image_metadata_t*)(m_pMap + m_slots[frame]);
+}
+
+uint8_t* ReplaySource::GetImage(int frame, int image)
+{
+    return m_pMap + m_slots[frame] + CAMERA_RAW_DATA_OFFSET + image * (GetMeta(frame)->size_bytes / 2);
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Asks for the frames ahead to be read in and gives back the ones already handed out
+// -----------------------------------------------------------------------------------------------------------------------------
+void ReplaySource::Prefetch(int frame)
+{
+    const int ahead = std::min(frame + PREFETCH_FRAMES, NumFrames());
+
+    for (; m_prefetched < ahead; m_prefetched++)
+    {
+        madvise(m_pMap + m_slots[m_prefetched], m_slotSize, MADV_WILLNEED);
+    }
+
+    // The frame before this one may still be in use by whoever asked for it last time
+    if (frame >= 2)
+    {
+        madvise(m_pMap + m_slots[frame - 2], m_slotSize, MADV_DONTNEED);
+    }
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Frame n is due (timestamp n - timestamp 0) / speed after frame 0 was handed out. Running late never skips frames, the
+// schedule stays anchored to frame 0 so the timing catches up again afterwards.
+// -----------------------------------------------------------------------------------------------------------------------------
+bool ReplaySource::WaitForFrame(int frame, const bool* pStop)
+{
+    Prefetch(frame);
+
+    if (m_startNs < 0)
+    {
+        m_startNs = MonotonicNs();
+    }
+
+    if (m_speed <= 0) return !*pStop;
+
+    const int64_t dueNs = m_startNs + (int64_t)((GetMeta(frame)->timestamp_ns - GetMeta(0)->timestamp_ns) / m_speed);
+
+    while (!*pStop)
+    {
+        const int64_t nowNs = MonotonicNs();
+
+        if (nowNs >= dueNs)
+        {
+            if (nowNs - dueNs > m_maxLateNs) m_maxLateNs = nowNs - dueNs;
+            return true;
+        }
+
+        struct timespec ts;
+        const int64_t   sleepNs = std::min(dueNs - nowNs, (int64_t)MAX_SLEEP_NS);
+        ts.tv_sec  = sleepNs / 1000000000;
+        ts.tv_nsec = sleepNs % 1000000000;
+        nanosleep(&ts, NULL);
+    }
+
+    return false;
+}
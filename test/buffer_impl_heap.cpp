@@ -0,0 +1,110 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer_manager.h"
+
+#define ALIGN_BYTE(x, a) ((x % a == 0) ? x : x - (x % a) + a)
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Plain heap stand-in for the buffer_impl_*.cpp files so the buffer group can be used off target. The layout matches the
+// QRB5165 ion buffers: rows are padded to 64 bytes and the UV plane starts after the Y plane padded to 64 rows.
+// -----------------------------------------------------------------------------------------------------------------------------
+void bufferMakeYUVContiguous(BufferBlock* pBufferInfo)
+{
+    const int width  = pBufferInfo->width;
+    const int height = pBufferInfo->height;
+    const int stride = pBufferInfo->stride;
+    uint8_t*  y      = (uint8_t*)(pBufferInfo->vaddress);
+    uint8_t*  uv     = bufferGetUVPlane(pBufferInfo);
+
+    for (int row = 1; row < height; row++)
+    {
+        memmove(y + row * width, y + row * stride, width);
+    }
+
+    for (int row = 0; row < height / 2; row++)
+    {
+        memmove(y + (height + row) * width, uv + row * stride, width);
+    }
+}
+
+uint8_t* bufferGetUVPlane(BufferBlock* pBufferInfo)
+{
+    return (uint8_t*)(pBufferInfo->vaddress) + pBufferInfo->stride * pBufferInfo->slice;
+}
+
+int allocateOneBuffer(
+        BufferGroup&       bufferGroup,
+        unsigned int       index,
+        unsigned int       width,
+        unsigned int       height,
+        unsigned int       format,
+        unsigned long int  consumerFlags,
+        buffer_handle_t*   pBuffer)
+{
+    const unsigned int stride = ALIGN_BYTE(width, 64);
+    const unsigned int slice  = ALIGN_BYTE(height, 64);
+    const size_t       size   = ((size_t)(stride * slice * 3 / 2) + 4095U) & (~4095U);
+
+    void* vaddress = calloc(1, size);
+
+    if (vaddress == NULL) return -1;
+
+    bufferGroup.bufferBlocks[index].vaddress = vaddress;
+    bufferGroup.bufferBlocks[index].size     = size;
+    bufferGroup.bufferBlocks[index].width    = width;
+    bufferGroup.bufferBlocks[index].height   = height;
+    bufferGroup.bufferBlocks[index].stride   = stride;
+    bufferGroup.bufferBlocks[index].slice    = slice;
+
+    // Nothing looks inside the handle off target, it only has to be unique
+    *pBuffer = (buffer_handle_t)calloc(1, sizeof(native_handle_t));
+
+    return 0;
+}
+
+void deleteOneBuffer(
+       BufferGroup&       bufferGroup,
+       unsigned int       index)
+{
+    if (bufferGroup.buffers[index] != NULL) {
+        free(bufferGroup.bufferBlocks[index].vaddress);
+        free((void*)bufferGroup.buffers[index]);
+
+        bufferGroup.bufferBlocks[index].vaddress = NULL;
+        bufferGroup.buffers[index]               = NULL;
+    }
+}
@@ -0,0 +1,368 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "voxl_camera_codec.h"
+
+#define NUM_RANDOM_IMAGES       2000
+#define MAX_RANDOM_WIDTH        700
+#define MAX_RANDOM_HEIGHT       40
+#define GUARD_BYTES             64      // Past the end of every buffer, must come back untouched
+#define GUARD_VALUE             0x5A
+#define BENCH_WIDTH             1280
+#define BENCH_HEIGHT            800
+#define BENCH_ITERATIONS        50
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Round trips of libvoxl_camera_codec over random sizes, strides and image content, the error paths of the decoder and the
+// bounds of camera_codec_max_size(), then the encode and decode throughput at a typical tracking camera size
+// -----------------------------------------------------------------------------------------------------------------------------
+static int failures = 0;
+
+#define CHECK(cond, ...)                                \
+    do {                                                \
+        if (!(cond)) {                                  \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                        \
+            printf("\n");                               \
+            failures++;                                 \
+        }                                               \
+    } while (0)
+
+enum ImageType
+{
+    IMAGE_FLAT,
+    IMAGE_GRADIENT,
+    IMAGE_NOISE,
+    IMAGE_CHECKER,      // 0/255 in every other pixel, the largest residuals there are
+    NUM_IMAGE_TYPES
+};
+
+static const char* imageNames[NUM_IMAGE_TYPES] = {"flat", "gradient", "noise", "checker"};
+
+static void FillImage(uint8_t* img, int stride, int width, int height, ImageType type)
+{
+    const uint8_t flat = rand();
+
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < stride; x++)
+        {
+            uint8_t v;
+
+            switch (type)
+            {
+                case IMAGE_FLAT:     v = flat;                        break;
+                case IMAGE_GRADIENT: v = x * 3 + y * 2 + (rand() & 1); break;
+                case IMAGE_NOISE:    v = rand();                      break;
+                default:             v = ((x + y) & 1) ? 255 : 0;     break;
+            }
+
+            // The padding between rows must never make it into the stream
+            img[y * stride + x] = (x < width) ? v : rand();
+        }
+    }
+}
+
+static bool GuardIntact(const std::vector<uint8_t>& buf, size_t size)
+{
+    for (size_t i = size; i < buf.size(); i++)
+    {
+        if (buf[i] != GUARD_VALUE) return false;
+    }
+
+    return true;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Encodes and decodes one image, returns the stream for the error path tests
+// -----------------------------------------------------------------------------------------------------------------------------
+static std::vector<uint8_t> RoundTrip(int width, int height, int stride, ImageType type)
+{
+    std::vector<uint8_t> img(stride * height);
+    FillImage(img.data(), stride, width, height, type);
+
+    const int maxSize = camera_codec_max_size(width, height);
+    std::vector<uint8_t> enc(maxSize + GUARD_BYTES, GUARD_VALUE);
+
+    const int size = camera_codec_encode(img.data(), stride, width, height, enc.data(), maxSize);
+
+    CHECK(size > (int)sizeof(camera_codec_header_t) && size <= maxSize,
+          "%dx%d stride %d %s: encoded %d bytes, max %d", width, height, stride, imageNames[type], size, maxSize);
+    CHECK(GuardIntact(enc, maxSize), "%dx%d %s: encoder wrote past max_size", width, height, imageNames[type]);
+
+    if (size <= 0) return std::vector<uint8_t>();
+
+    // The vectorized encoder (NEON on ARM) has to write exactly what the plain C one does
+    std::vector<uint8_t> ref(maxSize);
+    const int refSize = camera_codec_encode_reference(img.data(), stride, width, height, ref.data(), maxSize);
+
+    CHECK(refSize == size && !memcmp(ref.data(), enc.data(), size),
+          "%dx%d stride %d %s: stream differs from the reference encoder", width, height, stride, imageNames[type]);
+
+    enc.resize(size);
+
+    int w = 0, h = 0;
+    CHECK(camera_codec_get_size(enc.data(), size, &w, &h) == 0 && w == width && h == height,
+          "%dx%d %s: get_size gave %dx%d", width, height, imageNames[type], w, h);
+
+    // Decode to a different stride than we encoded from, the padding must be left alone
+    const int dstStride = width + rand() % 33;
+    std::vector<uint8_t> dec(dstStride * height + GUARD_BYTES, GUARD_VALUE);
+
+    CHECK(camera_codec_decode(enc.data(), size, dec.data(), dstStride) == 0,
+          "%dx%d %s: decode failed", width, height, imageNames[type]);
+
+    for (int y = 0; y < height; y++)
+    {
+        if (memcmp(&img[y * stride], &dec[y * dstStride], width))
+        {
+            CHECK(false, "%dx%d stride %d %s: row %d differs", width, height, stride, imageNames[type], y);
+            break;
+        }
+
+        for (int x = width; x < dstStride; x++)
+        {
+            if (dec[y * dstStride + x] != GUARD_VALUE)
+            {
+                CHECK(false, "%dx%d %s: decoder wrote into the row padding of row %d", width, height, imageNames[type], y);
+                break;
+            }
+        }
+    }
+
+    CHECK(GuardIntact(dec, dstStride * height), "%dx%d %s: decoder wrote past the image", width, height, imageNames[type]);
+
+    std::vector<uint8_t> refDec(dec.size(), GUARD_VALUE);
+
+    CHECK(camera_codec_decode_reference(enc.data(), size, refDec.data(), dstStride) == 0 && refDec == dec,
+          "%dx%d %s: image differs from the reference decoder", width, height, imageNames[type]);
+
+    return enc;
+}
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Every broken stream has to be rejected with -1 without reading or writing out of bounds
+// -----------------------------------------------------------------------------------------------------------------------------
+static void ErrorPaths(const std::vector<uint8_t>& enc, int width, int height)
+{
+    const int size = enc.size();
+    std::vector<uint8_t> dec(width * height);
+    std::vector<uint8_t> bad;
+    camera_codec_header_t header;
+    int w, h;
+
+    memcpy(&header, enc.data(), sizeof(header));
+
+    // Cut short, with the header still claiming the full size
+    const int cuts[] = {0, 1, (int)sizeof(camera_codec_header_t) - 1, (int)sizeof(camera_codec_header_t), size / 2, size - 1};
+    for (int cut : cuts)
+    {
+        if (cut < 0 || cut >= size) continue;
+
+        bad.assign(enc.begin(), enc.begin() + cut);
+        CHECK(camera_codec_decode(bad.data(), cut, dec.data(), width) == -1, "%dx%d: cut to %d decoded", width, height, cut);
+        CHECK(camera_codec_get_size(bad.data(), cut, &w, &h) == -1 || cut >= (int)sizeof(camera_codec_header_t),
+              "%dx%d: cut to %d gave a size", width, height, cut);
+    }
+
+    // Cut short, with the header rewritten to match, the row data runs out instead
+    if (size > (int)sizeof(camera_codec_header_t) + 1)
+    {
+        bad.assign(enc.begin(), enc.end() - 1);
+        camera_codec_header_t shortHeader = header;
+        shortHeader.size_bytes = bad.size();
+        memcpy(bad.data(), &shortHeader, sizeof(shortHeader));
+
+        CHECK(camera_codec_decode(bad.data(), bad.size(), dec.data(), width) == -1,
+              "%dx%d: stream one byte short decoded", width, height);
+    }
+
+    // Broken header fields
+    for (int field = 0; field < 6; field++)
+    {
+        camera_codec_header_t badHeader = header;
+
+        switch (field)
+        {
+            case 0: badHeader.magic ^= 1;                    break;
+            case 1: badHeader.version++;                     break;
+            case 2: badHeader.width = 0;                     break;
+            case 3: badHeader.height = -height;              break;
+            case 4: badHeader.size_bytes = size + 1;         break;
+            case 5: badHeader.size_bytes = sizeof(header) - 1; break;
+        }
+
+        bad = enc;
+        memcpy(bad.data(), &badHeader, sizeof(badHeader));
+
+        CHECK(camera_codec_decode(bad.data(), size, dec.data(), width) == -1, "%dx%d: bad header field %d decoded",
+              width, height, field);
+        CHECK(camera_codec_get_size(bad.data(), size, &w, &h) == -1, "%dx%d: bad header field %d gave a size",
+              width, height, field);
+    }
+
+    // A block width over 8 bits can't be in a valid stream
+    bad = enc;
+    bad[sizeof(camera_codec_header_t)] |= 0x0F;
+    CHECK(camera_codec_decode(bad.data(), size, dec.data(), width) == -1, "%dx%d: block width 15 decoded", width, height);
+
+    // Too small a destination stride
+    CHECK(camera_codec_decode(enc.data(), size, dec.data(), width - 1) == -1, "%dx%d: short stride decoded", width, height);
+
+    // Flipped bits in the row data may still make a valid stream, they just mustn't take the decoder out of bounds
+    bad = enc;
+    for (int i = 0; i < 8; i++)
+    {
+        bad[sizeof(camera_codec_header_t) + rand() % (size - sizeof(camera_codec_header_t))] ^= 1 << (rand() % 8);
+    }
+    std::vector<uint8_t> refDec(width * height);
+    int ret    = camera_codec_decode(bad.data(), size, dec.data(), width);
+    int refRet = camera_codec_decode_reference(bad.data(), size, refDec.data(), width);
+    CHECK(ret == 0 || ret == -1, "%dx%d: corrupt stream returned %d", width, height, ret);
+    CHECK(ret == refRet && (ret != 0 || refDec == dec), "%dx%d: corrupt stream decoded differently from the reference",
+          width, height);
+}
+
+static void MaxSizeBounds()
+{
+    CHECK(camera_codec_max_size(0, 10) == -1, "max_size of zero width");
+    CHECK(camera_codec_max_size(10, 0) == -1, "max_size of zero height");
+    CHECK(camera_codec_max_size(-1, 10) == -1, "max_size of negative width");
+
+    // The worst case has to fit, and max_size is all the encoder may ask for
+    const int width  = 1 + rand() % MAX_RANDOM_WIDTH;
+    const int height = 1 + rand() % MAX_RANDOM_HEIGHT;
+    const int max    = camera_codec_max_size(width, height);
+
+    std::vector<uint8_t> img(width * height);
+    std::vector<uint8_t> enc(max);
+    FillImage(img.data(), width, width, height, IMAGE_CHECKER);
+
+    CHECK(camera_codec_encode(img.data(), width, width, height, enc.data(), max - 1) == -1,
+          "%dx%d: encoded into max_size - 1 bytes", width, height);
+    CHECK(camera_codec_encode(img.data(), width - 1, width, height, enc.data(), max) == -1,
+          "%dx%d: encoded with stride < width", width, height);
+    CHECK(camera_codec_encode(img.data(), width, 0, height, enc.data(), max) == -1, "encoded a zero width image");
+}
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Encode and decode speed of the library and of the plain C reference, which is the same code on hosts without NEON
+static void Throughput()
+{
+    typedef int (*EncodeFn)(const uint8_t*, int, int, int, uint8_t*, int);
+    typedef int (*DecodeFn)(const uint8_t*, int, uint8_t*, int);
+
+    static const EncodeFn    encoders[2] = {camera_codec_encode, camera_codec_encode_reference};
+    static const DecodeFn    decoders[2] = {camera_codec_decode, camera_codec_decode_reference};
+    static const char* const names[2]    = {"library", "reference"};
+
+    const int width  = BENCH_WIDTH;
+    const int height = BENCH_HEIGHT;
+    const int max    = camera_codec_max_size(width, height);
+
+    std::vector<uint8_t> img(width * height);
+    std::vector<uint8_t> enc(max);
+    std::vector<uint8_t> dec(width * height);
+
+    for (int type = IMAGE_FLAT; type < IMAGE_CHECKER; type++)
+    {
+        FillImage(img.data(), width, width, height, (ImageType)type);
+
+        for (int impl = 0; impl < 2; impl++)
+        {
+            int    size  = 0;
+            double start = Now();
+            for (int i = 0; i < BENCH_ITERATIONS; i++)
+            {
+                size = encoders[impl](img.data(), width, width, height, enc.data(), max);
+            }
+            double encodeS = (Now() - start) / BENCH_ITERATIONS;
+
+            start = Now();
+            for (int i = 0; i < BENCH_ITERATIONS; i++)
+            {
+                decoders[impl](enc.data(), size, dec.data(), width);
+            }
+            double decodeS = (Now() - start) / BENCH_ITERATIONS;
+
+            printf("%dx%d %-8s %-9s ratio %5.2f  encode %6.0f MB/s  decode %6.0f MB/s\n", width, height, imageNames[type],
+                   names[impl], (double)width * height / size, width * height / encodeS / 1e6,
+                   width * height / decodeS / 1e6);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    srand(1);
+
+    for (int i = 0; i < NUM_RANDOM_IMAGES; i++)
+    {
+        const int       width  = 1 + rand() % MAX_RANDOM_WIDTH;
+        const int       height = 1 + rand() % MAX_RANDOM_HEIGHT;
+        const int       stride = width + rand() % 65;
+        const ImageType type   = (ImageType)(rand() % NUM_IMAGE_TYPES);
+
+        std::vector<uint8_t> enc = RoundTrip(width, height, stride, type);
+
+        if (!enc.empty()) ErrorPaths(enc, width, height);
+    }
+
+    for (int i = 0; i < 100; i++)
+    {
+        MaxSizeBounds();
+    }
+
+    Throughput();
+
+    if (failures != 0)
+    {
+        printf("%d checks failed\n", failures);
+        return -1;
+    }
+
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,203 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "imgproc.h"
+#include "worker_pool.h"
+
+#define DEFAULT_FRAMES          10
+#define DEFAULT_WIDTH           3840
+#define DEFAULT_HEIGHT          2160
+#define DEFAULT_MAX_BANDS       4
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Times imgprocDebayer (RGB24) and imgprocDebayerNV12 in bilinear and edge aware mode, split over 1 to N bands of rows on a
+// WorkerPool the same way PerCameraMgr::WriteColor does it. Fails if the banded output isn't bit exact with the single band
+// one, so the band edges don't leak into the image.
+// -----------------------------------------------------------------------------------------------------------------------------
+typedef struct DebayerJobs
+{
+    const uint8_t* src;
+    uint8_t*       dst;
+    uint8_t*       scratch;             ///< Row pairs of every band for NV12, NULL for RGB
+    int            width;
+    int            height;
+    int            bands;
+    bool           edgeAware;
+} DebayerJobs;
+
+static void DebayerBand(void* context, int band)
+{
+    DebayerJobs* jobs  = (DebayerJobs*)context;
+    const int    start = (band * jobs->height / jobs->bands) & ~1;
+    const int    end   = ((band + 1) * jobs->height / jobs->bands) & ~1;
+
+    if (jobs->scratch != NULL)
+    {
+        imgprocDebayerNV12(jobs->src, jobs->width, jobs->width, jobs->height, IMGPROC_BAYER_RGGB, jobs->edgeAware,
+                           jobs->dst, jobs->dst + jobs->width * jobs->height, jobs->width,
+                           jobs->scratch + band * IMGPROC_DEBAYER_SCRATCH(jobs->width), start, end);
+    }
+    else
+    {
+        imgprocDebayer(jobs->src, jobs->width, jobs->width, jobs->height, IMGPROC_BAYER_RGGB, jobs->edgeAware,
+                       jobs->dst, jobs->width * 3, start, end);
+    }
+}
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void PrintUsage()
+{
+    printf("Usage: debayer_bench [-n frames] [-s WIDTHxHEIGHT] [-b bands]\n"
+           "  -n  frames per measurement, default %d\n"
+           "  -s  frame size, default %dx%d\n"
+           "  -b  run with 1 up to this many bands, default %d\n",
+           DEFAULT_FRAMES, DEFAULT_WIDTH, DEFAULT_HEIGHT, DEFAULT_MAX_BANDS);
+}
+
+int main(int argc, char* argv[])
+{
+    int numFrames = DEFAULT_FRAMES;
+    int width     = DEFAULT_WIDTH;
+    int height    = DEFAULT_HEIGHT;
+    int maxBands  = DEFAULT_MAX_BANDS;
+    int option;
+
+    while ((option = getopt(argc, argv, "n:s:b:h")) != -1)
+    {
+        switch(option)
+        {
+            case 'n':
+                numFrames = atoi(optarg);
+                break;
+
+            case 's':
+                if (sscanf(optarg, "%dx%d", &width, &height) != 2)
+                {
+                    PrintUsage();
+                    return -1;
+                }
+                break;
+
+            case 'b':
+                maxBands = atoi(optarg);
+                break;
+
+            default:
+                PrintUsage();
+                return option == 'h' ? 0 : -1;
+        }
+    }
+
+    if (numFrames <= 0 || maxBands <= 0 || width <= 0 || height <= 0 || (width & 1) || (height & 1))
+    {
+        printf("ERROR: frames and bands have to be positive and the size even\n");
+        return -1;
+    }
+
+    // Smooth gradients with some noise on top so the edge aware mode has real decisions to make
+    std::vector<uint8_t> raw(width * height);
+    srand(1);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            raw[y * width + x] = ((x * 255 / width) ^ (y & 0x40)) + (rand() & 7);
+        }
+    }
+
+    const int rgbSize  = width * height * 3;
+    const int nv12Size = width * height * 3 / 2;
+
+    std::vector<uint8_t> reference(rgbSize);
+    std::vector<uint8_t> dst(rgbSize);
+    std::vector<uint8_t> scratch(IMGPROC_DEBAYER_SCRATCH(width) * maxBands);
+    int                  failures = 0;
+
+    printf("%dx%d, %d frames per measurement, %ld cores\n", width, height, numFrames, sysconf(_SC_NPROCESSORS_ONLN));
+
+    for (int nv12 = 0; nv12 < 2; nv12++)
+    {
+        for (int edgeAware = 0; edgeAware < 2; edgeAware++)
+        {
+            const int size = nv12 ? nv12Size : rgbSize;
+
+            for (int bands = 1; bands <= maxBands; bands++)
+            {
+                // The caller works on the jobs as well
+                WorkerPool  pool(bands - 1, "debayer");
+                DebayerJobs jobs;
+
+                jobs.src       = raw.data();
+                jobs.dst       = (bands == 1) ? reference.data() : dst.data();
+                jobs.scratch   = nv12 ? scratch.data() : NULL;
+                jobs.width     = width;
+                jobs.height    = height;
+                jobs.bands     = bands;
+                jobs.edgeAware = edgeAware;
+
+                // One untimed frame to fault the pages in and start the threads
+                pool.Run(bands, DebayerBand, &jobs);
+
+                const double start = Now();
+                for (int i = 0; i < numFrames; i++)
+                {
+                    pool.Run(bands, DebayerBand, &jobs);
+                }
+                const double ms = (Now() - start) * 1000.0 / numFrames;
+
+                bool exact = (bands == 1) || memcmp(reference.data(), dst.data(), size) == 0;
+                if (!exact) failures++;
+
+                printf("%-4s %-8s %d band%s %8.2f ms %7.1f MP/s%s\n", nv12 ? "NV12" : "RGB",
+                       edgeAware ? "edge" : "bilinear", bands, bands == 1 ? " " : "s", ms,
+                       (double)width * height / (ms * 1000.0), exact ? "" : "  differs from 1 band");
+            }
+        }
+    }
+
+    return failures == 0 ? 0 : -1;
+}
@@ -0,0 +1,296 @@
+/*******************************************************************************
+ * Copyright 2020 ModalAI Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * 4. The Software is used solely in conjunction with devices provided by
+ *    ModalAI Inc.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <modal_journal.h>
+#include <modal_pipe.h>
+
+#include "omx_video_encoder.h"
+#include "buffer_manager.h"
+
+#define DEFAULT_FRAMES          300
+#define DEFAULT_WIDTH           1920
+#define DEFAULT_HEIGHT          1080
+#define DEFAULT_FPS             30
+#define NUM_ENCODE_BUFFERS      11      // Same as the camera manager
+#define NUM_ENCODE_BUFFERS_LOW_LATENCY 6
+#define DRAIN_TIMEOUT_MS        5000    // Longest we wait for the encoder to hand everything back
+#define WATCHDOG_S              60      // A hung shutdown fails the test instead of blocking ctest
+
+// -----------------------------------------------------------------------------------------------------------------------------
+// Runs the real VideoEncoder on top of the mock OMX core (VOXL_OMX_CORE=mock) and a heap backed buffer group. Frames are
+// fed back to back, as fast as the encoder takes them, then the encoder is drained, stopped and deleted. Fails if a frame
+// goes missing, a buffer doesn't come back or the shutdown doesn't finish.
+// -----------------------------------------------------------------------------------------------------------------------------
+static int64_t _time_monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void PrintUsage()
+{
+    printf("Usage: omx_encoder_bench [-n frames] [-s WIDTHxHEIGHT] [-5] [-l]\n"
+           "  -n  frames to encode, default %d\n"
+           "  -s  frame size, default %dx%d\n"
+           "  -5  h265 instead of h264\n"
+           "  -l  low latency encoder settings\n"
+           "Needs VOXL_OMX_CORE=mock, VOXL_OMX_MOCK_DELAY_US sets the time each frame spends in the encoder\n",
+           DEFAULT_FRAMES, DEFAULT_WIDTH, DEFAULT_HEIGHT);
+}
+
+static bool WaitForDrain(VideoEncoder* pEncoder)
+{
+    for (int ms = 0; ms < DRAIN_TIMEOUT_MS; ms++)
+    {
+        pthread_mutex_lock(&pEncoder->out_mutex);
+        bool outputDone = pEncoder->out_msgQueue.empty() && pEncoder->out_metaQueue.empty();
+        pthread_mutex_unlock(&pEncoder->out_mutex);
+
+        if (pEncoder->m_inputInFlight == 0 && outputDone) return true;
+
+        usleep(1000);
+    }
+
+    return false;
+}
+
+int main(int argc, char* argv[])
+{
+    int  numFrames  = DEFAULT_FRAMES;
+    int  width      = DEFAULT_WIDTH;
+    int  height     = DEFAULT_HEIGHT;
+    bool isH265     = false;
+    bool lowLatency = false;
+    int  option;
+
+    while ((option = getopt(argc, argv, "n:s:5lh")) != -1)
+    {
+        switch(option)
+        {
+            case 'n':
+                numFrames = atoi(optarg);
+                break;
+
+            case 's':
+                if (sscanf(optarg, "%dx%d", &width, &height) != 2)
+                {
+                    PrintUsage();
+                    return -1;
+                }
+                break;
+
+            case '5':
+                isH265 = true;
+                break;
+
+            case 'l':
+                lowLatency = true;
+                break;
+
+            default:
+                PrintUsage();
+                return -1;
+        }
+    }
+
+    // The OMX core gets picked when the encoder is loaded, make sure this can never end up on the real one
+    const char* core = getenv("VOXL_OMX_CORE");
+    if (core == NULL || strcmp(core, "mock"))
+    {
+        M_ERROR("VOXL_OMX_CORE=mock has to be set to run the encoder bench\n");
+        return -1;
+    }
+
+    if (numFrames <= 0 || width <= 0 || height <= 0)
+    {
+        PrintUsage();
+        return -1;
+    }
+
+    alarm(WATCHDOG_S);
+
+    BufferGroup* pBuffers = new BufferGroup();
+
+    const int numBuffers = lowLatency ? NUM_ENCODE_BUFFERS_LOW_LATENCY : NUM_ENCODE_BUFFERS;
+
+    if (bufferAllocateBuffers(*pBuffers, numBuffers, width, height, HAL3_FMT_YUV, 0))
+    {
+        M_ERROR("Failed to allocate the input buffers\n");
+        return -1;
+    }
+
+    int outputChannel = pipe_server_get_next_available_channel();
+
+    pipe_info_t info;
+    memset(&info, 0, sizeof(info));
+    strcpy(info.name       , "omx_encoder_bench");
+    strcpy(info.type       , "camera_image_metadata_t");
+    strcpy(info.server_name, "omx_encoder_bench");
+    info.size_bytes = 16*1024*1024;
+
+    if (pipe_server_create(outputChannel, info, 0))
+    {
+        M_WARN("Failed to create the output pipe, encoded frames go nowhere\n");
+    }
+
+    VideoEncoderConfig config = {
+        .width =             (uint32_t)width,
+        .height =            (uint32_t)height,
+        .format =            (uint32_t)HAL_PIXEL_FORMAT_YCbCr_420_888,
+        .isBitRateConstant = true,
+        .targetBitRate =     (int)VideoEncoder::BitrateDefault,
+        .frameRate =         DEFAULT_FPS,
+        .isH265 =            isH265,
+        .inputBuffers =      pBuffers,
+        .outputPipe =        outputChannel,
+        .isLowLatency =      lowLatency,
+        .recorder =          NULL
+    };
+
+    VideoEncoder* pEncoder;
+
+    try{
+        pEncoder = new VideoEncoder(&config);
+    } catch(int) {
+        M_ERROR("Failed to create the encoder\n");
+        return -1;
+    }
+
+    pEncoder->Start();
+
+    uint32_t bufferUses[BUFFER_QUEUE_MAX_SIZE] = {0};
+    int      framesSent     = 0;
+    int      framesNoBuffer = 0;
+    int64_t  startNs        = _time_monotonic_ns();
+
+    for (int i = 0; i < numFrames; i++)
+    {
+        // Only as fast as the encoder takes them, anything faster just gets recycled as busy
+        while ((uint32_t)pEncoder->m_inputInFlight >= pEncoder->m_maxInputInFlight)
+        {
+            usleep(100);
+        }
+
+        buffer_handle_t* pHandle = bufferTryPop(*pBuffers);
+
+        if (pHandle == NULL)
+        {
+            // With fewer frames in the encoder than buffers this means one got lost
+            pEncoder->CountSkippedNoBuffer();
+            framesNoBuffer++;
+            continue;
+        }
+
+        BufferBlock* pBlock = bufferGetBufferInfo(pBuffers, pHandle);
+        bufferUses[pHandle - pBuffers->buffers]++;
+
+        camera_image_metadata_t meta;
+        memset(&meta, 0, sizeof(meta));
+        meta.magic_number = CAMERA_MAGIC_NUMBER;
+        meta.timestamp_ns = _time_monotonic_ns();
+        meta.frame_id     = i;
+        meta.width        = width;
+        meta.height       = height;
+        meta.stride       = pBlock->stride;
+        meta.size_bytes   = pBlock->size;
+        meta.format       = IMAGE_FORMAT_NV12;
+
+        pEncoder->ProcessFrameToEncode(meta, pBlock);
+        framesSent++;
+    }
+
+    bool drained = WaitForDrain(pEncoder);
+
+    int64_t elapsedNs = _time_monotonic_ns() - startNs;
+
+    pEncoder->Stop();
+
+    EncoderStats stats       = pEncoder->GetStats();
+    uint32_t     freeBuffers = pBuffers->freeBuffers.size();
+
+    delete pEncoder;
+
+    uint32_t minUses = UINT32_MAX;
+    uint32_t maxUses = 0;
+
+    for (uint32_t i = 0; i < pBuffers->totalBuffers; i++)
+    {
+        if (bufferUses[i] < minUses) minUses = bufferUses[i];
+        if (bufferUses[i] > maxUses) maxUses = bufferUses[i];
+    }
+
+    printf("%dx%d %s%s: %d frames in %.1fms, %.1f fps\n",
+           width, height, isH265 ? "h265" : "h264", lowLatency ? " low latency" : "",
+           framesSent, elapsedNs / 1000000.0, framesSent * 1000000000.0 / elapsedNs);
+    printf("encoded: %llu, latency avg: %.2fms min: %.2fms max: %.2fms\n",
+           (unsigned long long)stats.framesEncoded,
+           stats.framesEncoded ? (double)stats.latencySumNs / stats.framesEncoded / 1000000.0 : 0.0,
+           stats.framesEncoded ? stats.latencyMinNs / 1000000.0 : 0.0,
+           stats.latencyMaxNs / 1000000.0);
+    printf("buffers: %u of %u free after stop, each used %u to %u times, %d frames without a buffer\n",
+           freeBuffers, pBuffers->totalBuffers, minUses, maxUses, framesNoBuffer);
+
+    int ret = 0;
+
+    if (!drained)
+    {
+        M_ERROR("Encoder didn't hand everything back within %dms\n", DRAIN_TIMEOUT_MS);
+        ret = -1;
+    }
+
+    if (stats.framesEncoded != (uint64_t)framesSent)
+    {
+        M_ERROR("Sent %d frames but %llu came out\n", framesSent, (unsigned long long)stats.framesEncoded);
+        ret = -1;
+    }
+
+    if (freeBuffers != pBuffers->totalBuffers || framesNoBuffer != 0)
+    {
+        M_ERROR("Input buffers went missing\n");
+        ret = -1;
+    }
+
+    bufferDeleteBuffers(*pBuffers);
+    delete pBuffers;
+
+    pipe_server_close_all();
+
+    return ret;
+}